@@ -6,15 +6,45 @@
 #ifndef AZSPHERE_IOTHUB_CLIENT_H
 #define AZSPHERE_IOTHUB_CLIENT_H
 
+#include <sys/types.h>
+#include <time.h>
+#include <applibs/eventloop.h>
+
 typedef enum {
     CodeSuccess = 0,
     CodeInvalidParam,
     CodeInvalidState,
     CodeResourceNotAvailable,
     CodeRunFailed,
-    CodeInternalError
+    CodeInternalError,
+    CodeThrottled           // over the send rate or the daily quota, retry later
 } IotHubClientReturnCode;
 
+typedef enum {
+    SendResultSuccess = 0,
+    SendResultTimeout,
+    SendResultError,
+    SendResultDestroyed     // the client was torn down before the hub acknowledged
+} IotHubSendResult;
+
+#define IOTHUB_SEND_LATENCY_BUCKETS         16
+
+typedef struct {
+    unsigned long sent;
+    unsigned long succeeded;
+    unsigned long timed_out;
+    unsigned long failed;
+    unsigned long destroyed;
+    unsigned long untracked;            // sent while all tracking slots were in use
+    unsigned int in_flight;
+    unsigned int max_in_flight;
+    // Send to acknowledgement latency of delivered messages. Bucket 0 counts latencies under
+    // 1 ms, bucket i those from 2^(i-1) to 2^i - 1 ms, the last bucket everything above.
+    unsigned long latency_hist[IOTHUB_SEND_LATENCY_BUCKETS];
+    unsigned long long latency_sum_ms;
+    unsigned int latency_max_ms;
+} IotHubSendStats;
+
 typedef enum {
     StatusNotAuthenticated = 0,
     StatusInitiateError,
@@ -22,10 +52,84 @@ typedef enum {
     StatusAuthenticated
 } IotHubAuthenticateStatus;
 
+#define IOTHUB_HUB_CACHE_SIZE               512
+
+// IoT Hub meters device-to-cloud messages in units of 4 KB: a message counts one unit for every
+// started 4 KB of payload.
+#define IOTHUB_BILLING_UNIT                 4096
+
+typedef struct {
+    bool enabled;
+    unsigned long daily_units;
+    unsigned long used_today;           // units sent since midnight UTC
+    unsigned long remaining_today;
+    unsigned int available_units;       // that can go out back to back now
+    unsigned int next_unit_ms;          // until a unit can be sent, 0 if one can now
+    unsigned long throttled;            // sends refused with CodeThrottled
+    // When the daily quota runs out at the average rate since midnight, or since the client was
+    // initialized if later. 0 if it lasts the day or nothing was sent yet.
+    time_t projected_exhaustion;
+} IotHubQuotaInfo;
+
+typedef enum {
+    ProvisioningIdle = 0,
+    ProvisioningInProgress,
+    ProvisioningSucceeded,
+    ProvisioningFailed
+} IotHubProvisioningState;
+
+typedef struct {
+    IotHubProvisioningState state;
+    int last_result;                    // AZURE_SPHERE_PROV_RESULT of the last attempt
+    unsigned long attempts;
+    unsigned long failures;
+    unsigned int elapsed_ms;            // of the attempt in progress, else of the last one
+    unsigned int max_duration_ms;
+    unsigned int time_to_auth_ms;       // from the start of the last attempt to authenticated
+    bool direct;                        // the last attempt used the cached hub, skipping DPS
+    unsigned long dps_registrations;
+    unsigned long direct_connects;
+    unsigned long fallbacks;            // cached hub rejected the device, DPS ran again
+} IotHubProvisioningInfo;
+
+typedef enum {
+    ReconnectIdle = 0,                  // authenticated, or not connecting
+    ReconnectAttempting,                // provisioning, or waiting for the hub to authenticate
+    ReconnectBackoff,                   // waiting before the next attempt
+    ReconnectWaitingNetwork,            // next attempt when the interface comes up
+    ReconnectWarm                       // the transport is restoring the dropped connection
+} IotHubReconnectState;
+
+// Connections lost after authenticating. A warm reconnect restores the connection on the same
+// client after a network drop, a full one recreates the client and provisions again.
+typedef struct {
+    IotHubReconnectState state;
+    unsigned int next_attempt_ms;       // time left until the retry timer fires, 0 if not armed
+    unsigned int consecutive_failures;  // drives the backoff, reset when authenticated
+    unsigned long attempts;             // clients created, including the first connection
+    unsigned long network_changes;      // interface up/down transitions seen
+    bool reconnecting;
+    bool last_warm;
+    int last_reason;                    // IOTHUB_CLIENT_CONNECTION_STATUS_REASON of the last drop
+    unsigned long drops;
+    unsigned long warm_reconnects;
+    unsigned long full_reconnects;
+    unsigned long warm_timeouts;        // warm reconnects given up for a full one
+    unsigned int last_reconnect_ms;     // from the drop to authenticated again
+    unsigned int max_reconnect_ms;
+} IotHubReconnectInfo;
+
 typedef void (*IotHubAuthenticateStatusCallback)(IotHubAuthenticateStatus status);
 typedef void (*IotHubReceiveMessageCallback)(unsigned char* p_msg, size_t msg_len);
 typedef void (*IotHubTwinMessageCallback)(unsigned char* p_twin_msg, size_t msg_len);
 typedef void (*IotHubTimerCallback)(void* p_context);
+// Called from the event loop when provisioning starts and when it completes.
+typedef void (*IotHubProvisioningCallback)(const IotHubProvisioningInfo* p_info);
+typedef void (*IotHubSendCompleteCallback)(unsigned int msg_id, IotHubSendResult result,
+    unsigned int latency_ms, void* p_context);
+// Called once the layer no longer references a buffer passed to iothub_client_send_bytes().
+typedef void (*IotHubBufferReleaseCallback)(const unsigned char* p_data, size_t data_len,
+    void* p_context);
 
 typedef struct {
     char netif[10];
@@ -33,6 +137,24 @@ typedef struct {
     IotHubAuthenticateStatusCallback auth_status_cb;
     IotHubReceiveMessageCallback recv_msg_cb;
     IotHubTwinMessageCallback twin_msg_cb;
+    // Longest pause between DoWork calls while idle, 0 for the default of 50 ms, i.e. 20
+    // wakeups a second. C2D messages wait up to this long, e.g. 1000 wakes the device once a
+    // second for up to 1 s of command latency.
+    int dowork_idle_ms;
+    EventLoop* p_event_loop; // application loop to register with, NULL for a private loop
+    unsigned int provisioning_timeout_ms; // DPS timeout, 0 for the default of 10 s
+    IotHubProvisioningCallback prov_status_cb;
+    // Region of a file, e.g. from Storage_OpenMutableFile(), keeping the hub assigned by DPS so
+    // later starts connect to it directly. A hub_cache_size of 0 disables the cache.
+    int hub_cache_fd;
+    off_t hub_cache_offset;
+    size_t hub_cache_size;              // at least IOTHUB_HUB_CACHE_SIZE
+    // Daily device-to-cloud quota in IOTHUB_BILLING_UNIT units, reset at midnight UTC. Sends are
+    // spread over the day by a token bucket refilled at quota_daily_units per day, which holds
+    // at most quota_burst_units. A send over either limit fails with CodeThrottled.
+    // A quota_daily_units of 0 disables the limiter.
+    unsigned long quota_daily_units;
+    unsigned int quota_burst_units;     // 0 for one minute of the daily quota, at least 1
 } IotHubClientInit;
 
 // Functions declarations
@@ -40,12 +162,29 @@ IotHubClientReturnCode iothub_client_init(IotHubClientInit* p_init);
 IotHubClientReturnCode iothub_client_connect(void);
 IotHubClientReturnCode iothub_client_send_message(const char* p_msg, const char* p_content_type,
     const char* p_content_encoding);
+IotHubClientReturnCode iothub_client_send_bytes(const unsigned char* p_data, size_t data_len,
+    const char* p_content_type, const char* p_content_encoding,
+    IotHubBufferReleaseCallback release_cb, void* p_release_ctx);
+IotHubClientReturnCode iothub_client_send_tracked(const unsigned char* p_data, size_t data_len,
+    const char* p_content_type, const char* p_content_encoding,
+    IotHubSendCompleteCallback complete_cb, void* p_complete_ctx, unsigned int* p_msg_id);
+IotHubClientReturnCode iothub_client_get_send_stats(IotHubSendStats* p_stats);
+IotHubClientReturnCode iothub_client_get_quota_info(IotHubQuotaInfo* p_info);
 IotHubClientReturnCode iothub_client_run(int timeout_ms);
+IotHubClientReturnCode iothub_client_get_wait_fd(int* p_fd);
 IotHubClientReturnCode iothub_client_disconnect(void);
+IotHubClientReturnCode iothub_client_get_provisioning_info(IotHubProvisioningInfo* p_info);
+IotHubClientReturnCode iothub_client_get_reconnect_info(IotHubReconnectInfo* p_info);
 IotHubClientReturnCode iothub_client_add_timer(int interval_s,
 IotHubTimerCallback timer_cb, void* p_ctx, int *p_timer_handle);
+// First due after delay_ms, then every period_ms. A period_ms of 0 makes a one-shot timer, whose
+// handle becomes invalid once it has fired.
+IotHubClientReturnCode iothub_client_add_timer_ms(unsigned int delay_ms, unsigned int period_ms,
+    IotHubTimerCallback timer_cb, void* p_ctx, int *p_timer_handle);
 IotHubClientReturnCode iothub_client_get_timer_interval(int timer_handle, int *p_interval);
 IotHubClientReturnCode iothub_client_set_timer_interval(int timer_handle, int interval_s);
+IotHubClientReturnCode iothub_client_set_timer_ms(int timer_handle, unsigned int delay_ms,
+    unsigned int period_ms);
 IotHubClientReturnCode iothub_client_delete_timer(int timer_handle);
 IotHubClientReturnCode iothub_client_uninit(void);
 
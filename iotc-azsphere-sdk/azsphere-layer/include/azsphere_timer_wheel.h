@@ -0,0 +1,48 @@
+//
+// Copyright: Avnet 2021
+// Hierarchical timer wheel with millisecond resolution, driven by a single timerfd in the
+// IoTHub client layer.
+//
+// Timers are kept in 4 levels of 64 slots, each level 64 times coarser than the one below, so
+// timers up to 4.6 hours away are placed directly and farther ones are parked and re-placed.
+// Insert and cancel are O(1). Timers move down one level when their slot comes up, and the next
+// expiry is found from a per level occupancy bitmap. The timer table grows on demand, so the
+// number of timers is only bounded by memory.
+//
+
+#ifndef AZSPHERE_TIMER_WHEEL_H
+#define AZSPHERE_TIMER_WHEEL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef void (*TimerWheelCallback)(void* p_context);
+
+// now_ms values are read from a monotonic clock and must never go backwards.
+bool timer_wheel_init(uint64_t now_ms);
+void timer_wheel_deinit(void);
+
+// Adds a timer first due delay_ms from now, then every period_ms. A period_ms of 0 makes a
+// one-shot timer, released once its callback has been called. Returns a handle, 0 on failure.
+int timer_wheel_add(uint64_t now_ms, unsigned int delay_ms, unsigned int period_ms,
+    TimerWheelCallback cb, void* p_context);
+
+// Reschedules an existing timer.
+bool timer_wheel_modify(int handle, uint64_t now_ms, unsigned int delay_ms,
+    unsigned int period_ms);
+
+bool timer_wheel_cancel(int handle);
+
+bool timer_wheel_get_period(int handle, unsigned int* p_period_ms);
+
+// Time at which timer_wheel_advance() next has work to do. Returns false if no timer is set.
+bool timer_wheel_next_expiry(uint64_t* p_due_ms);
+
+// Calls the callbacks of all timers due at or before now_ms. Callbacks may add, modify and
+// cancel timers, including their own.
+void timer_wheel_advance(uint64_t now_ms);
+
+size_t timer_wheel_count(void);
+
+#endif //AZSPHERE_TIMER_WHEEL_H
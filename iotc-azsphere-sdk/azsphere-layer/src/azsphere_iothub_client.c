@@ -4,31 +4,71 @@
 //
 
 #include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <stdlib.h>
+#include <time.h>
 #include <unistd.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
 #include <sys/timerfd.h>
 #include <azure_sphere_provisioning.h>
+#include <iothub_security_factory.h>
+#include <iothubtransportmqtt.h>
+#include <azure_prov_client/prov_device_ll_client.h>
+#include <azure_prov_client/prov_security_factory.h>
+#include <azure_prov_client/prov_transport_mqtt_client.h>
 #include <applibs/eventloop.h>
 #include <applibs/networking.h>
 #include <applibs/log.h>
 #include "azsphere_iothub_client.h"
+#include "azsphere_timer_wheel.h"
 
 /******************************************************/
 /* Data type definition                               */
 /******************************************************/
+#define HUB_NAME_SIZE                       128
+
 typedef struct {
     bool used;
-    int timer_fd;
-    int interval_s;
-    EventRegistration* evt_reg;
+    unsigned int msg_id;
+    struct timespec sent_at;
+    IotHubSendCompleteCallback cb;
     void* p_ctx;
-    IotHubTimerCallback cb;
-} TimerContext;
+} SendContext;
+
+// Handed to the provisioning thread, which only touches this and the event fd.
+typedef struct {
+    char scope_id[30];
+    unsigned int timeout_ms;
+    char hub_host[HUB_NAME_SIZE];       // in: cached hub to connect to, out: hub in use
+    char device_id[HUB_NAME_SIZE];      // out: device id assigned by DPS
+    bool direct;                        // out: connected to the cached hub without DPS
+    bool dps_done;
+    PROV_DEVICE_RESULT dps_result;
+    IOTHUB_DEVICE_CLIENT_LL_HANDLE handle;
+    AZURE_SPHERE_PROV_RETURN_VALUE result;
+} ProvisioningJob;
+
+// Hub assignment kept in mutable storage between runs.
+typedef struct {
+    uint32_t magic;
+    char scope_id[30];
+    char hub_host[HUB_NAME_SIZE];
+    char device_id[HUB_NAME_SIZE];
+    uint32_t checksum;
+} HubCacheRecord;
 
 /******************************************************/
 /* Forward declarations                               */
 /******************************************************/
 static void iothub_poll_handler(void* p_ctx);
+static void request_dowork(int delay_ms);
+static void retry_timer_cb(void* p_ctx);
+static void setup_azure_iot_client(void);
+static void hub_cache_clear(void);
+static unsigned int elapsed_ms(const struct timespec* p_since);
+static void dowork_timer_cb(void* p_ctx);
 
 /******************************************************/
 /* Macros definition                                  */
@@ -36,25 +76,54 @@ static void iothub_poll_handler(void* p_ctx);
 #define M_ARRAY_SIZE(a)                     (sizeof(a)/sizeof(a[0]))
 
 #define M_ADD_TIMER(t)                      do{ \
-                                                add_timer(t, iothub_poll_handler, NULL, true); \
+                                                m_poll_timer = add_timer((t) * 1000, (t) * 1000, \
+                                                    iothub_poll_handler, NULL); \
                                             }while(0)
 
-#define M_GET_TIMER_INTERVAL()              get_timer_interval(0, true)
+#define M_GET_TIMER_INTERVAL()              get_timer_interval(m_poll_timer)
 
 #define M_SET_TIMER_INTERVAL(t)             do{ \
-                                                set_timer_interval(0, t, true); \
+                                                set_timer(m_poll_timer, (t) * 1000, (t) * 1000); \
                                             }while (0)
 
 #define M_DEL_TIMER()                       do{ \
-                                                delete_timer(0, true); \
+                                                delete_timer(m_poll_timer); \
+                                                m_poll_timer = 0; \
                                             }while (0)
 
 /******************************************************/
 /* Static definition                                  */
 /******************************************************/
-#define MAX_TIMERS                          (3 + 1)
 #define IOTHUB_POLL_INTERVAL_S              5
 #define MAX_DEVICE_TWIN_PAYLOAD_SIZE        (8 * 1024)
+#define MAX_TRACKED_MESSAGES                64
+#define MESSAGE_TIMEOUT_MS                  (60 * 1000)
+// DoWork runs right after a send, every DOWORK_BUSY_MS while connecting or waiting for
+// acknowledgements, and every dowork_idle_ms otherwise, for C2D messages and keepalives.
+// The idle default keeps the C2D latency of polling DoWork every 50 ms.
+#define DOWORK_BUSY_MS                      50
+#define DOWORK_IDLE_MS                      50
+#define PROVISIONING_TIMEOUT_MS             10000
+#define DPS_GLOBAL_ENDPOINT                 "global.azure-devices-provisioning.net"
+#define DPS_DOWORK_INTERVAL_MS              100
+#define HUB_CACHE_MAGIC                     0x31434849  // "IHC1"
+// Failed attempts on the cached hub, without ever authenticating, before going back to DPS.
+#define DIRECT_CONNECT_MAX_FAILURES         3
+// Longest a dropped connection is left to the transport to restore on the same client handle
+// before the client is recreated and provisioned again.
+#define WARM_RECONNECT_TIMEOUT_MS           60000
+// Connection attempts back off exponentially between these bounds. Each delay is drawn from its
+// upper half at random, so a fleet that lost the hub together does not retry in lockstep.
+#define RECONNECT_BACKOFF_BASE_MS           1000
+#define RECONNECT_BACKOFF_MAX_MS            300000
+// Longest wait for the hub to authenticate a client once provisioning succeeded.
+#define HUB_AUTH_TIMEOUT_MS                 30000
+// Network polling while not authenticated, so interface changes are acted on quickly.
+#define NETWORK_POLL_INTERVAL_S             1
+// Quota tokens are kept in units times the milliseconds of a day, so refilling at the daily
+// quota per day adds quota_daily_units tokens per ms, without rounding.
+#define QUOTA_DAY_S                         (24 * 60 * 60)
+#define QUOTA_DAY_MS                        (QUOTA_DAY_S * 1000LL)
 
 /******************************************************/
 /* Member variables declaration                       */
@@ -62,10 +131,52 @@ static void iothub_poll_handler(void* p_ctx);
 static IOTHUB_DEVICE_CLIENT_LL_HANDLE m_client_handle = NULL;
 static IotHubClientInit m_init = { 0 };
 static EventLoop* m_evt_loop = NULL;
+static bool m_evt_loop_owned = false;
 static IotHubAuthenticateStatus m_auth_status = StatusNotAuthenticated;
-static TimerContext m_timer_ctx[MAX_TIMERS];
 static bool m_initialized = false;
 static bool m_disconnect_pending = false;
+static SendContext m_send_ctx[MAX_TRACKED_MESSAGES];
+static unsigned int m_next_msg_id = 1;
+static IotHubSendStats m_send_stats = { 0 };
+// All timers, including the DoWork deadline, share one timerfd armed for the next expiry.
+static int m_timer_fd = -1;
+static EventRegistration* m_timer_reg = NULL;
+static uint64_t m_timer_armed_ms = 0;
+static bool m_timer_dispatching = false;
+static int m_poll_timer = 0;
+static int m_dowork_timer = 0;
+static uint64_t m_dowork_due_ms = 0;
+// DPS provisioning runs on a worker thread and posts its completion through an eventfd.
+static int m_prov_event_fd = -1;
+static EventRegistration* m_prov_reg = NULL;
+static pthread_t m_prov_thread;
+static bool m_prov_running = false;
+static bool m_prov_cancelled = false;
+static ProvisioningJob m_prov_job;
+static struct timespec m_prov_started;
+static IotHubProvisioningInfo m_prov_info = { 0 };
+static HubCacheRecord m_hub_cache;
+static bool m_hub_cache_valid = false;
+static bool m_connected_direct = false;
+static bool m_awaiting_auth = false;
+static unsigned int m_direct_failures = 0;
+static bool m_warm_reconnect = false;
+static bool m_client_stale = false;     // left for the poll handler to replace, no more DoWork
+static struct timespec m_drop_started;
+static IotHubReconnectInfo m_reconnect_info = { 0 };
+static int m_retry_timer = 0;
+static uint64_t m_next_attempt_ms = 0;
+static bool m_network_up = false;
+static uint32_t m_jitter_state = 1;
+static long long m_quota_tokens = 0;    // may go below 0 after a message bigger than the burst
+static long long m_quota_capacity = 0;
+static uint64_t m_quota_refilled_ms = 0;
+static time_t m_quota_day = -1;         // days since the epoch, UTC
+static time_t m_quota_since = 0;        // start of the day, or of the client if later
+static unsigned long m_quota_used = 0;
+static unsigned long m_quota_throttled = 0;
+// The device certificate is used with DPS and IoT Hub, which needs the SetDeviceId option.
+static const int m_device_id_for_daa_cert = 1;
 
 /******************************************************/
 /* Helper functions definition                        */
@@ -129,113 +240,121 @@ static char* print_connection_status_string(IOTHUB_CLIENT_CONNECTION_STATUS_REAS
     return res_str;
 }
 
-static void user_timer_cb(EventLoop* el, int fd, EventLoop_IoEvents events, void* context) {
-    int idx = (int)context;
+static uint64_t now_ms(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000 + (uint64_t)now.tv_nsec / 1000000;
+}
+
+static unsigned long quota_units(size_t data_len) {
+    return data_len > IOTHUB_BILLING_UNIT ?
+        (unsigned long)((data_len + IOTHUB_BILLING_UNIT - 1) / IOTHUB_BILLING_UNIT) : 1;
+}
+
+static void quota_refill(void) {
+    uint64_t now = now_ms();
+    time_t wall = time(NULL);
+    uint64_t elapsed = now - m_quota_refilled_ms;
+    m_quota_refilled_ms = now;
+    if (elapsed >= QUOTA_DAY_MS || m_quota_tokens + (long long)elapsed *
+        (long long)m_init.quota_daily_units >= m_quota_capacity) {
+        m_quota_tokens = m_quota_capacity;
+    } else {
+        m_quota_tokens += (long long)elapsed * (long long)m_init.quota_daily_units;
+    }
+    if (wall / QUOTA_DAY_S != m_quota_day) {
+        m_quota_since = m_quota_day == -1 ? wall : wall - wall % QUOTA_DAY_S;
+        m_quota_day = wall / QUOTA_DAY_S;
+        m_quota_used = 0;
+    }
+}
+
+// A message bigger than the burst needs a full bucket and leaves it in debt, so the rate over
+// the day still holds.
+static bool quota_allows(unsigned long units) {
+    unsigned long need = units;
+    quota_refill();
+    if (need * QUOTA_DAY_MS > (unsigned long long)m_quota_capacity) {
+        need = (unsigned long)(m_quota_capacity / QUOTA_DAY_MS);
+    }
+    return m_quota_tokens >= (long long)need * QUOTA_DAY_MS &&
+        m_quota_used + units <= m_init.quota_daily_units;
+}
+
+// Points the timerfd at the next expiry of the timer wheel, if that changed.
+static void arm_timer_fd(void) {
+    uint64_t due_ms = 0;
+    if (m_timer_fd == -1 || m_timer_dispatching) {
+        return;
+    }
+    if (!timer_wheel_next_expiry(&due_ms)) {
+        due_ms = 0;
+    }
+    if (due_ms == m_timer_armed_ms) {
+        return;
+    }
+    // A zero it_value disarms the timer
+    struct itimerspec new_value = { .it_value = { .tv_sec = (time_t)(due_ms / 1000),
+        .tv_nsec = (long)(due_ms % 1000) * 1000000 } };
+    if (timerfd_settime(m_timer_fd, TFD_TIMER_ABSTIME, &new_value, NULL) == -1) {
+        Log_Debug("ERROR: Could not set timer: %s (%d).\n", strerror(errno), errno);
+        return;
+    }
+    m_timer_armed_ms = due_ms;
+}
+
+static void timer_fd_cb(EventLoop* el, int fd, EventLoop_IoEvents events, void* context) {
     uint64_t timer_data = 0;
-    if (read(fd, &timer_data, sizeof(timer_data)) == -1) {
+    if (read(fd, &timer_data, sizeof(timer_data)) == -1 && errno != EAGAIN) {
         Log_Debug("ERROR: Could not read timerfd %s (%d).\n", strerror(errno), errno);
         return;
     }
-    if (m_timer_ctx[idx].cb) {
-        m_timer_ctx[idx].cb(m_timer_ctx[idx].p_ctx);
-    }
+    // The timerfd is re-armed once, after all due callbacks have run.
+    m_timer_dispatching = true;
+    timer_wheel_advance(now_ms());
+    m_timer_dispatching = false;
+    m_timer_armed_ms = 0;
+    arm_timer_fd();
 }
 
-static int add_timer(int interval_s, IotHubTimerCallback timer_cb, void* p_ctx,
-    bool internal_use) {
-    if (m_evt_loop == NULL) {
+static int add_timer(unsigned int delay_ms, unsigned int period_ms, IotHubTimerCallback timer_cb,
+    void* p_ctx) {
+    if (m_timer_fd == -1) {
         return 0;
     }
-    for (int i = (internal_use ? 0:1); i < M_ARRAY_SIZE(m_timer_ctx); i++) {
-        if (m_timer_ctx[i].used == false) {
-            m_timer_ctx[i].timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
-            if (m_timer_ctx[i].timer_fd == -1) {
-                Log_Debug("ERROR: Unable to create timer: %s (%d).\n",
-                    strerror(errno), errno);
-                return 0;
-            }
-            struct timespec ts = { .tv_sec = interval_s, .tv_nsec = 0 };
-            struct itimerspec new_value = { .it_value = ts,
-                                          .it_interval = ts };
-            if (timerfd_settime(m_timer_ctx[i].timer_fd, 0, &new_value, NULL) == -1) {
-                Log_Debug("ERROR: Could not set timer period: %s (%d).\n",
-                    strerror(errno), errno);
-                return 0;
-            }
-            m_timer_ctx[i].evt_reg =
-                EventLoop_RegisterIo(m_evt_loop, m_timer_ctx[i].timer_fd,
-                    EventLoop_Input, user_timer_cb, (void*)i);
-            if (m_timer_ctx[i].evt_reg == NULL) {
-                Log_Debug("ERROR: Unable to register timer event: %s (%d).\n",
-                    strerror(errno), errno);
-                close(m_timer_ctx[i].timer_fd);
-                return 0;
-            }
-            m_timer_ctx[i].interval_s = interval_s;
-            m_timer_ctx[i].cb = timer_cb;
-            m_timer_ctx[i].p_ctx = p_ctx;
-            m_timer_ctx[i].used = true;
-            return i + 1;
-        } else {
-            if (i == 0 && internal_use) {
-                return i + 1;
-            }
-        }
+    int hndl = timer_wheel_add(now_ms(), delay_ms, period_ms, timer_cb, p_ctx);
+    if (hndl == 0) {
+        Log_Debug("ERROR: No timer resource available!\n");
+        return 0;
     }
-    Log_Debug("ERROR: No timer resource available!\n");
-    return 0;
+    arm_timer_fd();
+    return hndl;
 }
 
-static int get_timer_interval(int timer_handle, bool internal_use) {
-    int idx = timer_handle - 1;
-    if (internal_use) {
-        idx = 0;
-    } else if ((idx <= 0) || (idx >= M_ARRAY_SIZE(m_timer_ctx))) {
+static int get_timer_interval(int timer_handle) {
+    unsigned int period_ms;
+    if (!timer_wheel_get_period(timer_handle, &period_ms)) {
         Log_Debug("Invalid timer_handle!\n");
         return -1;
     }
-    if (m_timer_ctx[idx].used) {
-        return m_timer_ctx[idx].interval_s;
-    }
-    return -1;
+    return (int)(period_ms / 1000);
 }
 
-static bool set_timer_interval(int timer_handle, int interval_s, bool internal_use) {
-    int idx = timer_handle - 1;
-    if (internal_use) {
-        idx = 0;
-    } else if ((idx <= 0) || (idx >= M_ARRAY_SIZE(m_timer_ctx))) {
+static bool set_timer(int timer_handle, unsigned int delay_ms, unsigned int period_ms) {
+    if (!timer_wheel_modify(timer_handle, now_ms(), delay_ms, period_ms)) {
         Log_Debug("Invalid timer_handle!\n");
         return false;
     }
-    if (m_timer_ctx[idx].used) {
-        struct timespec ts = { .tv_sec = interval_s, .tv_nsec = 0 };
-        struct itimerspec new_value = { .it_value = ts,
-                                      .it_interval = ts };
-        if (timerfd_settime(m_timer_ctx[idx].timer_fd, 0, &new_value, NULL) == -1) {
-            Log_Debug("ERROR: Could not set timer period: %s (%d).\n",
-                strerror(errno), errno);
-            return false;
-        }
-        m_timer_ctx[idx].interval_s = interval_s;
-        return true;
-    }
-    return false;
+    arm_timer_fd();
+    return true;
 }
 
-static void delete_timer(int timer_handle, bool internal_use) {
-    int idx = timer_handle - 1;
-    if (internal_use) {
-        idx = 0;
-    } else if ((idx <= 0) || (idx >= M_ARRAY_SIZE(m_timer_ctx))) {
+static void delete_timer(int timer_handle) {
+    if (!timer_wheel_cancel(timer_handle)) {
         Log_Debug("Invalid timer_handle!\n");
         return;
     }
-    if (m_timer_ctx[idx].used) {
-        EventLoop_UnregisterIo(m_evt_loop, m_timer_ctx[idx].evt_reg);
-        close(m_timer_ctx[idx].timer_fd);
-        m_timer_ctx[idx].used = false;
-    }
+    arm_timer_fd();
 }
 
 static void on_device_twin_cb(DEVICE_TWIN_UPDATE_STATE update_state,
@@ -266,96 +385,617 @@ static IOTHUBMESSAGE_DISPOSITION_RESULT on_recv_msg_cb(IOTHUB_MESSAGE_HANDLE mes
     return IOTHUBMESSAGE_ACCEPTED;
 }
 
+// Drops the transport recovers from by itself, keeping the client and its session.
+static bool is_transient_drop(int reason) {
+    return reason == IOTHUB_CLIENT_CONNECTION_NO_NETWORK ||
+        reason == IOTHUB_CLIENT_CONNECTION_COMMUNICATION_ERROR ||
+        reason == IOTHUB_CLIENT_CONNECTION_NO_PING_RESPONSE;
+}
+
+static uint32_t next_jitter(void) {
+    // xorshift32
+    m_jitter_state ^= m_jitter_state << 13;
+    m_jitter_state ^= m_jitter_state >> 17;
+    m_jitter_state ^= m_jitter_state << 5;
+    return m_jitter_state;
+}
+
+// Seeded per device and per boot, so devices sharing a firmware image spread out.
+static void seed_jitter(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    uint32_t hash = 2166136261u;
+    for (const char* p = m_init.scope_id; *p; p++) {
+        hash = (hash ^ (unsigned char)*p) * 16777619u;
+    }
+    m_jitter_state = hash ^ (uint32_t)now.tv_nsec ^ ((uint32_t)getpid() << 16);
+    if (m_jitter_state == 0) {
+        m_jitter_state = 1;
+    }
+}
+
+static unsigned int next_backoff_ms(void) {
+    unsigned int shift = m_reconnect_info.consecutive_failures;
+    uint64_t cap = (uint64_t)RECONNECT_BACKOFF_BASE_MS << (shift < 16 ? shift : 16);
+    if (cap > RECONNECT_BACKOFF_MAX_MS) {
+        cap = RECONNECT_BACKOFF_MAX_MS;
+    }
+    return (unsigned int)(cap / 2 + next_jitter() % (cap / 2 + 1));
+}
+
+static void cancel_retry(void) {
+    if (m_retry_timer) {
+        delete_timer(m_retry_timer);
+        m_retry_timer = 0;
+    }
+    m_next_attempt_ms = 0;
+}
+
+// Arms the one-shot retry timer, which acts on whatever state the scheduler is in when it fires.
+static void arm_retry(IotHubReconnectState state, unsigned int delay_ms) {
+    m_reconnect_info.state = state;
+    m_next_attempt_ms = now_ms() + delay_ms;
+    if (m_retry_timer) {
+        set_timer(m_retry_timer, delay_ms, 0);
+    } else {
+        m_retry_timer = add_timer(delay_ms, 0, retry_timer_cb, NULL);
+    }
+}
+
+static void start_attempt(void) {
+    cancel_retry();
+    m_reconnect_info.state = ReconnectAttempting;
+    m_reconnect_info.attempts++;
+    setup_azure_iot_client();
+}
+
+static void on_attempt_failed(void) {
+    m_reconnect_info.consecutive_failures++;
+    unsigned int delay_ms = next_backoff_ms();
+    Log_Debug("IoTHub connection attempt %u failed, next in %u ms\n",
+        m_reconnect_info.consecutive_failures, delay_ms);
+    arm_retry(ReconnectBackoff, delay_ms);
+}
+
+static void retry_timer_cb(void* p_ctx) {
+    // One-shot, already released by the timer wheel
+    m_retry_timer = 0;
+    m_next_attempt_ms = 0;
+    if (m_reconnect_info.state == ReconnectWarm) {
+        Log_Debug("WARNING: IoTHub did not reconnect in time, recreating the client.\n");
+        m_reconnect_info.warm_timeouts++;
+        m_warm_reconnect = false;
+    } else if (m_reconnect_info.state == ReconnectAttempting) {
+        Log_Debug("WARNING: IoTHub did not authenticate in time, recreating the client.\n");
+        m_reconnect_info.consecutive_failures++;
+    }
+    if (!m_network_up) {
+        // Retried as soon as the poll handler sees the interface come up.
+        m_reconnect_info.state = ReconnectWaitingNetwork;
+        return;
+    }
+    start_attempt();
+}
+
+// Interface changes make the backoff moot: whatever failed before is likely to work now.
+static void on_network_change(bool up) {
+    m_reconnect_info.network_changes++;
+    if (!up || m_auth_status == StatusAuthenticated) {
+        return;
+    }
+    Log_Debug("Network is up, connecting to IoTHub now.\n");
+    m_reconnect_info.consecutive_failures = 0;
+    if (m_warm_reconnect) {
+        request_dowork(0);
+    } else if (m_reconnect_info.state != ReconnectAttempting || !m_prov_running) {
+        start_attempt();
+    }
+}
+
+// A warm reconnect keeps the client handle and lets DoWork bring the transport back. Otherwise
+// the client is recreated and provisioned again, after a backoff delay.
+static void begin_reconnect(bool warm, int reason) {
+    if (!m_reconnect_info.reconnecting) {
+        m_reconnect_info.reconnecting = true;
+        m_reconnect_info.drops++;
+        clock_gettime(CLOCK_MONOTONIC, &m_drop_started);
+    }
+    m_reconnect_info.last_reason = reason;
+    m_warm_reconnect = warm && m_client_handle != NULL;
+    if (m_warm_reconnect) {
+        Log_Debug("IoTHub connection lost, reconnecting with the same client.\n");
+        arm_retry(ReconnectWarm, WARM_RECONNECT_TIMEOUT_MS);
+        request_dowork(0);
+        return;
+    }
+    // Keeping DoWork going would let the transport reconnect the client being replaced.
+    m_client_stale = true;
+    arm_retry(ReconnectBackoff, next_backoff_ms());
+}
+
+static void end_reconnect(void) {
+    unsigned int took_ms = elapsed_ms(&m_drop_started);
+    m_reconnect_info.reconnecting = false;
+    m_reconnect_info.last_warm = m_warm_reconnect;
+    if (m_warm_reconnect) {
+        m_reconnect_info.warm_reconnects++;
+    } else {
+        m_reconnect_info.full_reconnects++;
+    }
+    m_reconnect_info.last_reconnect_ms = took_ms;
+    if (took_ms > m_reconnect_info.max_reconnect_ms) {
+        m_reconnect_info.max_reconnect_ms = took_ms;
+    }
+    Log_Debug("IoTHub reconnected in %u ms (%s)\n", took_ms, m_reconnect_info.last_warm ?
+        "same client" : "new client");
+}
+
 static void on_connect_status_cb(IOTHUB_CLIENT_CONNECTION_STATUS result,
                                  IOTHUB_CLIENT_CONNECTION_STATUS_REASON reason,
                                  void* user_context_cb) {
 
     Log_Debug("IoTHub connection status: %s\n", print_connection_status_string(reason));
-    if (result != IOTHUB_CLIENT_CONNECTION_AUTHENTICATED) {
+    if (result != IOTHUB_CLIENT_CONNECTION_AUTHENTICATED && m_connected_direct &&
+        (reason == IOTHUB_CLIENT_CONNECTION_BAD_CREDENTIAL ||
+        reason == IOTHUB_CLIENT_CONNECTION_DEVICE_DISABLED ||
+        reason == IOTHUB_CLIENT_CONNECTION_RETRY_EXPIRED ||
+        (m_awaiting_auth && ++m_direct_failures >= DIRECT_CONNECT_MAX_FAILURES))) {
+        // The cached hub does not take the device, e.g. it was moved: provision again. The
+        // client is destroyed from the poll timer, not from within its own callback.
+        Log_Debug("WARNING: Cached IoTHub %s rejected the device, provisioning again.\n",
+            m_hub_cache.hub_host);
+        hub_cache_clear();
+        m_connected_direct = false;
+        m_client_stale = true;
+        m_prov_info.fallbacks++;
+        m_auth_status = StatusNotAuthenticated;
+        arm_retry(ReconnectBackoff, 0);
+    } else if (result != IOTHUB_CLIENT_CONNECTION_AUTHENTICATED) {
         if (m_auth_status == StatusAuthenticated) {
             Log_Debug("IoTHub auth status: Not authenticated\n");
             m_auth_status = StatusNotAuthenticated;
-            if (m_timer_ctx[0].used) {
-                M_SET_TIMER_INTERVAL(1);
-            } else {
-                M_ADD_TIMER(1);
-            }
+            begin_reconnect(is_transient_drop(reason), reason);
+        } else if (m_warm_reconnect && !is_transient_drop(reason)) {
+            // The transport gave up, or the hub refused the device while reconnecting.
+            begin_reconnect(false, reason);
         }
     } else {
         if (m_auth_status != StatusAuthenticated) {
             Log_Debug("IoTHub auth status: Authenticated\n");
             m_auth_status = StatusAuthenticated;
         }
+        if (m_awaiting_auth) {
+            m_awaiting_auth = false;
+            m_prov_info.time_to_auth_ms = elapsed_ms(&m_prov_started);
+        }
+        if (m_reconnect_info.reconnecting) {
+            end_reconnect();
+        }
+        m_warm_reconnect = false;
+        m_reconnect_info.consecutive_failures = 0;
+        m_reconnect_info.state = ReconnectIdle;
+        cancel_retry();
     }
     if (m_init.auth_status_cb) {
         m_init.auth_status_cb(m_auth_status);
     }
 }
 
+static unsigned int elapsed_ms(const struct timespec* p_since) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    long long ms = (long long)(now.tv_sec - p_since->tv_sec) * 1000 +
+        (now.tv_nsec - p_since->tv_nsec) / 1000000;
+    return ms > 0 ? (unsigned int)ms : 0;
+}
+
+static void record_latency(unsigned int latency_ms) {
+    int bucket = 0;
+    while (latency_ms && bucket < IOTHUB_SEND_LATENCY_BUCKETS - 1) {
+        latency_ms >>= 1;
+        bucket++;
+    }
+    m_send_stats.latency_hist[bucket]++;
+}
+
+static SendContext* alloc_send_ctx(void) {
+    static int next = 0;
+    for (int i = 0; i < MAX_TRACKED_MESSAGES; i++) {
+        int idx = (next + i) % MAX_TRACKED_MESSAGES;
+        if (!m_send_ctx[idx].used) {
+            next = (idx + 1) % MAX_TRACKED_MESSAGES;
+            return &m_send_ctx[idx];
+        }
+    }
+    return NULL;
+}
+
 static void on_send_evt_cb(IOTHUB_CLIENT_CONFIRMATION_RESULT result,
     void* context) {
-    Log_Debug("INFO: Send status code %d.\n", result);
+    SendContext* p_send = context;
+    IotHubSendResult send_result;
+    switch (result) {
+    case IOTHUB_CLIENT_CONFIRMATION_OK:
+        send_result = SendResultSuccess;
+        m_send_stats.succeeded++;
+        break;
+    case IOTHUB_CLIENT_CONFIRMATION_MESSAGE_TIMEOUT:
+        send_result = SendResultTimeout;
+        m_send_stats.timed_out++;
+        break;
+    case IOTHUB_CLIENT_CONFIRMATION_BECAUSE_DESTROY:
+        send_result = SendResultDestroyed;
+        m_send_stats.destroyed++;
+        break;
+    default:
+        Log_Debug("INFO: Send status code %d.\n", result);
+        send_result = SendResultError;
+        m_send_stats.failed++;
+        break;
+    }
+    if (p_send == NULL) {
+        return;
+    }
+    unsigned int latency_ms = elapsed_ms(&p_send->sent_at);
+    if (send_result == SendResultSuccess) {
+        record_latency(latency_ms);
+        m_send_stats.latency_sum_ms += latency_ms;
+        if (latency_ms > m_send_stats.latency_max_ms) {
+            m_send_stats.latency_max_ms = latency_ms;
+        }
+    }
+    p_send->used = false;
+    m_send_stats.in_flight--;
+    if (p_send->cb) {
+        p_send->cb(p_send->msg_id, send_result, latency_ms, p_send->p_ctx);
+    }
+}
+
+// Schedules DoWork delay_ms from now, unless it is due sooner already.
+static void request_dowork(int delay_ms) {
+    uint64_t due_ms = now_ms() + (uint64_t)delay_ms;
+    if (m_timer_fd == -1) {
+        return;
+    }
+    if (m_dowork_timer) {
+        if (m_dowork_due_ms <= due_ms) {
+            return;
+        }
+        set_timer(m_dowork_timer, (unsigned int)delay_ms, 0);
+    } else {
+        m_dowork_timer = add_timer((unsigned int)delay_ms, 0, dowork_timer_cb, NULL);
+    }
+    m_dowork_due_ms = due_ms;
+}
+
+static void schedule_dowork(void) {
+    if (m_client_handle == NULL || (m_client_stale && !m_disconnect_pending)) {
+        return;
+    }
+    if (m_auth_status != StatusAuthenticated || m_send_stats.in_flight > 0 || m_disconnect_pending) {
+        request_dowork(DOWORK_BUSY_MS);
+    } else {
+        request_dowork(m_init.dowork_idle_ms > 0 ? m_init.dowork_idle_ms : DOWORK_IDLE_MS);
+    }
+}
+
+static void dowork_timer_cb(void* p_ctx) {
+    // One-shot, already released by the timer wheel
+    m_dowork_timer = 0;
+    if (m_client_handle == NULL || (m_client_stale && !m_disconnect_pending)) {
+        return;
+    }
+    IoTHubDeviceClient_LL_DoWork(m_client_handle);
+    if (m_disconnect_pending) {
+        m_disconnect_pending = false;
+        IoTHubDeviceClient_LL_Destroy(m_client_handle);
+        m_client_handle = NULL;
+        m_auth_status = StatusNotAuthenticated;
+        if (m_init.auth_status_cb) {
+            m_init.auth_status_cb(m_auth_status);
+        }
+        return;
+    }
+    schedule_dowork();
+}
+
+static void report_provisioning(void) {
+    if (m_init.prov_status_cb) {
+        m_init.prov_status_cb(&m_prov_info);
+    }
+}
+
+static uint32_t hub_cache_checksum(const HubCacheRecord* p_rec) {
+    // FNV-1a
+    uint32_t hash = 2166136261u;
+    const unsigned char* p = (const unsigned char*)p_rec;
+    for (size_t i = 0; i < offsetof(HubCacheRecord, checksum); i++) {
+        hash = (hash ^ p[i]) * 16777619u;
+    }
+    return hash;
+}
+
+static bool hub_cache_enabled(void) {
+    return m_init.hub_cache_size >= sizeof(HubCacheRecord);
+}
+
+static void hub_cache_write(void) {
+    if (lseek(m_init.hub_cache_fd, m_init.hub_cache_offset, SEEK_SET) == -1 ||
+        write(m_init.hub_cache_fd, &m_hub_cache, sizeof(m_hub_cache)) != sizeof(m_hub_cache)) {
+        Log_Debug("ERROR: Could not write the IoTHub cache: %s (%d).\n", strerror(errno), errno);
+        return;
+    }
+    fsync(m_init.hub_cache_fd);
+}
+
+static void hub_cache_load(void) {
+    m_hub_cache_valid = false;
+    if (!hub_cache_enabled()) {
+        return;
+    }
+    if (lseek(m_init.hub_cache_fd, m_init.hub_cache_offset, SEEK_SET) == -1 ||
+        read(m_init.hub_cache_fd, &m_hub_cache, sizeof(m_hub_cache)) != sizeof(m_hub_cache)) {
+        return;
+    }
+    // Entries written for another scope are ignored.
+    m_hub_cache_valid = m_hub_cache.magic == HUB_CACHE_MAGIC &&
+        m_hub_cache.checksum == hub_cache_checksum(&m_hub_cache) &&
+        strncmp(m_hub_cache.scope_id, m_init.scope_id, sizeof(m_hub_cache.scope_id)) == 0 &&
+        memchr(m_hub_cache.hub_host, 0, sizeof(m_hub_cache.hub_host)) != NULL &&
+        m_hub_cache.hub_host[0] != 0;
 }
 
+static void hub_cache_store(const ProvisioningJob* p_job) {
+    if (!hub_cache_enabled() || (m_hub_cache_valid &&
+        strcmp(m_hub_cache.hub_host, p_job->hub_host) == 0 &&
+        strcmp(m_hub_cache.device_id, p_job->device_id) == 0)) {
+        return;
+    }
+    memset(&m_hub_cache, 0, sizeof(m_hub_cache));
+    m_hub_cache.magic = HUB_CACHE_MAGIC;
+    memcpy(m_hub_cache.scope_id, m_init.scope_id, sizeof(m_hub_cache.scope_id));
+    memcpy(m_hub_cache.hub_host, p_job->hub_host, sizeof(m_hub_cache.hub_host));
+    memcpy(m_hub_cache.device_id, p_job->device_id, sizeof(m_hub_cache.device_id));
+    m_hub_cache.checksum = hub_cache_checksum(&m_hub_cache);
+    m_hub_cache_valid = true;
+    hub_cache_write();
+}
+
+static void hub_cache_clear(void) {
+    if (!m_hub_cache_valid) {
+        return;
+    }
+    m_hub_cache_valid = false;
+    m_hub_cache.magic = 0;
+    hub_cache_write();
+}
+
+static void on_dps_register(PROV_DEVICE_RESULT register_result, const char* iothub_uri,
+    const char* device_id, void* user_context) {
+    ProvisioningJob* p_job = (ProvisioningJob*)user_context;
+    p_job->dps_result = register_result;
+    if (register_result == PROV_DEVICE_RESULT_OK && iothub_uri) {
+        strncpy(p_job->hub_host, iothub_uri, sizeof(p_job->hub_host) - 1);
+        if (device_id) {
+            strncpy(p_job->device_id, device_id, sizeof(p_job->device_id) - 1);
+        }
+    }
+    p_job->dps_done = true;
+}
+
+// Registers with DPS and waits for the hub assignment. Runs on the provisioning thread.
+static void register_with_dps(ProvisioningJob* p_job) {
+    p_job->result.result = AZURE_SPHERE_PROV_RESULT_PROV_DEVICE_ERROR;
+    if (prov_dev_security_init(SECURE_DEVICE_TYPE_X509) != 0) {
+        p_job->result.result = AZURE_SPHERE_PROV_RESULT_DEVICEAUTH_NOT_READY;
+        return;
+    }
+    PROV_DEVICE_LL_HANDLE prov_handle = Prov_Device_LL_Create(DPS_GLOBAL_ENDPOINT,
+        p_job->scope_id, Prov_Device_MQTT_Protocol);
+    if (prov_handle == NULL ||
+        Prov_Device_LL_SetOption(prov_handle, "SetDeviceId", &m_device_id_for_daa_cert) !=
+        PROV_DEVICE_RESULT_OK ||
+        Prov_Device_LL_Register_Device(prov_handle, on_dps_register, p_job, NULL, NULL) !=
+        PROV_DEVICE_RESULT_OK) {
+        p_job->result.result = AZURE_SPHERE_PROV_RESULT_GENERIC_ERROR;
+    } else {
+        struct timespec started;
+        struct timespec interval = { .tv_sec = 0, .tv_nsec = DPS_DOWORK_INTERVAL_MS * 1000000 };
+        clock_gettime(CLOCK_MONOTONIC, &started);
+        while (!p_job->dps_done && elapsed_ms(&started) < p_job->timeout_ms) {
+            Prov_Device_LL_DoWork(prov_handle);
+            if (!p_job->dps_done) {
+                nanosleep(&interval, NULL);
+            }
+        }
+        if (!p_job->dps_done) {
+            p_job->dps_result = PROV_DEVICE_RESULT_TIMEOUT;
+        }
+        p_job->result.prov_device_error = p_job->dps_result;
+        if (p_job->dps_result == PROV_DEVICE_RESULT_OK && p_job->hub_host[0]) {
+            p_job->result.result = AZURE_SPHERE_PROV_RESULT_OK;
+        }
+    }
+    if (prov_handle) {
+        Prov_Device_LL_Destroy(prov_handle);
+    }
+    prov_dev_security_deinit();
+}
+
+static IOTHUB_DEVICE_CLIENT_LL_HANDLE create_hub_client(const char* p_hub_host) {
+    if (iothub_security_init(IOTHUB_SECURITY_TYPE_X509) != 0) {
+        return NULL;
+    }
+    IOTHUB_DEVICE_CLIENT_LL_HANDLE handle =
+        IoTHubDeviceClient_LL_CreateWithAzureSphereFromDeviceAuth(p_hub_host, MQTT_Protocol);
+    if (handle && IoTHubDeviceClient_LL_SetOption(handle, "SetDeviceId",
+        &m_device_id_for_daa_cert) != IOTHUB_CLIENT_OK) {
+        IoTHubDeviceClient_LL_Destroy(handle);
+        handle = NULL;
+    }
+    return handle;
+}
+
+// With a cached hub the client connects to it directly and DPS is skipped. A hub that does not
+// take the device is caught by the connection status callback, which clears the cache.
+static void* provisioning_thread(void* p_arg) {
+    ProvisioningJob* p_job = (ProvisioningJob*)p_arg;
+    uint64_t done = 1;
+    if (p_job->hub_host[0]) {
+        p_job->handle = create_hub_client(p_job->hub_host);
+        p_job->direct = (p_job->handle != NULL);
+    }
+    if (p_job->handle) {
+        p_job->result.result = AZURE_SPHERE_PROV_RESULT_OK;
+    } else {
+        memset(p_job->hub_host, 0, sizeof(p_job->hub_host));
+        register_with_dps(p_job);
+        if (p_job->result.result == AZURE_SPHERE_PROV_RESULT_OK) {
+            p_job->handle = create_hub_client(p_job->hub_host);
+            if (p_job->handle == NULL) {
+                p_job->result.result = AZURE_SPHERE_PROV_RESULT_IOTHUB_CLIENT_ERROR;
+            }
+        }
+    }
+    if (write(m_prov_event_fd, &done, sizeof(done)) == -1) {
+        Log_Debug("ERROR: Could not signal provisioning result: %s (%d).\n", strerror(errno), errno);
+    }
+    return NULL;
+}
+
+// Runs on the event loop once the provisioning thread has finished.
+static void on_provisioning_done(EventLoop* el, int fd, EventLoop_IoEvents events, void* context) {
+    uint64_t done = 0;
+    if (read(fd, &done, sizeof(done)) == -1 || !m_prov_running) {
+        return;
+    }
+    pthread_join(m_prov_thread, NULL);
+    m_prov_running = false;
+    AZURE_SPHERE_PROV_RETURN_VALUE prov_res = m_prov_job.result;
+    m_prov_info.elapsed_ms = elapsed_ms(&m_prov_started);
+    if (m_prov_info.elapsed_ms > m_prov_info.max_duration_ms) {
+        m_prov_info.max_duration_ms = m_prov_info.elapsed_ms;
+    }
+    m_prov_info.last_result = prov_res.result;
+    Log_Debug("IoTHub provisioning result: %s (%u ms%s)\n",
+        print_provisioning_result_string(prov_res), m_prov_info.elapsed_ms,
+        m_prov_job.direct ? ", cached hub" : "");
+    if (m_prov_cancelled) {
+        // Disconnected while provisioning
+        if (m_prov_job.handle) {
+            IoTHubDeviceClient_LL_Destroy(m_prov_job.handle);
+        }
+        m_prov_info.state = ProvisioningIdle;
+        report_provisioning();
+        return;
+    }
+    if (prov_res.result != AZURE_SPHERE_PROV_RESULT_OK) {
+        m_prov_info.failures++;
+        m_prov_info.state = ProvisioningFailed;
+        report_provisioning();
+        on_attempt_failed();
+        return;
+    }
+    m_client_handle = m_prov_job.handle;
+    m_connected_direct = m_prov_job.direct;
+    m_direct_failures = 0;
+    m_awaiting_auth = true;
+    m_prov_info.direct = m_prov_job.direct;
+    if (m_prov_job.direct) {
+        m_prov_info.direct_connects++;
+    } else {
+        m_prov_info.dps_registrations++;
+        hub_cache_store(&m_prov_job);
+    }
+    m_prov_info.state = ProvisioningSucceeded;
+    report_provisioning();
+    m_auth_status = StatusInitiated;
+    IoTHubDeviceClient_LL_SetMessageCallback(m_client_handle, on_recv_msg_cb, NULL);
+    IoTHubDeviceClient_LL_SetDeviceTwinCallback(m_client_handle, on_device_twin_cb, NULL);
+    IoTHubDeviceClient_LL_SetConnectionStatusCallback(m_client_handle, on_connect_status_cb,
+        NULL);
+    // OPTION_MESSAGE_TIMEOUT, so undelivered messages are reported instead of kept forever.
+    uint_fast64_t message_timeout_ms = MESSAGE_TIMEOUT_MS;
+    IoTHubDeviceClient_LL_SetOption(m_client_handle, "messageTimeout", &message_timeout_ms);
+    arm_retry(ReconnectAttempting, HUB_AUTH_TIMEOUT_MS);
+    request_dowork(0);
+}
+
+// Starts provisioning in the background. The event loop keeps running while DPS is contacted,
+// which can take up to the provisioning timeout.
 static void setup_azure_iot_client(void) {
+    if (m_prov_running) {
+        return;
+    }
     if (m_client_handle != NULL) {
         IoTHubDeviceClient_LL_Destroy(m_client_handle);
+        m_client_handle = NULL;
+    }
+    m_warm_reconnect = false;
+    m_client_stale = false;
+    memset(&m_prov_job, 0, sizeof(m_prov_job));
+    memcpy(m_prov_job.scope_id, m_init.scope_id, sizeof(m_prov_job.scope_id));
+    if (m_hub_cache_valid) {
+        memcpy(m_prov_job.hub_host, m_hub_cache.hub_host, sizeof(m_prov_job.hub_host));
     }
-    AZURE_SPHERE_PROV_RETURN_VALUE prov_res =
-        IoTHubDeviceClient_LL_CreateWithAzureSphereDeviceAuthProvisioning(m_init.scope_id,
-            10000, &m_client_handle);
-    Log_Debug("IoTHub provisioning result: %s\n",
-        print_provisioning_result_string(prov_res));
-    if (prov_res.result == AZURE_SPHERE_PROV_RESULT_OK) {
-        m_auth_status = StatusInitiated;
-        IoTHubDeviceClient_LL_SetMessageCallback(m_client_handle, on_recv_msg_cb, NULL);
-        IoTHubDeviceClient_LL_SetDeviceTwinCallback(m_client_handle, on_device_twin_cb, NULL);
-        IoTHubDeviceClient_LL_SetConnectionStatusCallback(m_client_handle, on_connect_status_cb,
-            NULL);
+    m_prov_job.timeout_ms = m_init.provisioning_timeout_ms > 0 ? m_init.provisioning_timeout_ms :
+        PROVISIONING_TIMEOUT_MS;
+    m_prov_cancelled = false;
+    clock_gettime(CLOCK_MONOTONIC, &m_prov_started);
+    m_prov_info.attempts++;
+    m_prov_info.elapsed_ms = 0;
+    m_awaiting_auth = false;
+    int err = pthread_create(&m_prov_thread, NULL, provisioning_thread, &m_prov_job);
+    if (err != 0) {
+        Log_Debug("ERROR: Unable to start provisioning: %s (%d).\n", strerror(err), err);
+        m_prov_info.failures++;
+        m_prov_info.state = ProvisioningFailed;
+        report_provisioning();
+        return;
     }
+    m_prov_running = true;
+    m_prov_info.state = ProvisioningInProgress;
+    report_provisioning();
 }
 
 static void iothub_poll_handler(void *p_ctx) {
     bool is_networking_ready = false;
+    bool network_up = false;
     bool need_report = false;
-    if (M_GET_TIMER_INTERVAL() == 1) {
-        M_SET_TIMER_INTERVAL(IOTHUB_POLL_INTERVAL_S);
-    }
     if ((Networking_IsNetworkingReady(&is_networking_ready) == -1) || !is_networking_ready) {
-        if (m_auth_status == StatusAuthenticated) {
-            m_auth_status = StatusNotAuthenticated;
-            need_report = true;
-            Log_Debug("WARNING: Network down. Device need to re-authenticate when network is up.\n");
-        } else {
+        if (m_auth_status != StatusAuthenticated && m_network_up) {
             Log_Debug("WARNING: Network is not ready. Device cannot connect until network is ready.\n");
         }
-        goto handler_end;
-    }
-    Networking_InterfaceConnectionStatus status;
-    if (Networking_GetInterfaceConnectionStatus(m_init.netif, &status) == 0) {
-        if (status & Networking_InterfaceConnectionStatus_ConnectedToInternet) {
-            if (m_auth_status == StatusNotAuthenticated) {
-                setup_azure_iot_client();
-            }
-        } else {
-            if (m_auth_status == StatusAuthenticated) {
-                m_auth_status = StatusNotAuthenticated;
-                need_report = true;
-            }
-        }
     } else {
-        if (m_auth_status == StatusAuthenticated) {
-            m_auth_status = StatusNotAuthenticated;
-            need_report = true;
-        }
-        if (errno != EAGAIN) {
+        Networking_InterfaceConnectionStatus status;
+        if (Networking_GetInterfaceConnectionStatus(m_init.netif, &status) == 0) {
+            network_up = (status & Networking_InterfaceConnectionStatus_ConnectedToInternet) != 0;
+        } else if (errno != EAGAIN) {
             m_auth_status = StatusInitiateError;
             need_report = true;
             Log_Debug("ERROR: Networking_GetInterfaceConnectionStatus: %d (%s)\n", errno,
                 strerror(errno));
         }
     }
-handler_end:
+    if (!network_up && m_auth_status == StatusAuthenticated) {
+        m_auth_status = StatusNotAuthenticated;
+        need_report = true;
+        begin_reconnect(true, IOTHUB_CLIENT_CONNECTION_NO_NETWORK);
+        Log_Debug("WARNING: Network down. Device need to re-authenticate when network is up.\n");
+    }
+    if (network_up != m_network_up) {
+        m_network_up = network_up;
+        on_network_change(network_up);
+    } else if (network_up && m_auth_status == StatusNotAuthenticated &&
+        m_reconnect_info.state == ReconnectIdle) {
+        // First connection, or connecting again after iothub_client_disconnect()
+        start_attempt();
+    }
+    int interval_s = m_auth_status == StatusAuthenticated ? IOTHUB_POLL_INTERVAL_S :
+        NETWORK_POLL_INTERVAL_S;
+    if (M_GET_TIMER_INTERVAL() != interval_s) {
+        M_SET_TIMER_INTERVAL(interval_s);
+    }
     if (need_report && m_init.auth_status_cb) {
         m_init.auth_status_cb(m_auth_status);
     }
@@ -376,17 +1016,78 @@ IotHubClientReturnCode iothub_client_init(IotHubClientInit *p_init) {
         return CodeInvalidParam;
     }
     memcpy(&m_init, p_init, sizeof(IotHubClientInit));
-    if (m_evt_loop) {
+    if (m_init.quota_daily_units) {
+        unsigned long burst = m_init.quota_burst_units ? m_init.quota_burst_units :
+            m_init.quota_daily_units / (24 * 60);
+        m_quota_capacity = (long long)(burst ? burst : 1) * QUOTA_DAY_MS;
+        m_quota_tokens = m_quota_capacity;
+        m_quota_refilled_ms = now_ms();
+        m_quota_day = -1;
+        m_quota_used = 0;
+        m_quota_throttled = 0;
+    }
+    if (m_evt_loop && m_evt_loop_owned) {
         EventLoop_Close(m_evt_loop);
     }
-    m_evt_loop = EventLoop_Create();
+    // Timers and DoWork are dispatched from the application loop when one is given, so nothing
+    // waits behind a second loop.
+    m_evt_loop_owned = (p_init->p_event_loop == NULL);
+    m_evt_loop = m_evt_loop_owned ? EventLoop_Create() : p_init->p_event_loop;
     if (m_evt_loop == NULL) {
         Log_Debug("ERROR: Unable to create event loop!\n");
         return CodeResourceNotAvailable;
     }
-    for (int i = 0; i < M_ARRAY_SIZE(m_timer_ctx); i++)    {
-        m_timer_ctx[i].used = false;
+    m_timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+    if (m_timer_fd == -1 || !timer_wheel_init(now_ms())) {
+        Log_Debug("ERROR: Unable to create timer: %s (%d).\n", strerror(errno), errno);
+        if (m_timer_fd != -1) {
+            close(m_timer_fd);
+            m_timer_fd = -1;
+        }
+        if (m_evt_loop_owned) {
+            EventLoop_Close(m_evt_loop);
+        }
+        m_evt_loop = NULL;
+        return CodeResourceNotAvailable;
+    }
+    m_timer_armed_ms = 0;
+    m_poll_timer = 0;
+    m_dowork_timer = 0;
+    m_timer_reg = EventLoop_RegisterIo(m_evt_loop, m_timer_fd, EventLoop_Input,
+        timer_fd_cb, NULL);
+    if (m_timer_reg == NULL) {
+        Log_Debug("ERROR: Unable to register timer event: %s (%d).\n", strerror(errno), errno);
+        timer_wheel_deinit();
+        close(m_timer_fd);
+        m_timer_fd = -1;
+        if (m_evt_loop_owned) {
+            EventLoop_Close(m_evt_loop);
+        }
+        m_evt_loop = NULL;
+        return CodeResourceNotAvailable;
     }
+    m_prov_event_fd = eventfd(0, EFD_NONBLOCK);
+    m_prov_reg = m_prov_event_fd == -1 ? NULL : EventLoop_RegisterIo(m_evt_loop, m_prov_event_fd,
+        EventLoop_Input, on_provisioning_done, NULL);
+    if (m_prov_reg == NULL) {
+        Log_Debug("ERROR: Unable to register provisioning event: %s (%d).\n",
+            strerror(errno), errno);
+        if (m_prov_event_fd != -1) {
+            close(m_prov_event_fd);
+            m_prov_event_fd = -1;
+        }
+        EventLoop_UnregisterIo(m_evt_loop, m_timer_reg);
+        timer_wheel_deinit();
+        close(m_timer_fd);
+        m_timer_fd = -1;
+        if (m_evt_loop_owned) {
+            EventLoop_Close(m_evt_loop);
+        }
+        m_evt_loop = NULL;
+        return CodeResourceNotAvailable;
+    }
+    hub_cache_load();
+    seed_jitter();
     m_initialized = true;
     return CodeSuccess;
 }
@@ -400,7 +1101,8 @@ IotHubClientReturnCode iothub_client_connect(void) {
     Log_Debug("ERROR: IoTHub client already connected!\n");
     return CodeInvalidState;
     }
-    if (m_timer_ctx[0].used) {
+    m_prov_cancelled = false;
+    if (m_poll_timer) {
         M_SET_TIMER_INTERVAL(1);
     } else {
         M_ADD_TIMER(1);
@@ -410,7 +1112,36 @@ IotHubClientReturnCode iothub_client_connect(void) {
 
 IotHubClientReturnCode iothub_client_send_message(const char* p_msg,
     const char* p_content_type, const char* p_content_encoding) {
-    IOTHUB_MESSAGE_HANDLE msg_handle;
+    if (!p_msg) {
+        Log_Debug("ERROR: p_msg is NULL!\n");
+        return CodeInvalidParam;
+    }
+    return iothub_client_send_bytes((const unsigned char*)p_msg, strlen(p_msg), p_content_type,
+        p_content_encoding, NULL, NULL);
+}
+
+// The payload is handed to IoTHubMessage_CreateFromByteArray() as is: no strlen() and no
+// intermediate string copy. release_cb, if given, is called exactly once before returning, on
+// success and on failure, as the IoTHub message keeps its own copy of the payload.
+IotHubClientReturnCode iothub_client_send_bytes(const unsigned char* p_data, size_t data_len,
+    const char* p_content_type, const char* p_content_encoding,
+    IotHubBufferReleaseCallback release_cb, void* p_release_ctx) {
+    IotHubClientReturnCode ret = iothub_client_send_tracked(p_data, data_len, p_content_type,
+        p_content_encoding, NULL, NULL, NULL);
+    if (release_cb) {
+        release_cb(p_data, data_len, p_release_ctx);
+    }
+    return ret;
+}
+
+// Every message gets an id and, while tracking slots are free, its acknowledgement is timed
+// and counted. complete_cb is called once the hub acknowledged the message or it failed. If
+// complete_cb is given and no slot is free, the message is not sent.
+IotHubClientReturnCode iothub_client_send_tracked(const unsigned char* p_data, size_t data_len,
+    const char* p_content_type, const char* p_content_encoding,
+    IotHubSendCompleteCallback complete_cb, void* p_complete_ctx, unsigned int* p_msg_id) {
+    IOTHUB_MESSAGE_HANDLE msg_handle = NULL;
+    SendContext* p_send = NULL;
     if (!m_initialized) {
         Log_Debug("ERROR: IoTHub client not initialize!\n");
         return CodeInvalidState;
@@ -419,21 +1150,110 @@ IotHubClientReturnCode iothub_client_send_message(const char* p_msg,
         Log_Debug("ERROR: IoTHub client not connected!\n");
         return CodeInvalidState;
     }
-    //Log_Debug("msg => %s\n", p_msg);
-    msg_handle = IoTHubMessage_CreateFromString(p_msg);
+    if (!p_data && data_len) {
+        Log_Debug("ERROR: p_data is NULL!\n");
+        return CodeInvalidParam;
+    }
+    if (m_init.quota_daily_units && !quota_allows(quota_units(data_len))) {
+        m_quota_throttled++;
+        return CodeThrottled;
+    }
+    p_send = alloc_send_ctx();
+    if (p_send == NULL && complete_cb) {
+        Log_Debug("ERROR: Too many messages in flight!\n");
+        return CodeResourceNotAvailable;
+    }
+    msg_handle = IoTHubMessage_CreateFromByteArray(p_data, data_len);
     if (msg_handle == 0) {
         Log_Debug("ERROR: unable to create a new IoTHubMessage.\n");
-        return CodeResourceNotAvailable;
+        return CodeInternalError;
     }
     IoTHubMessage_SetContentTypeSystemProperty(msg_handle, p_content_type);
-    IoTHubMessage_SetContentEncodingSystemProperty(msg_handle, p_content_encoding);
+    if (p_content_encoding) {
+        // Binary payloads have no character encoding.
+        IoTHubMessage_SetContentEncodingSystemProperty(msg_handle, p_content_encoding);
+    }
+    unsigned int msg_id = m_next_msg_id++;
+    if (m_next_msg_id == 0) {
+        m_next_msg_id = 1;
+    }
+    if (p_send) {
+        p_send->used = true;
+        p_send->msg_id = msg_id;
+        p_send->cb = complete_cb;
+        p_send->p_ctx = p_complete_ctx;
+        clock_gettime(CLOCK_MONOTONIC, &p_send->sent_at);
+    }
     // Attempt to send the message we created
     if (IoTHubDeviceClient_LL_SendEventAsync(m_client_handle, msg_handle, on_send_evt_cb,
-        /*&callback_param*/ NULL) != IOTHUB_CLIENT_OK) {
+        p_send) != IOTHUB_CLIENT_OK) {
         Log_Debug("ERROR: failure sending message to Iothub.\n");
+        if (p_send) {
+            p_send->used = false;
+        }
+        IoTHubMessage_Destroy(msg_handle);
+        return CodeInternalError;
     }
     // Cleanup
     IoTHubMessage_Destroy(msg_handle);
+    request_dowork(0);
+    m_send_stats.sent++;
+    if (m_init.quota_daily_units) {
+        m_quota_tokens -= (long long)quota_units(data_len) * QUOTA_DAY_MS;
+        m_quota_used += quota_units(data_len);
+    }
+    if (p_send) {
+        if (++m_send_stats.in_flight > m_send_stats.max_in_flight) {
+            m_send_stats.max_in_flight = m_send_stats.in_flight;
+        }
+    } else {
+        m_send_stats.untracked++;
+    }
+    if (p_msg_id) {
+        *p_msg_id = msg_id;
+    }
+    return CodeSuccess;
+}
+
+IotHubClientReturnCode iothub_client_get_send_stats(IotHubSendStats* p_stats) {
+    if (!p_stats) {
+        Log_Debug("ERROR: p_stats is NULL!\n");
+        return CodeInvalidParam;
+    }
+    *p_stats = m_send_stats;
+    return CodeSuccess;
+}
+
+IotHubClientReturnCode iothub_client_get_quota_info(IotHubQuotaInfo* p_info) {
+    if (!p_info) {
+        return CodeInvalidParam;
+    }
+    memset(p_info, 0, sizeof(*p_info));
+    if (!m_initialized || !m_init.quota_daily_units) {
+        return CodeSuccess;
+    }
+    quota_refill();
+    time_t now = time(NULL);
+    time_t day_end = (m_quota_day + 1) * QUOTA_DAY_S;
+    p_info->enabled = true;
+    p_info->daily_units = m_init.quota_daily_units;
+    p_info->used_today = m_quota_used;
+    p_info->remaining_today = m_quota_used < m_init.quota_daily_units ?
+        m_init.quota_daily_units - m_quota_used : 0;
+    p_info->available_units = m_quota_tokens > 0 ? (unsigned int)(m_quota_tokens / QUOTA_DAY_MS) : 0;
+    if (p_info->remaining_today == 0) {
+        p_info->next_unit_ms = (unsigned int)((day_end - now) * 1000);
+    } else if (m_quota_tokens < QUOTA_DAY_MS) {
+        p_info->next_unit_ms = (unsigned int)((QUOTA_DAY_MS - m_quota_tokens +
+            (long long)m_init.quota_daily_units - 1) / (long long)m_init.quota_daily_units);
+    }
+    p_info->throttled = m_quota_throttled;
+    if (m_quota_used > 0) {
+        time_t elapsed = now > m_quota_since ? now - m_quota_since : 1;
+        time_t exhaustion = now + (time_t)((double)p_info->remaining_today * (double)elapsed /
+            (double)m_quota_used);
+        p_info->projected_exhaustion = exhaustion < day_end ? exhaustion : 0;
+    }
     return CodeSuccess;
 }
 
@@ -447,21 +1267,23 @@ IotHubClientReturnCode iothub_client_run(int timeout_ms) {
     if (result == EventLoop_Run_Failed && errno != EINTR) {
         return CodeRunFailed;
     }
-    if (m_client_handle != NULL) {
-        IoTHubDeviceClient_LL_DoWork(m_client_handle);
-        if (m_disconnect_pending) {
-            m_disconnect_pending = false;
-            IoTHubDeviceClient_LL_Destroy(m_client_handle);
-            m_client_handle = NULL;
-            m_auth_status = StatusNotAuthenticated;
-            if (m_init.auth_status_cb) {
-                m_init.auth_status_cb(m_auth_status);
-            }
-        }
-    }
     return CodeSuccess;
 }
 
+// The descriptor becomes readable when the client has events to process, so the private loop can
+// be nested in another one, e.g. registered with epoll, and run with a zero timeout.
+IotHubClientReturnCode iothub_client_get_wait_fd(int* p_fd) {
+    if (!m_initialized) {
+        Log_Debug("ERROR: IoTHub client not initialize!\n");
+        return CodeInvalidState;
+    }
+    if (!p_fd) {
+        return CodeInvalidParam;
+    }
+    *p_fd = EventLoop_GetWaitDescriptor(m_evt_loop);
+    return *p_fd == -1 ? CodeInternalError : CodeSuccess;
+}
+
 IotHubClientReturnCode iothub_client_disconnect(void) {
     if (!m_initialized) {
         Log_Debug("ERROR: IoTHub client not initialize!\n");
@@ -469,6 +1291,36 @@ IotHubClientReturnCode iothub_client_disconnect(void) {
     }
     if (m_client_handle) {
         m_disconnect_pending = true;
+        request_dowork(0);
+    }
+    if (m_prov_running) {
+        m_prov_cancelled = true;
+    }
+    m_reconnect_info.reconnecting = false;
+    m_reconnect_info.state = ReconnectIdle;
+    m_reconnect_info.consecutive_failures = 0;
+    m_warm_reconnect = false;
+    cancel_retry();
+    return CodeSuccess;
+}
+
+IotHubClientReturnCode iothub_client_get_reconnect_info(IotHubReconnectInfo* p_info) {
+    if (!p_info) {
+        return CodeInvalidParam;
+    }
+    *p_info = m_reconnect_info;
+    uint64_t now = now_ms();
+    p_info->next_attempt_ms = m_next_attempt_ms > now ? (unsigned int)(m_next_attempt_ms - now) : 0;
+    return CodeSuccess;
+}
+
+IotHubClientReturnCode iothub_client_get_provisioning_info(IotHubProvisioningInfo* p_info) {
+    if (!p_info) {
+        return CodeInvalidParam;
+    }
+    *p_info = m_prov_info;
+    if (m_prov_running) {
+        p_info->elapsed_ms = elapsed_ms(&m_prov_started);
     }
     return CodeSuccess;
 }
@@ -479,7 +1331,17 @@ IotHubClientReturnCode iothub_client_add_timer(int interval_s, IotHubTimerCallba
         Log_Debug("ERROR: IoTHub client not initialize!\n");
         return CodeInvalidState;
     }
-    int hndl = add_timer(interval_s, timer_cb, p_ctx, false);
+    return iothub_client_add_timer_ms((unsigned int)interval_s * 1000,
+        (unsigned int)interval_s * 1000, timer_cb, p_ctx, p_timer_handle);
+}
+
+IotHubClientReturnCode iothub_client_add_timer_ms(unsigned int delay_ms, unsigned int period_ms,
+    IotHubTimerCallback timer_cb, void *p_ctx, int *p_timer_handle) {
+    if (!m_initialized) {
+        Log_Debug("ERROR: IoTHub client not initialize!\n");
+        return CodeInvalidState;
+    }
+    int hndl = add_timer(delay_ms, period_ms, timer_cb, p_ctx);
     if (hndl == 0) {
         Log_Debug("ERROR: Unable to add timer!\n");
         return CodeResourceNotAvailable;
@@ -493,7 +1355,7 @@ IotHubClientReturnCode iothub_client_get_timer_interval(int timer_handle, int *p
         Log_Debug("ERROR: IoTHub client not initialize!\n");
         return CodeInvalidState;
     }
-    int interval = get_timer_interval(timer_handle, false);
+    int interval = get_timer_interval(timer_handle);
     if (interval == -1) {
         Log_Debug("ERROR: Unable to get timer interval for handle %d!\n", timer_handle);
         return CodeResourceNotAvailable;
@@ -507,7 +1369,17 @@ IotHubClientReturnCode iothub_client_set_timer_interval(int timer_handle, int in
         Log_Debug("ERROR: IoTHub client not initialize!\n");
         return CodeInvalidState;
     }
-    if (set_timer_interval(timer_handle, interval_s, false) == false) {
+    return iothub_client_set_timer_ms(timer_handle, (unsigned int)interval_s * 1000,
+        (unsigned int)interval_s * 1000);
+}
+
+IotHubClientReturnCode iothub_client_set_timer_ms(int timer_handle, unsigned int delay_ms,
+    unsigned int period_ms) {
+    if (!m_initialized) {
+        Log_Debug("ERROR: IoTHub client not initialize!\n");
+        return CodeInvalidState;
+    }
+    if (set_timer(timer_handle, delay_ms, period_ms) == false) {
         Log_Debug("ERROR: Unable to set timer interval for handle %d!\n", timer_handle);
         return CodeResourceNotAvailable;
     }
@@ -519,7 +1391,7 @@ IotHubClientReturnCode iothub_client_delete_timer(int timer_handle) {
         Log_Debug("ERROR: IoTHub client not initialize!\n");
         return CodeInvalidState;
     }
-    delete_timer(timer_handle, false);
+    delete_timer(timer_handle);
     return CodeSuccess;
 }
 
@@ -528,17 +1400,47 @@ IotHubClientReturnCode iothub_client_uninit(void) {
         Log_Debug("ERROR: IoTHub client not initialize!\n");
         return CodeInvalidState;
     }
+    if (m_client_handle && m_disconnect_pending) {
+        // Completes a disconnect still waiting for its DoWork, so the caller need not run the
+        // event loop again before closing it.
+        if (m_dowork_timer) {
+            delete_timer(m_dowork_timer);
+        }
+        dowork_timer_cb(NULL);
+    }
     if (m_client_handle) {
         Log_Debug("ERROR: IoTHub client handle is not NULL!\n");
         return CodeInvalidState;
     }
+    if (m_prov_running) {
+        // Waits for at most the provisioning timeout.
+        m_prov_cancelled = true;
+        pthread_join(m_prov_thread, NULL);
+        m_prov_running = false;
+        if (m_prov_job.handle) {
+            IoTHubDeviceClient_LL_Destroy(m_prov_job.handle);
+        }
+    }
     if (m_evt_loop) {
-        for (int i = 0; i < M_ARRAY_SIZE(m_timer_ctx); i++) {
-            if (m_timer_ctx[i].used) {
-                iothub_client_delete_timer(i + 1);
-            }
+        if (m_prov_event_fd != -1) {
+            EventLoop_UnregisterIo(m_evt_loop, m_prov_reg);
+            close(m_prov_event_fd);
+            m_prov_event_fd = -1;
+        }
+        // The wheel starts over on the next init, where these handles could alias new timers.
+        timer_wheel_deinit();
+        m_poll_timer = 0;
+        m_dowork_timer = 0;
+        m_retry_timer = 0;
+        m_next_attempt_ms = 0;
+        if (m_timer_fd != -1) {
+            EventLoop_UnregisterIo(m_evt_loop, m_timer_reg);
+            close(m_timer_fd);
+            m_timer_fd = -1;
+        }
+        if (m_evt_loop_owned) {
+            EventLoop_Close(m_evt_loop);
         }
-        EventLoop_Close(m_evt_loop);
         m_evt_loop = NULL;
     }
     m_initialized = false;
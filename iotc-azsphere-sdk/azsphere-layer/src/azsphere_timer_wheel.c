@@ -0,0 +1,294 @@
+//
+// Copyright: Avnet 2021
+//
+
+#include <stdlib.h>
+#include <string.h>
+#include "azsphere_timer_wheel.h"
+
+/******************************************************/
+/* Data type definition                               */
+/******************************************************/
+typedef struct {
+    bool used;
+    uint8_t generation;     // bumped on release so stale handles are rejected
+    int16_t slot;           // index in m_heads, -1 while not queued
+    int prev;
+    int next;               // also links the free list
+    uint64_t expiry_ms;
+    unsigned int period_ms;
+    TimerWheelCallback cb;
+    void* p_ctx;
+} TimerNode;
+
+/******************************************************/
+/* Static definition                                  */
+/******************************************************/
+#define WHEEL_BITS                          6
+#define WHEEL_SLOTS                         (1 << WHEEL_BITS)
+#define WHEEL_LEVELS                        4
+#define WHEEL_SPAN_MS                       ((uint64_t)1 << (WHEEL_BITS * WHEEL_LEVELS))
+#define INITIAL_TIMERS                      16
+// Handles carry the table index + 1 in the low bits and a generation above them.
+#define HANDLE_INDEX_BITS                   24
+#define HANDLE_INDEX_MASK                   ((1 << HANDLE_INDEX_BITS) - 1)
+#define HANDLE_GENERATION_MASK              0x7F
+
+/******************************************************/
+/* Member variables declaration                       */
+/******************************************************/
+static TimerNode* m_nodes = NULL;
+static int m_capacity = 0;
+static int m_free = -1;
+static int m_heads[WHEEL_LEVELS * WHEEL_SLOTS];
+static uint64_t m_occupied[WHEEL_LEVELS];
+static uint64_t m_now_ms = 0;           // next tick to process
+static size_t m_count = 0;
+
+/******************************************************/
+/* Helper functions definition                        */
+/******************************************************/
+static int lowest_bit(uint64_t bits) {
+    return __builtin_ctzll(bits);
+}
+
+static TimerNode* node_from_handle(int handle) {
+    int idx = (handle & HANDLE_INDEX_MASK) - 1;
+    if (handle <= 0 || idx < 0 || idx >= m_capacity || !m_nodes[idx].used ||
+        (m_nodes[idx].generation & HANDLE_GENERATION_MASK) !=
+        ((handle >> HANDLE_INDEX_BITS) & HANDLE_GENERATION_MASK)) {
+        return NULL;
+    }
+    return &m_nodes[idx];
+}
+
+static bool grow(void) {
+    int capacity = m_capacity ? m_capacity * 2 : INITIAL_TIMERS;
+    if (capacity > HANDLE_INDEX_MASK) {
+        return false;
+    }
+    TimerNode* p_nodes = realloc(m_nodes, (size_t)capacity * sizeof(TimerNode));
+    if (p_nodes == NULL) {
+        return false;
+    }
+    memset(&p_nodes[m_capacity], 0, (size_t)(capacity - m_capacity) * sizeof(TimerNode));
+    for (int i = capacity - 1; i >= m_capacity; i--) {
+        p_nodes[i].slot = -1;
+        p_nodes[i].next = m_free;
+        m_free = i;
+    }
+    m_nodes = p_nodes;
+    m_capacity = capacity;
+    return true;
+}
+
+static void enqueue(int idx) {
+    TimerNode* p_node = &m_nodes[idx];
+    uint64_t expiry = p_node->expiry_ms > m_now_ms ? p_node->expiry_ms : m_now_ms;
+    uint64_t delta = expiry - m_now_ms;
+    int level = 0;
+    while (level < WHEEL_LEVELS - 1 && delta >= ((uint64_t)1 << (WHEEL_BITS * (level + 1)))) {
+        level++;
+    }
+    if (delta >= WHEEL_SPAN_MS) {
+        // Parked in the farthest slot and placed again from there.
+        expiry = m_now_ms + WHEEL_SPAN_MS - 1;
+    }
+    int slot = level * WHEEL_SLOTS + (int)((expiry >> (WHEEL_BITS * level)) & (WHEEL_SLOTS - 1));
+    p_node->slot = (int16_t)slot;
+    p_node->prev = -1;
+    p_node->next = m_heads[slot];
+    if (m_heads[slot] != -1) {
+        m_nodes[m_heads[slot]].prev = idx;
+    }
+    m_heads[slot] = idx;
+    m_occupied[level] |= (uint64_t)1 << (slot % WHEEL_SLOTS);
+}
+
+static void unlink_node(int idx) {
+    TimerNode* p_node = &m_nodes[idx];
+    int slot = p_node->slot;
+    if (slot < 0) {
+        return;
+    }
+    if (p_node->prev != -1) {
+        m_nodes[p_node->prev].next = p_node->next;
+    } else {
+        m_heads[slot] = p_node->next;
+    }
+    if (p_node->next != -1) {
+        m_nodes[p_node->next].prev = p_node->prev;
+    }
+    if (m_heads[slot] == -1) {
+        m_occupied[slot / WHEEL_SLOTS] &= ~((uint64_t)1 << (slot % WHEEL_SLOTS));
+    }
+    p_node->slot = -1;
+}
+
+static void release(int idx) {
+    TimerNode* p_node = &m_nodes[idx];
+    unlink_node(idx);
+    p_node->used = false;
+    p_node->generation++;
+    p_node->next = m_free;
+    m_free = idx;
+    m_count--;
+}
+
+// Moves the timers of one slot to the levels below.
+static void cascade(int level, int slot) {
+    int head = level * WHEEL_SLOTS + slot;
+    while (m_heads[head] != -1) {
+        int idx = m_heads[head];
+        unlink_node(idx);
+        enqueue(idx);
+    }
+}
+
+static void expire(int slot) {
+    while (m_heads[slot] != -1) {
+        int idx = m_heads[slot];
+        TimerNode* p_node = &m_nodes[idx];
+        TimerWheelCallback cb = p_node->cb;
+        void* p_ctx = p_node->p_ctx;
+        unlink_node(idx);
+        if (p_node->period_ms) {
+            // Keep the phase, unless whole periods were missed.
+            p_node->expiry_ms += p_node->period_ms;
+            if (p_node->expiry_ms <= m_now_ms) {
+                p_node->expiry_ms = m_now_ms + p_node->period_ms;
+            }
+            enqueue(idx);
+        } else {
+            release(idx);
+        }
+        // May add timers and so move the table.
+        if (cb) {
+            cb(p_ctx);
+        }
+    }
+}
+
+/******************************************************/
+/* Timer wheel functions definition                   */
+/******************************************************/
+bool timer_wheel_init(uint64_t now_ms) {
+    timer_wheel_deinit();
+    for (int i = 0; i < WHEEL_LEVELS * WHEEL_SLOTS; i++) {
+        m_heads[i] = -1;
+    }
+    memset(m_occupied, 0, sizeof(m_occupied));
+    m_now_ms = now_ms;
+    return grow();
+}
+
+void timer_wheel_deinit(void) {
+    free(m_nodes);
+    m_nodes = NULL;
+    m_capacity = 0;
+    m_free = -1;
+    m_count = 0;
+    for (int i = 0; i < WHEEL_LEVELS * WHEEL_SLOTS; i++) {
+        m_heads[i] = -1;
+    }
+    memset(m_occupied, 0, sizeof(m_occupied));
+}
+
+int timer_wheel_add(uint64_t now_ms, unsigned int delay_ms, unsigned int period_ms,
+    TimerWheelCallback cb, void* p_context) {
+    if (m_free == -1 && !grow()) {
+        return 0;
+    }
+    int idx = m_free;
+    TimerNode* p_node = &m_nodes[idx];
+    m_free = p_node->next;
+    p_node->used = true;
+    p_node->expiry_ms = now_ms + delay_ms;
+    p_node->period_ms = period_ms;
+    p_node->cb = cb;
+    p_node->p_ctx = p_context;
+    enqueue(idx);
+    m_count++;
+    return ((p_node->generation & HANDLE_GENERATION_MASK) << HANDLE_INDEX_BITS) | (idx + 1);
+}
+
+bool timer_wheel_modify(int handle, uint64_t now_ms, unsigned int delay_ms,
+    unsigned int period_ms) {
+    TimerNode* p_node = node_from_handle(handle);
+    if (p_node == NULL) {
+        return false;
+    }
+    int idx = (int)(p_node - m_nodes);
+    unlink_node(idx);
+    p_node->expiry_ms = now_ms + delay_ms;
+    p_node->period_ms = period_ms;
+    enqueue(idx);
+    return true;
+}
+
+bool timer_wheel_cancel(int handle) {
+    TimerNode* p_node = node_from_handle(handle);
+    if (p_node == NULL) {
+        return false;
+    }
+    release((int)(p_node - m_nodes));
+    return true;
+}
+
+bool timer_wheel_get_period(int handle, unsigned int* p_period_ms) {
+    TimerNode* p_node = node_from_handle(handle);
+    if (p_node == NULL) {
+        return false;
+    }
+    *p_period_ms = p_node->period_ms;
+    return true;
+}
+
+// For each level, the first occupied slot at or after the current position is the next time
+// that level needs attention: an expiry on level 0, a cascade above it.
+bool timer_wheel_next_expiry(uint64_t* p_due_ms) {
+    bool found = false;
+    for (int level = 0; level < WHEEL_LEVELS; level++) {
+        if (m_occupied[level] == 0) {
+            continue;
+        }
+        int shift = WHEEL_BITS * level;
+        uint64_t start = m_now_ms >> shift;
+        if (m_now_ms & (((uint64_t)1 << shift) - 1)) {
+            // The current slot of this level was already cascaded.
+            start++;
+        }
+        int rot = (int)(start & (WHEEL_SLOTS - 1));
+        uint64_t bits = rot ? (m_occupied[level] >> rot) | (m_occupied[level] << (64 - rot)) :
+            m_occupied[level];
+        uint64_t due = (start + (uint64_t)lowest_bit(bits)) << shift;
+        if (!found || due < *p_due_ms) {
+            *p_due_ms = due;
+            found = true;
+        }
+    }
+    return found;
+}
+
+void timer_wheel_advance(uint64_t now_ms) {
+    uint64_t due;
+    while (timer_wheel_next_expiry(&due) && due <= now_ms) {
+        // Nothing is queued in between, so the wheel jumps straight to the next tick with work.
+        m_now_ms = due;
+        for (int level = WHEEL_LEVELS - 1; level > 0; level--) {
+            int shift = WHEEL_BITS * level;
+            if ((m_now_ms & (((uint64_t)1 << shift) - 1)) == 0) {
+                cascade(level, (int)((m_now_ms >> shift) & (WHEEL_SLOTS - 1)));
+            }
+        }
+        expire((int)(m_now_ms & (WHEEL_SLOTS - 1)));
+        m_now_ms++;
+    }
+    if (m_now_ms <= now_ms) {
+        m_now_ms = now_ms + 1;
+    }
+}
+
+size_t timer_wheel_count(void) {
+    return m_count;
+}
@@ -0,0 +1,23 @@
+//
+// Copyright: Avnet 2021
+// Host stand-in for the Azure Sphere applibs/log.h header.
+//
+
+#ifndef HOST_APPLIBS_LOG_H
+#define HOST_APPLIBS_LOG_H
+
+#include <stdarg.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Writes to stderr unless disabled with host_log_set_enabled(false).
+int Log_Debug(const char *fmt, ...);
+int Log_DebugVarArgs(const char *fmt, va_list args);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //HOST_APPLIBS_LOG_H
@@ -0,0 +1,33 @@
+//
+// Copyright: Avnet 2021
+// Host stand-in for the Azure Sphere applibs/networking.h header.
+// The reported state is driven by host_networking_set_ready() in iothub_loopback.h.
+//
+
+#ifndef HOST_APPLIBS_NETWORKING_H
+#define HOST_APPLIBS_NETWORKING_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef uint32_t Networking_InterfaceConnectionStatus;
+enum {
+    Networking_InterfaceConnectionStatus_InterfaceUp = 1 << 0,
+    Networking_InterfaceConnectionStatus_ConnectedToNetwork = 1 << 1,
+    Networking_InterfaceConnectionStatus_IpAvailable = 1 << 2,
+    Networking_InterfaceConnectionStatus_ConnectedToInternet = 1 << 3
+};
+
+int Networking_IsNetworkingReady(bool *outIsNetworkingReady);
+int Networking_GetInterfaceConnectionStatus(const char *networkInterfaceName,
+    Networking_InterfaceConnectionStatus *outStatus);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //HOST_APPLIBS_NETWORKING_H
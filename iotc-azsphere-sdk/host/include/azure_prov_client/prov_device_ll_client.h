@@ -0,0 +1,62 @@
+//
+// Copyright: Avnet 2021
+// Host stand-in for the subset of the Azure IoT C SDK prov_device_ll_client.h used by the SDK.
+// Registration is answered by the loopback hub, see iothub_loopback.h.
+//
+
+#ifndef HOST_PROV_DEVICE_LL_CLIENT_H
+#define HOST_PROV_DEVICE_LL_CLIENT_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum {
+    PROV_DEVICE_RESULT_OK,
+    PROV_DEVICE_RESULT_INVALID_ARG,
+    PROV_DEVICE_RESULT_SUCCESS,
+    PROV_DEVICE_RESULT_MEMORY,
+    PROV_DEVICE_RESULT_PARSING,
+    PROV_DEVICE_RESULT_TRANSPORT,
+    PROV_DEVICE_RESULT_INVALID_STATE,
+    PROV_DEVICE_RESULT_DEV_AUTH_ERROR,
+    PROV_DEVICE_RESULT_TIMEOUT,
+    PROV_DEVICE_RESULT_KEY_ERROR,
+    PROV_DEVICE_RESULT_ERROR,
+    PROV_DEVICE_RESULT_HUB_NOT_SPECIFIED,
+    PROV_DEVICE_RESULT_UNAUTHORIZED,
+    PROV_DEVICE_RESULT_DISABLED
+} PROV_DEVICE_RESULT;
+
+typedef enum {
+    PROV_DEVICE_REG_STATUS_CONNECTED,
+    PROV_DEVICE_REG_STATUS_REGISTERING,
+    PROV_DEVICE_REG_STATUS_ASSIGNING,
+    PROV_DEVICE_REG_STATUS_ASSIGNED,
+    PROV_DEVICE_REG_STATUS_ERROR,
+    PROV_DEVICE_REG_HUB_NOT_SPECIFIED
+} PROV_DEVICE_REG_STATUS;
+
+typedef struct PROV_INSTANCE_INFO_TAG *PROV_DEVICE_LL_HANDLE;
+typedef const void *(*PROV_DEVICE_TRANSPORT_PROVIDER_FUNCTION)(void);
+
+typedef void (*PROV_DEVICE_CLIENT_REGISTER_DEVICE_CALLBACK)(PROV_DEVICE_RESULT register_result,
+    const char *iothub_uri, const char *device_id, void *user_context);
+typedef void (*PROV_DEVICE_CLIENT_REGISTER_STATUS_CALLBACK)(PROV_DEVICE_REG_STATUS reg_status,
+    void *user_context);
+
+PROV_DEVICE_LL_HANDLE Prov_Device_LL_Create(const char *uri, const char *scope_id,
+    PROV_DEVICE_TRANSPORT_PROVIDER_FUNCTION protocol);
+void Prov_Device_LL_Destroy(PROV_DEVICE_LL_HANDLE handle);
+PROV_DEVICE_RESULT Prov_Device_LL_Register_Device(PROV_DEVICE_LL_HANDLE handle,
+    PROV_DEVICE_CLIENT_REGISTER_DEVICE_CALLBACK register_callback, void *user_context,
+    PROV_DEVICE_CLIENT_REGISTER_STATUS_CALLBACK reg_status_cb, void *status_user_ctext);
+void Prov_Device_LL_DoWork(PROV_DEVICE_LL_HANDLE handle);
+PROV_DEVICE_RESULT Prov_Device_LL_SetOption(PROV_DEVICE_LL_HANDLE handle, const char *optionName,
+    const void *value);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //HOST_PROV_DEVICE_LL_CLIENT_H
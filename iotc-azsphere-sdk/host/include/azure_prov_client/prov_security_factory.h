@@ -0,0 +1,27 @@
+//
+// Copyright: Avnet 2021
+// Host stand-in for the Azure IoT C SDK prov_security_factory.h header.
+//
+
+#ifndef HOST_PROV_SECURITY_FACTORY_H
+#define HOST_PROV_SECURITY_FACTORY_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum {
+    SECURE_DEVICE_TYPE_UNKNOWN,
+    SECURE_DEVICE_TYPE_TPM,
+    SECURE_DEVICE_TYPE_X509,
+    SECURE_DEVICE_TYPE_SYMMETRIC_KEY
+} SECURE_DEVICE_TYPE;
+
+int prov_dev_security_init(SECURE_DEVICE_TYPE hsm_type);
+void prov_dev_security_deinit(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //HOST_PROV_SECURITY_FACTORY_H
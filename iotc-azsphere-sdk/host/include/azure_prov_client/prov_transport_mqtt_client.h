@@ -0,0 +1,19 @@
+//
+// Copyright: Avnet 2021
+// Host stand-in for the Azure IoT C SDK prov_transport_mqtt_client.h header.
+//
+
+#ifndef HOST_PROV_TRANSPORT_MQTT_CLIENT_H
+#define HOST_PROV_TRANSPORT_MQTT_CLIENT_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+const void *Prov_Device_MQTT_Protocol(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //HOST_PROV_TRANSPORT_MQTT_CLIENT_H
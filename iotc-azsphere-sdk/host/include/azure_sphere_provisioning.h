@@ -0,0 +1,43 @@
+//
+// Copyright: Avnet 2021
+// Host stand-in for the Azure Sphere azure_sphere_provisioning.h header.
+//
+
+#ifndef HOST_AZURE_SPHERE_PROVISIONING_H
+#define HOST_AZURE_SPHERE_PROVISIONING_H
+
+#include "iothub_device_client_ll.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum {
+    AZURE_SPHERE_PROV_RESULT_OK,
+    AZURE_SPHERE_PROV_RESULT_INVALID_PARAM,
+    AZURE_SPHERE_PROV_RESULT_NETWORK_NOT_READY,
+    AZURE_SPHERE_PROV_RESULT_DEVICEAUTH_NOT_READY,
+    AZURE_SPHERE_PROV_RESULT_PROV_DEVICE_ERROR,
+    AZURE_SPHERE_PROV_RESULT_IOTHUB_CLIENT_ERROR,
+    AZURE_SPHERE_PROV_RESULT_GENERIC_ERROR
+} AZURE_SPHERE_PROV_RESULT;
+
+typedef struct {
+    AZURE_SPHERE_PROV_RESULT result;
+    int prov_device_error;
+    IOTHUB_CLIENT_RESULT iothub_client_error;
+} AZURE_SPHERE_PROV_RETURN_VALUE;
+
+AZURE_SPHERE_PROV_RETURN_VALUE IoTHubDeviceClient_LL_CreateWithAzureSphereDeviceAuthProvisioning(
+    const char *idScope, unsigned int timeout, IOTHUB_DEVICE_CLIENT_LL_HANDLE *handle);
+
+// Client for a known hub, authenticated with the device certificate. Needs the "SetDeviceId"
+// option.
+IOTHUB_DEVICE_CLIENT_LL_HANDLE IoTHubDeviceClient_LL_CreateWithAzureSphereFromDeviceAuth(
+    const char *iothub_uri, IOTHUB_CLIENT_TRANSPORT_PROVIDER protocol);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //HOST_AZURE_SPHERE_PROVISIONING_H
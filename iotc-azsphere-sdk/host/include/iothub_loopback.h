@@ -0,0 +1,85 @@
+//
+// Copyright: Avnet 2021
+// Control interface of the host stand-ins. The loopback hub takes the place of IoT Hub: every
+// message sent through IoTHubDeviceClient_LL_SendEventAsync() is recorded and acknowledged on the
+// next IoTHubDeviceClient_LL_DoWork(), and C2D messages can be injected from the test driver.
+//
+
+#ifndef IOTHUB_LOOPBACK_H
+#define IOTHUB_LOOPBACK_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <azure_sphere_provisioning.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define LOOPBACK_HUB_DEFAULT_RECORD_LIMIT   64
+#define LOOPBACK_HUB_NAME_SIZE              128
+#define LOOPBACK_HUB_DEFAULT_HOST           "loopback-hub.azure-devices.net"
+#define LOOPBACK_HUB_DEVICE_ID              "loopback-device"
+
+typedef struct {
+    unsigned char *p_payload;   // NUL terminated copy of the payload
+    size_t len;
+    char *p_content_type;
+    char *p_content_encoding;
+    unsigned long seq;          // 1 based sequence number of the message
+} LoopbackHubMessage;
+
+typedef struct {
+    unsigned long sent_count;
+    unsigned long long sent_bytes;
+    unsigned long c2d_count;
+    unsigned long long c2d_bytes;
+    unsigned long connect_count;
+    unsigned long provision_count;     // DPS registrations
+    unsigned long direct_count;        // clients created for a known hub, without DPS
+    unsigned long refused_count;       // sends failed by loopback_hub_set_send_failures()
+} LoopbackHubStats;
+
+// Called for every message the hub receives, after it is recorded and acknowledged.
+// It is safe to call loopback_hub_inject_c2d() from the hook, e.g. to answer hello requests.
+typedef void (*LoopbackHubSendHook)(const LoopbackHubMessage *p_msg, void *p_ctx);
+
+void loopback_hub_reset(void);
+void loopback_hub_set_send_hook(LoopbackHubSendHook hook, void *p_ctx);
+// Number of most recent messages kept for loopback_hub_get_sent(). 0 keeps only the counters.
+void loopback_hub_set_record_limit(size_t limit);
+// Queue a C2D message. It is delivered to the client on its next DoWork.
+bool loopback_hub_inject_c2d(const unsigned char *p_payload, size_t len);
+// idx 0 is the most recent message. Returns NULL if idx is not recorded.
+const LoopbackHubMessage *loopback_hub_get_sent(size_t idx);
+void loopback_hub_get_stats(LoopbackHubStats *p_stats);
+// Result returned by the next provisioning attempts.
+void loopback_hub_set_provisioning_result(AZURE_SPHERE_PROV_RESULT result);
+// Time each provisioning attempt takes, as with a slow DPS round trip. Called from the SDK's
+// provisioning thread.
+void loopback_hub_set_provisioning_delay(unsigned int delay_ms);
+// Hub that DPS assigns the device to. Clients created for any other hub are rejected with
+// IOTHUB_CLIENT_CONNECTION_BAD_CREDENTIAL, as after the device was moved to a new hub.
+void loopback_hub_set_assigned_hub(const char *p_host);
+// Report the connection as lost with the given reason on the next DoWork. For outage_ms the
+// client cannot re-authenticate and provisioning fails with NETWORK_NOT_READY, after that the
+// client re-authenticates on its next DoWork.
+void loopback_hub_drop_connection(IOTHUB_CLIENT_CONNECTION_STATUS_REASON reason,
+    unsigned int outage_ms);
+
+// Acknowledge messages only once they are delay_ms old, to emulate the network round trip.
+// Messages older than the client's "messageTimeout" option are reported as timed out.
+void loopback_hub_set_ack_delay(unsigned int delay_ms);
+
+// Refuse every n-th IoTHubDeviceClient_LL_SendEventAsync() with IOTHUB_CLIENT_ERROR, as a client
+// out of memory would. 0 accepts every message.
+void loopback_hub_set_send_failures(unsigned long every_n);
+
+void host_networking_set_ready(bool ready);
+void host_log_set_enabled(bool enabled);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //IOTHUB_LOOPBACK_H
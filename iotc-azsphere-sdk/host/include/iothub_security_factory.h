@@ -0,0 +1,27 @@
+//
+// Copyright: Avnet 2021
+// Host stand-in for the Azure IoT C SDK iothub_security_factory.h header.
+//
+
+#ifndef HOST_IOTHUB_SECURITY_FACTORY_H
+#define HOST_IOTHUB_SECURITY_FACTORY_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum {
+    IOTHUB_SECURITY_TYPE_UNKNOWN,
+    IOTHUB_SECURITY_TYPE_SAS,
+    IOTHUB_SECURITY_TYPE_X509,
+    IOTHUB_SECURITY_TYPE_HTTP_EDGE
+} IOTHUB_SECURITY_TYPE;
+
+int iothub_security_init(IOTHUB_SECURITY_TYPE sec_type);
+void iothub_security_deinit(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //HOST_IOTHUB_SECURITY_FACTORY_H
@@ -0,0 +1,21 @@
+//
+// Copyright: Avnet 2021
+// Host stand-in for the Azure IoT C SDK iothubtransportmqtt.h header.
+//
+
+#ifndef HOST_IOTHUBTRANSPORTMQTT_H
+#define HOST_IOTHUBTRANSPORTMQTT_H
+
+#include "iothub_device_client_ll.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+const void *MQTT_Protocol(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //HOST_IOTHUBTRANSPORTMQTT_H
@@ -0,0 +1,142 @@
+//
+// Copyright: Avnet 2021
+// epoll based host implementation of the applibs EventLoop API.
+//
+
+#include <errno.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <applibs/eventloop.h>
+
+struct EventLoop {
+    int epoll_fd;
+    bool stop;
+};
+
+struct EventRegistration {
+    int fd;
+    EventLoopIoCallback *cb;
+    void *p_ctx;
+};
+
+static long long now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+EventLoop *EventLoop_Create(void) {
+    EventLoop *el = calloc(1, sizeof(EventLoop));
+    if (el == NULL) {
+        return NULL;
+    }
+    el->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (el->epoll_fd == -1) {
+        free(el);
+        return NULL;
+    }
+    return el;
+}
+
+void EventLoop_Close(EventLoop *el) {
+    if (el == NULL) {
+        return;
+    }
+    close(el->epoll_fd);
+    free(el);
+}
+
+EventLoop_Run_Result EventLoop_Run(EventLoop *el, int duration_in_milliseconds,
+    bool process_one_event) {
+    if (el == NULL) {
+        errno = EINVAL;
+        return EventLoop_Run_Failed;
+    }
+    long long deadline = now_ms() + duration_in_milliseconds;
+    bool processed = false;
+    el->stop = false;
+    for (;;) {
+        int wait_ms = -1;
+        if (duration_in_milliseconds >= 0) {
+            long long remaining = deadline - now_ms();
+            wait_ms = remaining > 0 ? (int)remaining : 0;
+        }
+        // One event per wait, so a callback may safely unregister any other registration.
+        struct epoll_event ev;
+        int n = epoll_wait(el->epoll_fd, &ev, 1, wait_ms);
+        if (n == -1) {
+            return EventLoop_Run_Failed;
+        }
+        if (n == 0) {
+            break;
+        }
+        EventRegistration *reg = ev.data.ptr;
+        reg->cb(el, reg->fd, ev.events & (EventLoop_Input | EventLoop_Output | EventLoop_Error),
+            reg->p_ctx);
+        processed = true;
+        if (process_one_event || el->stop) {
+            break;
+        }
+    }
+    return processed ? EventLoop_Run_Finished : EventLoop_Run_FinishedEmpty;
+}
+
+int EventLoop_Stop(EventLoop *el) {
+    if (el == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+    el->stop = true;
+    return 0;
+}
+
+int EventLoop_GetWaitDescriptor(EventLoop *el) {
+    if (el == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+    return el->epoll_fd;
+}
+
+EventRegistration *EventLoop_RegisterIo(EventLoop *el, int fd, EventLoop_IoEvents event_bitmask,
+    EventLoopIoCallback *callback, void *context) {
+    if (el == NULL || callback == NULL) {
+        errno = EINVAL;
+        return NULL;
+    }
+    EventRegistration *reg = malloc(sizeof(EventRegistration));
+    if (reg == NULL) {
+        return NULL;
+    }
+    reg->fd = fd;
+    reg->cb = callback;
+    reg->p_ctx = context;
+    struct epoll_event ev = { .events = event_bitmask, .data.ptr = reg };
+    if (epoll_ctl(el->epoll_fd, EPOLL_CTL_ADD, fd, &ev) == -1) {
+        free(reg);
+        return NULL;
+    }
+    return reg;
+}
+
+int EventLoop_ModifyIoEvents(EventLoop *el, EventRegistration *reg,
+    EventLoop_IoEvents event_bitmask) {
+    if (el == NULL || reg == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+    struct epoll_event ev = { .events = event_bitmask, .data.ptr = reg };
+    return epoll_ctl(el->epoll_fd, EPOLL_CTL_MOD, reg->fd, &ev);
+}
+
+int EventLoop_UnregisterIo(EventLoop *el, EventRegistration *reg) {
+    if (el == NULL || reg == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+    int ret = epoll_ctl(el->epoll_fd, EPOLL_CTL_DEL, reg->fd, NULL);
+    free(reg);
+    return ret;
+}
@@ -0,0 +1,686 @@
+//
+// Copyright: Avnet 2021
+// In-process loopback implementation of the Azure IoT LL device client, IoTHubMessage, DPS
+// provisioning client and Azure Sphere provisioning APIs for host builds.
+//
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <iothub_security_factory.h>
+#include <iothubtransportmqtt.h>
+#include <azure_prov_client/prov_device_ll_client.h>
+#include <azure_prov_client/prov_security_factory.h>
+#include <azure_prov_client/prov_transport_mqtt_client.h>
+#include "iothub_loopback.h"
+
+/******************************************************/
+/* Data type definition                               */
+/******************************************************/
+struct IOTHUB_MESSAGE_HANDLE_DATA_TAG {
+    IOTHUBMESSAGE_CONTENT_TYPE type;
+    unsigned char *p_data;      // always allocated with a NUL terminator
+    size_t len;
+    char *p_content_type;
+    char *p_content_encoding;
+};
+
+typedef struct LoopbackEvent {
+    IOTHUB_MESSAGE_HANDLE msg;
+    IOTHUB_CLIENT_EVENT_CONFIRMATION_CALLBACK cb;
+    void *p_ctx;
+    long long queued_ms;
+    struct LoopbackEvent *p_next;
+} LoopbackEvent;
+
+typedef struct {
+    LoopbackEvent *p_head;
+    LoopbackEvent *p_tail;
+} LoopbackEventList;
+
+struct IOTHUB_CLIENT_CORE_LL_HANDLE_DATA_TAG {
+    IOTHUB_CLIENT_MESSAGE_CALLBACK_ASYNC msg_cb;
+    void *p_msg_ctx;
+    IOTHUB_CLIENT_DEVICE_TWIN_CALLBACK twin_cb;
+    void *p_twin_ctx;
+    IOTHUB_CLIENT_CONNECTION_STATUS_CALLBACK status_cb;
+    void *p_status_ctx;
+    bool authenticated;
+    bool rejected;
+    char hub[LOOPBACK_HUB_NAME_SIZE];          // set for clients created for a known hub
+    unsigned long long message_timeout_ms;     // 0 waits forever, like the real client
+    LoopbackEventList outbound;
+};
+
+struct PROV_INSTANCE_INFO_TAG {
+    PROV_DEVICE_CLIENT_REGISTER_DEVICE_CALLBACK register_cb;
+    void *p_register_ctx;
+    bool registering;
+    long long due_ms;
+};
+
+/******************************************************/
+/* Member variables declaration                       */
+/******************************************************/
+static LoopbackHubMessage *m_records = NULL;
+static size_t m_record_limit = LOOPBACK_HUB_DEFAULT_RECORD_LIMIT;
+static size_t m_record_count = 0;
+static size_t m_record_next = 0;
+static LoopbackHubStats m_stats = { 0 };
+static LoopbackHubSendHook m_send_hook = NULL;
+static void *m_send_hook_ctx = NULL;
+static LoopbackEventList m_c2d = { 0 };
+static AZURE_SPHERE_PROV_RESULT m_prov_result = AZURE_SPHERE_PROV_RESULT_OK;
+static unsigned int m_prov_delay_ms = 0;
+static char m_assigned_hub[LOOPBACK_HUB_NAME_SIZE] = LOOPBACK_HUB_DEFAULT_HOST;
+static bool m_drop_pending = false;
+static IOTHUB_CLIENT_CONNECTION_STATUS_REASON m_drop_reason = IOTHUB_CLIENT_CONNECTION_OK;
+static long long m_outage_end_ms = 0;
+static unsigned int m_ack_delay_ms = 0;
+static unsigned long m_fail_every = 0;
+static unsigned long m_send_attempts = 0;
+
+/******************************************************/
+/* Helper functions definition                        */
+/******************************************************/
+static long long now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static bool in_outage(void) {
+    return now_ms() < m_outage_end_ms;
+}
+
+static char *clone_str(const char *p_str) {
+    if (p_str == NULL) {
+        return NULL;
+    }
+    size_t len = strlen(p_str);
+    char *p_copy = malloc(len + 1);
+    if (p_copy) {
+        memcpy(p_copy, p_str, len + 1);
+    }
+    return p_copy;
+}
+
+static void list_append(LoopbackEventList *p_list, LoopbackEvent *p_evt) {
+    p_evt->p_next = NULL;
+    if (p_list->p_tail) {
+        p_list->p_tail->p_next = p_evt;
+    } else {
+        p_list->p_head = p_evt;
+    }
+    p_list->p_tail = p_evt;
+}
+
+static LoopbackEvent *list_detach(LoopbackEventList *p_list) {
+    LoopbackEvent *p_head = p_list->p_head;
+    p_list->p_head = NULL;
+    p_list->p_tail = NULL;
+    return p_head;
+}
+
+static void free_record(LoopbackHubMessage *p_rec) {
+    free(p_rec->p_payload);
+    free(p_rec->p_content_type);
+    free(p_rec->p_content_encoding);
+    memset(p_rec, 0, sizeof(LoopbackHubMessage));
+}
+
+static void free_records(void) {
+    if (m_records) {
+        for (size_t i = 0; i < m_record_limit; i++) {
+            free_record(&m_records[i]);
+        }
+        free(m_records);
+        m_records = NULL;
+    }
+    m_record_count = 0;
+    m_record_next = 0;
+}
+
+static void record_message(IOTHUB_MESSAGE_HANDLE msg, LoopbackHubMessage *p_rec) {
+    m_stats.sent_count++;
+    m_stats.sent_bytes += msg->len;
+    p_rec->p_payload = msg->p_data;
+    p_rec->len = msg->len;
+    p_rec->p_content_type = msg->p_content_type;
+    p_rec->p_content_encoding = msg->p_content_encoding;
+    p_rec->seq = m_stats.sent_count;
+    if (m_record_limit == 0) {
+        return;
+    }
+    if (m_records == NULL) {
+        m_records = calloc(m_record_limit, sizeof(LoopbackHubMessage));
+        if (m_records == NULL) {
+            return;
+        }
+    }
+    LoopbackHubMessage *p_slot = &m_records[m_record_next];
+    free_record(p_slot);
+    p_slot->p_payload = malloc(msg->len + 1);
+    if (p_slot->p_payload) {
+        memcpy(p_slot->p_payload, msg->p_data, msg->len + 1);
+    }
+    p_slot->len = msg->len;
+    p_slot->p_content_type = clone_str(msg->p_content_type);
+    p_slot->p_content_encoding = clone_str(msg->p_content_encoding);
+    p_slot->seq = p_rec->seq;
+    m_record_next = (m_record_next + 1) % m_record_limit;
+    if (m_record_count < m_record_limit) {
+        m_record_count++;
+    }
+}
+
+static void report_status(IOTHUB_DEVICE_CLIENT_LL_HANDLE handle,
+    IOTHUB_CLIENT_CONNECTION_STATUS status, IOTHUB_CLIENT_CONNECTION_STATUS_REASON reason) {
+    if (handle->status_cb) {
+        handle->status_cb(status, reason, handle->p_status_ctx);
+    }
+}
+
+/******************************************************/
+/* Loopback hub control functions definition          */
+/******************************************************/
+void loopback_hub_reset(void) {
+    LoopbackEvent *p_evt = list_detach(&m_c2d);
+    while (p_evt) {
+        LoopbackEvent *p_next = p_evt->p_next;
+        IoTHubMessage_Destroy(p_evt->msg);
+        free(p_evt);
+        p_evt = p_next;
+    }
+    free_records();
+    memset(&m_stats, 0, sizeof(m_stats));
+    m_send_hook = NULL;
+    m_send_hook_ctx = NULL;
+    m_prov_result = AZURE_SPHERE_PROV_RESULT_OK;
+    m_prov_delay_ms = 0;
+    strcpy(m_assigned_hub, LOOPBACK_HUB_DEFAULT_HOST);
+    m_drop_pending = false;
+    m_outage_end_ms = 0;
+    m_ack_delay_ms = 0;
+    m_fail_every = 0;
+    m_send_attempts = 0;
+}
+
+void loopback_hub_set_ack_delay(unsigned int delay_ms) {
+    m_ack_delay_ms = delay_ms;
+}
+
+void loopback_hub_set_send_failures(unsigned long every_n) {
+    m_fail_every = every_n;
+    m_send_attempts = 0;
+}
+
+void loopback_hub_set_send_hook(LoopbackHubSendHook hook, void *p_ctx) {
+    m_send_hook = hook;
+    m_send_hook_ctx = p_ctx;
+}
+
+void loopback_hub_set_record_limit(size_t limit) {
+    free_records();
+    m_record_limit = limit;
+}
+
+bool loopback_hub_inject_c2d(const unsigned char *p_payload, size_t len) {
+    LoopbackEvent *p_evt = calloc(1, sizeof(LoopbackEvent));
+    if (p_evt == NULL) {
+        return false;
+    }
+    p_evt->msg = IoTHubMessage_CreateFromByteArray(p_payload, len);
+    if (p_evt->msg == NULL) {
+        free(p_evt);
+        return false;
+    }
+    list_append(&m_c2d, p_evt);
+    return true;
+}
+
+const LoopbackHubMessage *loopback_hub_get_sent(size_t idx) {
+    if (idx >= m_record_count) {
+        return NULL;
+    }
+    return &m_records[(m_record_next + m_record_limit - 1 - idx) % m_record_limit];
+}
+
+void loopback_hub_get_stats(LoopbackHubStats *p_stats) {
+    *p_stats = m_stats;
+}
+
+void loopback_hub_set_provisioning_result(AZURE_SPHERE_PROV_RESULT result) {
+    m_prov_result = result;
+}
+
+void loopback_hub_set_provisioning_delay(unsigned int delay_ms) {
+    m_prov_delay_ms = delay_ms;
+}
+
+void loopback_hub_set_assigned_hub(const char *p_host) {
+    strncpy(m_assigned_hub, p_host, sizeof(m_assigned_hub) - 1);
+    m_assigned_hub[sizeof(m_assigned_hub) - 1] = 0;
+}
+
+void loopback_hub_drop_connection(IOTHUB_CLIENT_CONNECTION_STATUS_REASON reason,
+    unsigned int outage_ms) {
+    m_drop_pending = true;
+    m_drop_reason = reason;
+    m_outage_end_ms = now_ms() + outage_ms;
+}
+
+/******************************************************/
+/* IoTHubMessage functions definition                 */
+/******************************************************/
+IOTHUB_MESSAGE_HANDLE IoTHubMessage_CreateFromByteArray(const unsigned char *byteArray,
+    size_t size) {
+    if (byteArray == NULL && size != 0) {
+        return NULL;
+    }
+    IOTHUB_MESSAGE_HANDLE msg = calloc(1, sizeof(struct IOTHUB_MESSAGE_HANDLE_DATA_TAG));
+    if (msg == NULL) {
+        return NULL;
+    }
+    msg->p_data = malloc(size + 1);
+    if (msg->p_data == NULL) {
+        free(msg);
+        return NULL;
+    }
+    if (size) {
+        memcpy(msg->p_data, byteArray, size);
+    }
+    msg->p_data[size] = 0;
+    msg->len = size;
+    msg->type = IOTHUBMESSAGE_BYTEARRAY;
+    return msg;
+}
+
+IOTHUB_MESSAGE_HANDLE IoTHubMessage_CreateFromString(const char *source) {
+    if (source == NULL) {
+        return NULL;
+    }
+    IOTHUB_MESSAGE_HANDLE msg =
+        IoTHubMessage_CreateFromByteArray((const unsigned char *)source, strlen(source));
+    if (msg) {
+        msg->type = IOTHUBMESSAGE_STRING;
+    }
+    return msg;
+}
+
+IOTHUB_MESSAGE_HANDLE IoTHubMessage_Clone(IOTHUB_MESSAGE_HANDLE iotHubMessageHandle) {
+    if (iotHubMessageHandle == NULL) {
+        return NULL;
+    }
+    IOTHUB_MESSAGE_HANDLE msg = IoTHubMessage_CreateFromByteArray(iotHubMessageHandle->p_data,
+        iotHubMessageHandle->len);
+    if (msg == NULL) {
+        return NULL;
+    }
+    msg->type = iotHubMessageHandle->type;
+    msg->p_content_type = clone_str(iotHubMessageHandle->p_content_type);
+    msg->p_content_encoding = clone_str(iotHubMessageHandle->p_content_encoding);
+    return msg;
+}
+
+IOTHUB_MESSAGE_RESULT IoTHubMessage_GetByteArray(IOTHUB_MESSAGE_HANDLE iotHubMessageHandle,
+    const unsigned char **buffer, size_t *size) {
+    if (iotHubMessageHandle == NULL || buffer == NULL || size == NULL) {
+        return IOTHUB_MESSAGE_INVALID_ARG;
+    }
+    if (iotHubMessageHandle->type != IOTHUBMESSAGE_BYTEARRAY) {
+        return IOTHUB_MESSAGE_INVALID_TYPE;
+    }
+    *buffer = iotHubMessageHandle->p_data;
+    *size = iotHubMessageHandle->len;
+    return IOTHUB_MESSAGE_OK;
+}
+
+const char *IoTHubMessage_GetString(IOTHUB_MESSAGE_HANDLE iotHubMessageHandle) {
+    if (iotHubMessageHandle == NULL || iotHubMessageHandle->type != IOTHUBMESSAGE_STRING) {
+        return NULL;
+    }
+    return (const char *)iotHubMessageHandle->p_data;
+}
+
+IOTHUBMESSAGE_CONTENT_TYPE IoTHubMessage_GetContentType(IOTHUB_MESSAGE_HANDLE iotHubMessageHandle) {
+    if (iotHubMessageHandle == NULL) {
+        return IOTHUBMESSAGE_UNKNOWN;
+    }
+    return iotHubMessageHandle->type;
+}
+
+IOTHUB_MESSAGE_RESULT IoTHubMessage_SetContentTypeSystemProperty(
+    IOTHUB_MESSAGE_HANDLE iotHubMessageHandle, const char *contentType) {
+    if (iotHubMessageHandle == NULL || contentType == NULL) {
+        return IOTHUB_MESSAGE_INVALID_ARG;
+    }
+    free(iotHubMessageHandle->p_content_type);
+    iotHubMessageHandle->p_content_type = clone_str(contentType);
+    return iotHubMessageHandle->p_content_type ? IOTHUB_MESSAGE_OK : IOTHUB_MESSAGE_ERROR;
+}
+
+const char *IoTHubMessage_GetContentTypeSystemProperty(IOTHUB_MESSAGE_HANDLE iotHubMessageHandle) {
+    return iotHubMessageHandle ? iotHubMessageHandle->p_content_type : NULL;
+}
+
+IOTHUB_MESSAGE_RESULT IoTHubMessage_SetContentEncodingSystemProperty(
+    IOTHUB_MESSAGE_HANDLE iotHubMessageHandle, const char *contentEncoding) {
+    if (iotHubMessageHandle == NULL || contentEncoding == NULL) {
+        return IOTHUB_MESSAGE_INVALID_ARG;
+    }
+    free(iotHubMessageHandle->p_content_encoding);
+    iotHubMessageHandle->p_content_encoding = clone_str(contentEncoding);
+    return iotHubMessageHandle->p_content_encoding ? IOTHUB_MESSAGE_OK : IOTHUB_MESSAGE_ERROR;
+}
+
+const char *IoTHubMessage_GetContentEncodingSystemProperty(
+    IOTHUB_MESSAGE_HANDLE iotHubMessageHandle) {
+    return iotHubMessageHandle ? iotHubMessageHandle->p_content_encoding : NULL;
+}
+
+void IoTHubMessage_Destroy(IOTHUB_MESSAGE_HANDLE iotHubMessageHandle) {
+    if (iotHubMessageHandle == NULL) {
+        return;
+    }
+    free(iotHubMessageHandle->p_data);
+    free(iotHubMessageHandle->p_content_type);
+    free(iotHubMessageHandle->p_content_encoding);
+    free(iotHubMessageHandle);
+}
+
+/******************************************************/
+/* Azure Sphere provisioning functions definition     */
+/******************************************************/
+AZURE_SPHERE_PROV_RETURN_VALUE IoTHubDeviceClient_LL_CreateWithAzureSphereDeviceAuthProvisioning(
+    const char *idScope, unsigned int timeout, IOTHUB_DEVICE_CLIENT_LL_HANDLE *handle) {
+    AZURE_SPHERE_PROV_RETURN_VALUE res = { .result = m_prov_result };
+    if (idScope == NULL || handle == NULL) {
+        res.result = AZURE_SPHERE_PROV_RESULT_INVALID_PARAM;
+        return res;
+    }
+    m_stats.provision_count++;
+    *handle = NULL;
+    if (m_prov_delay_ms) {
+        struct timespec delay = { .tv_sec = m_prov_delay_ms / 1000,
+            .tv_nsec = (long)(m_prov_delay_ms % 1000) * 1000000 };
+        nanosleep(&delay, NULL);
+    }
+    if (res.result == AZURE_SPHERE_PROV_RESULT_OK && in_outage()) {
+        res.result = AZURE_SPHERE_PROV_RESULT_NETWORK_NOT_READY;
+    }
+    if (res.result != AZURE_SPHERE_PROV_RESULT_OK) {
+        return res;
+    }
+    *handle = calloc(1, sizeof(struct IOTHUB_CLIENT_CORE_LL_HANDLE_DATA_TAG));
+    if (*handle == NULL) {
+        res.result = AZURE_SPHERE_PROV_RESULT_GENERIC_ERROR;
+    }
+    return res;
+}
+
+IOTHUB_DEVICE_CLIENT_LL_HANDLE IoTHubDeviceClient_LL_CreateWithAzureSphereFromDeviceAuth(
+    const char *iothub_uri, IOTHUB_CLIENT_TRANSPORT_PROVIDER protocol) {
+    if (iothub_uri == NULL || strlen(iothub_uri) >= LOOPBACK_HUB_NAME_SIZE) {
+        return NULL;
+    }
+    IOTHUB_DEVICE_CLIENT_LL_HANDLE handle =
+        calloc(1, sizeof(struct IOTHUB_CLIENT_CORE_LL_HANDLE_DATA_TAG));
+    if (handle) {
+        strcpy(handle->hub, iothub_uri);
+        m_stats.direct_count++;
+    }
+    return handle;
+}
+
+const void *MQTT_Protocol(void) {
+    return NULL;
+}
+
+int iothub_security_init(IOTHUB_SECURITY_TYPE sec_type) {
+    return 0;
+}
+
+void iothub_security_deinit(void) {
+}
+
+/******************************************************/
+/* DPS provisioning client functions definition       */
+/******************************************************/
+int prov_dev_security_init(SECURE_DEVICE_TYPE hsm_type) {
+    return 0;
+}
+
+void prov_dev_security_deinit(void) {
+}
+
+const void *Prov_Device_MQTT_Protocol(void) {
+    return NULL;
+}
+
+PROV_DEVICE_LL_HANDLE Prov_Device_LL_Create(const char *uri, const char *scope_id,
+    PROV_DEVICE_TRANSPORT_PROVIDER_FUNCTION protocol) {
+    if (uri == NULL || scope_id == NULL) {
+        return NULL;
+    }
+    return calloc(1, sizeof(struct PROV_INSTANCE_INFO_TAG));
+}
+
+void Prov_Device_LL_Destroy(PROV_DEVICE_LL_HANDLE handle) {
+    free(handle);
+}
+
+PROV_DEVICE_RESULT Prov_Device_LL_Register_Device(PROV_DEVICE_LL_HANDLE handle,
+    PROV_DEVICE_CLIENT_REGISTER_DEVICE_CALLBACK register_callback, void *user_context,
+    PROV_DEVICE_CLIENT_REGISTER_STATUS_CALLBACK reg_status_cb, void *status_user_ctext) {
+    if (handle == NULL || register_callback == NULL) {
+        return PROV_DEVICE_RESULT_INVALID_ARG;
+    }
+    handle->register_cb = register_callback;
+    handle->p_register_ctx = user_context;
+    handle->registering = true;
+    handle->due_ms = now_ms() + m_prov_delay_ms;
+    return PROV_DEVICE_RESULT_OK;
+}
+
+// Answers the registration once the provisioning delay has passed, with the hub set by
+// loopback_hub_set_assigned_hub().
+void Prov_Device_LL_DoWork(PROV_DEVICE_LL_HANDLE handle) {
+    if (handle == NULL || !handle->registering || now_ms() < handle->due_ms) {
+        return;
+    }
+    handle->registering = false;
+    m_stats.provision_count++;
+    if (in_outage()) {
+        handle->register_cb(PROV_DEVICE_RESULT_TRANSPORT, NULL, NULL, handle->p_register_ctx);
+    } else if (m_prov_result != AZURE_SPHERE_PROV_RESULT_OK) {
+        handle->register_cb(PROV_DEVICE_RESULT_ERROR, NULL, NULL, handle->p_register_ctx);
+    } else {
+        handle->register_cb(PROV_DEVICE_RESULT_OK, m_assigned_hub, LOOPBACK_HUB_DEVICE_ID,
+            handle->p_register_ctx);
+    }
+}
+
+PROV_DEVICE_RESULT Prov_Device_LL_SetOption(PROV_DEVICE_LL_HANDLE handle, const char *optionName,
+    const void *value) {
+    return handle ? PROV_DEVICE_RESULT_OK : PROV_DEVICE_RESULT_INVALID_ARG;
+}
+
+/******************************************************/
+/* IoTHub LL device client functions definition       */
+/******************************************************/
+IOTHUB_CLIENT_RESULT IoTHubDeviceClient_LL_SendEventAsync(
+    IOTHUB_DEVICE_CLIENT_LL_HANDLE iotHubClientHandle, IOTHUB_MESSAGE_HANDLE eventMessageHandle,
+    IOTHUB_CLIENT_EVENT_CONFIRMATION_CALLBACK eventConfirmationCallback,
+    void *userContextCallback) {
+    if (iotHubClientHandle == NULL || eventMessageHandle == NULL) {
+        return IOTHUB_CLIENT_INVALID_ARG;
+    }
+    if (m_fail_every && (++m_send_attempts % m_fail_every) == 0) {
+        m_stats.refused_count++;
+        return IOTHUB_CLIENT_ERROR;
+    }
+    LoopbackEvent *p_evt = calloc(1, sizeof(LoopbackEvent));
+    if (p_evt == NULL) {
+        return IOTHUB_CLIENT_ERROR;
+    }
+    // Like the real client, keep a private copy so the caller can destroy its handle.
+    p_evt->msg = IoTHubMessage_Clone(eventMessageHandle);
+    if (p_evt->msg == NULL) {
+        free(p_evt);
+        return IOTHUB_CLIENT_ERROR;
+    }
+    p_evt->cb = eventConfirmationCallback;
+    p_evt->p_ctx = userContextCallback;
+    p_evt->queued_ms = now_ms();
+    list_append(&iotHubClientHandle->outbound, p_evt);
+    return IOTHUB_CLIENT_OK;
+}
+
+IOTHUB_CLIENT_RESULT IoTHubDeviceClient_LL_SetMessageCallback(
+    IOTHUB_DEVICE_CLIENT_LL_HANDLE iotHubClientHandle,
+    IOTHUB_CLIENT_MESSAGE_CALLBACK_ASYNC messageCallback, void *userContextCallback) {
+    if (iotHubClientHandle == NULL) {
+        return IOTHUB_CLIENT_INVALID_ARG;
+    }
+    iotHubClientHandle->msg_cb = messageCallback;
+    iotHubClientHandle->p_msg_ctx = userContextCallback;
+    return IOTHUB_CLIENT_OK;
+}
+
+IOTHUB_CLIENT_RESULT IoTHubDeviceClient_LL_SetConnectionStatusCallback(
+    IOTHUB_DEVICE_CLIENT_LL_HANDLE iotHubClientHandle,
+    IOTHUB_CLIENT_CONNECTION_STATUS_CALLBACK connectionStatusCallback,
+    void *userContextCallback) {
+    if (iotHubClientHandle == NULL) {
+        return IOTHUB_CLIENT_INVALID_ARG;
+    }
+    iotHubClientHandle->status_cb = connectionStatusCallback;
+    iotHubClientHandle->p_status_ctx = userContextCallback;
+    return IOTHUB_CLIENT_OK;
+}
+
+IOTHUB_CLIENT_RESULT IoTHubDeviceClient_LL_SetDeviceTwinCallback(
+    IOTHUB_DEVICE_CLIENT_LL_HANDLE iotHubClientHandle,
+    IOTHUB_CLIENT_DEVICE_TWIN_CALLBACK deviceTwinCallback, void *userContextCallback) {
+    if (iotHubClientHandle == NULL) {
+        return IOTHUB_CLIENT_INVALID_ARG;
+    }
+    iotHubClientHandle->twin_cb = deviceTwinCallback;
+    iotHubClientHandle->p_twin_ctx = userContextCallback;
+    return IOTHUB_CLIENT_OK;
+}
+
+IOTHUB_CLIENT_RESULT IoTHubDeviceClient_LL_SetOption(IOTHUB_DEVICE_CLIENT_LL_HANDLE iotHubClientHandle,
+    const char *optionName, const void *value) {
+    if (iotHubClientHandle == NULL || optionName == NULL) {
+        return IOTHUB_CLIENT_INVALID_ARG;
+    }
+    if (strcmp(optionName, "messageTimeout") == 0 && value != NULL) {
+        iotHubClientHandle->message_timeout_ms = *(const uint_fast64_t *)value;
+    }
+    return IOTHUB_CLIENT_OK;
+}
+
+void IoTHubDeviceClient_LL_DoWork(IOTHUB_DEVICE_CLIENT_LL_HANDLE iotHubClientHandle) {
+    if (iotHubClientHandle == NULL) {
+        return;
+    }
+    if (m_drop_pending) {
+        m_drop_pending = false;
+        if (iotHubClientHandle->authenticated) {
+            iotHubClientHandle->authenticated = false;
+            report_status(iotHubClientHandle, IOTHUB_CLIENT_CONNECTION_UNAUTHENTICATED,
+                m_drop_reason);
+        }
+        return;
+    }
+    if (!iotHubClientHandle->authenticated) {
+        if (in_outage() || iotHubClientHandle->rejected) {
+            return;
+        }
+        if (iotHubClientHandle->hub[0] && strcmp(iotHubClientHandle->hub, m_assigned_hub) != 0) {
+            // The device is no longer registered with this hub
+            iotHubClientHandle->rejected = true;
+            report_status(iotHubClientHandle, IOTHUB_CLIENT_CONNECTION_UNAUTHENTICATED,
+                IOTHUB_CLIENT_CONNECTION_BAD_CREDENTIAL);
+            return;
+        }
+        iotHubClientHandle->authenticated = true;
+        m_stats.connect_count++;
+        report_status(iotHubClientHandle, IOTHUB_CLIENT_CONNECTION_AUTHENTICATED,
+            IOTHUB_CLIENT_CONNECTION_OK);
+    }
+    // Messages sent from within the callbacks below go out on the next DoWork. Messages are
+    // acknowledged in order once they are m_ack_delay_ms old.
+    LoopbackEvent *p_evt = list_detach(&iotHubClientHandle->outbound);
+    long long now = now_ms();
+    while (p_evt) {
+        LoopbackEvent *p_next = p_evt->p_next;
+        if (now - p_evt->queued_ms < (long long)m_ack_delay_ms) {
+            if (iotHubClientHandle->message_timeout_ms == 0 ||
+                now - p_evt->queued_ms < (long long)iotHubClientHandle->message_timeout_ms) {
+                break;
+            }
+            if (p_evt->cb) {
+                p_evt->cb(IOTHUB_CLIENT_CONFIRMATION_MESSAGE_TIMEOUT, p_evt->p_ctx);
+            }
+            IoTHubMessage_Destroy(p_evt->msg);
+            free(p_evt);
+            p_evt = p_next;
+            continue;
+        }
+        LoopbackHubMessage rec;
+        record_message(p_evt->msg, &rec);
+        if (p_evt->cb) {
+            p_evt->cb(IOTHUB_CLIENT_CONFIRMATION_OK, p_evt->p_ctx);
+        }
+        if (m_send_hook) {
+            m_send_hook(&rec, m_send_hook_ctx);
+        }
+        IoTHubMessage_Destroy(p_evt->msg);
+        free(p_evt);
+        p_evt = p_next;
+    }
+    if (p_evt) {
+        // Not due yet: put them back in front of anything sent from the callbacks.
+        LoopbackEvent *p_last = p_evt;
+        while (p_last->p_next) {
+            p_last = p_last->p_next;
+        }
+        p_last->p_next = iotHubClientHandle->outbound.p_head;
+        if (iotHubClientHandle->outbound.p_tail == NULL) {
+            iotHubClientHandle->outbound.p_tail = p_last;
+        }
+        iotHubClientHandle->outbound.p_head = p_evt;
+    }
+    p_evt = list_detach(&m_c2d);
+    while (p_evt) {
+        LoopbackEvent *p_next = p_evt->p_next;
+        m_stats.c2d_count++;
+        m_stats.c2d_bytes += p_evt->msg->len;
+        if (iotHubClientHandle->msg_cb) {
+            iotHubClientHandle->msg_cb(p_evt->msg, iotHubClientHandle->p_msg_ctx);
+        }
+        IoTHubMessage_Destroy(p_evt->msg);
+        free(p_evt);
+        p_evt = p_next;
+    }
+}
+
+void IoTHubDeviceClient_LL_Destroy(IOTHUB_DEVICE_CLIENT_LL_HANDLE iotHubClientHandle) {
+    if (iotHubClientHandle == NULL) {
+        return;
+    }
+    LoopbackEvent *p_evt = list_detach(&iotHubClientHandle->outbound);
+    while (p_evt) {
+        LoopbackEvent *p_next = p_evt->p_next;
+        if (p_evt->cb) {
+            p_evt->cb(IOTHUB_CLIENT_CONFIRMATION_BECAUSE_DESTROY, p_evt->p_ctx);
+        }
+        IoTHubMessage_Destroy(p_evt->msg);
+        free(p_evt);
+        p_evt = p_next;
+    }
+    free(iotHubClientHandle);
+}
@@ -0,0 +1,30 @@
+//
+// Copyright: Avnet 2021
+// Host implementation of the applibs Log_Debug API.
+//
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <applibs/log.h>
+#include "iothub_loopback.h"
+
+static bool m_enabled = true;
+
+void host_log_set_enabled(bool enabled) {
+    m_enabled = enabled;
+}
+
+int Log_DebugVarArgs(const char *fmt, va_list args) {
+    if (!m_enabled) {
+        return 0;
+    }
+    return vfprintf(stderr, fmt, args);
+}
+
+int Log_Debug(const char *fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    int ret = Log_DebugVarArgs(fmt, args);
+    va_end(args);
+    return ret;
+}
@@ -0,0 +1,38 @@
+//
+// Copyright: Avnet 2021
+// Host implementation of the applibs networking status API.
+//
+
+#include <errno.h>
+#include <applibs/networking.h>
+#include "iothub_loopback.h"
+
+static bool m_ready = true;
+
+void host_networking_set_ready(bool ready) {
+    m_ready = ready;
+}
+
+int Networking_IsNetworkingReady(bool *outIsNetworkingReady) {
+    if (outIsNetworkingReady == NULL) {
+        errno = EFAULT;
+        return -1;
+    }
+    *outIsNetworkingReady = m_ready;
+    return 0;
+}
+
+int Networking_GetInterfaceConnectionStatus(const char *networkInterfaceName,
+    Networking_InterfaceConnectionStatus *outStatus) {
+    if (networkInterfaceName == NULL || outStatus == NULL) {
+        errno = EFAULT;
+        return -1;
+    }
+    *outStatus = Networking_InterfaceConnectionStatus_InterfaceUp;
+    if (m_ready) {
+        *outStatus |= Networking_InterfaceConnectionStatus_ConnectedToNetwork |
+            Networking_InterfaceConnectionStatus_IpAvailable |
+            Networking_InterfaceConnectionStatus_ConnectedToInternet;
+    }
+    return 0;
+}
@@ -0,0 +1,668 @@
+//
+// Copyright: Avnet 2021
+// Drives the IoTConnect SDK against the loopback hub on a Linux host: connects, completes the
+// hello handshake, then sends telemetry at a given rate while injecting C2D commands.
+// Intended to be run under perf or valgrind.
+//
+// Usage: iotc-loopback-bench [-n messages] [-r messages_per_second] [-c c2d_every_n]
+//                            [-b batch_bytes] [-l batch_latency_s] [-q queue_bytes]
+//                            [-o drop_every_n] [-d outage_ms] [-s spool_file] [-i]
+//                            [-a arena_bytes] [-k ack_delay_ms] [-t] [-e]
+//                            [-p provisioning_delay_ms] [-H hub_cache_file] [-m]
+//                            [-C session_cache_file] [-w hello_delay_ms] [-F] [-N]
+//                            [-E json|cbor|msgpack] [-T] [-D deadband]
+//                            [-A window_ms[:hop_ms]] [-z deflate|gzip] [-P alarm_every_n]
+//                            [-Q daily_messages[:burst]] [-R fail_every_n] [-v]
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <applibs/eventloop.h>
+#include <applibs/log.h>
+#include "azsphere_iothub_client.h"
+#include "iothub_loopback.h"
+#include "iotconnect.h"
+
+#define HELLO_REQUEST_MARKER        "\"mt\":200"
+#define HELLO_RESPONSE              "{\"d\":{\"ec\":0,\"ct\":200,\"sid\":\"bG9vcGJhY2stc2lk\"," \
+                                    "\"meta\":{\"dtg\":\"a3c1e2f0-0000-4000-8000-00000000beef\"," \
+                                    "\"df\":5,\"v\":2.1},\"has\":{\"d\":0,\"attr\":0,\"set\":0," \
+                                    "\"r\":0,\"ota\":0}}}"
+#define SPOOL_SIZE                  (256 * 1024)
+#define MOVED_HUB                   "moved-hub.azure-devices.net"
+#define TICK_MS                     10
+#define ENCODE_BUFFER_SIZE          512
+#define FILTER_MAX_SILENCE_MS       1000
+#define ALARM_PACKET                "{\"mt\":0,\"d\":[{\"d\":{\"alarm\":1}}]}"
+#define C2D_COMMAND                 "{\"v\":\"2.1\",\"ct\":0,\"cmd\":\"bench-cmd 1\"," \
+                                    "\"ack\":\"00000000-0000-4000-8000-000000000001\"}"
+
+static unsigned long m_commands = 0;
+static bool m_connected = false;
+static bool m_tracked = false;
+static unsigned int m_hello_delay_ms = 0;
+static bool m_use_encoder = false;
+static IotConnectTemplate *m_tmpl = NULL;
+static bool m_filtered = false;
+static IotConnectAggregator *m_agg = NULL;
+static unsigned long m_delivered = 0;
+static EventLoop *m_app_loop = NULL;
+static long long m_last_tick_us = 0;
+static long long m_max_tick_gap_us = 0;
+
+static long long now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void send_hello_response(void *p_ctx) {
+    loopback_hub_inject_c2d((const unsigned char *)HELLO_RESPONSE, strlen(HELLO_RESPONSE));
+}
+
+static void restore_network(void *p_ctx) {
+    host_networking_set_ready(true);
+}
+
+static void on_hub_message(const LoopbackHubMessage *p_msg, void *p_ctx) {
+    if (strstr((const char *)p_msg->p_payload, HELLO_REQUEST_MARKER) != NULL) {
+        int timer = 0;
+        if (m_hello_delay_ms == 0 ||
+            iothub_client_add_timer_ms(m_hello_delay_ms, 0, send_hello_response, NULL, &timer) !=
+            CodeSuccess) {
+            send_hello_response(NULL);
+        }
+    }
+}
+
+static void on_command(IotclEventData data) {
+    m_commands++;
+}
+
+static void on_inbound(const IotConnectInboundEvent *p_evt) {
+    if (p_evt->ct == IOTCONNECT_INBOUND_CT_COMMAND) {
+        m_commands++;
+    }
+}
+
+static void on_send_complete(unsigned int msg_id, IotConnectSendResult result,
+    unsigned int latency_ms, void *p_ctx) {
+    if (result == IOTCONNECT_SEND_DELIVERED) {
+        m_delivered++;
+    }
+}
+
+// Stands in for application work on the loop, e.g. sensor sampling, to measure how long the
+// loop stalls.
+static void on_tick(void *p_ctx) {
+    long long now = now_us();
+    if (m_last_tick_us && now - m_last_tick_us > m_max_tick_gap_us) {
+        m_max_tick_gap_us = now - m_last_tick_us;
+    }
+    m_last_tick_us = now;
+}
+
+static void on_status(IotConnectConnectionStatus status) {
+    m_connected = (status == IOTCONNECT_CONNECTED);
+}
+
+// Upper bound of the histogram bucket holding the given percentile.
+static unsigned long hist_percentile(const unsigned long *p_hist, int buckets, int pct) {
+    unsigned long total = 0;
+    unsigned long seen = 0;
+    for (int i = 0; i < buckets; i++) {
+        total += p_hist[i];
+    }
+    for (int i = 0; i < buckets; i++) {
+        seen += p_hist[i];
+        if (total && seen * 100 >= total * (unsigned long)pct) {
+            return 1UL << i;
+        }
+    }
+    return 0;
+}
+
+static unsigned long latency_percentile(const IotConnectDeliveryStats *p_stats, int pct) {
+    return hist_percentile(p_stats->latency_hist, IOTCONNECT_SEND_LATENCY_BUCKETS, pct);
+}
+
+// With -e the SDK shares the bench's own loop, as an application would run it.
+static bool run_loop(int timeout_ms) {
+    if (m_app_loop) {
+        return EventLoop_Run(m_app_loop, timeout_ms, true) != EventLoop_Run_Failed;
+    }
+    return iotconnect_sdk_poll(timeout_ms) == IOTC_SDK_SUCCESS;
+}
+
+static void on_packet_released(const char *p_data, void *p_ctx) {
+    iotcl_destroy_serialized(p_data);
+}
+
+// Same telemetry built with the streaming encoder, in the configured encoding.
+static void send_encoded_telemetry(unsigned long seq) {
+    unsigned char buf[ENCODE_BUFFER_SIZE];
+    IotConnectEncoder enc;
+    iotconnect_sdk_telemetry_begin(&enc, buf, sizeof(buf));
+    iotconnect_telemetry_add_record(&enc, time(NULL));
+    iotconnect_telemetry_put_number(&enc, "seq", (double)seq);
+    iotconnect_telemetry_put_number(&enc, "temperature", 20.0 + (double)(seq % 100) / 10.0);
+    iotconnect_telemetry_put_number(&enc, "humidity", 40.0 + (double)(seq % 300) / 10.0);
+    size_t len = iotconnect_telemetry_end(&enc);
+    if (len == 0) {
+        return;
+    }
+    if (m_tracked) {
+        iotconnect_sdk_send_packet_tracked((const char *)buf, len, NULL);
+    } else {
+        iotconnect_sdk_send_packet_len((const char *)buf, len);
+    }
+}
+
+enum {
+    ATTR_SEQ = 0,
+    ATTR_TEMPERATURE,
+    ATTR_HUMIDITY
+};
+
+static IotConnectAttribute m_attrs[] = {
+    [ATTR_SEQ] = { .p_name = "seq", .type = IOTCONNECT_ATTR_INTEGER },
+    [ATTR_TEMPERATURE] = { .p_name = "temperature", .type = IOTCONNECT_ATTR_NUMBER, .precision = 1 },
+    [ATTR_HUMIDITY] = { .p_name = "humidity", .type = IOTCONNECT_ATTR_NUMBER, .precision = 1 }
+};
+
+// Same telemetry rendered from a template compiled once, in the configured encoding.
+static void send_template_telemetry(unsigned long seq) {
+    iotconnect_template_set_number(m_tmpl, ATTR_TEMPERATURE, 20.0 + (double)(seq % 100) / 10.0);
+    iotconnect_template_set_number(m_tmpl, ATTR_HUMIDITY, 40.0 + (double)(seq % 300) / 10.0);
+    if (m_filtered) {
+        // seq changes every time, so it is left out to let whole messages be suppressed.
+        iotconnect_sdk_send_template_changes(m_tmpl);
+        return;
+    }
+    iotconnect_template_set_integer(m_tmpl, ATTR_SEQ, (int64_t)seq);
+    size_t len;
+    const char *p_msg = iotconnect_sdk_template_render(m_tmpl, &len);
+    if (p_msg == NULL) {
+        return;
+    }
+    if (m_tracked) {
+        iotconnect_sdk_send_packet_tracked(p_msg, len, NULL);
+    } else {
+        iotconnect_sdk_send_packet_len(p_msg, len);
+    }
+}
+
+static const IotConnectAggregateAttribute m_agg_attrs[] = {
+    { .p_name = "temperature", .precision = 2 },
+    { .p_name = "humidity", .precision = 2 }
+};
+
+static void send_telemetry(unsigned long seq) {
+    if (m_agg) {
+        // Samples only, the SDK sends one record per window.
+        iotconnect_aggregator_add(m_agg, 0, 20.0 + (double)(seq % 100) / 10.0);
+        iotconnect_aggregator_add(m_agg, 1, 40.0 + (double)(seq % 300) / 10.0);
+        return;
+    }
+    if (m_tmpl) {
+        send_template_telemetry(seq);
+        return;
+    }
+    if (m_use_encoder) {
+        send_encoded_telemetry(seq);
+        return;
+    }
+    IotclMessageHandle msg_hndl = iotcl_telemetry_v2_create();
+    if (msg_hndl == NULL) {
+        return;
+    }
+    iotcl_telemetry_set_number(msg_hndl, "seq", (double)seq);
+    iotcl_telemetry_set_number(msg_hndl, "temperature", 20.0 + (double)(seq % 100) / 10.0);
+    iotcl_telemetry_set_number(msg_hndl, "humidity", 40.0 + (double)(seq % 300) / 10.0);
+    const char *p_msg = iotcl_create_serialized_string(msg_hndl, false);
+    if (p_msg) {
+        if (m_tracked) {
+            iotconnect_sdk_send_packet_tracked(p_msg, strlen(p_msg), NULL);
+            iotcl_destroy_serialized(p_msg);
+        } else {
+            iotconnect_sdk_send_packet_buffer(p_msg, strlen(p_msg), on_packet_released, NULL);
+        }
+    }
+    iotcl_telemetry_destroy(msg_hndl);
+}
+
+int main(int argc, char *argv[]) {
+    unsigned long count = 10000;
+    unsigned long rate = 0;
+    unsigned long c2d_every = 100;
+    unsigned long batch_bytes = 0;
+    int batch_latency_s = 0;
+    unsigned long queue_bytes = 0;
+    unsigned long drop_every = 0;
+    unsigned int outage_ms = 0;
+    const char *spool_path = NULL;
+    bool in_place = false;
+    unsigned long arena_bytes = 0;
+    unsigned int ack_delay_ms = 0;
+    unsigned int prov_delay_ms = 0;
+    const char *hub_cache_path = NULL;
+    bool moved_hub = false;
+    const char *session_path = NULL;
+    IOTHUB_CLIENT_CONNECTION_STATUS_REASON drop_reason = IOTHUB_CLIENT_CONNECTION_NO_NETWORK;
+    bool network_down = false;
+    IotConnectEncoding encoding = IOTCONNECT_ENCODING_JSON;
+    bool use_template = false;
+    IotConnectWindowConfig window = { 0 };
+    IotConnectCompressMethod compression = IOTCONNECT_COMPRESS_NONE;
+    unsigned long alarm_every = 0;
+    IotConnectQuotaConfig quota = { 0 };
+    unsigned long fail_every = 0;
+    bool verbose = false;
+    int opt;
+    while ((opt = getopt(argc, argv, "n:r:c:b:l:q:o:d:s:ia:k:tep:H:mC:w:FNE:TD:A:z:P:Q:R:v")) != -1) {
+        switch (opt) {
+        case 'n':
+            count = strtoul(optarg, NULL, 10);
+            break;
+        case 'r':
+            rate = strtoul(optarg, NULL, 10);
+            break;
+        case 'c':
+            c2d_every = strtoul(optarg, NULL, 10);
+            break;
+        case 'b':
+            batch_bytes = strtoul(optarg, NULL, 10);
+            break;
+        case 'l':
+            batch_latency_s = atoi(optarg);
+            break;
+        case 'q':
+            queue_bytes = strtoul(optarg, NULL, 10);
+            break;
+        case 'o':
+            drop_every = strtoul(optarg, NULL, 10);
+            break;
+        case 'd':
+            outage_ms = (unsigned int)strtoul(optarg, NULL, 10);
+            break;
+        case 's':
+            spool_path = optarg;
+            break;
+        case 'i':
+            in_place = true;
+            break;
+        case 'a':
+            arena_bytes = strtoul(optarg, NULL, 10);
+            break;
+        case 'k':
+            ack_delay_ms = (unsigned int)strtoul(optarg, NULL, 10);
+            break;
+        case 't':
+            m_tracked = true;
+            break;
+        case 'e':
+            m_app_loop = EventLoop_Create();
+            break;
+        case 'p':
+            prov_delay_ms = (unsigned int)strtoul(optarg, NULL, 10);
+            break;
+        case 'H':
+            hub_cache_path = optarg;
+            break;
+        case 'm':
+            moved_hub = true;
+            break;
+        case 'C':
+            session_path = optarg;
+            break;
+        case 'w':
+            m_hello_delay_ms = (unsigned int)strtoul(optarg, NULL, 10);
+            break;
+        case 'F':
+            // Drops the client cannot recover from by itself, so each one provisions again.
+            drop_reason = IOTHUB_CLIENT_CONNECTION_DEVICE_DISABLED;
+            break;
+        case 'N':
+            // The interface also goes down for the outage, as when Wi-Fi is lost.
+            network_down = true;
+            break;
+        case 'E':
+            m_use_encoder = true;
+            if (strcmp(optarg, "cbor") == 0) {
+                encoding = IOTCONNECT_ENCODING_CBOR;
+            } else if (strcmp(optarg, "msgpack") == 0) {
+                encoding = IOTCONNECT_ENCODING_MSGPACK;
+            }
+            break;
+        case 'T':
+            use_template = true;
+            break;
+        case 'D':
+            // Report-on-change: temperature by an absolute deadband, humidity by the same
+            // fraction of its value, both at least once a second.
+            use_template = true;
+            m_filtered = true;
+            m_attrs[ATTR_TEMPERATURE].deadband = strtod(optarg, NULL);
+            m_attrs[ATTR_HUMIDITY].deadband_rel = strtod(optarg, NULL) / 100.0;
+            m_attrs[ATTR_TEMPERATURE].max_silence_ms = FILTER_MAX_SILENCE_MS;
+            m_attrs[ATTR_HUMIDITY].max_silence_ms = FILTER_MAX_SILENCE_MS;
+            break;
+        case 'A': {
+            char *p_end;
+            window.window_ms = (unsigned int)strtoul(optarg, &p_end, 10);
+            window.hop_ms = (*p_end == ':') ? (unsigned int)strtoul(p_end + 1, NULL, 10) : 0;
+            break;
+        }
+        case 'z':
+            compression = strcmp(optarg, "gzip") == 0 ? IOTCONNECT_COMPRESS_GZIP :
+                IOTCONNECT_COMPRESS_DEFLATE;
+            break;
+        case 'P':
+            alarm_every = strtoul(optarg, NULL, 10);
+            break;
+        case 'Q': {
+            char *p_end;
+            quota.daily_messages = strtoul(optarg, &p_end, 10);
+            quota.burst = (*p_end == ':') ? (unsigned int)strtoul(p_end + 1, NULL, 10) : 0;
+            break;
+        }
+        case 'R':
+            // Every n-th send fails, so live telemetry goes to the queue or spool while connected.
+            fail_every = strtoul(optarg, NULL, 10);
+            break;
+        case 'v':
+            verbose = true;
+            break;
+        default:
+            fprintf(stderr, "Usage: %s [-n messages] [-r messages_per_second] "
+                "[-c c2d_every_n] [-b batch_bytes] [-l batch_latency_s] [-q queue_bytes] "
+                "[-o drop_every_n] [-d outage_ms] [-s spool_file] [-i] [-a arena_bytes] [-k ack_delay_ms] [-t] [-e] [-p provisioning_delay_ms] [-H hub_cache_file] [-m] [-C session_cache_file] [-w hello_delay_ms] [-F] [-N] [-E json|cbor|msgpack] [-T] [-D deadband] [-A window_ms[:hop_ms]] [-z deflate|gzip] [-P alarm_every_n] [-Q daily_messages[:burst]] [-R fail_every_n] [-v]\n", argv[0]);
+            return 1;
+        }
+    }
+    host_log_set_enabled(verbose);
+    loopback_hub_set_record_limit(16);
+    loopback_hub_set_send_hook(on_hub_message, NULL);
+    loopback_hub_set_ack_delay(ack_delay_ms);
+    loopback_hub_set_send_failures(fail_every);
+    loopback_hub_set_provisioning_delay(prov_delay_ms);
+    if (moved_hub) {
+        // DPS now assigns another hub, so a hub cached by a previous run rejects the device.
+        loopback_hub_set_assigned_hub(MOVED_HUB);
+    }
+
+    IotConnectClientConfig *p_cfg = iotconnect_sdk_init_and_get_config();
+    p_cfg->status_cb = on_status;
+    p_cfg->cmd_cb = on_command;
+    p_cfg->inbound_cb = in_place ? on_inbound : NULL;
+    p_cfg->arena.size = arena_bytes;
+    p_cfg->send_cb = on_send_complete;
+    p_cfg->event_loop = m_app_loop;
+    p_cfg->encoding = encoding;
+    p_cfg->compression.method = compression;
+    p_cfg->priority.enabled = alarm_every > 0;
+    p_cfg->quota = quota;
+    p_cfg->batch.max_bytes = batch_bytes;
+    p_cfg->batch.max_latency_s = batch_latency_s;
+    p_cfg->queue.capacity = queue_bytes;
+    p_cfg->queue.drain_per_s = 1000;
+    if (spool_path) {
+        p_cfg->spool.fd = open(spool_path, O_RDWR | O_CREAT, 0600);
+        if (p_cfg->spool.fd < 0) {
+            perror(spool_path);
+            return 1;
+        }
+        p_cfg->spool.size = SPOOL_SIZE;
+    }
+    if (hub_cache_path) {
+        p_cfg->hub_cache.fd = open(hub_cache_path, O_RDWR | O_CREAT, 0600);
+        if (p_cfg->hub_cache.fd < 0) {
+            perror(hub_cache_path);
+            return 1;
+        }
+        p_cfg->hub_cache.size = IOTCONNECT_HUB_CACHE_SIZE;
+    }
+    if (session_path) {
+        p_cfg->session.fd = open(session_path, O_RDWR | O_CREAT, 0600);
+        if (p_cfg->session.fd < 0) {
+            perror(session_path);
+            return 1;
+        }
+        p_cfg->session.size = IOTCONNECT_SESSION_CACHE_SIZE;
+    }
+    IotConnectAzsphereConfig init = { .p_netif = "eth0", .p_scope_id = "loopback" };
+    if (iotconnect_sdk_init(&init) != IOTC_SDK_SUCCESS) {
+        fprintf(stderr, "iotconnect_sdk_init() failed\n");
+        return 1;
+    }
+    if (use_template) {
+        m_tmpl = iotconnect_sdk_template_create(m_attrs, sizeof(m_attrs) / sizeof(m_attrs[0]));
+        if (m_tmpl == NULL) {
+            fprintf(stderr, "iotconnect_sdk_template_create() failed\n");
+            return 1;
+        }
+    }
+    if (window.window_ms) {
+        m_agg = iotconnect_sdk_aggregator_create(m_agg_attrs,
+            sizeof(m_agg_attrs) / sizeof(m_agg_attrs[0]), &window);
+        if (m_agg == NULL) {
+            fprintf(stderr, "iotconnect_sdk_aggregator_create() failed\n");
+            return 1;
+        }
+    }
+    int tick_timer = 0;
+    iothub_client_add_timer_ms(TICK_MS, TICK_MS, on_tick, NULL, &tick_timer);
+    long long start_us = now_us();
+    while (!m_connected) {
+        if (!run_loop(100)) {
+            fprintf(stderr, "event loop run failed\n");
+            return 1;
+        }
+        if (now_us() - start_us > 30 * 1000000LL) {
+            fprintf(stderr, "Timed out waiting for the hello handshake\n");
+            return 1;
+        }
+    }
+    long long connect_us = now_us() - start_us;
+    iothub_client_delete_timer(tick_timer);
+
+    struct rusage ru_start, ru_end;
+    getrusage(RUSAGE_SELF, &ru_start);
+    start_us = now_us();
+    long long start_us_drain;
+    long long period_us = rate ? 1000000LL / (long long)rate : 0;
+    for (unsigned long i = 0; i < count; i++) {
+        send_telemetry(i);
+        if (alarm_every && (i % alarm_every) == 0) {
+            iotconnect_sdk_send_packet_class(ALARM_PACKET, strlen(ALARM_PACKET),
+                IOTCONNECT_CLASS_ALARM);
+        }
+        if (c2d_every && (i % c2d_every) == 0) {
+            loopback_hub_inject_c2d((const unsigned char *)C2D_COMMAND, strlen(C2D_COMMAND));
+        }
+        if (drop_every && i && (i % drop_every) == 0) {
+            loopback_hub_drop_connection(drop_reason, outage_ms);
+            int timer = 0;
+            if (network_down && iothub_client_add_timer_ms(outage_ms, 0, restore_network, NULL,
+                &timer) == CodeSuccess) {
+                host_networking_set_ready(false);
+            }
+        }
+        long long next_us = start_us + (long long)(i + 1) * period_us;
+        do {
+            long long wait_us = next_us - now_us();
+            run_loop(wait_us > 0 ? (int)(wait_us / 1000) : 0);
+        } while (period_us && now_us() < next_us - 1000);
+    }
+    iotconnect_sdk_flush();
+    start_us_drain = now_us();
+    while (((spool_path && iotconnect_spool_pending() > 0) ||
+        (!spool_path && queue_bytes && iotconnect_queue_count() > 0) ||
+        iotconnect_priority_pending() > 0) &&
+        now_us() - start_us_drain < 60 * 1000000LL) {
+        run_loop(100);
+    }
+    IotConnectDeliveryStats ds;
+    do {
+        run_loop(10);
+        iotconnect_sdk_get_delivery_stats(&ds);
+    } while (ds.in_flight > 0 && now_us() - start_us_drain < 60 * 1000000LL);
+    long long elapsed_us = now_us() - start_us;
+    getrusage(RUSAGE_SELF, &ru_end);
+
+    LoopbackHubStats stats;
+    loopback_hub_get_stats(&stats);
+    double cpu_s = (double)(ru_end.ru_utime.tv_sec - ru_start.ru_utime.tv_sec) +
+        (double)(ru_end.ru_utime.tv_usec - ru_start.ru_utime.tv_usec) / 1e6 +
+        (double)(ru_end.ru_stime.tv_sec - ru_start.ru_stime.tv_sec) +
+        (double)(ru_end.ru_stime.tv_usec - ru_start.ru_stime.tv_usec) / 1e6;
+    IotHubProvisioningInfo prov;
+    iothub_client_get_provisioning_info(&prov);
+    printf("connect+hello:  %.1f ms\n", (double)connect_us / 1000.0);
+    printf("provisioning:   %lu attempts, %lu failed, last %u ms, loop stalled up to %.1f ms\n",
+        prov.attempts, prov.failures, prov.elapsed_ms, (double)m_max_tick_gap_us / 1000.0);
+    printf("hub:            %s, %lu DPS registrations, %lu direct, %lu fallbacks, "
+        "authenticated after %u ms\n", prov.direct ? "cached" : "DPS", prov.dps_registrations,
+        prov.direct_connects, prov.fallbacks, prov.time_to_auth_ms);
+    if (drop_every) {
+        IotHubReconnectInfo rc;
+        iothub_client_get_reconnect_info(&rc);
+        printf("reconnects:     %lu drops, %lu warm, %lu full, last %u ms, max %u ms, "
+            "%lu attempts, %lu network changes\n", rc.drops, rc.warm_reconnects,
+            rc.full_reconnects, rc.last_reconnect_ms, rc.max_reconnect_ms, rc.attempts,
+            rc.network_changes);
+    }
+    if (session_path) {
+        IotConnectSessionStats sess;
+        iotconnect_session_get_stats(&sess);
+        printf("session cache:  %lu hits, %lu misses, %lu expired, %lu invalidated\n",
+            sess.hits, sess.misses, sess.expired, sess.invalidated);
+    }
+    printf("packets:        %lu in %.3f s (%.0f/s)\n", count, (double)elapsed_us / 1e6,
+        elapsed_us ? (double)count * 1e6 / (double)elapsed_us : 0.0);
+    printf("hub messages:   %lu, %llu bytes\n", stats.sent_count, stats.sent_bytes);
+    printf("c2d delivered:  %lu (%lu commands)\n", stats.c2d_count, m_commands);
+    if (spool_path) {
+        IotConnectSpoolStats ss;
+        iotconnect_spool_get_stats(&ss);
+        printf("spool:          %lu recovered in %lu us, %lu appended, %lu dropped, %lu drained\n",
+            ss.recovered_records, ss.recovery_us, ss.appended_records, ss.dropped_records,
+            ss.sent_records);
+        printf("spool writes:   %llu bytes in %lu writes (%.2f bytes written per payload byte)\n",
+            ss.written_bytes, ss.write_ops, ss.appended_bytes ?
+            (double)ss.written_bytes / (double)ss.appended_bytes : 0.0);
+    } else if (queue_bytes) {
+        IotConnectQueueStats qs;
+        iotconnect_queue_get_stats(&qs);
+        printf("queue:          %lu queued, %lu dropped (%llu bytes), %lu drained, "
+            "high water %u bytes\n", qs.queued_packets, qs.dropped_packets, qs.dropped_bytes,
+            qs.sent_packets, (unsigned int)qs.high_water_bytes);
+    }
+    iotconnect_sdk_get_delivery_stats(&ds);
+    printf("delivery:       %lu sent, %lu delivered, %lu timed out, %lu failed, "
+        "max %u in flight\n", ds.sent, ds.delivered, ds.timed_out, ds.failed, ds.max_in_flight);
+    printf("ack latency:    avg %u ms, max %u ms, p50 < %lu ms, p99 < %lu ms\n",
+        ds.latency_avg_ms, ds.latency_max_ms, latency_percentile(&ds, 50),
+        latency_percentile(&ds, 99));
+    if (m_tracked) {
+        printf("tracked:        %lu delivered\n", m_delivered);
+    }
+    if (arena_bytes) {
+        IotConnectArenaStats as;
+        iotconnect_arena_get_stats(&as);
+        printf("arena:          %lu allocs (%lu reused), %lu heap fallbacks, %lu resets, "
+            "high water %u bytes\n", as.allocs, as.reused, as.fallback_allocs, as.resets,
+            (unsigned int)as.high_water_bytes);
+    }
+    if (m_agg) {
+        IotConnectAggregatorStats as;
+        iotconnect_aggregator_get_stats(m_agg, &as);
+        printf("aggregation:    %lu samples, %lu windows sent, %lu empty, %lu rejected "
+            "(%.0f samples/message)\n", as.samples, as.windows, as.empty_windows, as.rejected,
+            as.windows ? (double)as.samples / (double)as.windows : 0.0);
+    }
+    if (m_filtered) {
+        IotConnectTemplateStats ts;
+        iotconnect_template_get_stats(m_tmpl, &ts);
+        printf("filter:         %lu renders, %lu suppressed (%.1f%%), values %lu offered, "
+            "%lu reported, %lu heartbeats, %lu in deadband, %lu rate limited\n",
+            ts.renders, ts.suppressed, ts.renders ? 100.0 * ts.suppressed / ts.renders : 0.0,
+            ts.values.offered, ts.values.reported, ts.values.heartbeats,
+            ts.values.deadband_suppressed, ts.values.interval_suppressed);
+    }
+    for (int c = 0; iotconnect_priority_is_enabled() && c < IOTCONNECT_CLASS_COUNT; c++) {
+        static const char *p_class_names[IOTCONNECT_CLASS_COUNT] = {
+            "control", "alarm", "telemetry", "bulk"
+        };
+        IotConnectClassStats cs;
+        iotconnect_priority_get_stats((IotConnectSendClass)c, &cs);
+        printf("class %-9s %lu sent in %lu messages (%lu packed), %lu rejected, %lu failed, "
+            "queued avg %.1f ms, p99 < %lu ms, max %u ms, ack avg %.1f ms, max %u outstanding\n",
+            p_class_names[c], cs.sent, cs.messages, cs.packed, cs.rejected, cs.failed,
+            cs.sent ? (double)cs.queue_latency_sum_ms / (double)cs.sent : 0.0,
+            hist_percentile(cs.queue_latency_hist, IOTCONNECT_PRIORITY_LATENCY_BUCKETS, 99),
+            cs.queue_latency_max_ms,
+            cs.acknowledged ? (double)cs.ack_latency_sum_ms / (double)cs.acknowledged : 0.0,
+            cs.max_outstanding_seen);
+    }
+    if (quota.daily_messages) {
+        IotConnectQuotaInfo qi;
+        iotconnect_sdk_get_quota_info(&qi);
+        printf("quota:          %lu of %lu used today, %lu remaining, %lu throttled, "
+            "next in %u ms, ", qi.used_today, qi.daily_messages, qi.remaining_today, qi.throttled,
+            qi.next_message_ms);
+        if (qi.projected_exhaustion) {
+            printf("exhausted in %.0f s at this rate\n",
+                difftime(qi.projected_exhaustion, time(NULL)));
+        } else {
+            printf("lasts the day\n");
+        }
+    }
+    if (compression != IOTCONNECT_COMPRESS_NONE) {
+        IotConnectCompressStats cs;
+        iotconnect_compress_get_stats(&cs);
+        printf("compression:    %lu compressed, %lu below threshold, %lu incompressible, "
+            "ratio %.2f, %.1f us/KB\n", cs.compressed, cs.below_threshold, cs.incompressible,
+            cs.bytes_out ? (double)cs.bytes_in / (double)cs.bytes_out : 0.0,
+            cs.attempted_bytes ? (double)cs.compress_us * 1024.0 / (double)cs.attempted_bytes : 0.0);
+    }
+    printf("cpu:            %.3f s (%.2f us/packet)\n", cpu_s,
+        count ? cpu_s * 1e6 / (double)count : 0.0);
+    int result = 0;
+    if (fail_every && (spool_path || queue_bytes)) {
+        // Every packet stored after a refused send must leave the store while still connected;
+        // size the store so nothing is dropped.
+        unsigned long stored, drained;
+        size_t left;
+        if (spool_path) {
+            IotConnectSpoolStats ss;
+            iotconnect_spool_get_stats(&ss);
+            stored = ss.appended_records;
+            drained = ss.sent_records;
+            left = iotconnect_spool_pending();
+        } else {
+            IotConnectQueueStats qs;
+            iotconnect_queue_get_stats(&qs);
+            stored = qs.queued_packets;
+            drained = qs.sent_packets;
+            left = iotconnect_queue_count();
+        }
+        result = (drained == stored && left == 0) ? 0 : 1;
+        printf("store check:    %lu sends refused, %lu queued, %lu drained, %u left: %s\n",
+            stats.refused_count, stored, drained, (unsigned int)left, result ? "FAILED" : "ok");
+    }
+
+    iotconnect_sdk_disconnect();
+    iotconnect_template_destroy(m_tmpl);
+    iotconnect_sdk_aggregator_destroy(m_agg);
+    iotconnect_sdk_deinit();
+    if (m_app_loop) {
+        EventLoop_Close(m_app_loop);
+    }
+    return result;
+}
@@ -0,0 +1,146 @@
+//
+// Copyright: Avnet 2021
+// Microbenchmark of telemetry number formatting. Compares the path the sample used with cJSON
+// (round with snprintf("%0.Nf"), strtod back, then cJSON printing the double) against the
+// encoder's shortest double, rounded double and fixed point formatting.
+// Checks that every output reads back as the expected value.
+//
+// Usage: iotc-number-bench [-n values] [-p decimals]
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include "cJSON.h"
+#include "iotconnect_encoder.h"
+
+#define OUT_SIZE                    64
+
+typedef size_t (*FormatFunction)(double value, int64_t mantissa, unsigned int decimals,
+    char *p_out);
+
+static size_t format_cjson(double value, int64_t mantissa, unsigned int decimals, char *p_out) {
+    char tmp[OUT_SIZE];
+    snprintf(tmp, sizeof(tmp), "%0.*f", (int)decimals, value);
+    cJSON *p_num = cJSON_CreateNumber(strtod(tmp, NULL));
+    char *p_str = cJSON_PrintUnformatted(p_num);
+    size_t len = strlen(p_str);
+    memcpy(p_out, p_str, len + 1);
+    cJSON_free(p_str);
+    cJSON_Delete(p_num);
+    return len;
+}
+
+static size_t encode(IotConnectEncoder *p_enc, char *p_out) {
+    size_t len = iotconnect_encoder_finish(p_enc);
+    p_out[len] = 0;
+    return len;
+}
+
+static size_t format_shortest(double value, int64_t mantissa, unsigned int decimals, char *p_out) {
+    IotConnectEncoder enc;
+    iotconnect_encoder_init(&enc, IOTCONNECT_ENCODING_JSON, (unsigned char *)p_out, OUT_SIZE);
+    iotconnect_encoder_double(&enc, value);
+    return encode(&enc, p_out);
+}
+
+static size_t format_precision(double value, int64_t mantissa, unsigned int decimals, char *p_out) {
+    IotConnectEncoder enc;
+    iotconnect_encoder_init(&enc, IOTCONNECT_ENCODING_JSON, (unsigned char *)p_out, OUT_SIZE);
+    iotconnect_encoder_double_precision(&enc, value, decimals);
+    return encode(&enc, p_out);
+}
+
+static size_t format_fixed(double value, int64_t mantissa, unsigned int decimals, char *p_out) {
+    IotConnectEncoder enc;
+    iotconnect_encoder_init(&enc, IOTCONNECT_ENCODING_JSON, (unsigned char *)p_out, OUT_SIZE);
+    iotconnect_encoder_fixed(&enc, mantissa, decimals);
+    return encode(&enc, p_out);
+}
+
+static long long now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// Values as a sensor reports them: a few integer digits and a noisy fraction.
+static void make_values(double *p_values, int64_t *p_mantissas, double *p_rounded, size_t count,
+    unsigned int decimals) {
+    double scale = pow(10, decimals);
+    srand(1);
+    for (size_t i = 0; i < count; i++) {
+        double value = ((double)rand() / RAND_MAX) * 200.0 - 50.0;
+        p_values[i] = value;
+        p_mantissas[i] = (int64_t)round(value * scale);
+        p_rounded[i] = (double)p_mantissas[i] / scale;
+    }
+}
+
+static void run(const char *p_name, FormatFunction format, const double *p_inputs,
+    const int64_t *p_mantissas, const double *p_expected, size_t count, unsigned int decimals) {
+    char out[OUT_SIZE];
+    size_t bytes = 0;
+    unsigned long mismatches = 0;
+    long long start = now_ns();
+    for (size_t i = 0; i < count; i++) {
+        bytes += format(p_inputs[i], p_mantissas[i], decimals, out);
+    }
+    long long elapsed = now_ns() - start;
+    for (size_t i = 0; i < count; i++) {
+        format(p_inputs[i], p_mantissas[i], decimals, out);
+        if (strtod(out, NULL) != p_expected[i]) {
+            if (mismatches++ == 0) {
+                fprintf(stderr, "%s: %.17g formatted as %s\n", p_name, p_inputs[i], out);
+            }
+        }
+    }
+    printf("%-22s %7.1f ns/value %5.2f bytes/value %lu mismatches\n", p_name,
+        (double)elapsed / (double)count, (double)bytes / (double)count, mismatches);
+}
+
+int main(int argc, char *argv[]) {
+    size_t count = 1000000;
+    unsigned int decimals = 2;
+    int opt;
+    while ((opt = getopt(argc, argv, "n:p:")) != -1) {
+        switch (opt) {
+        case 'n':
+            count = strtoul(optarg, NULL, 10);
+            break;
+        case 'p':
+            decimals = (unsigned int)strtoul(optarg, NULL, 10);
+            break;
+        default:
+            fprintf(stderr, "Usage: %s [-n values] [-p decimals]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (count == 0 || decimals > 9) {
+        fprintf(stderr, "Need at least one value and at most 9 decimals\n");
+        return 1;
+    }
+    double *p_values = malloc(count * sizeof(double));
+    int64_t *p_mantissas = malloc(count * sizeof(int64_t));
+    double *p_rounded = malloc(count * sizeof(double));
+    if (p_values == NULL || p_mantissas == NULL || p_rounded == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        return 1;
+    }
+    make_values(p_values, p_mantissas, p_rounded, count, decimals);
+
+    printf("%zu values, %u decimals\n", count, decimals);
+    run("cjson (sample)", format_cjson, p_values, p_mantissas, p_rounded, count, decimals);
+    run("encoder precision", format_precision, p_values, p_mantissas, p_rounded, count, decimals);
+    run("encoder fixed point", format_fixed, p_values, p_mantissas, p_rounded, count, decimals);
+    run("encoder shortest", format_shortest, p_rounded, p_mantissas, p_rounded, count, decimals);
+    run("encoder shortest, raw", format_shortest, p_values, p_mantissas, p_values, count, decimals);
+
+    free(p_values);
+    free(p_mantissas);
+    free(p_rounded);
+    return 0;
+}
@@ -0,0 +1,259 @@
+//
+// Copyright: Avnet 2021
+// Benchmark of batched numeric telemetry: size and encoding time of the same rows sent as
+// iotcl_create_serialized_string() records, encoder JSON and CBOR records, and series blocks,
+// raw and base64 in a JSON message as iotconnect_sdk_send_series() sends them.
+// Every series block is read back with the reference decoder and compared with the input.
+// Record timestamps of the JSON and CBOR messages have a resolution of a second, the series
+// keeps milliseconds.
+//
+// Usage: iotc-series-bench [-n rows] [-b rows per message] [-i interval_ms] [-j jitter_ms]
+//                          [-p decimals, 0 for full doubles]
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include "iotconnect_lib.h"
+#include "iotconnect_telemetry.h"
+#include "iotconnect_encoder.h"
+#include "iotconnect_series.h"
+
+#define COLUMNS                     3
+#define MESSAGE_SIZE                (256 * 1024)
+#define BENCH_DTG                   "00000000-0000-0000-0000-000000000000"
+
+typedef size_t (*EncodeFunction)(const uint64_t *p_times, const double (*p_rows)[COLUMNS],
+    size_t rows, unsigned char *p_out);
+
+static const char *m_names[COLUMNS] = { "temperature", "humidity", "pressure" };
+static unsigned int m_decimals = 1;
+
+static long long now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static size_t encode_iotcl(const uint64_t *p_times, const double (*p_rows)[COLUMNS], size_t rows,
+    unsigned char *p_out) {
+    IotclMessageHandle msg_hndl = iotcl_telemetry_v2_create();
+    if (msg_hndl == NULL) {
+        return 0;
+    }
+    for (size_t r = 0; r < rows; r++) {
+        // The first record is added by the create call
+        if (r > 0 && !iotcl_telemetry_add_with_epoch_time(msg_hndl, (time_t)(p_times[r] / 1000))) {
+            break;
+        }
+        for (size_t c = 0; c < COLUMNS; c++) {
+            iotcl_telemetry_set_number(msg_hndl, m_names[c], p_rows[r][c]);
+        }
+    }
+    const char *p_msg = iotcl_create_serialized_string(msg_hndl, false);
+    size_t len = 0;
+    if (p_msg) {
+        len = strlen(p_msg);
+        memcpy(p_out, p_msg, len < MESSAGE_SIZE ? len : MESSAGE_SIZE);
+        iotcl_destroy_serialized(p_msg);
+    }
+    iotcl_telemetry_destroy(msg_hndl);
+    return len;
+}
+
+static size_t encode_records(IotConnectEncoding encoding, const uint64_t *p_times,
+    const double (*p_rows)[COLUMNS], size_t rows, unsigned char *p_out) {
+    IotConnectEncoder enc;
+    iotconnect_encoder_init(&enc, encoding, p_out, MESSAGE_SIZE);
+    iotconnect_telemetry_begin(&enc, BENCH_DTG);
+    for (size_t r = 0; r < rows; r++) {
+        iotconnect_telemetry_add_record(&enc, (time_t)(p_times[r] / 1000));
+        for (size_t c = 0; c < COLUMNS; c++) {
+            if (m_decimals) {
+                iotconnect_telemetry_put_number_precision(&enc, m_names[c], p_rows[r][c], m_decimals);
+            } else {
+                iotconnect_telemetry_put_number(&enc, m_names[c], p_rows[r][c]);
+            }
+        }
+    }
+    return iotconnect_telemetry_end(&enc);
+}
+
+static size_t encode_json(const uint64_t *p_times, const double (*p_rows)[COLUMNS], size_t rows,
+    unsigned char *p_out) {
+    return encode_records(IOTCONNECT_ENCODING_JSON, p_times, p_rows, rows, p_out);
+}
+
+static size_t encode_cbor(const uint64_t *p_times, const double (*p_rows)[COLUMNS], size_t rows,
+    unsigned char *p_out) {
+    return encode_records(IOTCONNECT_ENCODING_CBOR, p_times, p_rows, rows, p_out);
+}
+
+static size_t encode_series(const uint64_t *p_times, const double (*p_rows)[COLUMNS], size_t rows,
+    unsigned char *p_out) {
+    IotConnectSeriesColumn columns[COLUMNS];
+    for (size_t c = 0; c < COLUMNS; c++) {
+        columns[c].p_name = m_names[c];
+        columns[c].precision = (int)m_decimals;
+    }
+    IotConnectSeriesEncoder enc;
+    if (!iotconnect_series_init(&enc, columns, COLUMNS, p_out, MESSAGE_SIZE)) {
+        return 0;
+    }
+    for (size_t r = 0; r < rows; r++) {
+        if (!iotconnect_series_add(&enc, p_times[r], p_rows[r])) {
+            return 0;
+        }
+    }
+    return iotconnect_series_finish(&enc);
+}
+
+static size_t encode_series_base64(const uint64_t *p_times, const double (*p_rows)[COLUMNS],
+    size_t rows, unsigned char *p_out) {
+    static unsigned char block[MESSAGE_SIZE];
+    static char text[MESSAGE_SIZE];
+    size_t len = encode_series(p_times, p_rows, rows, block);
+    if (len == 0 || iotconnect_base64_encode(block, len, text, sizeof(text)) == 0) {
+        return 0;
+    }
+    IotConnectEncoder enc;
+    iotconnect_encoder_init(&enc, IOTCONNECT_ENCODING_JSON, p_out, MESSAGE_SIZE);
+    iotconnect_telemetry_begin(&enc, BENCH_DTG);
+    iotconnect_telemetry_add_record(&enc, (time_t)(p_times[rows - 1] / 1000));
+    iotconnect_telemetry_put_string(&enc, "series", text);
+    return iotconnect_telemetry_end(&enc);
+}
+
+// Decodes a block and compares it with the rows it was made from. Returns the mismatches.
+static unsigned long verify_series(const unsigned char *p_block, size_t len,
+    const uint64_t *p_times, const double (*p_rows)[COLUMNS], size_t rows) {
+    IotConnectSeriesDecoder dec;
+    if (!iotconnect_series_decoder_init(&dec, p_block, len) || dec.rows != rows ||
+        dec.columns != COLUMNS) {
+        return rows;
+    }
+    unsigned long mismatches = 0;
+    uint64_t timestamp;
+    double values[COLUMNS];
+    for (size_t r = 0; r < rows; r++) {
+        if (!iotconnect_series_decoder_next(&dec, &timestamp, values)) {
+            return mismatches + rows - r;
+        }
+        bool same = timestamp == p_times[r];
+        for (size_t c = 0; c < COLUMNS; c++) {
+            same = same && memcmp(&values[c], &p_rows[r][c], sizeof(double)) == 0;
+        }
+        if (!same) {
+            mismatches++;
+        }
+    }
+    return mismatches;
+}
+
+// Slowly drifting readings, with the noise of a real sensor, taken at a nominal interval.
+static void make_rows(uint64_t *p_times, double (*p_rows)[COLUMNS], size_t count,
+    unsigned int interval_ms, unsigned int jitter_ms) {
+    double walk[COLUMNS] = { 21.5, 45.0, 1013.2 };
+    double noise[COLUMNS] = { 0.05, 0.2, 0.1 };
+    double scale = pow(10, m_decimals);
+    uint64_t timestamp = 1609459200000ULL;
+    srand(1);
+    for (size_t r = 0; r < count; r++) {
+        p_times[r] = timestamp + (jitter_ms ? (uint64_t)(rand() % (jitter_ms + 1)) : 0);
+        timestamp += interval_ms;
+        for (size_t c = 0; c < COLUMNS; c++) {
+            walk[c] += ((double)rand() / RAND_MAX - 0.5) * noise[c];
+            p_rows[r][c] = m_decimals ? round(walk[c] * scale) / scale : walk[c];
+        }
+    }
+}
+
+static void run(const char *p_name, EncodeFunction encode, const uint64_t *p_times,
+    const double (*p_rows)[COLUMNS], size_t count, size_t batch, bool verify) {
+    static unsigned char out[MESSAGE_SIZE];
+    size_t bytes = 0;
+    unsigned long failed = 0;
+    long long start = now_ns();
+    for (size_t r = 0; r < count; r += batch) {
+        size_t rows = count - r < batch ? count - r : batch;
+        size_t len = encode(&p_times[r], &p_rows[r], rows, out);
+        if (len == 0) {
+            failed++;
+        }
+        bytes += len;
+    }
+    long long elapsed = now_ns() - start;
+    unsigned long mismatches = 0;
+    for (size_t r = 0; verify && r < count; r += batch) {
+        size_t rows = count - r < batch ? count - r : batch;
+        size_t len = encode(&p_times[r], &p_rows[r], rows, out);
+        mismatches += verify_series(out, len, &p_times[r], &p_rows[r], rows);
+    }
+    printf("%-22s %6.2f bytes/sample %7.1f ns/sample %lu failed", p_name,
+        (double)bytes / (double)(count * COLUMNS), (double)elapsed / (double)(count * COLUMNS),
+        failed);
+    if (verify) {
+        printf(" %lu rows mismatched", mismatches);
+    }
+    printf("\n");
+}
+
+int main(int argc, char *argv[]) {
+    size_t count = 100000;
+    size_t batch = 60;
+    unsigned int interval_ms = 1000;
+    unsigned int jitter_ms = 0;
+    int opt;
+    while ((opt = getopt(argc, argv, "n:b:i:j:p:")) != -1) {
+        switch (opt) {
+        case 'n':
+            count = strtoul(optarg, NULL, 10);
+            break;
+        case 'b':
+            batch = strtoul(optarg, NULL, 10);
+            break;
+        case 'i':
+            interval_ms = (unsigned int)strtoul(optarg, NULL, 10);
+            break;
+        case 'j':
+            jitter_ms = (unsigned int)strtoul(optarg, NULL, 10);
+            break;
+        case 'p':
+            m_decimals = (unsigned int)strtoul(optarg, NULL, 10);
+            break;
+        default:
+            fprintf(stderr, "Usage: %s [-n rows] [-b rows per message] [-i interval_ms] "
+                "[-j jitter_ms] [-p decimals]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (count == 0 || batch == 0 || batch > 1000 || m_decimals > IOTCONNECT_SERIES_MAX_PRECISION) {
+        fprintf(stderr, "Need at least one row, 1 to 1000 rows per message and at most %d decimals\n",
+            IOTCONNECT_SERIES_MAX_PRECISION);
+        return 1;
+    }
+    uint64_t *p_times = malloc(count * sizeof(uint64_t));
+    double (*p_rows)[COLUMNS] = malloc(count * sizeof(*p_rows));
+    if (p_times == NULL || p_rows == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        return 1;
+    }
+    make_rows(p_times, p_rows, count, interval_ms, jitter_ms);
+
+    printf("%zu rows of %d values, %zu rows per message, every %u ms, jitter %u ms, %u decimals\n",
+        count, COLUMNS, batch, interval_ms, jitter_ms, m_decimals);
+    run("iotcl serialized", encode_iotcl, p_times, (const double (*)[COLUMNS])p_rows, count, batch,
+        false);
+    run("encoder JSON", encode_json, p_times, (const double (*)[COLUMNS])p_rows, count, batch, false);
+    run("encoder CBOR", encode_cbor, p_times, (const double (*)[COLUMNS])p_rows, count, batch, false);
+    run("series", encode_series, p_times, (const double (*)[COLUMNS])p_rows, count, batch, true);
+    run("series base64 in JSON", encode_series_base64, p_times, (const double (*)[COLUMNS])p_rows,
+        count, batch, false);
+
+    free(p_times);
+    free(p_rows);
+    return 0;
+}
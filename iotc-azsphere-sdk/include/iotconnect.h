@@ -7,10 +7,23 @@
 #ifndef IOTCONNECT_H
 #define IOTCONNECT_H
 
+#include <applibs/eventloop.h>
 #include "iotconnect_common.h"
 #include "iotconnect_event.h"
 #include "iotconnect_telemetry.h"
 #include "iotconnect_lib.h"
+#include "iotconnect_batch.h"
+#include "iotconnect_queue.h"
+#include "iotconnect_spool.h"
+#include "iotconnect_session.h"
+#include "iotconnect_encoder.h"
+#include "iotconnect_template.h"
+#include "iotconnect_aggregate.h"
+#include "iotconnect_series.h"
+#include "iotconnect_compress.h"
+#include "iotconnect_priority.h"
+#include "iotconnect_inbound.h"
+#include "iotconnect_arena.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -33,11 +46,93 @@ typedef enum {
 
 typedef void (*IotConnectStatusCallback)(IotConnectConnectionStatus data);
 
+typedef enum {
+    IOTCONNECT_SEND_DELIVERED = 0,  // acknowledged by the hub
+    IOTCONNECT_SEND_TIMED_OUT,
+    IOTCONNECT_SEND_FAILED          // send error, or the connection was torn down first
+} IotConnectSendResult;
+
+// Called once per message sent with iotconnect_sdk_send_packet_tracked().
+typedef void (*IotConnectSendCallback)(unsigned int msg_id, IotConnectSendResult result,
+    unsigned int latency_ms, void *p_ctx);
+
+#define IOTCONNECT_SEND_LATENCY_BUCKETS     16
+
+// Covers every message sent to the hub, including batches, drained packets and hello requests.
+typedef struct {
+    unsigned long sent;
+    unsigned long delivered;
+    unsigned long timed_out;
+    unsigned long failed;
+    unsigned int in_flight;
+    unsigned int max_in_flight;
+    // Send to acknowledgement latency of delivered messages. Bucket 0 counts latencies under
+    // 1 ms, bucket i those from 2^(i-1) to 2^i - 1 ms, the last bucket everything above.
+    unsigned long latency_hist[IOTCONNECT_SEND_LATENCY_BUCKETS];
+    unsigned int latency_avg_ms;
+    unsigned int latency_max_ms;
+} IotConnectDeliveryStats;
+
+// Called with a command or hello response parsed in place. The slices point into the message
+// and are only valid during the call.
+typedef void (*IotConnectInboundCallback)(const IotConnectInboundEvent *p_evt);
+
+// Called once the SDK no longer references a buffer passed to iotconnect_sdk_send_packet_buffer().
+typedef void (*IotConnectBufferReleaseCallback)(const char *p_data, void *p_ctx);
+
 typedef struct {
     const char *p_netif;
     const char* p_scope_id;
 } IotConnectAzsphereConfig;
 
+typedef struct {
+    size_t max_bytes;   // Merge telemetry packets into messages of up to this size. 0 disables batching.
+    int max_latency_s;  // Flush pending telemetry at least this often. 0 flushes only when full.
+} IotConnectBatchConfig;
+
+#define IOTCONNECT_QUEUE_DEFAULT_DRAIN_PER_S    10
+
+typedef struct {
+    size_t capacity;    // RAM reserved for telemetry held while disconnected. 0 disables the queue.
+    void *p_buffer;     // Optional storage of capacity bytes. Allocated once by the SDK if NULL.
+    IotConnectQueueDropPolicy drop_policy;
+    int drain_per_s;    // Packets sent per second after reconnecting or a refused send. Defaults to IOTCONNECT_QUEUE_DEFAULT_DRAIN_PER_S.
+} IotConnectQueueConfig;
+
+typedef struct {
+    size_t size;        // Arena for cJSON and IoTConnect lib allocations. 0 keeps using the heap.
+    void *p_buffer;     // Optional storage of size bytes. Allocated once by the SDK if NULL.
+} IotConnectArenaConfig;
+
+typedef struct {
+    int fd;             // Read/write descriptor, e.g. from Storage_OpenMutableFile().
+    off_t offset;       // Start of the region used in the file.
+    size_t size;        // At least IOTCONNECT_HUB_CACHE_SIZE. 0 disables the cache.
+} IotConnectHubCacheConfig;
+
+#define IOTCONNECT_HUB_CACHE_SIZE           512
+
+// Keeps the device within the daily message quota of its IoT Hub tier, counted in 4 KB units
+// (IOTCONNECT_BATCH_BILLING_UNIT), by spreading messages evenly over the day. Setting a quota
+// enables the priority queues, so throttled packets wait in their class, and packs queued
+// telemetry into 4 KB messages unless priority.pack_bytes is set. Packets sent with
+// iotconnect_sdk_send_packet_tracked() are not queued and fail while throttled.
+typedef struct {
+    unsigned long daily_messages; // 4 KB messages per UTC day. 0 disables the limiter.
+    unsigned int burst;           // messages that can go out back to back. 0 uses one minute of quota.
+} IotConnectQuotaConfig;
+
+typedef struct {
+    bool enabled;
+    unsigned long daily_messages;
+    unsigned long used_today;       // since midnight UTC
+    unsigned long remaining_today;
+    unsigned int burst_available;   // messages that can go out back to back now
+    unsigned int next_message_ms;   // until the next message can go out, 0 if one can now
+    unsigned long throttled;        // sends held back by the limiter
+    time_t projected_exhaustion;    // at the average rate of the day, 0 if the quota lasts the day
+} IotConnectQuotaInfo;
+
 typedef struct {
     char *env;    // Environment name. Contact your representative for details.
     char *cpid;   // Settings -> Company Profile.
@@ -46,6 +141,21 @@ typedef struct {
     IotclCommandCallback cmd_cb; // callback for command events.
     IotclMessageCallback msg_cb; // callback for ALL messages, including the specific ones like cmd or ota callback.
     IotConnectStatusCallback status_cb; // callback for connection status
+    IotConnectSendCallback send_cb; // delivery result of packets sent with iotconnect_sdk_send_packet_tracked()
+    int idle_poll_ms; // longest time between IoT Hub client runs while idle, bounds C2D latency. 0 uses 50 ms, i.e. 20 idle wakeups a second; e.g. 1000 wakes once a second for up to 1 s of command latency.
+    unsigned int provisioning_timeout_ms; // DPS timeout of each attempt, made in the background. 0 uses 10 s.
+    EventLoop *event_loop; // when set, the SDK registers its timers with this application loop and iotconnect_sdk_poll() is not needed
+    IotConnectInboundCallback inbound_cb; // when set, commands and hello responses are parsed without heap use and passed here instead of to cmd_cb and msg_cb
+    IotConnectBatchConfig batch; // telemetry batching, e.g. max_bytes = IOTCONNECT_BATCH_BILLING_UNIT
+    IotConnectQueueConfig queue; // store-and-forward of telemetry while disconnected
+    IotConnectArenaConfig arena; // bounded memory for serializing and parsing messages
+    IotConnectSpoolConfig spool; // durable store-and-forward in a file, used instead of the queue when set
+    IotConnectHubCacheConfig hub_cache; // keeps the hub assigned by DPS so later starts skip provisioning
+    IotConnectSessionConfig session; // keeps the hello session so telemetry starts right after authentication
+    IotConnectEncoding encoding; // of telemetry built with iotconnect_sdk_telemetry_begin(), JSON by default
+    IotConnectCompressConfig compression; // deflate or gzip of large outgoing messages, off by default
+    IotConnectPriorityConfig priority; // per-class send queues in front of the IoT Hub client, off by default
+    IotConnectQuotaConfig quota; // daily message quota and burst, off by default
 } IotConnectClientConfig;
 
 IotConnectClientConfig *iotconnect_sdk_init_and_get_config(void);
@@ -58,10 +168,75 @@ IotclConfig *iotconnect_sdk_get_lib_config(void);
 
 void iotconnect_sdk_send_packet(const char *data);
 
+// Same as iotconnect_sdk_send_packet(), for a packet of len bytes that need not be NUL terminated.
+void iotconnect_sdk_send_packet_len(const char *data, size_t len);
+
+// Sends a packet in a priority class. Telemetry takes the iotconnect_sdk_send_packet_len() path
+// and control packets, such as command acknowledgements, go out right away like hello requests.
+// Without priority queues, alarms and bulk packets are handled as telemetry. Packets sent with
+// iotconnect_sdk_send_packet_tracked() bypass the class queues.
+void iotconnect_sdk_send_packet_class(const char *data, size_t len, IotConnectSendClass send_class);
+
+// Sends a packet and hands the buffer back through release_cb once it is no longer needed,
+// e.g. to free a string from iotcl_create_serialized_string() with iotcl_destroy_serialized().
+void iotconnect_sdk_send_packet_buffer(const char *data, size_t len,
+    IotConnectBufferReleaseCallback release_cb, void *p_ctx);
+
+// Sends a packet right away, bypassing batching and store-and-forward, and reports its delivery
+// to send_cb with p_ctx. Returns the message id, or 0 if the packet could not be sent now, e.g.
+// while not connected. Pending batched records are flushed first to keep the order.
+unsigned int iotconnect_sdk_send_packet_tracked(const char *data, size_t len, void *p_ctx);
+
+void iotconnect_sdk_get_delivery_stats(IotConnectDeliveryStats *p_stats);
+
+void iotconnect_sdk_get_quota_info(IotConnectQuotaInfo *p_info);
+
+// Starts a telemetry message in the configured encoding, for the current session, in p_buf.
+// Add records with iotconnect_telemetry_add_record() and the iotconnect_telemetry_put_*()
+// functions, then send the iotconnect_telemetry_end() bytes with iotconnect_sdk_send_packet_len().
+// Packets not starting with '{' are sent with the content type of the configured encoding.
+// Batching only merges JSON packets.
+bool iotconnect_sdk_telemetry_begin(IotConnectEncoder *p_enc, unsigned char *p_buf, size_t size);
+
+// Compiles a telemetry template in the configured encoding, see iotconnect_template.h.
+IotConnectTemplate *iotconnect_sdk_template_create(const IotConnectAttribute *p_attrs, size_t count);
+
+// Renders the template slots as a message of the current session, timestamped now, ready for
+// iotconnect_sdk_send_packet_len(). The buffer is reused by the next render of the template.
+const char *iotconnect_sdk_template_render(IotConnectTemplate *p_tmpl, size_t *p_len);
+
+// Filter stage in front of iotconnect_sdk_send_packet_len(): renders the template attributes
+// that pass their report-on-change filter and sends them, or sends nothing when none passes.
+IotConnectTemplateResult iotconnect_sdk_send_template_changes(IotConnectTemplate *p_tmpl);
+
+// Aggregates samples over windows, see iotconnect_aggregate.h, and sends one record per window
+// in the configured encoding from a timer every hop. Feed it with iotconnect_aggregator_add().
+// Call after iotconnect_sdk_init(). Up to 4 aggregators can run at a time. Aggregators not
+// destroyed by then are destroyed by iotconnect_sdk_deinit().
+IotConnectAggregator *iotconnect_sdk_aggregator_create(const IotConnectAggregateAttribute *p_attrs,
+    size_t count, const IotConnectWindowConfig *p_window);
+void iotconnect_sdk_aggregator_destroy(IotConnectAggregator *p_agg);
+
+// Sends a finished series block, see iotconnect_series.h, base64 encoded in the string attribute
+// p_attribute of a single record timestamped now, in the configured encoding.
+bool iotconnect_sdk_send_series(const unsigned char *p_block, size_t len, const char *p_attribute);
+
+// Send any telemetry held back by batching now.
+void iotconnect_sdk_flush(void);
+
 unsigned int iotconnect_sdk_poll(int wait_time_ms);
 
+// Returns a descriptor that becomes readable when the SDK has events to process, or -1. An
+// application running its own loop can wait on it and then call iotconnect_sdk_poll(0).
+// Not needed when the application loop is passed in the event_loop config field.
+int iotconnect_sdk_get_wait_fd(void);
+
 void iotconnect_sdk_disconnect(void);
 
+// Releases the SDK after iotconnect_sdk_disconnect(), including its registrations with the
+// application event loop. Call it before closing that loop.
+void iotconnect_sdk_deinit(void);
+
 #ifdef __cplusplus
 }
 #endif
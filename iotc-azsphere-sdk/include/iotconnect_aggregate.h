@@ -0,0 +1,84 @@
+//
+// Copyright: Avnet 2021
+// Windowed aggregation of telemetry: samples taken at a high rate are reduced on the device to
+// per-window statistics, uploaded as one record per window.
+//
+// Windows are made of panes of hop_ms. Each pane keeps count, sum, minimum and maximum of every
+// attribute, so adding a sample is O(1). When a pane closes, the statistics of the last
+// window_ms / hop_ms panes are combined into one record: a tumbling window is a single pane,
+// a sliding window of window_ms is reported every hop_ms.
+//
+
+#ifndef IOTCONNECT_AGGREGATE_H
+#define IOTCONNECT_AGGREGATE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <time.h>
+#include "iotconnect_encoder.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define IOTCONNECT_AGGREGATE_MAX_PANES      64
+
+// Statistics reported for an attribute, as name_min, name_max, name_mean and name_count.
+#define IOTCONNECT_AGG_MIN                  0x01
+#define IOTCONNECT_AGG_MAX                  0x02
+#define IOTCONNECT_AGG_MEAN                 0x04
+#define IOTCONNECT_AGG_COUNT                0x08
+#define IOTCONNECT_AGG_ALL                  0x0f
+
+typedef struct {
+    const char *p_name;
+    int precision;          // decimals of min, max and mean, 0 keeps the full value
+    unsigned int stats;     // IOTCONNECT_AGG_* mask, 0 for all of them
+} IotConnectAggregateAttribute;
+
+typedef struct {
+    unsigned int window_ms;
+    unsigned int hop_ms;    // 0 for tumbling windows, else a divisor of window_ms
+} IotConnectWindowConfig;
+
+typedef struct {
+    unsigned long samples;
+    unsigned long rejected;             // NaN or infinite, or an unknown attribute
+    unsigned long windows;              // records emitted
+    unsigned long empty_windows;        // closed without any sample, not emitted
+    unsigned long failed;               // records that could not be rendered
+} IotConnectAggregatorStats;
+
+typedef struct IotConnectAggregator IotConnectAggregator;
+
+// Receives each record, in a buffer owned by the aggregator and reused for the next record.
+typedef void (*IotConnectAggregateEmitCallback)(const unsigned char *p_msg, size_t len,
+    void *p_ctx);
+
+// The first pane starts now. Returns NULL on an invalid window or attribute, on more than
+// IOTCONNECT_TEMPLATE_MAX_ATTRIBUTES statistics in total, or out of memory.
+IotConnectAggregator *iotconnect_aggregator_create(const IotConnectAggregateAttribute *p_attrs,
+    size_t count, const IotConnectWindowConfig *p_window, IotConnectEncoding encoding);
+void iotconnect_aggregator_destroy(IotConnectAggregator *p_agg);
+
+// Adds a sample to the current pane of the attribute given by its index.
+bool iotconnect_aggregator_add(IotConnectAggregator *p_agg, size_t index, double value);
+
+// Closes the panes that have ended and emits a record for each window ending with them, time
+// stamped with timestamp. To be called every hop_ms, or more often; windows closing while it
+// was not called are emitted late rather than lost. Returns the number of records emitted.
+size_t iotconnect_aggregator_advance(IotConnectAggregator *p_agg, const char *p_dtg,
+    time_t timestamp, IotConnectAggregateEmitCallback emit_cb, void *p_ctx);
+
+// Time until the current pane ends.
+unsigned int iotconnect_aggregator_next_ms(const IotConnectAggregator *p_agg);
+unsigned int iotconnect_aggregator_hop_ms(const IotConnectAggregator *p_agg);
+
+void iotconnect_aggregator_get_stats(const IotConnectAggregator *p_agg,
+    IotConnectAggregatorStats *p_stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
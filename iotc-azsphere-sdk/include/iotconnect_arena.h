@@ -0,0 +1,49 @@
+//
+// Copyright: Avnet 2021
+// Fixed-size arena for the short lived allocations of cJSON and the IoTConnect lib, installed
+// with cJSON_InitHooks().
+//
+// Blocks are carved from the arena by bumping an offset and rounded up to a power of two size
+// class. Freed blocks go to a free list per class and are reused by the same message. When the
+// last live block is freed, i.e. at the end of each message, the whole arena is reset. Requests
+// that do not fit fall back to the heap and are counted.
+//
+
+#ifndef IOTCONNECT_ARENA_H
+#define IOTCONNECT_ARENA_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct {
+    unsigned long allocs;           // blocks handed out from the arena
+    unsigned long reused;           // of those, taken from a free list
+    unsigned long fallback_allocs;  // requests served by the heap
+    unsigned long resets;           // times the arena emptied and started over
+    size_t live_blocks;
+    size_t used_bytes;              // bytes carved from the arena since the last reset
+    size_t high_water_bytes;
+} IotConnectArenaStats;
+
+// p_buffer may be NULL, the buffer is then allocated once.
+bool iotconnect_arena_init(void *p_buffer, size_t size);
+
+// Must only be called once nothing allocated from the arena is in use.
+void iotconnect_arena_deinit(void);
+
+void *iotconnect_arena_malloc(size_t size);
+
+// Accepts blocks from the arena and from the heap.
+void iotconnect_arena_free(void *p);
+
+void iotconnect_arena_get_stats(IotConnectArenaStats *p_stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
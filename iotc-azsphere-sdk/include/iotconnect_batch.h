@@ -0,0 +1,53 @@
+//
+// Copyright: Avnet 2021
+// Telemetry batching: merges the records of the top level "d" array of serialized telemetry
+// packets into a single IoTConnect message, flushed when the size cap is reached or on demand.
+//
+
+#ifndef IOTCONNECT_BATCH_H
+#define IOTCONNECT_BATCH_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// IoT Hub meters D2C messages in 4 KB units.
+#define IOTCONNECT_BATCH_BILLING_UNIT       4096
+
+// Called with the merged message. p_data is NUL terminated and only valid during the call.
+typedef void (*IotConnectBatchFlushCallback)(const char *p_data, size_t len);
+
+typedef struct {
+    unsigned long packets;          // telemetry packets merged into flushed messages
+    unsigned long messages;         // messages flushed
+    unsigned long bypassed;         // packets that could not be batched and were sent on their own
+} IotConnectBatchStats;
+
+bool iotconnect_batch_init(size_t max_bytes, IotConnectBatchFlushCallback flush_cb);
+
+void iotconnect_batch_deinit(void);
+
+// Returns false if the packet has no top level "d" array to merge or is bigger than the cap.
+// Pending records are flushed first in that case, so the caller can send the packet as is
+// without reordering. p_packet does not need to be NUL terminated.
+bool iotconnect_batch_add(const char *p_packet, size_t len);
+
+void iotconnect_batch_flush(void);
+
+size_t iotconnect_batch_pending_bytes(void);
+
+void iotconnect_batch_get_stats(IotConnectBatchStats *p_stats);
+
+// Locates the top level "d" array of a serialized telemetry packet, p_open and p_close being the
+// offsets of its brackets. Returns false if there is none or it holds no records.
+bool iotconnect_batch_find_records(const char *p_packet, size_t len, size_t *p_open,
+    size_t *p_close);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
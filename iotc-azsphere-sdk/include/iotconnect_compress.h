@@ -0,0 +1,69 @@
+//
+// Copyright: Avnet 2021
+// Compression of outgoing payloads: messages of at least min_bytes are deflated and sent with
+// a matching content encoding, "deflate" (zlib format) or "gzip", instead of "utf-8".
+// Only enable it when the service reading the messages decodes that content encoding, and keep
+// in mind that IoT Hub routing queries on the message body only apply to utf-8 messages.
+//
+// The compressor keeps its whole state in fixed tables allocated once: a 4 KB match window with
+// hash chains, 24 KB, and the output buffer. Matches are coded with the fixed Huffman codes of
+// deflate, in a single block. A payload that does not get smaller, or does not fit in the
+// output buffer once compressed, is sent as is.
+//
+
+#ifndef IOTCONNECT_COMPRESS_H
+#define IOTCONNECT_COMPRESS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define IOTCONNECT_COMPRESS_DEFAULT_MIN_BYTES   512
+#define IOTCONNECT_COMPRESS_DEFAULT_OUT_BYTES   (16 * 1024)
+#define IOTCONNECT_COMPRESS_DEFAULT_MAX_CHAIN   32
+
+typedef enum {
+    IOTCONNECT_COMPRESS_NONE = 0,
+    IOTCONNECT_COMPRESS_DEFLATE,        // zlib stream, content encoding "deflate"
+    IOTCONNECT_COMPRESS_GZIP            // gzip member, content encoding "gzip"
+} IotConnectCompressMethod;
+
+typedef struct {
+    IotConnectCompressMethod method;
+    size_t min_bytes;       // smaller payloads are sent as is. 0 uses IOTCONNECT_COMPRESS_DEFAULT_MIN_BYTES
+    size_t out_bytes;       // output buffer. 0 uses IOTCONNECT_COMPRESS_DEFAULT_OUT_BYTES
+    unsigned int max_chain; // earlier matches tried per position, more is smaller and slower. 0 uses the default
+} IotConnectCompressConfig;
+
+typedef struct {
+    unsigned long compressed;           // payloads sent compressed
+    unsigned long below_threshold;      // sent as is, smaller than min_bytes
+    unsigned long incompressible;       // sent as is, not smaller once compressed or too big
+    unsigned long long bytes_in;        // of the compressed payloads
+    unsigned long long bytes_out;
+    unsigned long long compress_us;     // time spent compressing, including incompressible payloads
+    unsigned long long attempted_bytes; // input of all compression attempts, for the time per KB
+} IotConnectCompressStats;
+
+bool iotconnect_compress_init(const IotConnectCompressConfig *p_config);
+
+void iotconnect_compress_deinit(void);
+
+// Returns the compressed payload, valid until the next call, or NULL if the payload is to be
+// sent as is: compression off, below the threshold or incompressible.
+const unsigned char *iotconnect_compress_payload(const unsigned char *p_data, size_t len,
+    size_t *p_out_len);
+
+// Content encoding of the payloads returned by iotconnect_compress_payload().
+const char *iotconnect_compress_content_encoding(void);
+
+void iotconnect_compress_get_stats(IotConnectCompressStats *p_stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,106 @@
+//
+// Copyright: Avnet 2021
+// Streaming encoder for telemetry: writes JSON, CBOR (RFC 8949) or MessagePack straight into a
+// caller supplied buffer, without building a document tree and without heap use.
+//
+// Maps and arrays are opened, filled and closed in order. Their element count is not needed
+// up front: a three byte header is reserved when a container is opened and patched when it is
+// closed, then shrunk to the one byte form when the count is small, so the output always uses
+// definite lengths in their shortest form. Containers opened with a known count are written in
+// their final form right away.
+//
+
+#ifndef IOTCONNECT_ENCODER_H
+#define IOTCONNECT_ENCODER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum {
+    IOTCONNECT_ENCODING_JSON = 0,
+    IOTCONNECT_ENCODING_CBOR,
+    IOTCONNECT_ENCODING_MSGPACK
+} IotConnectEncoding;
+
+#define IOTCONNECT_ENCODER_MAX_DEPTH        8
+
+typedef struct {
+    size_t start;           // offset of the container header
+    uint16_t count;         // items written, keys and values both count in maps
+    uint16_t expected;      // entries declared up front, for containers opened with a count
+    bool fixed;
+    bool is_map;
+} IotConnectEncoderLevel;
+
+typedef struct {
+    IotConnectEncoding encoding;
+    unsigned char *p_buf;
+    size_t size;
+    size_t len;
+    bool failed;            // out of space, too deep or unbalanced: the output is unusable
+    int depth;
+    IotConnectEncoderLevel levels[IOTCONNECT_ENCODER_MAX_DEPTH];
+} IotConnectEncoder;
+
+// Content type for IoT Hub messages in the given encoding, URL encoded as the hub expects.
+const char *iotconnect_encoding_content_type(IotConnectEncoding encoding);
+
+void iotconnect_encoder_init(IotConnectEncoder *p_enc, IotConnectEncoding encoding,
+    unsigned char *p_buf, size_t size);
+
+bool iotconnect_encoder_begin_map(IotConnectEncoder *p_enc);
+bool iotconnect_encoder_begin_array(IotConnectEncoder *p_enc);
+// Same, for a container of exactly count entries (key and value pairs in maps).
+bool iotconnect_encoder_begin_map_n(IotConnectEncoder *p_enc, uint16_t count);
+bool iotconnect_encoder_begin_array_n(IotConnectEncoder *p_enc, uint16_t count);
+// Closes the innermost map or array.
+bool iotconnect_encoder_end(IotConnectEncoder *p_enc);
+
+// In maps, keys and values are written alternately. Keys are strings.
+bool iotconnect_encoder_string(IotConnectEncoder *p_enc, const char *p_str);
+bool iotconnect_encoder_string_len(IotConnectEncoder *p_enc, const char *p_str, size_t len);
+bool iotconnect_encoder_int(IotConnectEncoder *p_enc, int64_t value);
+// Integral values are written as integers, others in the shortest form that keeps the value
+// exactly: in JSON the fewest decimal digits, in binary encodings the smallest float. NaN and infinities are written as null, as JSON has no way to carry them.
+bool iotconnect_encoder_double(IotConnectEncoder *p_enc, double value);
+// Value rounded to the given number of decimals (at most 17), written without trailing zeros.
+// JSON digits are produced with integer arithmetic. Binary encodings use an integer when the
+// rounded value is one, else a float when it rounds back to the same decimals.
+bool iotconnect_encoder_double_precision(IotConnectEncoder *p_enc, double value,
+    unsigned int decimals);
+// Fixed point value mantissa * 10^-decimals, e.g. 2145 with 2 decimals for 21.45.
+bool iotconnect_encoder_fixed(IotConnectEncoder *p_enc, int64_t mantissa, unsigned int decimals);
+bool iotconnect_encoder_bool(IotConnectEncoder *p_enc, bool value);
+bool iotconnect_encoder_null(IotConnectEncoder *p_enc);
+
+// Returns the length of the encoded document, or 0 if encoding failed or containers are left
+// open. JSON output is NUL terminated when there is room for it.
+size_t iotconnect_encoder_finish(IotConnectEncoder *p_enc);
+
+// IoTConnect telemetry message: {"dtg": dtg, "mt": 0, "d": [{"dt": time, "d": {attributes}}]}.
+// Records are started with iotconnect_telemetry_add_record() and filled with the setters.
+bool iotconnect_telemetry_begin(IotConnectEncoder *p_enc, const char *p_dtg);
+bool iotconnect_telemetry_add_record(IotConnectEncoder *p_enc, time_t timestamp);
+bool iotconnect_telemetry_put_number(IotConnectEncoder *p_enc, const char *p_name, double value);
+bool iotconnect_telemetry_put_number_precision(IotConnectEncoder *p_enc, const char *p_name,
+    double value, unsigned int decimals);
+bool iotconnect_telemetry_put_fixed(IotConnectEncoder *p_enc, const char *p_name,
+    int64_t mantissa, unsigned int decimals);
+bool iotconnect_telemetry_put_bool(IotConnectEncoder *p_enc, const char *p_name, bool value);
+bool iotconnect_telemetry_put_string(IotConnectEncoder *p_enc, const char *p_name,
+    const char *p_value);
+bool iotconnect_telemetry_put_null(IotConnectEncoder *p_enc, const char *p_name);
+// Closes the message. Returns its length, or 0 on failure.
+size_t iotconnect_telemetry_end(IotConnectEncoder *p_enc);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,59 @@
+//
+// Copyright: Avnet 2021
+// Allocation-free parsing of inbound IoTConnect messages. The payload is scanned in place and the
+// fields of interest are returned as slices pointing into it, so no JSON tree is built and no
+// heap is used per message.
+//
+
+#ifndef IOTCONNECT_INBOUND_H
+#define IOTCONNECT_INBOUND_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Values of the "ct" field in cloud to device messages.
+#define IOTCONNECT_INBOUND_CT_COMMAND       0
+#define IOTCONNECT_INBOUND_CT_OTA           1
+#define IOTCONNECT_INBOUND_CT_HELLO         200
+// Attribute, setting, rule, child device and frequency updates, device deleted and disabled:
+// the device configuration changed in the cloud and the hello handshake must be repeated.
+#define IOTCONNECT_INBOUND_CT_SYNC_FIRST    101
+#define IOTCONNECT_INBOUND_CT_SYNC_LAST     107
+#define IOTCONNECT_INBOUND_CT_NONE          (-1)
+
+// Part of a message. Not NUL terminated. Strings are returned without the quotes and with any
+// escape sequences left as they are.
+typedef struct {
+    const char *p;
+    size_t len;
+} IotConnectSlice;
+
+typedef struct {
+    int ct;                 // message type, IOTCONNECT_INBOUND_CT_NONE if missing
+    int ec;                 // error code of a hello response, 0 if missing
+    IotConnectSlice cmd;    // command line
+    IotConnectSlice ack;    // acknowledgement id
+    IotConnectSlice sid;    // hello response session id
+    IotConnectSlice dtg;    // hello response "meta"."dtg"
+    IotConnectSlice message; // the whole message
+} IotConnectInboundEvent;
+
+// Fields are looked up at the top level, or in the top level "d" object where hello responses
+// keep them. Returns false if the message is not a well formed JSON object.
+bool iotconnect_inbound_parse(const char *p_data, size_t len, IotConnectInboundEvent *p_evt);
+
+// Copies a slice into a buffer of size bytes and NUL terminates it. Returns false if it does
+// not fit.
+bool iotconnect_slice_copy(IotConnectSlice slice, char *p_buf, size_t size);
+
+bool iotconnect_slice_equals(IotConnectSlice slice, const char *p_str);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
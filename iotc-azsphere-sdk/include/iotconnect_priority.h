@@ -0,0 +1,115 @@
+//
+// Copyright: Avnet 2021
+// Priority send queues in front of the IoT Hub client, whose own queue is a single FIFO: each
+// class of messages waits in its own queue and only a few messages per class are handed to the
+// client at a time, so a command acknowledgement or an alarm never sits behind a backlog of
+// telemetry inside it.
+//
+// Classes with a weight of 0 are served first, in class order. The weighted classes share what
+// is left in proportion to their weights (smooth weighted round robin), so bulk traffic keeps
+// moving while telemetry flows. A class is skipped while it has max_outstanding messages sent
+// and not yet acknowledged.
+//
+// With pack_bytes set, the JSON telemetry packets waiting at the head of a queue, other than the
+// control queue, are merged into one message of up to pack_bytes as they are dispatched, in
+// queue order, the way batching merges them. IoT Hub meters messages in 4 KB units, so packets
+// piled up behind a rate limit go out in as few units as they fit in.
+//
+
+#ifndef IOTCONNECT_PRIORITY_H
+#define IOTCONNECT_PRIORITY_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define IOTCONNECT_PRIORITY_LATENCY_BUCKETS     16
+
+typedef enum {
+    IOTCONNECT_CLASS_CONTROL = 0,   // hello requests and command acknowledgements
+    IOTCONNECT_CLASS_ALARM,
+    IOTCONNECT_CLASS_TELEMETRY,
+    IOTCONNECT_CLASS_BULK,          // store-and-forward backlog, diagnostic dumps
+    IOTCONNECT_CLASS_COUNT
+} IotConnectSendClass;
+
+typedef struct {
+    size_t capacity;                // queue bytes. 0 uses the class default
+    unsigned int weight;            // 0 for strict priority, else share of the weighted classes
+    unsigned int max_outstanding;   // sent, not yet acknowledged. 0 uses the class default
+} IotConnectClassConfig;
+
+// Defaults: control 4 KB, strict, 8 outstanding; alarm 4 KB, strict, 8; telemetry 16 KB,
+// weight 4, 16; bulk 16 KB, weight 1, 8. A class left with a capacity of 0 takes all of its
+// defaults, otherwise its weight is used as given. A class sends at most max_outstanding
+// messages per acknowledgement round trip.
+typedef struct {
+    bool enabled;
+    IotConnectClassConfig classes[IOTCONNECT_CLASS_COUNT];
+    size_t pack_bytes;              // e.g. IOTCONNECT_BATCH_BILLING_UNIT. 0 sends packets as queued
+} IotConnectPriorityConfig;
+
+typedef struct {
+    unsigned long queued;
+    unsigned long rejected;             // queue full, left to the caller
+    unsigned long sent;                 // packets, packed or not
+    unsigned long messages;             // handed to the client, fewer than sent when packing
+    unsigned long packed;               // packets merged into a message with others
+    unsigned long failed;               // packets the client refused for good, dropped
+    unsigned long acknowledged;         // messages completed, delivered or not
+    size_t pending;                     // messages waiting in the queue
+    size_t pending_bytes;
+    unsigned int outstanding;
+    unsigned int max_outstanding_seen;
+    // Time from queued to handed to the client. Bucket 0 counts latencies under 1 ms, bucket i
+    // those from 2^(i-1) to 2^i - 1 ms, the last bucket everything above.
+    unsigned long queue_latency_hist[IOTCONNECT_PRIORITY_LATENCY_BUCKETS];
+    unsigned long long queue_latency_sum_ms;
+    unsigned int queue_latency_max_ms;
+    // Time from handed to the client to acknowledged, as reported to iotconnect_priority_complete()
+    unsigned long long ack_latency_sum_ms;
+    unsigned int ack_latency_max_ms;
+} IotConnectClassStats;
+
+typedef enum {
+    IOTCONNECT_PRIORITY_SENT = 0,
+    IOTCONNECT_PRIORITY_RETRY,      // cannot take it now: not connected, throttled, no free slot
+    IOTCONNECT_PRIORITY_FAILED      // can never be sent
+} IotConnectPrioritySendResult;
+
+// Hands a message to the client. On IOTCONNECT_PRIORITY_RETRY the message stays at the head of
+// its queue and the dispatch stops, on IOTCONNECT_PRIORITY_FAILED it is dropped and the dispatch
+// goes on. p_data is only valid during the call.
+typedef IotConnectPrioritySendResult (*IotConnectPrioritySendFunction)(const char *p_data,
+    size_t len, IotConnectSendClass send_class);
+
+bool iotconnect_priority_init(const IotConnectPriorityConfig *p_config,
+    IotConnectPrioritySendFunction send_fn);
+
+void iotconnect_priority_deinit(void);
+
+bool iotconnect_priority_is_enabled(void);
+
+// Returns false if the queue of the class is full.
+bool iotconnect_priority_enqueue(IotConnectSendClass send_class, const char *p_data, size_t len);
+
+// Sends messages in class order until every queue is empty or at its outstanding limit, or the
+// send function asks to retry one later. Returns the number of messages sent, packed ones counting once.
+size_t iotconnect_priority_dispatch(void);
+
+// A message of the class sent by the dispatcher was acknowledged or failed.
+void iotconnect_priority_complete(IotConnectSendClass send_class, unsigned int ack_latency_ms);
+
+size_t iotconnect_priority_pending(void);
+unsigned int iotconnect_priority_outstanding(void);
+
+void iotconnect_priority_get_stats(IotConnectSendClass send_class, IotConnectClassStats *p_stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,56 @@
+//
+// Copyright: Avnet 2021
+// Store-and-forward queue: a bounded ring buffer in fixed memory that holds serialized packets
+// while the device is not connected to IoTConnect.
+//
+
+#ifndef IOTCONNECT_QUEUE_H
+#define IOTCONNECT_QUEUE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum {
+    IOTC_QUEUE_DROP_OLDEST = 0,     // make room by discarding the oldest packets
+    IOTC_QUEUE_DROP_NEWEST          // reject the packet being queued
+} IotConnectQueueDropPolicy;
+
+typedef struct {
+    unsigned long queued_packets;   // packets accepted into the queue
+    unsigned long long queued_bytes;
+    unsigned long dropped_packets;  // packets lost to the drop policy
+    unsigned long long dropped_bytes;
+    unsigned long sent_packets;     // packets drained to the hub
+    unsigned long long sent_bytes;
+    size_t pending_packets;         // packets currently held
+    size_t pending_bytes;
+    size_t high_water_bytes;        // peak ring usage, including record headers
+} IotConnectQueueStats;
+
+// p_buffer is optional storage of capacity bytes. The queue allocates it once if NULL.
+bool iotconnect_queue_init(size_t capacity, void *p_buffer, IotConnectQueueDropPolicy policy);
+
+void iotconnect_queue_deinit(void);
+
+bool iotconnect_queue_push(const char *p_data, size_t len);
+
+// Returns the oldest packet, NUL terminated, or NULL if the queue is empty. The pointer stays
+// valid until the packet is popped.
+const char *iotconnect_queue_peek(size_t *p_len);
+
+// Removes the oldest packet after it was sent.
+void iotconnect_queue_pop(void);
+
+size_t iotconnect_queue_count(void);
+
+void iotconnect_queue_get_stats(IotConnectQueueStats *p_stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,114 @@
+//
+// Copyright: Avnet 2021
+// Compact encoding of numeric telemetry series, for messages carrying many samples: timestamps
+// and values are compressed as in Facebook's Gorilla, with delta-of-delta timestamps and XOR
+// encoded doubles, so a sample of a slowly changing value takes a few bits instead of a JSON
+// key and its decimal text.
+//
+// A block holds rows of one millisecond timestamp and one value per column. Layout, big endian:
+//   u8 version (1), u8 columns, u16 rows,
+//   per column: u8 name length, name, u8 precision,
+//   then a bit stream, most significant bit first, padded with zero bits to a byte:
+//   row 0: timestamp in 64 bits, each value in 64 bits,
+//   next rows: timestamp delta-of-delta, then each value coded against the previous row.
+// Columns with a precision of 0 hold doubles, coded by XOR with the previous value: '0' if equal,
+// '10' and the meaningful bits if they fit in the previous leading/trailing zero window, else
+// '11', 5 bits of leading zeros, 6 bits of meaningful length - 1 and the meaningful bits.
+// Columns with a precision p hold round(value * 10^p), as the JSON path would report it, first
+// as a 64 bit two's complement integer, then as deltas. Deltas and delta-of-deltas use
+//   '0' for 0, '10' + 7 bits for -63..64, '110' + 9 bits for -255..256,
+//   '1110' + 12 bits for -2047..2048, '11110' + 32 bits for int32, '11111' + 64 bits,
+// the short forms holding the value plus 63, 255 or 2047.
+//
+
+#ifndef IOTCONNECT_SERIES_H
+#define IOTCONNECT_SERIES_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define IOTCONNECT_SERIES_VERSION           1
+#define IOTCONNECT_SERIES_MAX_COLUMNS       16
+#define IOTCONNECT_SERIES_MAX_ROWS          UINT16_MAX
+#define IOTCONNECT_SERIES_MAX_PRECISION     9
+
+typedef struct {
+    const char *p_name;     // up to 255 bytes
+    int precision;          // 0 for lossless doubles, else decimals kept, as fixed point
+} IotConnectSeriesColumn;
+
+typedef struct {
+    uint64_t bits;          // previous double, or previous fixed point value
+    int leading;            // XOR window of the previous value, -1 before the first window
+    int trailing;
+    double scale;           // 10^precision, 0 for doubles
+} IotConnectSeriesColumnState;
+
+typedef struct {
+    unsigned char *p_buf;
+    size_t size;
+    size_t bit_len;
+    size_t columns;
+    size_t rows;
+    uint64_t prev_time;
+    int64_t prev_delta;
+    bool full;              // the last row did not fit, finish the block and start another
+    IotConnectSeriesColumnState state[IOTCONNECT_SERIES_MAX_COLUMNS];
+} IotConnectSeriesEncoder;
+
+// Writes the block header. Returns false if a column is invalid or the header does not fit.
+bool iotconnect_series_init(IotConnectSeriesEncoder *p_enc, const IotConnectSeriesColumn *p_columns,
+    size_t count, unsigned char *p_buf, size_t size);
+
+// Appends a row, one value per column. Returns false, leaving the block as it was, when the row
+// does not fit (full is set), the block has IOTCONNECT_SERIES_MAX_ROWS rows, or a fixed point
+// value is not finite or out of range.
+bool iotconnect_series_add(IotConnectSeriesEncoder *p_enc, uint64_t timestamp_ms,
+    const double *p_values);
+
+// Completes the block and returns its length, 0 if it holds no row.
+size_t iotconnect_series_finish(IotConnectSeriesEncoder *p_enc);
+
+// Reference decoder
+typedef struct {
+    const unsigned char *p_block;
+    size_t len;
+    size_t bit_pos;
+    size_t columns;
+    size_t rows;
+    size_t row;             // rows read so far
+    bool failed;
+    const char *p_names[IOTCONNECT_SERIES_MAX_COLUMNS];     // not NUL terminated
+    size_t name_lens[IOTCONNECT_SERIES_MAX_COLUMNS];
+    int precisions[IOTCONNECT_SERIES_MAX_COLUMNS];
+    uint64_t prev_time;
+    int64_t prev_delta;
+    IotConnectSeriesColumnState state[IOTCONNECT_SERIES_MAX_COLUMNS];
+} IotConnectSeriesDecoder;
+
+// Parses the header. Returns false if this is not a valid block.
+bool iotconnect_series_decoder_init(IotConnectSeriesDecoder *p_dec, const unsigned char *p_block,
+    size_t len);
+// Reads the next row into p_values, which has room for one value per column. Returns false after
+// the last row or on a malformed block, failed telling which.
+bool iotconnect_series_decoder_next(IotConnectSeriesDecoder *p_dec, uint64_t *p_timestamp_ms,
+    double *p_values);
+
+// Standard base64 with padding, for carrying a block in a text message. Returns the length
+// written, without the NUL terminator, or 0 if out_size is too small.
+size_t iotconnect_base64_encode(const unsigned char *p_data, size_t len, char *p_out,
+    size_t out_size);
+// Returns the decoded length, or 0 on invalid input or a too small output buffer.
+size_t iotconnect_base64_decode(const char *p_text, size_t len, unsigned char *p_out,
+    size_t out_size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
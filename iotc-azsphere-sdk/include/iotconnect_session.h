@@ -0,0 +1,63 @@
+//
+// Copyright: Avnet 2021
+// Cache of the IoTConnect session returned by the hello handshake: the session id (SID) and the
+// device template guid (DTG). Kept in a region of a file, so after a restart or reconnect
+// telemetry can be sent as soon as the hub is authenticated, while the hello request confirms
+// the session in the background.
+//
+// An entry is used for up to max_age_s after it was last confirmed, and is dropped when the cloud
+// reports a change of the device configuration or rejects the hello request. Age is measured on
+// the wall clock. An entry that looks saved in the future, e.g. before the clock was set, is
+// still used, since the hello request confirms it anyway.
+//
+
+#ifndef IOTCONNECT_SESSION_H
+#define IOTCONNECT_SESSION_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define IOTCONNECT_SESSION_CACHE_SIZE           256
+#define IOTCONNECT_SESSION_DEFAULT_MAX_AGE_S    (24 * 60 * 60)
+
+typedef struct {
+    int fd;                 // Read/write descriptor, e.g. from Storage_OpenMutableFile().
+    off_t offset;           // Start of the region used in the file.
+    size_t size;            // At least IOTCONNECT_SESSION_CACHE_SIZE. 0 disables the cache.
+    int max_age_s;          // Defaults to IOTCONNECT_SESSION_DEFAULT_MAX_AGE_S.
+} IotConnectSessionConfig;
+
+typedef struct {
+    unsigned long hits;             // connections that started with a cached session
+    unsigned long misses;           // no entry, or one written for another scope
+    unsigned long expired;
+    unsigned long invalidated;      // dropped after a cloud side change or a rejected hello
+    unsigned long refreshed;        // hello responses that changed the cached session
+} IotConnectSessionStats;
+
+// Reads the entry saved for key, typically the DPS scope id. Returns false if the cache is
+// disabled or unreadable.
+bool iotconnect_session_open(const IotConnectSessionConfig *p_cfg, const char *p_key);
+
+// Copies a valid entry into the sid and dtg buffers, each of size bytes. Returns false if
+// there is none, in which case the buffers are left untouched.
+bool iotconnect_session_load(char *p_sid, char *p_dtg, size_t size);
+
+// Saves the session from a successful hello response. An unchanged entry is only written again
+// once half of max_age_s has passed, to extend its validity.
+void iotconnect_session_store(const char *p_sid, const char *p_dtg);
+
+void iotconnect_session_invalidate(void);
+
+void iotconnect_session_get_stats(IotConnectSessionStats *p_stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,78 @@
+//
+// Copyright: Avnet 2021
+// Durable telemetry spool: an append-only log of serialized packets kept in a region of a file,
+// e.g. the Azure Sphere mutable storage file or a plain file on a Linux host.
+//
+// The region is split into fixed size segments, reused oldest first. Each segment starts with a
+// header carrying a sequence number, followed by records of an 8 byte header and the payload.
+// The record CRC covers the segment sequence number, so stale records left in a reused segment
+// are never mistaken for new ones. Records are coalesced in RAM and written in one go, and
+// progress of the drain is logged as acknowledgement records, so the spool resumes where it
+// left off after a reboot or crash. Every write ends with a zeroed record header, so after a
+// restart appending continues in the newest segment unless its last write was torn. Delivery
+// is at least once: packets sent after the last written acknowledgement are sent again after a
+// crash.
+//
+
+#ifndef IOTCONNECT_SPOOL_H
+#define IOTCONNECT_SPOOL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define IOTCONNECT_SPOOL_DEFAULT_SEGMENT_SIZE       (8 * 1024)
+#define IOTCONNECT_SPOOL_DEFAULT_COALESCE_BYTES     1024
+#define IOTCONNECT_SPOOL_DEFAULT_FLUSH_INTERVAL_S   5
+
+typedef struct {
+    int fd;                 // Read/write descriptor, e.g. from Storage_OpenMutableFile().
+    off_t offset;           // Start of the region used in the file.
+    size_t size;            // Size of the region, at least two segments. 0 disables the spool.
+    size_t segment_size;    // Defaults to IOTCONNECT_SPOOL_DEFAULT_SEGMENT_SIZE.
+    size_t coalesce_bytes;  // RAM write buffer. Defaults to IOTCONNECT_SPOOL_DEFAULT_COALESCE_BYTES.
+    int flush_interval_s;   // Longest time records stay in RAM. Defaults to IOTCONNECT_SPOOL_DEFAULT_FLUSH_INTERVAL_S.
+} IotConnectSpoolConfig;
+
+typedef struct {
+    unsigned long appended_records;
+    unsigned long long appended_bytes;  // payload bytes accepted
+    unsigned long long written_bytes;   // bytes written to the file, including all headers
+    unsigned long write_ops;
+    unsigned long sent_records;
+    unsigned long dropped_records;      // overwritten before they were sent, or too big
+    unsigned long recovered_records;    // unsent records found when the spool was opened
+    unsigned long recovery_us;          // time taken to scan the region when opened
+} IotConnectSpoolStats;
+
+// Opens the spool and recovers unsent records from a previous run.
+bool iotconnect_spool_open(const IotConnectSpoolConfig *p_cfg);
+
+// Writes out buffered records. Does not close the descriptor.
+void iotconnect_spool_close(void);
+
+bool iotconnect_spool_append(const char *p_data, size_t len);
+
+// Writes the RAM buffer to the file.
+bool iotconnect_spool_sync(void);
+
+// Returns the oldest unsent record, NUL terminated, or NULL if there is none. The pointer stays
+// valid until the next spool call.
+const char *iotconnect_spool_peek(size_t *p_len);
+
+// Marks the record returned by iotconnect_spool_peek() as sent.
+void iotconnect_spool_pop(void);
+
+size_t iotconnect_spool_pending(void);
+
+void iotconnect_spool_get_stats(IotConnectSpoolStats *p_stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,119 @@
+//
+// Copyright: Avnet 2021
+// Telemetry templates: a fixed set of attributes is compiled once into a pre-rendered message
+// skeleton, then each sample is serialized by filling the attribute slots and rendering them
+// into the template's own buffer. Rendering allocates nothing and only formats the values, the
+// rest of the message is copied from the skeleton.
+//
+// Attributes can also be filtered, to report slowly changing values only when they move: see
+// iotconnect_template_render_changes().
+//
+
+#ifndef IOTCONNECT_TEMPLATE_H
+#define IOTCONNECT_TEMPLATE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+#include "iotconnect_encoder.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define IOTCONNECT_TEMPLATE_MAX_ATTRIBUTES  64
+#define IOTCONNECT_TEMPLATE_DTG_SIZE        64
+#define IOTCONNECT_TEMPLATE_STRING_SIZE     32  // default max_len of string attributes
+
+typedef enum {
+    IOTCONNECT_ATTR_NUMBER = 0,
+    IOTCONNECT_ATTR_INTEGER,
+    IOTCONNECT_ATTR_BOOL,
+    IOTCONNECT_ATTR_STRING
+} IotConnectAttributeType;
+
+typedef struct {
+    const char *p_name;
+    IotConnectAttributeType type;
+    int precision;          // numbers: decimals to round to (at most 17), 0 keeps the full value
+    size_t max_len;         // strings: longest value accepted, 0 uses IOTCONNECT_TEMPLATE_STRING_SIZE
+    // Report-on-change filter, used by iotconnect_template_render_changes(). A value is reported
+    // when it differs from the last one reported by more than the larger of deadband and
+    // deadband_rel times that value (any change when both are 0; strings and bools on any change),
+    // but not within min_interval_ms of the last report. An unchanged value is still reported
+    // once max_silence_ms have passed, bounding how stale the cloud view gets.
+    double deadband;
+    double deadband_rel;    // e.g. 0.02 for 2%
+    unsigned int min_interval_ms;
+    unsigned int max_silence_ms;    // 0 never reports unchanged values
+} IotConnectAttribute;
+
+typedef enum {
+    IOTCONNECT_TEMPLATE_RENDERED = 0,
+    IOTCONNECT_TEMPLATE_SUPPRESSED,     // no attribute passed its filter, nothing to send
+    IOTCONNECT_TEMPLATE_FAILED
+} IotConnectTemplateResult;
+
+// Counters of iotconnect_template_render_changes(), to tune the filters against bandwidth.
+typedef struct {
+    unsigned long offered;              // values set when rendering
+    unsigned long reported;
+    unsigned long heartbeats;           // reported unchanged, as max_silence_ms ran out
+    unsigned long deadband_suppressed;  // unchanged, or within the deadband
+    unsigned long interval_suppressed;  // changed, but within min_interval_ms of the last report
+} IotConnectAttributeStats;
+
+typedef struct {
+    unsigned long renders;
+    unsigned long suppressed;           // renders with nothing to send
+    IotConnectAttributeStats values;    // summed over the attributes
+} IotConnectTemplateStats;
+
+typedef struct IotConnectTemplate IotConnectTemplate;
+
+// Compiles the attributes, in order, into a template for the given encoding. Names are copied.
+// Returns NULL if an attribute is invalid or memory runs out.
+IotConnectTemplate *iotconnect_template_create(const IotConnectAttribute *p_attrs, size_t count,
+    IotConnectEncoding encoding);
+void iotconnect_template_destroy(IotConnectTemplate *p_tmpl);
+
+// Slots are addressed by the attribute index given to iotconnect_template_create() and keep their
+// value until set again. Slots never set are sent as null. String values are not copied and must
+// stay valid until rendered. Setters fail on a type mismatch or a string over max_len.
+bool iotconnect_template_set_number(IotConnectTemplate *p_tmpl, size_t index, double value);
+// Number attributes can also take a fixed point value, mantissa * 10^-precision, e.g. 2145 for
+// 21.45 with a precision of 2, formatted without any floating point conversion.
+bool iotconnect_template_set_fixed(IotConnectTemplate *p_tmpl, size_t index, int64_t mantissa);
+bool iotconnect_template_set_integer(IotConnectTemplate *p_tmpl, size_t index, int64_t value);
+bool iotconnect_template_set_bool(IotConnectTemplate *p_tmpl, size_t index, bool value);
+bool iotconnect_template_set_string(IotConnectTemplate *p_tmpl, size_t index, const char *p_value);
+void iotconnect_template_clear(IotConnectTemplate *p_tmpl, size_t index);
+
+// Renders a one record telemetry message with the current slot values. The returned buffer
+// belongs to the template and is overwritten by the next render. Returns NULL on failure,
+// e.g. a dtg longer than IOTCONNECT_TEMPLATE_DTG_SIZE - 1.
+const unsigned char *iotconnect_template_render(IotConnectTemplate *p_tmpl, const char *p_dtg,
+    time_t timestamp, size_t *p_len);
+
+// Same, with only the attributes passing their filter. Slots never set are left out rather than
+// sent as null. Returns IOTCONNECT_TEMPLATE_SUPPRESSED, rendering nothing, when no attribute
+// passes. The values rendered become the reference for the next filtering.
+IotConnectTemplateResult iotconnect_template_render_changes(IotConnectTemplate *p_tmpl,
+    const char *p_dtg, time_t timestamp, const unsigned char **pp_msg, size_t *p_len);
+
+// Makes the next iotconnect_template_render_changes() report every set attribute, e.g. after
+// the cloud asked for the device state again.
+void iotconnect_template_reset_filters(IotConnectTemplate *p_tmpl);
+
+bool iotconnect_template_get_attribute_stats(const IotConnectTemplate *p_tmpl, size_t index,
+    IotConnectAttributeStats *p_stats);
+void iotconnect_template_get_stats(const IotConnectTemplate *p_tmpl, IotConnectTemplateStats *p_stats);
+
+IotConnectEncoding iotconnect_template_get_encoding(const IotConnectTemplate *p_tmpl);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -8,6 +8,7 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <applibs/log.h>
+#include "cJSON.h"
 #include "azsphere_iothub_client.h"
 #include "iotconnect.h"
 
@@ -15,6 +16,10 @@
 /* Static definition                                                                        */
 /********************************************************************************************/
 #define SEND_HELLO_INTERVAL_S               15 //secs
+#define MAX_AGGREGATORS                     4
+#define PRIORITY_RETRY_MS                   1000
+#define DRAIN_TICKS_PER_S                   10  // a refused send costs the rest of one tick
+#define SERIES_MESSAGE_OVERHEAD             128 // dtg, record and keys around the base64 text
 
 /********************************************************************************************/
 /* Member variables declaration                                                             */
@@ -23,27 +28,244 @@ static IotConnectClientConfig config = { 0 };
 static IotclConfig lib_config = { 0 };
 static bool iothub_authenticated = false;
 static bool iotconnect_connected = false;
+static bool hello_confirmed = false;    // a hello response was received since authentication
+static bool session_known = false;      // sid_str and dtg_str hold a session from this run
 static char sid_str[80] = "";
 static char dtg_str[80] = "";
 static int timer_hndl = 0;
+static int batch_timer_hndl = 0;
+static int drain_timer_hndl = 0;
+static int spool_timer_hndl = 0;
+static int priority_timer_hndl = 0;
+static bool priority_throttled = false; // the last dispatch stopped at the quota
+static struct {
+    IotConnectAggregator *p_agg;
+    int timer_hndl;
+} aggregators[MAX_AGGREGATORS];
 
 /********************************************************************************************/
 /* Helper functions definition                                                              */
 /********************************************************************************************/
+// Telemetry may be binary. Everything else, such as hello requests and command
+// acknowledgements, is JSON from the IoTConnect lib.
+static bool is_binary_packet(const char *data, size_t len) {
+    return config.encoding != IOTCONNECT_ENCODING_JSON && len > 0 && data[0] != '{';
+}
+
+// Packets are compressed here, when enabled, so batching and store-and-forward keep handling
+// the plain packets.
+static IotHubClientReturnCode send_payload(const char *data, size_t len,
+    IotHubSendCompleteCallback complete_cb, void *p_ctx, unsigned int *p_msg_id) {
+    bool binary = is_binary_packet(data, len);
+    const char *p_content_type = binary ? iotconnect_encoding_content_type(config.encoding) :
+        "application%2fjson";
+    const char *p_content_encoding = binary ? NULL : "utf-8";
+    size_t out_len;
+    const unsigned char *p_out = iotconnect_compress_payload((const unsigned char *)data, len,
+        &out_len);
+    if (p_out) {
+        return iothub_client_send_tracked(p_out, out_len, p_content_type,
+            iotconnect_compress_content_encoding(), complete_cb, p_ctx, p_msg_id);
+    }
+    return iothub_client_send_tracked((const unsigned char *)data, len, p_content_type,
+        p_content_encoding, complete_cb, p_ctx, p_msg_id);
+}
+
+static IotHubClientReturnCode send_bytes(const char *data, size_t len) {
+    return send_payload(data, len, NULL, NULL, NULL);
+}
+
+static void on_priority_complete(unsigned int msg_id, IotHubSendResult result,
+    unsigned int latency_ms, void *p_ctx);
+
+// Hello requests go out as soon as the hub is connected, the other classes once the IoTConnect
+// session is known.
+static IotConnectPrioritySendResult on_priority_send(const char *data, size_t len,
+    IotConnectSendClass send_class) {
+    if (!iothub_authenticated || (send_class != IOTCONNECT_CLASS_CONTROL && !iotconnect_connected)) {
+        return IOTCONNECT_PRIORITY_RETRY;
+    }
+    IotHubClientReturnCode ret = send_payload(data, len, on_priority_complete,
+        (void *)(uintptr_t)send_class, NULL);
+    priority_throttled = (ret == CodeThrottled);
+    switch (ret) {
+    case CodeSuccess:
+        return IOTCONNECT_PRIORITY_SENT;
+    case CodeInvalidState:          // not connected
+    case CodeResourceNotAvailable:  // no free tracking slot
+    case CodeThrottled:
+        return IOTCONNECT_PRIORITY_RETRY;
+    default:
+        Log_Debug("Dropping a message the IoTHub client refused: %.*s\n", (int)len, data);
+        return IOTCONNECT_PRIORITY_FAILED;
+    }
+}
+
+static void on_priority_timer_cb(void *p_ctx);
+
+static void schedule_priority_dispatch(unsigned int delay_ms) {
+    if (priority_timer_hndl) {
+        if (delay_ms == 0) {
+            iothub_client_set_timer_ms(priority_timer_hndl, 0, 0);
+        }
+        return;
+    }
+    if (iothub_client_add_timer_ms(delay_ms, 0, on_priority_timer_cb, NULL,
+        &priority_timer_hndl) != CodeSuccess) {
+        priority_timer_hndl = 0;
+        Log_Debug("Unable to add the priority dispatch timer!\n");
+    }
+}
+
+static void dispatch_priority(void) {
+    priority_throttled = false;
+    iotconnect_priority_dispatch();
+    if (priority_throttled) {
+        // Resumed when the quota allows the next message, whatever is outstanding.
+        IotHubQuotaInfo quota;
+        iothub_client_get_quota_info(&quota);
+        schedule_priority_dispatch(quota.next_unit_ms ? quota.next_unit_ms : PRIORITY_RETRY_MS);
+    } else if (iothub_authenticated && iotconnect_priority_pending() > 0 &&
+        iotconnect_priority_outstanding() == 0) {
+        // A refused send with nothing outstanding has no completion to resume the dispatch.
+        schedule_priority_dispatch(PRIORITY_RETRY_MS);
+    }
+}
+
+// Returns false if the packet could neither be sent nor queued in its class.
+static bool send_class_packet(const char *data, size_t len, IotConnectSendClass send_class) {
+    if (!iotconnect_priority_is_enabled()) {
+        return send_bytes(data, len) == CodeSuccess;
+    }
+    if (!iotconnect_priority_enqueue(send_class, data, len)) {
+        return false;
+    }
+    dispatch_priority();
+    return true;
+}
+
+static void send_packet_now(const char *data, size_t len, IotConnectSendClass send_class) {
+    if (iothub_authenticated) {
+        if (!send_class_packet(data, len, send_class)) {
+            Log_Debug("Failed to send message: %.*s\n", (int)len, data);
+        }
+    }
+}
+
+// Offline telemetry goes to the spool when one is configured, otherwise to the RAM queue.
+static bool store_enabled(void) {
+    return config.spool.size || config.queue.capacity;
+}
+
+static bool store_push(const char *data, size_t len) {
+    if (config.spool.size) {
+        return iotconnect_spool_append(data, len);
+    }
+    return iotconnect_queue_push(data, len);
+}
+
+static const char *store_peek(size_t *p_len) {
+    return config.spool.size ? iotconnect_spool_peek(p_len) : iotconnect_queue_peek(p_len);
+}
+
+static void store_pop(void) {
+    if (config.spool.size) {
+        iotconnect_spool_pop();
+    } else {
+        iotconnect_queue_pop();
+    }
+}
+
+static size_t store_count(void) {
+    if (config.spool.size) {
+        return iotconnect_spool_pending();
+    }
+    return config.queue.capacity ? iotconnect_queue_count() : 0;
+}
+
+static void start_queue_drain(void);
+
+// Telemetry goes through the store-and-forward queue while not connected, and while older
+// packets are still queued so they keep their order.
+static void send_telemetry_packet(const char *data, size_t len) {
+    if (store_enabled()) {
+        if (iotconnect_connected && store_count() == 0 &&
+            send_class_packet(data, len, IOTCONNECT_CLASS_TELEMETRY)) {
+            return;
+        }
+        store_push(data, len);
+        // A send refused while connected, e.g. by a full class queue, is not followed by a
+        // reconnect that would drain the store, and later packets queue up behind it.
+        if (iotconnect_connected && drain_timer_hndl == 0) {
+            start_queue_drain();
+        }
+        return;
+    }
+    send_packet_now(data, len, IOTCONNECT_CLASS_TELEMETRY);
+}
+
+static void stop_queue_drain(void) {
+    if (drain_timer_hndl) {
+        iothub_client_delete_timer(drain_timer_hndl);
+        drain_timer_hndl = 0;
+    }
+}
+
+static void drain_queue(void) {
+    int per_s = config.queue.drain_per_s > 0 ? config.queue.drain_per_s :
+        IOTCONNECT_QUEUE_DEFAULT_DRAIN_PER_S;
+    int budget = (per_s + DRAIN_TICKS_PER_S - 1) / DRAIN_TICKS_PER_S;
+    while (budget-- > 0 && iotconnect_connected) {
+        size_t len;
+        const char *p_data = store_peek(&len);
+        if (p_data == NULL) {
+            break;
+        }
+        // The backlog goes out as bulk, behind live telemetry, acknowledgements and alarms.
+        if (!send_class_packet(p_data, len, IOTCONNECT_CLASS_BULK)) {
+            break;
+        }
+        store_pop();
+    }
+    if (store_count() == 0) {
+        stop_queue_drain();
+    }
+}
+
+static void on_drain_timer_cb(void* p_ctx) {
+    drain_queue();
+}
+
+static void start_queue_drain(void) {
+    if (store_count() == 0) {
+        return;
+    }
+    Log_Debug("Draining %u queued packets\n", (unsigned int)store_count());
+    drain_queue();
+    if (store_count() > 0 && drain_timer_hndl == 0) {
+        if (iothub_client_add_timer_ms(1000 / DRAIN_TICKS_PER_S, 1000 / DRAIN_TICKS_PER_S,
+            on_drain_timer_cb, NULL, &drain_timer_hndl) != CodeSuccess) {
+            Log_Debug("Unable to add the queue drain timer!\n");
+        }
+    }
+}
+
 static void send_hello_msg(void) {
     Log_Debug("Sending hello message to iotconnect...\n");
-    strcpy(sid_str, "");
-    strcpy(dtg_str, "");
     char* hello_request = iotcl_request_create_hello();
-    iotconnect_sdk_send_packet(hello_request);
-    free(hello_request);
+    if (hello_request == NULL) {
+        Log_Debug("ERROR: unable to create the hello request!\n");
+        return;
+    }
+    send_packet_now(hello_request, strlen(hello_request), IOTCONNECT_CLASS_CONTROL);
+    cJSON_free(hello_request);
 }
 
 /********************************************************************************************/
 /* Callback functions definition                                                            */
 /********************************************************************************************/
 static void on_timer_cb(void* p_ctx) {
-    if (!iotconnect_connected) {
+    if (!iotconnect_connected || !hello_confirmed) {
         send_hello_msg();
     } else {
         iothub_client_delete_timer(timer_hndl);
@@ -51,8 +273,140 @@ static void on_timer_cb(void* p_ctx) {
     }
 }
 
+static void on_batch_timer_cb(void* p_ctx) {
+    iotconnect_batch_flush();
+}
+
+static void on_priority_complete(unsigned int msg_id, IotHubSendResult result,
+    unsigned int latency_ms, void *p_ctx) {
+    iotconnect_priority_complete((IotConnectSendClass)(uintptr_t)p_ctx, latency_ms);
+    // Dispatched from the timer, not from within the IoT Hub client callback.
+    schedule_priority_dispatch(0);
+}
+
+static void on_priority_timer_cb(void *p_ctx) {
+    // One-shot, already released
+    priority_timer_hndl = 0;
+    dispatch_priority();
+}
+
+static void on_send_complete(unsigned int msg_id, IotHubSendResult result,
+    unsigned int latency_ms, void* p_ctx) {
+    if (config.send_cb == NULL) {
+        return;
+    }
+    IotConnectSendResult send_result = IOTCONNECT_SEND_FAILED;
+    if (result == SendResultSuccess) {
+        send_result = IOTCONNECT_SEND_DELIVERED;
+    } else if (result == SendResultTimeout) {
+        send_result = IOTCONNECT_SEND_TIMED_OUT;
+    }
+    config.send_cb(msg_id, send_result, latency_ms, p_ctx);
+}
+
+static void on_aggregate_emit(const unsigned char *p_msg, size_t len, void *p_ctx) {
+    iotconnect_sdk_send_packet_len((const char *)p_msg, len);
+}
+
+static void on_aggregate_timer_cb(void* p_ctx) {
+    iotconnect_aggregator_advance((IotConnectAggregator *)p_ctx, dtg_str, time(NULL),
+        on_aggregate_emit, NULL);
+}
+
+static void on_spool_timer_cb(void* p_ctx) {
+    iotconnect_spool_sync();
+}
+
+static void on_batch_flush(const char *p_data, size_t len) {
+    send_telemetry_packet(p_data, len);
+}
+
+static void on_session_ready(void) {
+    iotconnect_connected = true;
+    if (config.status_cb) {
+        config.status_cb(IOTCONNECT_CONNECTED);
+    }
+    if (iotconnect_priority_is_enabled()) {
+        dispatch_priority();
+    }
+    start_queue_drain();
+}
+
+static void on_hello_complete(void) {
+    if (strlen(lib_config.request.sid) > 0 && strlen(lib_config.telemetry.dtg) > 0) {
+        hello_confirmed = true;
+        session_known = true;
+        iotconnect_session_store(sid_str, dtg_str);
+        if (!iotconnect_connected) {
+            on_session_ready();
+        }
+    } else if (iotconnect_connected) {
+        // The cached session was rejected. The hello timer keeps asking for a new one.
+        Log_Debug("Cached IoTConnect session rejected\n");
+        session_known = false;
+        iotconnect_session_invalidate();
+        iotconnect_connected = false;
+        stop_queue_drain();
+        if (config.status_cb) {
+            config.status_cb(IOTCONNECT_DISCONNECTED);
+        }
+    }
+}
+
+// The device configuration changed in the cloud, so the session may have too. Telemetry keeps
+// going with the current one until the hello response replaces it.
+static void on_cloud_sync_request(int ct) {
+    Log_Debug("Cloud configuration changed (ct %d), repeating hello\n", ct);
+    session_known = false;
+    iotconnect_session_invalidate();
+    if (iothub_authenticated) {
+        hello_confirmed = false;
+        send_hello_msg();
+        if (timer_hndl == 0 && iothub_client_add_timer(SEND_HELLO_INTERVAL_S,
+            on_timer_cb, NULL, &timer_hndl) != CodeSuccess) {
+            Log_Debug("Unable to add the hello timer!\n");
+        }
+    }
+}
+
+static bool is_sync_request(int ct) {
+    return ct >= IOTCONNECT_INBOUND_CT_SYNC_FIRST && ct <= IOTCONNECT_INBOUND_CT_SYNC_LAST;
+}
+
+// Commands and hello responses are handled straight from the receive buffer, without the
+// copy and the cJSON tree of iotcl_process_event(). Returns false for messages left to the lib.
+static bool process_inbound_in_place(const char *data, size_t len) {
+    IotConnectInboundEvent evt;
+    if (!iotconnect_inbound_parse(data, len, &evt)) {
+        return false;
+    }
+    switch (evt.ct) {
+    case IOTCONNECT_INBOUND_CT_HELLO:
+        if (evt.ec != 0 || !iotconnect_slice_copy(evt.sid, sid_str, sizeof(sid_str)) ||
+            !iotconnect_slice_copy(evt.dtg, dtg_str, sizeof(dtg_str))) {
+            Log_Debug("Error from hello response. Error code %d.\n", evt.ec);
+            strcpy(sid_str, "");
+            strcpy(dtg_str, "");
+        }
+        config.inbound_cb(&evt);
+        on_hello_complete();
+        return true;
+    case IOTCONNECT_INBOUND_CT_COMMAND:
+        config.inbound_cb(&evt);
+        return true;
+    default:
+        if (is_sync_request(evt.ct)) {
+            on_cloud_sync_request(evt.ct);
+        }
+        return false;
+    }
+}
+
 // this function will Give you Device CallBack payload
 static void on_iothub_data(unsigned char *data, size_t len) {
+    if (config.inbound_cb && process_inbound_in_place((const char *)data, len)) {
+        return;
+    }
     char *str = malloc(len + 1);
     memcpy(str, data, len);
     str[len] = 0;
@@ -66,7 +420,17 @@ static void on_iothub_data(unsigned char *data, size_t len) {
 static void on_iotconnect_status(IotHubAuthenticateStatus status) {
     if (status == StatusAuthenticated) {
         iothub_authenticated = true;
+        hello_confirmed = false;
         if (!iotconnect_connected) {
+            // With a known session telemetry starts now and the hello request only confirms it.
+            // After a reconnect that is the session of this run, else the cached one.
+            if (session_known || iotconnect_session_load(sid_str, dtg_str, sizeof(sid_str))) {
+                Log_Debug("Resuming IoTConnect session\n");
+                on_session_ready();
+            } else {
+                strcpy(sid_str, "");
+                strcpy(dtg_str, "");
+            }
             send_hello_msg();
             if (iothub_client_add_timer(SEND_HELLO_INTERVAL_S,
                 on_timer_cb, NULL, &timer_hndl) != CodeSuccess) {
@@ -80,6 +444,10 @@ static void on_iotconnect_status(IotHubAuthenticateStatus status) {
             iothub_client_delete_timer(timer_hndl);
             timer_hndl = 0;
         }
+        stop_queue_drain();
+        if (config.spool.size) {
+            iotconnect_spool_sync();
+        }
         if (config.status_cb) {
             config.status_cb(IOTCONNECT_DISCONNECTED);
         }
@@ -94,6 +462,10 @@ static void on_message_intercept(IotclEventData data, IotclEventType type) {
     default:
         break; // not handling nay other messages
     }
+    // Messages parsed in place have been checked already.
+    if (config.inbound_cb == NULL && is_sync_request((int)type)) {
+        on_cloud_sync_request((int)type);
+    }
     if (NULL != config.msg_cb) {
         config.msg_cb(data, type);
     }
@@ -105,25 +477,22 @@ static void on_hello_response(IotclEventData data, IotclEventType type) {
         char* p_str = iotcl_clone_response_sid(data);
         if (NULL != p_str) {
             strcpy((char *)lib_config.request.sid, p_str);
-            free(p_str);
+            cJSON_free(p_str);
             Log_Debug("Hello reponse SID is %s\n", lib_config.request.sid);
             p_str = iotcl_clone_response_dtg(data);
             if (NULL != p_str) {
                 strcpy((char *)lib_config.telemetry.dtg, p_str);
-                free(p_str);
+                cJSON_free(p_str);
                 Log_Debug("Hello reponse DTG is %s\n", lib_config.telemetry.dtg);
             } else {
                 Log_Debug("Error from hello response. SID is null.\n");
+                strcpy(dtg_str, "");
             }
         } else {
             Log_Debug("Error from hello response. SID is null.\n");
+            strcpy(sid_str, "");
         }
-        if (strlen(lib_config.request.sid) > 0 && strlen(lib_config.telemetry.dtg) > 0) {
-            iotconnect_connected = true;
-            if (config.status_cb) {
-                config.status_cb(IOTCONNECT_CONNECTED);
-            }
-        }
+        on_hello_complete();
     }
     break;
     default:
@@ -136,16 +505,224 @@ static void on_hello_response(IotclEventData data, IotclEventType type) {
 /******************************************************/
 void iotconnect_sdk_disconnect() {
     Log_Debug("Disconnecting...\n");
+    iotconnect_batch_flush();
+    if (config.spool.size) {
+        iotconnect_spool_sync();
+    }
     iothub_client_disconnect();
 }
 
+void iotconnect_sdk_deinit(void) {
+    if (iothub_client_uninit() != CodeSuccess) {
+        Log_Debug("Failed to release the IoTHub client\n");
+    }
+    // The client timers are gone, and their handles may be reused after the next init.
+    timer_hndl = 0;
+    batch_timer_hndl = 0;
+    drain_timer_hndl = 0;
+    spool_timer_hndl = 0;
+    priority_timer_hndl = 0;
+    for (int i = 0; i < MAX_AGGREGATORS; i++) {
+        aggregators[i].timer_hndl = 0;
+        if (aggregators[i].p_agg) {
+            iotconnect_aggregator_destroy(aggregators[i].p_agg);
+            aggregators[i].p_agg = NULL;
+        }
+    }
+    iotconnect_priority_deinit();
+    iotconnect_compress_deinit();
+    iotconnect_batch_deinit();
+    if (config.spool.size) {
+        iotconnect_spool_close();
+    } else {
+        iotconnect_queue_deinit();
+    }
+    if (config.arena.size) {
+        cJSON_InitHooks(NULL);
+        iotconnect_arena_deinit();
+    }
+}
+
 void iotconnect_sdk_send_packet(const char *data) {
-    if (iothub_authenticated) {
-        if (iothub_client_send_message(data, "application%2fjson", "utf-8") !=
-            CodeSuccess) {
-            Log_Debug("Failed to send message: %s\n", data);
+    if (data == NULL) {
+        Log_Debug("ERROR: data is NULL!\n");
+        return;
+    }
+    iotconnect_sdk_send_packet_len(data, strlen(data));
+}
+
+void iotconnect_sdk_send_packet_len(const char *data, size_t len) {
+    if (config.batch.max_bytes && is_binary_packet(data, len)) {
+        iotconnect_batch_flush();
+    } else if (config.batch.max_bytes && iotconnect_batch_add(data, len)) {
+        return;
+    }
+    send_telemetry_packet(data, len);
+}
+
+void iotconnect_sdk_send_packet_class(const char *data, size_t len, IotConnectSendClass send_class) {
+    if (send_class == IOTCONNECT_CLASS_TELEMETRY) {
+        iotconnect_sdk_send_packet_len(data, len);
+    } else if (send_class == IOTCONNECT_CLASS_CONTROL) {
+        send_packet_now(data, len, send_class);
+    } else if (!iotconnect_priority_is_enabled()) {
+        send_telemetry_packet(data, len);
+    } else if (!send_class_packet(data, len, send_class)) {
+        Log_Debug("Priority queue %d full, message dropped\n", (int)send_class);
+    }
+}
+
+void iotconnect_sdk_send_packet_buffer(const char *data, size_t len,
+    IotConnectBufferReleaseCallback release_cb, void *p_ctx) {
+    iotconnect_sdk_send_packet_len(data, len);
+    // Batching, the queue, the spool and the IoTHub message all keep their own copy.
+    if (release_cb) {
+        release_cb(data, p_ctx);
+    }
+}
+
+unsigned int iotconnect_sdk_send_packet_tracked(const char *data, size_t len, void *p_ctx) {
+    unsigned int msg_id = 0;
+    iotconnect_batch_flush();
+    // Packets still held for store-and-forward would be overtaken.
+    if (!iotconnect_connected || store_count() > 0) {
+        return 0;
+    }
+    if (send_payload(data, len, on_send_complete, p_ctx, &msg_id) != CodeSuccess) {
+        return 0;
+    }
+    return msg_id;
+}
+
+bool iotconnect_sdk_telemetry_begin(IotConnectEncoder *p_enc, unsigned char *p_buf, size_t size) {
+    iotconnect_encoder_init(p_enc, config.encoding, p_buf, size);
+    return iotconnect_telemetry_begin(p_enc, dtg_str);
+}
+
+IotConnectTemplate *iotconnect_sdk_template_create(const IotConnectAttribute *p_attrs, size_t count) {
+    return iotconnect_template_create(p_attrs, count, config.encoding);
+}
+
+const char *iotconnect_sdk_template_render(IotConnectTemplate *p_tmpl, size_t *p_len) {
+    return (const char *)iotconnect_template_render(p_tmpl, dtg_str, time(NULL), p_len);
+}
+
+IotConnectTemplateResult iotconnect_sdk_send_template_changes(IotConnectTemplate *p_tmpl) {
+    const unsigned char *p_msg;
+    size_t len;
+    IotConnectTemplateResult result = iotconnect_template_render_changes(p_tmpl, dtg_str, time(NULL),
+        &p_msg, &len);
+    if (result == IOTCONNECT_TEMPLATE_RENDERED) {
+        iotconnect_sdk_send_packet_len((const char *)p_msg, len);
+    }
+    return result;
+}
+
+IotConnectAggregator *iotconnect_sdk_aggregator_create(const IotConnectAggregateAttribute *p_attrs,
+    size_t count, const IotConnectWindowConfig *p_window) {
+    for (int i = 0; i < MAX_AGGREGATORS; i++) {
+        if (aggregators[i].p_agg) {
+            continue;
         }
+        IotConnectAggregator *p_agg = iotconnect_aggregator_create(p_attrs, count, p_window,
+            config.encoding);
+        if (p_agg == NULL) {
+            return NULL;
+        }
+        unsigned int hop_ms = iotconnect_aggregator_hop_ms(p_agg);
+        if (iothub_client_add_timer_ms(hop_ms, hop_ms, on_aggregate_timer_cb, p_agg,
+            &aggregators[i].timer_hndl) != CodeSuccess) {
+            Log_Debug("Unable to add the aggregation timer!\n");
+            iotconnect_aggregator_destroy(p_agg);
+            return NULL;
+        }
+        aggregators[i].p_agg = p_agg;
+        return p_agg;
+    }
+    return NULL;
+}
+
+void iotconnect_sdk_aggregator_destroy(IotConnectAggregator *p_agg) {
+    for (int i = 0; p_agg && i < MAX_AGGREGATORS; i++) {
+        if (aggregators[i].p_agg == p_agg) {
+            if (aggregators[i].timer_hndl) {
+                iothub_client_delete_timer(aggregators[i].timer_hndl);
+            }
+            iotconnect_aggregator_destroy(p_agg);
+            aggregators[i].p_agg = NULL;
+            return;
+        }
+    }
+}
+
+bool iotconnect_sdk_send_series(const unsigned char *p_block, size_t len, const char *p_attribute) {
+    if (p_block == NULL || len == 0 || p_attribute == NULL) {
+        return false;
+    }
+    size_t text_size = (len + 2) / 3 * 4 + 1;
+    size_t size = text_size + strlen(p_attribute) + SERIES_MESSAGE_OVERHEAD;
+    unsigned char *p_buf = malloc(size + text_size);
+    if (p_buf == NULL) {
+        Log_Debug("Unable to allocate the series message!\n");
+        return false;
+    }
+    char *p_text = (char *)p_buf + size;
+    IotConnectEncoder enc;
+    size_t msg_len = 0;
+    if (iotconnect_base64_encode(p_block, len, p_text, text_size) &&
+        iotconnect_sdk_telemetry_begin(&enc, p_buf, size) &&
+        iotconnect_telemetry_add_record(&enc, time(NULL)) &&
+        iotconnect_telemetry_put_string(&enc, p_attribute, p_text)) {
+        msg_len = iotconnect_telemetry_end(&enc);
+    }
+    if (msg_len) {
+        iotconnect_sdk_send_packet_len((const char *)p_buf, msg_len);
+    }
+    free(p_buf);
+    return msg_len != 0;
+}
+
+void iotconnect_sdk_get_delivery_stats(IotConnectDeliveryStats *p_stats) {
+    IotHubSendStats stats;
+    memset(p_stats, 0, sizeof(*p_stats));
+    if (iothub_client_get_send_stats(&stats) != CodeSuccess) {
+        return;
+    }
+    p_stats->sent = stats.sent;
+    p_stats->delivered = stats.succeeded;
+    p_stats->timed_out = stats.timed_out;
+    p_stats->failed = stats.failed + stats.destroyed;
+    p_stats->in_flight = stats.in_flight;
+    p_stats->max_in_flight = stats.max_in_flight;
+    unsigned long timed = 0;
+    for (int i = 0; i < IOTCONNECT_SEND_LATENCY_BUCKETS; i++) {
+        p_stats->latency_hist[i] = stats.latency_hist[i];
+        timed += stats.latency_hist[i];
+    }
+    if (timed) {
+        p_stats->latency_avg_ms = (unsigned int)(stats.latency_sum_ms / timed);
     }
+    p_stats->latency_max_ms = stats.latency_max_ms;
+}
+
+void iotconnect_sdk_get_quota_info(IotConnectQuotaInfo *p_info) {
+    IotHubQuotaInfo quota;
+    memset(p_info, 0, sizeof(*p_info));
+    if (iothub_client_get_quota_info(&quota) != CodeSuccess) {
+        return;
+    }
+    p_info->enabled = quota.enabled;
+    p_info->daily_messages = quota.daily_units;
+    p_info->used_today = quota.used_today;
+    p_info->remaining_today = quota.remaining_today;
+    p_info->burst_available = quota.available_units;
+    p_info->next_message_ms = quota.next_unit_ms;
+    p_info->throttled = quota.throttled;
+    p_info->projected_exhaustion = quota.projected_exhaustion;
+}
+
+void iotconnect_sdk_flush(void) {
+    iotconnect_batch_flush();
 }
 
 IotclConfig* iotconnect_sdk_get_lib_config() {
@@ -168,6 +745,14 @@ unsigned int iotconnect_sdk_poll(int timeout_ms) {
     return IOTC_SDK_SUCCESS;
 }
 
+int iotconnect_sdk_get_wait_fd(void) {
+    int fd;
+    if (iothub_client_get_wait_fd(&fd) != CodeSuccess) {
+        return -1;
+    }
+    return fd;
+}
+
 ///////////////////////////////////////////////////////////////////////////////////
 // this the Initialization on IoTConnect SDK
 unsigned int iotconnect_sdk_init(IotConnectAzsphereConfig *p_cfg) {
@@ -175,15 +760,69 @@ unsigned int iotconnect_sdk_init(IotConnectAzsphereConfig *p_cfg) {
     if (iotconnect_connected) {
         return IOTC_SDK_INVALID_STATE;
     }
+    memset(&iothub_cli_init, 0, sizeof(iothub_cli_init));
     strcpy(iothub_cli_init.netif, p_cfg->p_netif);
     strcpy(iothub_cli_init.scope_id, p_cfg->p_scope_id);
     iothub_cli_init.recv_msg_cb = on_iothub_data;
     iothub_cli_init.auth_status_cb = on_iotconnect_status;
     iothub_cli_init.twin_msg_cb = NULL;
+    iothub_cli_init.dowork_idle_ms = config.idle_poll_ms;
+    iothub_cli_init.p_event_loop = config.event_loop;
+    iothub_cli_init.provisioning_timeout_ms = config.provisioning_timeout_ms;
+    iothub_cli_init.hub_cache_fd = config.hub_cache.fd;
+    iothub_cli_init.hub_cache_offset = config.hub_cache.offset;
+    iothub_cli_init.hub_cache_size = config.hub_cache.size;
+    iothub_cli_init.quota_daily_units = config.quota.daily_messages;
+    iothub_cli_init.quota_burst_units = config.quota.burst;
     if (iothub_client_init(&iothub_cli_init) != CodeSuccess) {
         Log_Debug("Failed to initialize Azure Sphere IoTHub client\n");
         return IOTC_SDK_IOTHUB_INIT_FAIL;
     }
+    if (config.batch.max_bytes) {
+        if (!iotconnect_batch_init(config.batch.max_bytes, on_batch_flush)) {
+            Log_Debug("Failed to allocate the telemetry batch buffer\n");
+            return IOTC_SDK_IOTCONNECT_INIT_FAIL;
+        }
+        if (config.batch.max_latency_s > 0 && iothub_client_add_timer(config.batch.max_latency_s,
+            on_batch_timer_cb, NULL, &batch_timer_hndl) != CodeSuccess) {
+            Log_Debug("Unable to add the telemetry batch timer!\n");
+        }
+    }
+    // Throttled packets wait in the class queues, packed into billing units.
+    if (config.quota.daily_messages) {
+        config.priority.enabled = true;
+        if (config.priority.pack_bytes == 0) {
+            config.priority.pack_bytes = IOTCONNECT_BATCH_BILLING_UNIT;
+        }
+    }
+    if (config.priority.enabled && !iotconnect_priority_init(&config.priority, on_priority_send)) {
+        Log_Debug("Failed to allocate the priority send queues\n");
+        return IOTC_SDK_IOTCONNECT_INIT_FAIL;
+    }
+    if (config.compression.method != IOTCONNECT_COMPRESS_NONE &&
+        !iotconnect_compress_init(&config.compression)) {
+        Log_Debug("Failed to allocate the compressor\n");
+        return IOTC_SDK_IOTCONNECT_INIT_FAIL;
+    }
+    if (config.session.size && !iotconnect_session_open(&config.session, p_cfg->p_scope_id)) {
+        Log_Debug("Failed to read the IoTConnect session cache\n");
+    }
+    if (config.spool.size) {
+        if (!iotconnect_spool_open(&config.spool)) {
+            Log_Debug("Failed to open the telemetry spool\n");
+            return IOTC_SDK_IOTCONNECT_INIT_FAIL;
+        }
+        Log_Debug("Telemetry spool holds %u unsent packets\n", (unsigned int)iotconnect_spool_pending());
+        if (iothub_client_add_timer(config.spool.flush_interval_s > 0 ? config.spool.flush_interval_s :
+            IOTCONNECT_SPOOL_DEFAULT_FLUSH_INTERVAL_S, on_spool_timer_cb, NULL,
+            &spool_timer_hndl) != CodeSuccess) {
+            Log_Debug("Unable to add the telemetry spool timer!\n");
+        }
+    } else if (config.queue.capacity && !iotconnect_queue_init(config.queue.capacity,
+        config.queue.p_buffer, config.queue.drop_policy)) {
+        Log_Debug("Failed to initialize the store-and-forward queue\n");
+        return IOTC_SDK_IOTCONNECT_INIT_FAIL;
+    }
     lib_config.device.cpid = "unused";
     lib_config.device.env = "unused";
     lib_config.device.duid = "unused";
@@ -198,6 +837,17 @@ unsigned int iotconnect_sdk_init(IotConnectAzsphereConfig *p_cfg) {
         Log_Debug("Failed to initialize the IoTConnect Lib\n");
         return IOTC_SDK_IOTCONNECT_INIT_FAIL;
     }
+    // Installed after iotcl_init() so only per-message allocations use the arena. The hooks
+    // free heap blocks too, so memory allocated before this point is still released correctly.
+    if (config.arena.size) {
+        if (!iotconnect_arena_init(config.arena.p_buffer, config.arena.size)) {
+            Log_Debug("Failed to initialize the allocation arena\n");
+            return IOTC_SDK_IOTCONNECT_INIT_FAIL;
+        }
+        cJSON_Hooks hooks = { .malloc_fn = iotconnect_arena_malloc,
+            .free_fn = iotconnect_arena_free };
+        cJSON_InitHooks(&hooks);
+    }
     if (iothub_client_connect() != CodeSuccess) {
         Log_Debug("Failed to connect!\n");
         return IOTC_SDK_CONNECT_INIT_FAIL;
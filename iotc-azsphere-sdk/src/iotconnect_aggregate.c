@@ -0,0 +1,266 @@
+//
+// Copyright: Avnet 2021
+//
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include "iotconnect_aggregate.h"
+#include "iotconnect_template.h"
+
+/********************************************************************************************/
+/* Static definition                                                                        */
+/********************************************************************************************/
+#define STAT_KINDS                          4
+#define MAX_NAME_LEN                        64
+
+typedef struct {
+    unsigned long count;
+    double sum;
+    double min;
+    double max;
+} PaneStats;
+
+typedef struct {
+    unsigned int stats;
+    size_t first_slot;                      // template slot of the first statistic reported
+} AggregateAttribute;
+
+struct IotConnectAggregator {
+    size_t count;
+    AggregateAttribute *p_attrs;
+    unsigned int hop_ms;
+    size_t panes;                           // per window
+    size_t current;                         // pane being filled, in the ring
+    size_t closed;                          // panes closed so far, up to panes
+    PaneStats *p_ring;                      // panes x count, pane major
+    unsigned long long pane_end_ms;
+    IotConnectTemplate *p_tmpl;
+    IotConnectAggregatorStats stats;
+};
+
+static const struct {
+    unsigned int flag;
+    const char *p_suffix;
+} m_stat_kinds[STAT_KINDS] = {
+    { IOTCONNECT_AGG_MIN, "_min" },
+    { IOTCONNECT_AGG_MAX, "_max" },
+    { IOTCONNECT_AGG_MEAN, "_mean" },
+    { IOTCONNECT_AGG_COUNT, "_count" }
+};
+
+/********************************************************************************************/
+/* Helper functions definition                                                              */
+/********************************************************************************************/
+static unsigned long long now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000 + (unsigned long long)ts.tv_nsec / 1000000;
+}
+
+static PaneStats *pane_stats(IotConnectAggregator *p_agg, size_t pane, size_t index) {
+    return &p_agg->p_ring[pane * p_agg->count + index];
+}
+
+static void reset_pane(IotConnectAggregator *p_agg, size_t pane) {
+    memset(pane_stats(p_agg, pane, 0), 0, p_agg->count * sizeof(PaneStats));
+}
+
+// Combines the panes of the window ending with the current pane into the template slots.
+// Returns the number of samples in the window.
+static unsigned long fill_window(IotConnectAggregator *p_agg) {
+    unsigned long total = 0;
+    size_t panes = p_agg->closed < p_agg->panes ? p_agg->closed : p_agg->panes;
+    for (size_t i = 0; i < p_agg->count; i++) {
+        PaneStats window = { 0, 0, INFINITY, -INFINITY };
+        for (size_t back = 0; back < panes; back++) {
+            size_t pane = (p_agg->current + p_agg->panes - back) % p_agg->panes;
+            const PaneStats *p_pane = pane_stats(p_agg, pane, i);
+            if (p_pane->count == 0) {
+                continue;
+            }
+            window.count += p_pane->count;
+            window.sum += p_pane->sum;
+            window.min = fmin(window.min, p_pane->min);
+            window.max = fmax(window.max, p_pane->max);
+        }
+        total += window.count;
+        const AggregateAttribute *p_attr = &p_agg->p_attrs[i];
+        size_t slot = p_attr->first_slot;
+        for (size_t kind = 0; kind < STAT_KINDS; kind++) {
+            unsigned int flag = m_stat_kinds[kind].flag;
+            if (!(p_attr->stats & flag)) {
+                continue;
+            }
+            if (flag == IOTCONNECT_AGG_COUNT) {
+                iotconnect_template_set_integer(p_agg->p_tmpl, slot, (int64_t)window.count);
+            } else if (window.count == 0) {
+                // No sample of this attribute in the window: sent as null
+                iotconnect_template_clear(p_agg->p_tmpl, slot);
+            } else {
+                double value = flag == IOTCONNECT_AGG_MIN ? window.min :
+                    flag == IOTCONNECT_AGG_MAX ? window.max : window.sum / (double)window.count;
+                iotconnect_template_set_number(p_agg->p_tmpl, slot, value);
+            }
+            slot++;
+        }
+    }
+    return total;
+}
+
+/********************************************************************************************/
+/* Aggregator functions definition                                                          */
+/********************************************************************************************/
+IotConnectAggregator *iotconnect_aggregator_create(const IotConnectAggregateAttribute *p_attrs,
+    size_t count, const IotConnectWindowConfig *p_window, IotConnectEncoding encoding) {
+    if (p_attrs == NULL || count == 0 || p_window == NULL || p_window->window_ms == 0) {
+        return NULL;
+    }
+    unsigned int hop_ms = p_window->hop_ms ? p_window->hop_ms : p_window->window_ms;
+    if (hop_ms > p_window->window_ms || p_window->window_ms % hop_ms != 0 ||
+        p_window->window_ms / hop_ms > IOTCONNECT_AGGREGATE_MAX_PANES) {
+        return NULL;
+    }
+    IotConnectAggregator *p_agg = calloc(1, sizeof(*p_agg));
+    if (p_agg == NULL) {
+        return NULL;
+    }
+    p_agg->count = count;
+    p_agg->hop_ms = hop_ms;
+    p_agg->panes = p_window->window_ms / hop_ms;
+    p_agg->p_attrs = calloc(count, sizeof(AggregateAttribute));
+    p_agg->p_ring = calloc(p_agg->panes * count, sizeof(PaneStats));
+    // One template attribute per statistic, named after the attribute
+    IotConnectAttribute *p_tmpl_attrs = calloc(count * STAT_KINDS, sizeof(IotConnectAttribute));
+    char (*p_names)[MAX_NAME_LEN] = calloc(count * STAT_KINDS, MAX_NAME_LEN);
+    size_t slots = 0;
+    bool valid = (p_agg->p_attrs && p_agg->p_ring && p_tmpl_attrs && p_names);
+    for (size_t i = 0; valid && i < count; i++) {
+        AggregateAttribute *p_attr = &p_agg->p_attrs[i];
+        p_attr->stats = p_attrs[i].stats ? p_attrs[i].stats & IOTCONNECT_AGG_ALL : IOTCONNECT_AGG_ALL;
+        p_attr->first_slot = slots;
+        if (p_attrs[i].p_name == NULL || p_attr->stats == 0) {
+            valid = false;
+            break;
+        }
+        for (size_t kind = 0; kind < STAT_KINDS; kind++) {
+            if (!(p_attr->stats & m_stat_kinds[kind].flag)) {
+                continue;
+            }
+            int len = snprintf(p_names[slots], MAX_NAME_LEN, "%s%s", p_attrs[i].p_name,
+                m_stat_kinds[kind].p_suffix);
+            if (len < 0 || len >= MAX_NAME_LEN) {
+                valid = false;
+                break;
+            }
+            p_tmpl_attrs[slots].p_name = p_names[slots];
+            if (m_stat_kinds[kind].flag == IOTCONNECT_AGG_COUNT) {
+                p_tmpl_attrs[slots].type = IOTCONNECT_ATTR_INTEGER;
+            } else {
+                p_tmpl_attrs[slots].type = IOTCONNECT_ATTR_NUMBER;
+                p_tmpl_attrs[slots].precision = p_attrs[i].precision;
+            }
+            slots++;
+        }
+    }
+    if (valid) {
+        p_agg->p_tmpl = iotconnect_template_create(p_tmpl_attrs, slots, encoding);
+    }
+    free(p_tmpl_attrs);
+    free(p_names);
+    if (p_agg->p_tmpl == NULL) {
+        iotconnect_aggregator_destroy(p_agg);
+        return NULL;
+    }
+    p_agg->pane_end_ms = now_ms() + hop_ms;
+    return p_agg;
+}
+
+void iotconnect_aggregator_destroy(IotConnectAggregator *p_agg) {
+    if (p_agg == NULL) {
+        return;
+    }
+    iotconnect_template_destroy(p_agg->p_tmpl);
+    free(p_agg->p_attrs);
+    free(p_agg->p_ring);
+    free(p_agg);
+}
+
+bool iotconnect_aggregator_add(IotConnectAggregator *p_agg, size_t index, double value) {
+    if (p_agg == NULL) {
+        return false;
+    }
+    if (index >= p_agg->count || !isfinite(value)) {
+        p_agg->stats.rejected++;
+        return false;
+    }
+    PaneStats *p_pane = pane_stats(p_agg, p_agg->current, index);
+    if (p_pane->count++ == 0) {
+        p_pane->min = value;
+        p_pane->max = value;
+    } else if (value < p_pane->min) {
+        p_pane->min = value;
+    } else if (value > p_pane->max) {
+        p_pane->max = value;
+    }
+    p_pane->sum += value;
+    p_agg->stats.samples++;
+    return true;
+}
+
+size_t iotconnect_aggregator_advance(IotConnectAggregator *p_agg, const char *p_dtg,
+    time_t timestamp, IotConnectAggregateEmitCallback emit_cb, void *p_ctx) {
+    if (p_agg == NULL) {
+        return 0;
+    }
+    size_t emitted = 0;
+    size_t closes = 0;
+    unsigned long long now = now_ms();
+    while (now >= p_agg->pane_end_ms) {
+        if (closes++ > p_agg->panes) {
+            // Every pane is empty by now, the windows still to close would all be skipped.
+            unsigned long long skipped = (now - p_agg->pane_end_ms) / p_agg->hop_ms + 1;
+            p_agg->stats.empty_windows += (unsigned long)skipped;
+            p_agg->pane_end_ms += skipped * p_agg->hop_ms;
+            break;
+        }
+        if (p_agg->closed < p_agg->panes) {
+            p_agg->closed++;
+        }
+        if (fill_window(p_agg) == 0) {
+            p_agg->stats.empty_windows++;
+        } else {
+            size_t len;
+            const unsigned char *p_msg = iotconnect_template_render(p_agg->p_tmpl, p_dtg,
+                timestamp, &len);
+            if (p_msg == NULL) {
+                p_agg->stats.failed++;
+            } else {
+                p_agg->stats.windows++;
+                emitted++;
+                if (emit_cb) {
+                    emit_cb(p_msg, len, p_ctx);
+                }
+            }
+        }
+        // The oldest pane leaves the window and is reused for the next one.
+        p_agg->current = (p_agg->current + 1) % p_agg->panes;
+        reset_pane(p_agg, p_agg->current);
+        p_agg->pane_end_ms += p_agg->hop_ms;
+    }
+    return emitted;
+}
+
+unsigned int iotconnect_aggregator_next_ms(const IotConnectAggregator *p_agg) {
+    unsigned long long now = now_ms();
+    return now >= p_agg->pane_end_ms ? 0 : (unsigned int)(p_agg->pane_end_ms - now);
+}
+
+unsigned int iotconnect_aggregator_hop_ms(const IotConnectAggregator *p_agg) {
+    return p_agg->hop_ms;
+}
+
+void iotconnect_aggregator_get_stats(const IotConnectAggregator *p_agg,
+    IotConnectAggregatorStats *p_stats) {
+    *p_stats = p_agg->stats;
+}
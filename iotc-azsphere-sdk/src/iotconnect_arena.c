@@ -0,0 +1,160 @@
+//
+// Copyright: Avnet 2021
+//
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include "iotconnect_arena.h"
+
+/********************************************************************************************/
+/* Static definition                                                                        */
+/********************************************************************************************/
+// Every block is preceded by a header holding its size class, or LARGE_CLASS and its size.
+// The header is 8 bytes so blocks stay aligned for doubles.
+#define BLOCK_HDR_SIZE                      8
+#define MIN_CLASS_SHIFT                     4   // 16 bytes
+#define NUM_CLASSES                         6   // up to 512 bytes: cJSON nodes, keys and values
+#define CLASS_SIZE(c)                       ((size_t)1 << ((c) + MIN_CLASS_SHIFT))
+#define LARGE_CLASS                         UINT32_MAX
+#define ALIGN_BLOCK(n)                      (((n) + BLOCK_HDR_SIZE - 1) & ~(size_t)(BLOCK_HDR_SIZE - 1))
+
+/********************************************************************************************/
+/* Member variables declaration                                                             */
+/********************************************************************************************/
+static unsigned char *arena_buf = NULL;
+static bool arena_buf_owned = false;
+static size_t arena_size = 0;
+static size_t arena_used = 0;
+static void *free_lists[NUM_CLASSES];
+static IotConnectArenaStats arena_stats = { 0 };
+
+/********************************************************************************************/
+/* Helper functions definition                                                              */
+/********************************************************************************************/
+static int size_class(size_t size) {
+    for (int c = 0; c < NUM_CLASSES; c++) {
+        if (size <= CLASS_SIZE(c)) {
+            return c;
+        }
+    }
+    return -1;
+}
+
+static bool in_arena(const void *p) {
+    return arena_buf && (const unsigned char *)p >= arena_buf &&
+        (const unsigned char *)p < arena_buf + arena_size;
+}
+
+static void *carve(uint32_t cls, size_t size) {
+    if (arena_size - arena_used < BLOCK_HDR_SIZE + size) {
+        return NULL;
+    }
+    unsigned char *p_hdr = arena_buf + arena_used;
+    uint32_t len = (uint32_t)size;
+    memcpy(p_hdr, &cls, sizeof(cls));
+    memcpy(p_hdr + sizeof(cls), &len, sizeof(len));
+    arena_used += BLOCK_HDR_SIZE + size;
+    if (arena_used > arena_stats.high_water_bytes) {
+        arena_stats.high_water_bytes = arena_used;
+    }
+    return p_hdr + BLOCK_HDR_SIZE;
+}
+
+static void arena_reset(void) {
+    arena_used = 0;
+    memset(free_lists, 0, sizeof(free_lists));
+    arena_stats.resets++;
+}
+
+/********************************************************************************************/
+/* Arena functions definition                                                               */
+/********************************************************************************************/
+bool iotconnect_arena_init(void *p_buffer, size_t size) {
+    iotconnect_arena_deinit();
+    if (size < BLOCK_HDR_SIZE + CLASS_SIZE(0)) {
+        return false;
+    }
+    if (p_buffer) {
+        // Keep block alignment whatever the alignment of the caller's buffer.
+        size_t skew = (size_t)((uintptr_t)p_buffer % BLOCK_HDR_SIZE);
+        skew = skew ? BLOCK_HDR_SIZE - skew : 0;
+        arena_buf = (unsigned char *)p_buffer + skew;
+        arena_size = size - skew;
+        arena_buf_owned = false;
+    } else {
+        arena_buf = malloc(size);
+        if (arena_buf == NULL) {
+            return false;
+        }
+        arena_size = size;
+        arena_buf_owned = true;
+    }
+    arena_used = 0;
+    memset(free_lists, 0, sizeof(free_lists));
+    memset(&arena_stats, 0, sizeof(arena_stats));
+    return true;
+}
+
+void iotconnect_arena_deinit(void) {
+    if (arena_buf_owned) {
+        free(arena_buf);
+    }
+    arena_buf = NULL;
+    arena_buf_owned = false;
+    arena_size = 0;
+    arena_used = 0;
+}
+
+// Small requests are served from per class free lists, then carved from the arena. Larger
+// ones, e.g. serialized messages, are carved at their exact size.
+void *iotconnect_arena_malloc(size_t size) {
+    void *p_block = NULL;
+    if (arena_buf) {
+        int c = size_class(size);
+        if (c >= 0 && free_lists[c]) {
+            p_block = free_lists[c];
+            memcpy(&free_lists[c], p_block, sizeof(void *));
+            arena_stats.reused++;
+        } else if (c >= 0) {
+            p_block = carve((uint32_t)c, CLASS_SIZE(c));
+        } else if (size <= UINT32_MAX) {
+            p_block = carve(LARGE_CLASS, ALIGN_BLOCK(size));
+        }
+    }
+    if (p_block == NULL) {
+        arena_stats.fallback_allocs++;
+        return malloc(size);
+    }
+    arena_stats.allocs++;
+    arena_stats.live_blocks++;
+    return p_block;
+}
+
+void iotconnect_arena_free(void *p) {
+    if (p == NULL) {
+        return;
+    }
+    if (!in_arena(p)) {
+        free(p);
+        return;
+    }
+    uint32_t cls;
+    uint32_t len;
+    unsigned char *p_hdr = (unsigned char *)p - BLOCK_HDR_SIZE;
+    memcpy(&cls, p_hdr, sizeof(cls));
+    memcpy(&len, p_hdr + sizeof(cls), sizeof(len));
+    if (--arena_stats.live_blocks == 0) {
+        arena_reset();
+    } else if ((unsigned char *)p + len == arena_buf + arena_used) {
+        // The most recent block is given back to the arena directly.
+        arena_used -= BLOCK_HDR_SIZE + len;
+    } else if (cls != LARGE_CLASS) {
+        memcpy(p, &free_lists[cls], sizeof(void *));
+        free_lists[cls] = p;
+    }
+}
+
+void iotconnect_arena_get_stats(IotConnectArenaStats *p_stats) {
+    *p_stats = arena_stats;
+    p_stats->used_bytes = arena_used;
+}
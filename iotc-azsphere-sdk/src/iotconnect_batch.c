@@ -0,0 +1,189 @@
+//
+// Copyright: Avnet 2021
+//
+#include <string.h>
+#include <stdlib.h>
+#include "iotconnect_batch.h"
+
+/********************************************************************************************/
+/* Member variables declaration                                                             */
+/********************************************************************************************/
+static char *batch_buf = NULL;
+static size_t batch_cap = 0;
+static size_t batch_len = 0;
+static size_t insert_pos = 0;           // offset of the closing ']' of the "d" array
+static unsigned long batch_records = 0;   // packets in the pending message
+static IotConnectBatchFlushCallback batch_flush_cb = NULL;
+static IotConnectBatchStats batch_stats = { 0 };
+
+/********************************************************************************************/
+/* Helper functions definition                                                              */
+/********************************************************************************************/
+// Locates the array value of the top level "d" key. On success *p_open and *p_close are the
+// offsets of its '[' and matching ']'.
+static bool find_record_array(const char *p_json, size_t len, size_t *p_open, size_t *p_close) {
+    size_t depth = 0;
+    size_t open = 0;
+    size_t key_start = 0;
+    bool in_str = false;
+    bool escaped = false;
+    bool is_key = false;
+    bool expect_key = false;
+    bool d_key = false;
+    bool in_records = false;
+
+    for (size_t i = 0; i < len; i++) {
+        char c = p_json[i];
+        if (in_str) {
+            if (escaped) {
+                escaped = false;
+            } else if (c == '\\') {
+                escaped = true;
+            } else if (c == '"') {
+                in_str = false;
+                if (is_key) {
+                    d_key = (i - key_start == 1 && p_json[key_start] == 'd');
+                    is_key = false;
+                }
+            }
+            continue;
+        }
+        switch (c) {
+        case '"':
+            in_str = true;
+            is_key = (depth == 1 && expect_key);
+            key_start = i + 1;
+            expect_key = false;
+            break;
+        case '{':
+        case '[':
+            if (depth == 1 && d_key && c == '[') {
+                open = i;
+                in_records = true;
+            }
+            d_key = false;
+            depth++;
+            expect_key = (c == '{' && depth == 1);
+            break;
+        case '}':
+        case ']':
+            if (depth == 0) {
+                return false;
+            }
+            depth--;
+            if (in_records && depth == 1) {
+                *p_open = open;
+                *p_close = i;
+                return true;
+            }
+            break;
+        case ',':
+            if (depth == 1) {
+                expect_key = true;
+                d_key = false;
+            }
+            break;
+        default:
+            break;
+        }
+    }
+    return false;
+}
+
+static bool has_records(size_t open, size_t close, const char *p_json) {
+    for (size_t i = open + 1; i < close; i++) {
+        if (p_json[i] != ' ' && p_json[i] != '\t' && p_json[i] != '\r' && p_json[i] != '\n') {
+            return true;
+        }
+    }
+    return false;
+}
+
+/********************************************************************************************/
+/* Batch functions definition                                                               */
+/********************************************************************************************/
+bool iotconnect_batch_init(size_t max_bytes, IotConnectBatchFlushCallback flush_cb) {
+    if (max_bytes == 0 || flush_cb == NULL) {
+        return false;
+    }
+    iotconnect_batch_deinit();
+    batch_buf = malloc(max_bytes + 1);
+    if (batch_buf == NULL) {
+        return false;
+    }
+    batch_cap = max_bytes;
+    batch_flush_cb = flush_cb;
+    memset(&batch_stats, 0, sizeof(batch_stats));
+    return true;
+}
+
+void iotconnect_batch_deinit(void) {
+    free(batch_buf);
+    batch_buf = NULL;
+    batch_cap = 0;
+    batch_len = 0;
+    batch_records = 0;
+    batch_flush_cb = NULL;
+}
+
+bool iotconnect_batch_add(const char *p_packet, size_t len) {
+    size_t open, close;
+    if (batch_buf == NULL || p_packet == NULL) {
+        return false;
+    }
+    if (!find_record_array(p_packet, len, &open, &close) || len > batch_cap) {
+        iotconnect_batch_flush();
+        batch_stats.bypassed++;
+        return false;
+    }
+    if (!has_records(open, close, p_packet)) {
+        return true;
+    }
+    if (batch_records == 0) {
+        memcpy(batch_buf, p_packet, len);
+        batch_buf[len] = 0;
+        batch_len = len;
+        insert_pos = close;
+        batch_records = 1;
+        return true;
+    }
+    size_t records_len = close - open - 1;
+    if (batch_len + records_len + 1 > batch_cap) {
+        iotconnect_batch_flush();
+        return iotconnect_batch_add(p_packet, len);
+    }
+    // Splice ",<records>" in front of the closing ']' and shift the envelope tail behind it.
+    memmove(batch_buf + insert_pos + records_len + 1, batch_buf + insert_pos,
+        batch_len - insert_pos + 1);
+    batch_buf[insert_pos] = ',';
+    memcpy(batch_buf + insert_pos + 1, p_packet + open + 1, records_len);
+    batch_len += records_len + 1;
+    insert_pos += records_len + 1;
+    batch_records++;
+    return true;
+}
+
+void iotconnect_batch_flush(void) {
+    if (batch_records == 0) {
+        return;
+    }
+    batch_stats.packets += batch_records;
+    batch_stats.messages++;
+    // Reset first, so a flush re-entered from the callback is a no-op.
+    batch_records = 0;
+    batch_flush_cb(batch_buf, batch_len);
+}
+
+size_t iotconnect_batch_pending_bytes(void) {
+    return batch_records ? batch_len : 0;
+}
+
+bool iotconnect_batch_find_records(const char *p_packet, size_t len, size_t *p_open,
+    size_t *p_close) {
+    return find_record_array(p_packet, len, p_open, p_close) &&
+        has_records(*p_open, *p_close, p_packet);
+}
+
+void iotconnect_batch_get_stats(IotConnectBatchStats *p_stats) {
+    *p_stats = batch_stats;
+}
@@ -0,0 +1,361 @@
+//
+// Copyright: Avnet 2021
+//
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "iotconnect_compress.h"
+
+/********************************************************************************************/
+/* Static definition                                                                        */
+/********************************************************************************************/
+#define WINDOW_SIZE                         4096    // power of 2, matches are closer than this
+#define WINDOW_MASK                         (WINDOW_SIZE - 1)
+#define HASH_BITS                           12
+#define HASH_SIZE                           (1 << HASH_BITS)
+#define MIN_MATCH                           3
+#define MAX_MATCH                           258
+#define END_OF_BLOCK                        256
+#define LITERAL_CODES                       288
+#define ZLIB_HEADER_LEN                     2
+#define ZLIB_TRAILER_LEN                    4
+#define GZIP_HEADER_LEN                     10
+#define GZIP_TRAILER_LEN                    8
+#define ADLER_MOD                           65521
+#define ADLER_BLOCK                         5552    // bytes summed before the sums could overflow
+
+typedef struct {
+    unsigned char *p_out;
+    size_t size;
+    size_t len;
+    uint32_t bits;
+    unsigned int count;
+    bool overflow;
+} BitWriter;
+
+static IotConnectCompressConfig settings;
+static IotConnectCompressStats stats;
+static uint32_t *hash_head = NULL;      // last position + 1 of each hash, 0 for none
+static uint16_t *hash_prev = NULL;      // distance back to the previous position of the same hash
+static unsigned char *out_buf = NULL;
+
+// Fixed Huffman codes of the literal/length alphabet, bit reversed for the LSB first stream
+static uint16_t literal_codes[LITERAL_CODES];
+static unsigned char literal_lens[LITERAL_CODES];
+
+static const uint16_t m_length_base[] = {
+    3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+    35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+};
+static const unsigned char m_length_extra[] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+    3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+};
+static const uint16_t m_dist_base[] = {
+    1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+    257, 385, 513, 769, 1025, 1537, 2049, 3073
+};
+static const unsigned char m_dist_extra[] = {
+    0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+    7, 7, 8, 8, 9, 9, 10, 10
+};
+
+#define LENGTH_CODES                        (sizeof(m_length_base) / sizeof(m_length_base[0]))
+#define DIST_CODES                          (sizeof(m_dist_base) / sizeof(m_dist_base[0]))
+
+static const uint32_t m_crc_nibble[16] = {
+    0x00000000, 0x1db71064, 0x3b6e20c8, 0x26d930ac, 0x76dc4190, 0x6b6b51f4, 0x4db26158, 0x5005713c,
+    0xedb88320, 0xf00f9344, 0xd6d6a3e8, 0xcb61b38c, 0x9b64c2b0, 0x86d3d2d4, 0xa00ae278, 0xbdbdf21c
+};
+
+/********************************************************************************************/
+/* Helper functions definition                                                              */
+/********************************************************************************************/
+static unsigned long long now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000 + (unsigned long long)ts.tv_nsec / 1000;
+}
+
+static unsigned int reverse_bits(unsigned int code, unsigned int len) {
+    unsigned int reversed = 0;
+    for (unsigned int i = 0; i < len; i++) {
+        reversed = (reversed << 1) | ((code >> i) & 1);
+    }
+    return reversed;
+}
+
+static void init_literal_codes(void) {
+    for (unsigned int sym = 0; sym < LITERAL_CODES; sym++) {
+        unsigned int code;
+        unsigned int len;
+        if (sym < 144) {
+            code = 0x30 + sym;
+            len = 8;
+        } else if (sym < 256) {
+            code = 0x190 + sym - 144;
+            len = 9;
+        } else if (sym < 280) {
+            code = sym - 256;
+            len = 7;
+        } else {
+            code = 0xc0 + sym - 280;
+            len = 8;
+        }
+        literal_codes[sym] = (uint16_t)reverse_bits(code, len);
+        literal_lens[sym] = (unsigned char)len;
+    }
+}
+
+static void put_bits(BitWriter *p_writer, uint32_t value, unsigned int count) {
+    p_writer->bits |= value << p_writer->count;
+    p_writer->count += count;
+    while (p_writer->count >= 8) {
+        if (p_writer->len < p_writer->size) {
+            p_writer->p_out[p_writer->len++] = (unsigned char)p_writer->bits;
+        } else {
+            p_writer->overflow = true;
+        }
+        p_writer->bits >>= 8;
+        p_writer->count -= 8;
+    }
+}
+
+static void put_symbol(BitWriter *p_writer, unsigned int sym) {
+    put_bits(p_writer, literal_codes[sym], literal_lens[sym]);
+}
+
+static void put_match(BitWriter *p_writer, unsigned int len, unsigned int dist) {
+    unsigned int code = LENGTH_CODES - 1;
+    while (m_length_base[code] > len) {
+        code--;
+    }
+    put_symbol(p_writer, 257 + code);
+    put_bits(p_writer, len - m_length_base[code], m_length_extra[code]);
+    code = DIST_CODES - 1;
+    while (m_dist_base[code] > dist) {
+        code--;
+    }
+    put_bits(p_writer, reverse_bits(code, 5), 5);
+    put_bits(p_writer, dist - m_dist_base[code], m_dist_extra[code]);
+}
+
+static unsigned int hash3(const unsigned char *p) {
+    uint32_t v = ((uint32_t)p[0] << 16) | ((uint32_t)p[1] << 8) | p[2];
+    return (v * 2654435761u) >> (32 - HASH_BITS);
+}
+
+// Links pos to the previous position with the same hash and returns that position + 1, or 0.
+static size_t insert_position(const unsigned char *p_data, size_t pos) {
+    unsigned int hash = hash3(&p_data[pos]);
+    size_t prev = hash_head[hash];
+    hash_prev[pos & WINDOW_MASK] = (prev && pos - (prev - 1) < WINDOW_SIZE) ?
+        (uint16_t)(pos - (prev - 1)) : 0;
+    hash_head[hash] = (uint32_t)(pos + 1);
+    return prev;
+}
+
+static unsigned int longest_match(const unsigned char *p_data, size_t len, size_t pos,
+    size_t candidate, unsigned int *p_dist) {
+    unsigned int best = 0;
+    unsigned int max_len = len - pos < MAX_MATCH ? (unsigned int)(len - pos) : MAX_MATCH;
+    unsigned int chain = settings.max_chain;
+    const unsigned char *p_cur = &p_data[pos];
+    while (candidate && chain--) {
+        size_t match = candidate - 1;
+        size_t dist = pos - match;
+        if (dist >= WINDOW_SIZE) {
+            break;
+        }
+        const unsigned char *p_match = &p_data[match];
+        if (p_match[best] == p_cur[best]) {
+            unsigned int l = 0;
+            while (l < max_len && p_match[l] == p_cur[l]) {
+                l++;
+            }
+            if (l > best) {
+                best = l;
+                *p_dist = (unsigned int)dist;
+                if (l == max_len) {
+                    break;
+                }
+            }
+        }
+        uint16_t step = hash_prev[match & WINDOW_MASK];
+        candidate = step ? candidate - step : 0;
+    }
+    return best;
+}
+
+// Single final block with the fixed codes. Returns false if the output does not fit.
+static bool deflate_block(const unsigned char *p_data, size_t len, BitWriter *p_writer) {
+    memset(hash_head, 0, HASH_SIZE * sizeof(hash_head[0]));
+    put_bits(p_writer, 1, 1);   // BFINAL
+    put_bits(p_writer, 1, 2);   // BTYPE fixed Huffman
+    size_t pos = 0;
+    while (pos < len && !p_writer->overflow) {
+        unsigned int match_len = 0;
+        unsigned int dist = 0;
+        if (len - pos >= MIN_MATCH) {
+            size_t candidate = insert_position(p_data, pos);
+            match_len = longest_match(p_data, len, pos, candidate, &dist);
+        }
+        if (match_len >= MIN_MATCH) {
+            put_match(p_writer, match_len, dist);
+            for (size_t i = 1; i < match_len; i++) {
+                if (len - (pos + i) >= MIN_MATCH) {
+                    insert_position(p_data, pos + i);
+                }
+            }
+            pos += match_len;
+        } else {
+            put_symbol(p_writer, p_data[pos]);
+            pos++;
+        }
+    }
+    put_symbol(p_writer, END_OF_BLOCK);
+    put_bits(p_writer, 0, 7);   // flush the last partial byte
+    return !p_writer->overflow;
+}
+
+static uint32_t adler32(const unsigned char *p_data, size_t len) {
+    uint32_t a = 1;
+    uint32_t b = 0;
+    while (len) {
+        size_t block = len < ADLER_BLOCK ? len : ADLER_BLOCK;
+        len -= block;
+        while (block--) {
+            a += *p_data++;
+            b += a;
+        }
+        a %= ADLER_MOD;
+        b %= ADLER_MOD;
+    }
+    return (b << 16) | a;
+}
+
+static uint32_t crc32(const unsigned char *p_data, size_t len) {
+    uint32_t crc = 0xffffffff;
+    while (len--) {
+        crc ^= *p_data++;
+        crc = (crc >> 4) ^ m_crc_nibble[crc & 0x0f];
+        crc = (crc >> 4) ^ m_crc_nibble[crc & 0x0f];
+    }
+    return ~crc;
+}
+
+static void put_be32(unsigned char *p, uint32_t v) {
+    p[0] = (unsigned char)(v >> 24);
+    p[1] = (unsigned char)(v >> 16);
+    p[2] = (unsigned char)(v >> 8);
+    p[3] = (unsigned char)v;
+}
+
+static void put_le32(unsigned char *p, uint32_t v) {
+    p[0] = (unsigned char)v;
+    p[1] = (unsigned char)(v >> 8);
+    p[2] = (unsigned char)(v >> 16);
+    p[3] = (unsigned char)(v >> 24);
+}
+
+// Returns the length of the wrapped stream, or 0 if it would not be smaller than limit.
+static size_t compress(const unsigned char *p_data, size_t len, size_t limit) {
+    bool gzip = settings.method == IOTCONNECT_COMPRESS_GZIP;
+    size_t header_len = gzip ? GZIP_HEADER_LEN : ZLIB_HEADER_LEN;
+    size_t trailer_len = gzip ? GZIP_TRAILER_LEN : ZLIB_TRAILER_LEN;
+    if (limit <= header_len + trailer_len) {
+        return 0;
+    }
+    BitWriter writer = { out_buf + header_len, limit - header_len - trailer_len, 0, 0, 0, false };
+    if (!deflate_block(p_data, len, &writer)) {
+        return 0;
+    }
+    unsigned char *p_trailer = out_buf + header_len + writer.len;
+    if (gzip) {
+        static const unsigned char gzip_header[GZIP_HEADER_LEN] = {
+            0x1f, 0x8b, 8, 0, 0, 0, 0, 0, 0, 0xff   // deflate, no flags, no time, unknown OS
+        };
+        memcpy(out_buf, gzip_header, GZIP_HEADER_LEN);
+        put_le32(p_trailer, crc32(p_data, len));
+        put_le32(p_trailer + 4, (uint32_t)len);
+    } else {
+        out_buf[0] = 0x78;      // deflate, 32 KB window at most
+        out_buf[1] = 0x01;      // fastest level, header check
+        put_be32(p_trailer, adler32(p_data, len));
+    }
+    return header_len + writer.len + trailer_len;
+}
+
+/********************************************************************************************/
+/* Compression functions definition                                                         */
+/********************************************************************************************/
+bool iotconnect_compress_init(const IotConnectCompressConfig *p_config) {
+    iotconnect_compress_deinit();
+    if (p_config == NULL || p_config->method == IOTCONNECT_COMPRESS_NONE) {
+        return false;
+    }
+    settings = *p_config;
+    if (settings.min_bytes == 0) {
+        settings.min_bytes = IOTCONNECT_COMPRESS_DEFAULT_MIN_BYTES;
+    }
+    if (settings.out_bytes == 0) {
+        settings.out_bytes = IOTCONNECT_COMPRESS_DEFAULT_OUT_BYTES;
+    }
+    if (settings.max_chain == 0) {
+        settings.max_chain = IOTCONNECT_COMPRESS_DEFAULT_MAX_CHAIN;
+    }
+    hash_head = malloc(HASH_SIZE * sizeof(hash_head[0]));
+    hash_prev = malloc(WINDOW_SIZE * sizeof(hash_prev[0]));
+    out_buf = malloc(settings.out_bytes);
+    if (hash_head == NULL || hash_prev == NULL || out_buf == NULL) {
+        iotconnect_compress_deinit();
+        return false;
+    }
+    init_literal_codes();
+    memset(&stats, 0, sizeof(stats));
+    return true;
+}
+
+void iotconnect_compress_deinit(void) {
+    free(hash_head);
+    free(hash_prev);
+    free(out_buf);
+    hash_head = NULL;
+    hash_prev = NULL;
+    out_buf = NULL;
+    settings.method = IOTCONNECT_COMPRESS_NONE;
+}
+
+const unsigned char *iotconnect_compress_payload(const unsigned char *p_data, size_t len,
+    size_t *p_out_len) {
+    if (out_buf == NULL) {
+        return NULL;
+    }
+    if (len < settings.min_bytes) {
+        stats.below_threshold++;
+        return NULL;
+    }
+    unsigned long long start = now_us();
+    // Worth sending only if smaller than the payload
+    size_t out_len = compress(p_data, len, len - 1 < settings.out_bytes ? len - 1 : settings.out_bytes);
+    stats.compress_us += now_us() - start;
+    stats.attempted_bytes += len;
+    if (out_len == 0) {
+        stats.incompressible++;
+        return NULL;
+    }
+    stats.compressed++;
+    stats.bytes_in += len;
+    stats.bytes_out += out_len;
+    *p_out_len = out_len;
+    return out_buf;
+}
+
+const char *iotconnect_compress_content_encoding(void) {
+    return settings.method == IOTCONNECT_COMPRESS_GZIP ? "gzip" : "deflate";
+}
+
+void iotconnect_compress_get_stats(IotConnectCompressStats *p_stats) {
+    *p_stats = stats;
+}
@@ -0,0 +1,681 @@
+//
+// Copyright: Avnet 2021
+//
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <math.h>
+#include "iotconnect_encoder.h"
+
+/********************************************************************************************/
+/* Static definition                                                                        */
+/********************************************************************************************/
+#define CONTAINER_HDR_SIZE                  3   // type byte and a 16 bit count
+#define CBOR_SHORT_MAX                      23
+#define MSGPACK_SHORT_MAX                   15
+
+#define CBOR_MAJOR_UINT                     0x00
+#define CBOR_MAJOR_NINT                     0x20
+#define CBOR_MAJOR_TEXT                     0x60
+#define CBOR_MAJOR_ARRAY                    0x80
+#define CBOR_MAJOR_MAP                      0xa0
+#define CBOR_FALSE                          0xf4
+#define CBOR_TRUE                           0xf5
+#define CBOR_NULL                           0xf6
+#define CBOR_HALF                           0xf9
+#define CBOR_FLOAT                          0xfa
+#define CBOR_DOUBLE                         0xfb
+
+#define MSGPACK_NIL                         0xc0
+#define MSGPACK_FALSE                       0xc2
+#define MSGPACK_TRUE                        0xc3
+#define MSGPACK_FLOAT                       0xca
+#define MSGPACK_DOUBLE                      0xcb
+#define MSGPACK_UINT8                       0xcc
+#define MSGPACK_INT8                        0xd0
+#define MSGPACK_STR8                        0xd9
+#define MSGPACK_STR16                       0xda
+#define MSGPACK_STR32                       0xdb
+#define MSGPACK_ARRAY16                     0xdc
+#define MSGPACK_MAP16                       0xde
+#define MSGPACK_FIXSTR                      0xa0
+#define MSGPACK_FIXARRAY                    0x90
+#define MSGPACK_FIXMAP                      0x80
+
+#define ISO_TIME_SIZE                       32
+#define NUMBER_SIZE                         32
+#define MAX_DECIMALS                        17
+#define EXACT_INT_LIMIT                     9007199254740992.0  // 2^53
+
+// Exact in a double up to 10^22.
+static const double m_pow10[MAX_DECIMALS + 1] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17
+};
+
+/********************************************************************************************/
+/* Helper functions definition                                                              */
+/********************************************************************************************/
+static bool put(IotConnectEncoder *p_enc, const void *p_data, size_t len) {
+    if (p_enc->failed || p_enc->size - p_enc->len < len) {
+        p_enc->failed = true;
+        return false;
+    }
+    memcpy(&p_enc->p_buf[p_enc->len], p_data, len);
+    p_enc->len += len;
+    return true;
+}
+
+static bool put_byte(IotConnectEncoder *p_enc, unsigned char byte) {
+    return put(p_enc, &byte, 1);
+}
+
+// Big endian, as both CBOR and MessagePack use.
+static bool put_be(IotConnectEncoder *p_enc, unsigned char type, uint64_t value, size_t width) {
+    unsigned char buf[9];
+    buf[0] = type;
+    for (size_t i = 0; i < width; i++) {
+        buf[width - i] = (unsigned char)(value >> (8 * i));
+    }
+    return put(p_enc, buf, width + 1);
+}
+
+// Separators and element counts. Every value, key or container goes through here first.
+static bool begin_item(IotConnectEncoder *p_enc) {
+    if (p_enc->failed) {
+        return false;
+    }
+    if (p_enc->depth == 0) {
+        if (p_enc->len > 0) {
+            // Only one top level value
+            p_enc->failed = true;
+            return false;
+        }
+        return true;
+    }
+    IotConnectEncoderLevel *p_level = &p_enc->levels[p_enc->depth - 1];
+    if (p_level->count == UINT16_MAX) {
+        p_enc->failed = true;
+        return false;
+    }
+    if (p_enc->encoding == IOTCONNECT_ENCODING_JSON && p_level->count > 0 &&
+        !put_byte(p_enc, (p_level->is_map && (p_level->count & 1)) ? ':' : ',')) {
+        return false;
+    }
+    p_level->count++;
+    return true;
+}
+
+static bool is_key_position(const IotConnectEncoder *p_enc) {
+    return p_enc->depth > 0 && p_enc->levels[p_enc->depth - 1].is_map &&
+        (p_enc->levels[p_enc->depth - 1].count & 1) == 0;
+}
+
+static bool put_uint_head(IotConnectEncoder *p_enc, unsigned char major, uint64_t value);
+
+static bool put_container_head(IotConnectEncoder *p_enc, bool is_map, uint16_t count) {
+    if (p_enc->encoding == IOTCONNECT_ENCODING_CBOR) {
+        return put_uint_head(p_enc, is_map ? CBOR_MAJOR_MAP : CBOR_MAJOR_ARRAY, count);
+    }
+    if (count <= MSGPACK_SHORT_MAX) {
+        return put_byte(p_enc, (unsigned char)((is_map ? MSGPACK_FIXMAP : MSGPACK_FIXARRAY) | count));
+    }
+    return put_be(p_enc, is_map ? MSGPACK_MAP16 : MSGPACK_ARRAY16, count, 2);
+}
+
+static bool begin_container(IotConnectEncoder *p_enc, bool is_map, bool fixed, uint16_t count) {
+    if (is_key_position(p_enc) || !begin_item(p_enc)) {
+        p_enc->failed = true;
+        return false;
+    }
+    if (p_enc->depth == IOTCONNECT_ENCODER_MAX_DEPTH) {
+        p_enc->failed = true;
+        return false;
+    }
+    IotConnectEncoderLevel *p_level = &p_enc->levels[p_enc->depth++];
+    p_level->start = p_enc->len;
+    p_level->count = 0;
+    p_level->expected = count;
+    p_level->fixed = fixed;
+    p_level->is_map = is_map;
+    if (p_enc->encoding == IOTCONNECT_ENCODING_JSON) {
+        return put_byte(p_enc, is_map ? '{' : '[');
+    }
+    if (fixed) {
+        return put_container_head(p_enc, is_map, count);
+    }
+    static const unsigned char placeholder[CONTAINER_HDR_SIZE] = { 0 };
+    return put(p_enc, placeholder, sizeof(placeholder));
+}
+
+static bool put_uint_head(IotConnectEncoder *p_enc, unsigned char major, uint64_t value) {
+    if (value <= CBOR_SHORT_MAX) {
+        return put_byte(p_enc, (unsigned char)(major | value));
+    } else if (value <= UINT8_MAX) {
+        return put_be(p_enc, major | 24, value, 1);
+    } else if (value <= UINT16_MAX) {
+        return put_be(p_enc, major | 25, value, 2);
+    } else if (value <= UINT32_MAX) {
+        return put_be(p_enc, major | 26, value, 4);
+    }
+    return put_be(p_enc, major | 27, value, 8);
+}
+
+static bool put_msgpack_int(IotConnectEncoder *p_enc, int64_t value) {
+    if (value >= 0) {
+        if (value <= 0x7f) {
+            return put_byte(p_enc, (unsigned char)value);
+        }
+        // uint8, uint16, uint32, uint64
+        for (size_t width = 1, type = MSGPACK_UINT8; width <= 8; width *= 2, type++) {
+            if (width == 8 || (uint64_t)value < ((uint64_t)1 << (8 * width))) {
+                return put_be(p_enc, (unsigned char)type, (uint64_t)value, width);
+            }
+        }
+    }
+    if (value >= -32) {
+        return put_byte(p_enc, (unsigned char)(int8_t)value);
+    }
+    // int8, int16, int32, int64
+    for (size_t width = 1, type = MSGPACK_INT8; width <= 8; width *= 2, type++) {
+        if (width == 8 || value >= -((int64_t)1 << (8 * width - 1))) {
+            return put_be(p_enc, (unsigned char)type, (uint64_t)value, width);
+        }
+    }
+    return false;
+}
+
+static uint32_t float_bits(float value) {
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    return bits;
+}
+
+// Half precision form of a float, if it holds the value exactly. Subnormals are not used.
+static bool to_half(float value, uint16_t *p_half) {
+    uint32_t bits = float_bits(value);
+    int exp = (int)((bits >> 23) & 0xff) - 127 + 15;
+    if (exp <= 0 || exp >= 31 || (bits & 0x1fff) != 0) {
+        return false;
+    }
+    *p_half = (uint16_t)(((bits >> 16) & 0x8000) | ((uint32_t)exp << 10) | ((bits >> 13) & 0x3ff));
+    return true;
+}
+
+static bool put_json_string(IotConnectEncoder *p_enc, const char *p_str, size_t len) {
+    static const char hex[] = "0123456789abcdef";
+    if (!put_byte(p_enc, '"')) {
+        return false;
+    }
+    size_t run = 0;
+    for (size_t i = 0; i < len; i++) {
+        unsigned char c = (unsigned char)p_str[i];
+        if (c >= 0x20 && c != '"' && c != '\\') {
+            continue;
+        }
+        // Plain characters are copied in runs.
+        if (!put(p_enc, &p_str[run], i - run)) {
+            return false;
+        }
+        run = i + 1;
+        char esc[6] = { '\\', (char)c, 0 };
+        size_t esc_len = 2;
+        switch (c) {
+        case '"':
+        case '\\':
+            break;
+        case '\n':
+            esc[1] = 'n';
+            break;
+        case '\r':
+            esc[1] = 'r';
+            break;
+        case '\t':
+            esc[1] = 't';
+            break;
+        default:
+            memcpy(esc, "\\u00", 4);
+            esc[4] = hex[c >> 4];
+            esc[5] = hex[c & 0xf];
+            esc_len = 6;
+            break;
+        }
+        if (!put(p_enc, esc, esc_len)) {
+            return false;
+        }
+    }
+    return put(p_enc, &p_str[run], len - run) && put_byte(p_enc, '"');
+}
+
+// mantissa * 10^-decimals in plain decimal notation, without trailing zeros in the fraction.
+// Integer arithmetic only. Returns the length written to p_buf, at most NUMBER_SIZE - 1.
+static size_t format_fixed(char *p_buf, int64_t mantissa, unsigned int decimals) {
+    char digits[NUMBER_SIZE];
+    size_t n = 0;
+    uint64_t mag = mantissa < 0 ? 0 - (uint64_t)mantissa : (uint64_t)mantissa;
+    do {
+        digits[n++] = (char)('0' + mag % 10);
+        mag /= 10;
+    } while (mag);
+    // Digits are in reverse order. Drop the trailing zeros of the fraction.
+    size_t skip = 0;
+    while (skip < decimals && skip < n && digits[skip] == '0') {
+        skip++;
+    }
+    if (skip == n) {
+        p_buf[0] = '0';
+        return 1;
+    }
+    decimals -= (unsigned int)skip;
+    size_t len = 0;
+    if (mantissa < 0) {
+        p_buf[len++] = '-';
+    }
+    if (n - skip <= decimals) {
+        // 0.000ddd
+        p_buf[len++] = '0';
+        p_buf[len++] = '.';
+        for (size_t i = n - skip; i < decimals; i++) {
+            p_buf[len++] = '0';
+        }
+        decimals = 0;
+    }
+    for (size_t i = n; i > skip; i--) {
+        if (decimals && i - skip == decimals) {
+            p_buf[len++] = '.';
+        }
+        p_buf[len++] = digits[i - 1];
+    }
+    return len;
+}
+
+static bool put_json_fixed(IotConnectEncoder *p_enc, int64_t mantissa, unsigned int decimals) {
+    char buf[NUMBER_SIZE];
+    return put(p_enc, buf, format_fixed(buf, mantissa, decimals));
+}
+
+// Finds the fewest decimals d for which round(value * 10^d) / 10^d reads back as value. The
+// division of two exact doubles is correctly rounded, as parsing the decimal string would be,
+// so the check needs no string round trip. Only for non integral values under 2^53.
+static bool put_json_short_fixed(IotConnectEncoder *p_enc, double value) {
+    for (unsigned int d = 1; d <= MAX_DECIMALS; d++) {
+        double scaled = value * m_pow10[d];
+        if (fabs(scaled) >= EXACT_INT_LIMIT) {
+            break;
+        }
+        double mantissa = round(scaled);
+        if (mantissa / m_pow10[d] == value) {
+            return put_json_fixed(p_enc, (int64_t)mantissa, d);
+        }
+    }
+    return false;
+}
+
+static bool put_json_double(IotConnectEncoder *p_enc, double value) {
+    if (fabs(value) < EXACT_INT_LIMIT) {
+        size_t len = p_enc->len;
+        if (put_json_short_fixed(p_enc, value)) {
+            return true;
+        }
+        if (p_enc->failed) {
+            return false;
+        }
+        p_enc->len = len;
+    }
+    char buf[NUMBER_SIZE];
+    // As cJSON does: 15 digits unless more are needed to read the same value back.
+    int len = snprintf(buf, sizeof(buf), "%1.15g", value);
+    if (strtod(buf, NULL) != value) {
+        len = snprintf(buf, sizeof(buf), "%1.17g", value);
+    }
+    return len > 0 && put(p_enc, buf, (size_t)len);
+}
+
+static bool put_key(IotConnectEncoder *p_enc, const char *p_name) {
+    return iotconnect_encoder_string(p_enc, p_name);
+}
+
+/********************************************************************************************/
+/* Encoder functions definition                                                             */
+/********************************************************************************************/
+const char *iotconnect_encoding_content_type(IotConnectEncoding encoding) {
+    switch (encoding) {
+    case IOTCONNECT_ENCODING_CBOR:
+        return "application%2fcbor";
+    case IOTCONNECT_ENCODING_MSGPACK:
+        return "application%2fx-msgpack";
+    default:
+        return "application%2fjson";
+    }
+}
+
+void iotconnect_encoder_init(IotConnectEncoder *p_enc, IotConnectEncoding encoding,
+    unsigned char *p_buf, size_t size) {
+    memset(p_enc, 0, sizeof(*p_enc));
+    p_enc->encoding = encoding;
+    p_enc->p_buf = p_buf;
+    p_enc->size = size;
+    p_enc->failed = (p_buf == NULL);
+}
+
+bool iotconnect_encoder_begin_map(IotConnectEncoder *p_enc) {
+    return begin_container(p_enc, true, false, 0);
+}
+
+bool iotconnect_encoder_begin_array(IotConnectEncoder *p_enc) {
+    return begin_container(p_enc, false, false, 0);
+}
+
+bool iotconnect_encoder_begin_map_n(IotConnectEncoder *p_enc, uint16_t count) {
+    if (count > UINT16_MAX / 2) {
+        p_enc->failed = true;
+        return false;
+    }
+    return begin_container(p_enc, true, true, count);
+}
+
+bool iotconnect_encoder_begin_array_n(IotConnectEncoder *p_enc, uint16_t count) {
+    return begin_container(p_enc, false, true, count);
+}
+
+bool iotconnect_encoder_end(IotConnectEncoder *p_enc) {
+    if (p_enc->failed || p_enc->depth == 0) {
+        p_enc->failed = true;
+        return false;
+    }
+    IotConnectEncoderLevel *p_level = &p_enc->levels[--p_enc->depth];
+    if (p_level->is_map && (p_level->count & 1)) {
+        // Key without a value
+        p_enc->failed = true;
+        return false;
+    }
+    unsigned int count = p_level->is_map ? p_level->count / 2u : p_level->count;
+    if (p_level->fixed && count != p_level->expected) {
+        p_enc->failed = true;
+        return false;
+    }
+    if (p_enc->encoding == IOTCONNECT_ENCODING_JSON) {
+        return put_byte(p_enc, p_level->is_map ? '}' : ']');
+    }
+    if (p_level->fixed) {
+        return true;
+    }
+    unsigned char *p_hdr = &p_enc->p_buf[p_level->start];
+    bool cbor = (p_enc->encoding == IOTCONNECT_ENCODING_CBOR);
+    if (count <= (cbor ? CBOR_SHORT_MAX : MSGPACK_SHORT_MAX)) {
+        // One byte header: move the body back over the unused part of the reservation.
+        size_t body = p_level->start + CONTAINER_HDR_SIZE;
+        memmove(p_hdr + 1, &p_enc->p_buf[body], p_enc->len - body);
+        p_enc->len -= CONTAINER_HDR_SIZE - 1;
+        if (cbor) {
+            p_hdr[0] = (unsigned char)((p_level->is_map ? CBOR_MAJOR_MAP : CBOR_MAJOR_ARRAY) | count);
+        } else {
+            p_hdr[0] = (unsigned char)((p_level->is_map ? MSGPACK_FIXMAP : MSGPACK_FIXARRAY) | count);
+        }
+        return true;
+    }
+    if (cbor) {
+        p_hdr[0] = (p_level->is_map ? CBOR_MAJOR_MAP : CBOR_MAJOR_ARRAY) | 25;
+    } else {
+        p_hdr[0] = p_level->is_map ? MSGPACK_MAP16 : MSGPACK_ARRAY16;
+    }
+    p_hdr[1] = (unsigned char)(count >> 8);
+    p_hdr[2] = (unsigned char)count;
+    return true;
+}
+
+bool iotconnect_encoder_string(IotConnectEncoder *p_enc, const char *p_str) {
+    return iotconnect_encoder_string_len(p_enc, p_str, p_str ? strlen(p_str) : 0);
+}
+
+bool iotconnect_encoder_string_len(IotConnectEncoder *p_enc, const char *p_str, size_t len) {
+    if (p_str == NULL || !begin_item(p_enc)) {
+        p_enc->failed = true;
+        return false;
+    }
+    switch (p_enc->encoding) {
+    case IOTCONNECT_ENCODING_CBOR:
+        return put_uint_head(p_enc, CBOR_MAJOR_TEXT, len) && put(p_enc, p_str, len);
+    case IOTCONNECT_ENCODING_MSGPACK:
+        if (len < 32) {
+            if (!put_byte(p_enc, (unsigned char)(MSGPACK_FIXSTR | len))) {
+                return false;
+            }
+        } else if (len <= UINT8_MAX) {
+            if (!put_be(p_enc, MSGPACK_STR8, len, 1)) {
+                return false;
+            }
+        } else if (len <= UINT16_MAX) {
+            if (!put_be(p_enc, MSGPACK_STR16, len, 2)) {
+                return false;
+            }
+        } else if (!put_be(p_enc, MSGPACK_STR32, len, 4)) {
+            return false;
+        }
+        return put(p_enc, p_str, len);
+    default:
+        return put_json_string(p_enc, p_str, len);
+    }
+}
+
+bool iotconnect_encoder_int(IotConnectEncoder *p_enc, int64_t value) {
+    if (is_key_position(p_enc) || !begin_item(p_enc)) {
+        p_enc->failed = true;
+        return false;
+    }
+    switch (p_enc->encoding) {
+    case IOTCONNECT_ENCODING_CBOR:
+        if (value < 0) {
+            return put_uint_head(p_enc, CBOR_MAJOR_NINT, (uint64_t)(-1 - value));
+        }
+        return put_uint_head(p_enc, CBOR_MAJOR_UINT, (uint64_t)value);
+    case IOTCONNECT_ENCODING_MSGPACK:
+        return put_msgpack_int(p_enc, value);
+    default:
+        return put_json_fixed(p_enc, value, 0);
+    }
+}
+
+bool iotconnect_encoder_double(IotConnectEncoder *p_enc, double value) {
+    if (!isfinite(value)) {
+        return iotconnect_encoder_null(p_enc);
+    }
+    // Within +-2^63, integral values convert to int64_t exactly.
+    if (value >= -9223372036854775808.0 && value < 9223372036854775808.0 &&
+        value == (double)(int64_t)value) {
+        return iotconnect_encoder_int(p_enc, (int64_t)value);
+    }
+    if (is_key_position(p_enc) || !begin_item(p_enc)) {
+        p_enc->failed = true;
+        return false;
+    }
+    float single = (float)value;
+    bool exact_single = ((double)single == value);
+    uint16_t half;
+    switch (p_enc->encoding) {
+    case IOTCONNECT_ENCODING_CBOR:
+        if (exact_single && to_half(single, &half)) {
+            return put_be(p_enc, CBOR_HALF, half, 2);
+        }
+        if (exact_single) {
+            return put_be(p_enc, CBOR_FLOAT, float_bits(single), 4);
+        }
+        break;
+    case IOTCONNECT_ENCODING_MSGPACK:
+        if (exact_single) {
+            return put_be(p_enc, MSGPACK_FLOAT, float_bits(single), 4);
+        }
+        break;
+    default:
+        return put_json_double(p_enc, value);
+    }
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    return put_be(p_enc, p_enc->encoding == IOTCONNECT_ENCODING_CBOR ? CBOR_DOUBLE : MSGPACK_DOUBLE,
+        bits, 8);
+}
+
+bool iotconnect_encoder_fixed(IotConnectEncoder *p_enc, int64_t mantissa, unsigned int decimals) {
+    if (decimals > MAX_DECIMALS) {
+        p_enc->failed = true;
+        return false;
+    }
+    if (p_enc->encoding == IOTCONNECT_ENCODING_JSON) {
+        if (is_key_position(p_enc) || !begin_item(p_enc)) {
+            p_enc->failed = true;
+            return false;
+        }
+        return put_json_fixed(p_enc, mantissa, decimals);
+    }
+    int64_t unit = (int64_t)m_pow10[decimals];
+    if (mantissa % unit == 0) {
+        return iotconnect_encoder_int(p_enc, mantissa / unit);
+    }
+    double value = (double)mantissa / m_pow10[decimals];
+    // A float is enough when it still rounds to the same mantissa.
+    float single = (float)value;
+    if (fabs((double)single - value) < 0.5 / m_pow10[decimals]) {
+        value = (double)single;
+    }
+    return iotconnect_encoder_double(p_enc, value);
+}
+
+bool iotconnect_encoder_double_precision(IotConnectEncoder *p_enc, double value,
+    unsigned int decimals) {
+    if (decimals > MAX_DECIMALS) {
+        p_enc->failed = true;
+        return false;
+    }
+    double scaled = value * m_pow10[decimals];
+    // Past 2^53 the scaled value is no longer exact and would print digits the double lacks.
+    if (!isfinite(scaled) || fabs(scaled) >= EXACT_INT_LIMIT) {
+        return iotconnect_encoder_double(p_enc, value);
+    }
+    double mantissa = round(scaled);
+    // The product may itself have rounded onto a tie, e.g. 36010.365 is stored as 36010.36499...
+    // but times 100 gives 3601036.5. The product error is exact as fma() computes it, so check
+    // the exact value against the ties around the mantissa.
+    double error = fma(value, m_pow10[decimals], -scaled);
+    double below = (scaled - mantissa + 0.5) + error;
+    double above = (scaled - mantissa - 0.5) + error;
+    if (below < 0.0 || (below == 0.0 && value < 0.0)) {
+        mantissa -= 1.0;
+    } else if (above > 0.0 || (above == 0.0 && value > 0.0)) {
+        mantissa += 1.0;
+    }
+    return iotconnect_encoder_fixed(p_enc, (int64_t)mantissa, decimals);
+}
+
+bool iotconnect_encoder_bool(IotConnectEncoder *p_enc, bool value) {
+    if (is_key_position(p_enc) || !begin_item(p_enc)) {
+        p_enc->failed = true;
+        return false;
+    }
+    switch (p_enc->encoding) {
+    case IOTCONNECT_ENCODING_CBOR:
+        return put_byte(p_enc, value ? CBOR_TRUE : CBOR_FALSE);
+    case IOTCONNECT_ENCODING_MSGPACK:
+        return put_byte(p_enc, value ? MSGPACK_TRUE : MSGPACK_FALSE);
+    default:
+        return value ? put(p_enc, "true", 4) : put(p_enc, "false", 5);
+    }
+}
+
+bool iotconnect_encoder_null(IotConnectEncoder *p_enc) {
+    if (is_key_position(p_enc) || !begin_item(p_enc)) {
+        p_enc->failed = true;
+        return false;
+    }
+    switch (p_enc->encoding) {
+    case IOTCONNECT_ENCODING_CBOR:
+        return put_byte(p_enc, CBOR_NULL);
+    case IOTCONNECT_ENCODING_MSGPACK:
+        return put_byte(p_enc, MSGPACK_NIL);
+    default:
+        return put(p_enc, "null", 4);
+    }
+}
+
+size_t iotconnect_encoder_finish(IotConnectEncoder *p_enc) {
+    if (p_enc->failed || p_enc->depth != 0 || p_enc->len == 0) {
+        return 0;
+    }
+    if (p_enc->encoding == IOTCONNECT_ENCODING_JSON && p_enc->len < p_enc->size) {
+        p_enc->p_buf[p_enc->len] = 0;
+    }
+    return p_enc->len;
+}
+
+/********************************************************************************************/
+/* Telemetry message functions definition                                                   */
+/********************************************************************************************/
+bool iotconnect_telemetry_begin(IotConnectEncoder *p_enc, const char *p_dtg) {
+    return iotconnect_encoder_begin_map(p_enc) &&
+        put_key(p_enc, "dtg") && iotconnect_encoder_string(p_enc, p_dtg ? p_dtg : "") &&
+        put_key(p_enc, "mt") && iotconnect_encoder_int(p_enc, 0) &&
+        put_key(p_enc, "d") && iotconnect_encoder_begin_array(p_enc);
+}
+
+bool iotconnect_telemetry_add_record(IotConnectEncoder *p_enc, time_t timestamp) {
+    // Depth 2 is inside the record array, 4 inside the attributes of a record.
+    if (p_enc->depth == 4 && !(iotconnect_encoder_end(p_enc) && iotconnect_encoder_end(p_enc))) {
+        return false;
+    }
+    if (p_enc->depth != 2) {
+        p_enc->failed = true;
+        return false;
+    }
+    char iso[ISO_TIME_SIZE];
+    struct tm tm;
+    if (gmtime_r(&timestamp, &tm) == NULL ||
+        strftime(iso, sizeof(iso), "%Y-%m-%dT%H:%M:%S.000Z", &tm) == 0) {
+        p_enc->failed = true;
+        return false;
+    }
+    return iotconnect_encoder_begin_map(p_enc) &&
+        put_key(p_enc, "dt") && iotconnect_encoder_string(p_enc, iso) &&
+        put_key(p_enc, "d") && iotconnect_encoder_begin_map(p_enc);
+}
+
+bool iotconnect_telemetry_put_number(IotConnectEncoder *p_enc, const char *p_name, double value) {
+    return p_enc->depth == 4 && put_key(p_enc, p_name) && iotconnect_encoder_double(p_enc, value);
+}
+
+bool iotconnect_telemetry_put_number_precision(IotConnectEncoder *p_enc, const char *p_name,
+    double value, unsigned int decimals) {
+    return p_enc->depth == 4 && put_key(p_enc, p_name) &&
+        iotconnect_encoder_double_precision(p_enc, value, decimals);
+}
+
+bool iotconnect_telemetry_put_fixed(IotConnectEncoder *p_enc, const char *p_name,
+    int64_t mantissa, unsigned int decimals) {
+    return p_enc->depth == 4 && put_key(p_enc, p_name) &&
+        iotconnect_encoder_fixed(p_enc, mantissa, decimals);
+}
+
+bool iotconnect_telemetry_put_bool(IotConnectEncoder *p_enc, const char *p_name, bool value) {
+    return p_enc->depth == 4 && put_key(p_enc, p_name) && iotconnect_encoder_bool(p_enc, value);
+}
+
+bool iotconnect_telemetry_put_string(IotConnectEncoder *p_enc, const char *p_name,
+    const char *p_value) {
+    return p_enc->depth == 4 && put_key(p_enc, p_name) &&
+        iotconnect_encoder_string(p_enc, p_value);
+}
+
+bool iotconnect_telemetry_put_null(IotConnectEncoder *p_enc, const char *p_name) {
+    return p_enc->depth == 4 && put_key(p_enc, p_name) && iotconnect_encoder_null(p_enc);
+}
+
+size_t iotconnect_telemetry_end(IotConnectEncoder *p_enc) {
+    if (p_enc->depth == 4) {
+        iotconnect_encoder_end(p_enc);
+        iotconnect_encoder_end(p_enc);
+    }
+    if (p_enc->depth != 2) {
+        p_enc->failed = true;
+        return 0;
+    }
+    iotconnect_encoder_end(p_enc);
+    iotconnect_encoder_end(p_enc);
+    return iotconnect_encoder_finish(p_enc);
+}
@@ -0,0 +1,208 @@
+//
+// Copyright: Avnet 2021
+//
+#include <limits.h>
+#include <string.h>
+#include "iotconnect_inbound.h"
+
+/********************************************************************************************/
+/* Data type definition                                                                     */
+/********************************************************************************************/
+typedef struct {
+    const char *p;
+    const char *p_end;
+} Cursor;
+
+/********************************************************************************************/
+/* Helper functions definition                                                              */
+/********************************************************************************************/
+static void skip_ws(Cursor *p_cur) {
+    while (p_cur->p < p_cur->p_end &&
+        (*p_cur->p == ' ' || *p_cur->p == '\t' || *p_cur->p == '\r' || *p_cur->p == '\n')) {
+        p_cur->p++;
+    }
+}
+
+static bool consume(Cursor *p_cur, char c) {
+    skip_ws(p_cur);
+    if (p_cur->p < p_cur->p_end && *p_cur->p == c) {
+        p_cur->p++;
+        return true;
+    }
+    return false;
+}
+
+// Scans a string starting at the opening quote. The slice excludes the quotes.
+static bool scan_string(Cursor *p_cur, IotConnectSlice *p_slice) {
+    if (p_cur->p >= p_cur->p_end || *p_cur->p != '"') {
+        return false;
+    }
+    const char *p_start = ++p_cur->p;
+    while (p_cur->p < p_cur->p_end) {
+        char c = *p_cur->p++;
+        if (c == '\\') {
+            if (p_cur->p >= p_cur->p_end) {
+                return false;
+            }
+            p_cur->p++;
+        } else if (c == '"') {
+            p_slice->p = p_start;
+            p_slice->len = (size_t)(p_cur->p - p_start - 1);
+            return true;
+        }
+    }
+    return false;
+}
+
+// Skips any value. Containers are skipped by tracking only the bracket depth, so arbitrary
+// nesting costs no stack.
+static bool skip_value(Cursor *p_cur) {
+    IotConnectSlice str;
+    skip_ws(p_cur);
+    if (p_cur->p >= p_cur->p_end) {
+        return false;
+    }
+    if (*p_cur->p == '"') {
+        return scan_string(p_cur, &str);
+    }
+    if (*p_cur->p == '{' || *p_cur->p == '[') {
+        unsigned int depth = 0;
+        while (p_cur->p < p_cur->p_end) {
+            char c = *p_cur->p;
+            if (c == '"') {
+                if (!scan_string(p_cur, &str)) {
+                    return false;
+                }
+                continue;
+            }
+            p_cur->p++;
+            if (c == '{' || c == '[') {
+                depth++;
+            } else if ((c == '}' || c == ']') && --depth == 0) {
+                return true;
+            }
+        }
+        return false;
+    }
+    // Number or literal
+    const char *p_start = p_cur->p;
+    while (p_cur->p < p_cur->p_end && *p_cur->p != ',' && *p_cur->p != '}' &&
+        *p_cur->p != ']' && *p_cur->p != ' ' && *p_cur->p != '\t' && *p_cur->p != '\r' &&
+        *p_cur->p != '\n') {
+        p_cur->p++;
+    }
+    return p_cur->p > p_start;
+}
+
+// Reads the next member of an object whose '{' has been consumed. Returns false at the '}'
+// or on malformed input, *p_ok tells which.
+static bool next_member(Cursor *p_cur, bool first, IotConnectSlice *p_key, Cursor *p_value,
+    bool *p_ok) {
+    *p_ok = false;
+    if (consume(p_cur, '}')) {
+        *p_ok = true;
+        return false;
+    }
+    if (!first && !consume(p_cur, ',')) {
+        return false;
+    }
+    skip_ws(p_cur);
+    if (!scan_string(p_cur, p_key) || !consume(p_cur, ':')) {
+        return false;
+    }
+    skip_ws(p_cur);
+    p_value->p = p_cur->p;
+    if (!skip_value(p_cur)) {
+        return false;
+    }
+    p_value->p_end = p_cur->p;
+    *p_ok = true;
+    return true;
+}
+
+static bool parse_int(Cursor value, int *p_int) {
+    int sign = 1;
+    int result = 0;
+    const char *p = value.p;
+    if (p < value.p_end && *p == '-') {
+        sign = -1;
+        p++;
+    }
+    if (p >= value.p_end || *p < '0' || *p > '9') {
+        return false;
+    }
+    while (p < value.p_end && *p >= '0' && *p <= '9') {
+        int digit = *p++ - '0';
+        // Values that do not fit an int are treated as missing.
+        if (result > (INT_MAX - digit) / 10) {
+            return false;
+        }
+        result = result * 10 + digit;
+    }
+    *p_int = sign * result;
+    return true;
+}
+
+static bool value_as_string(Cursor value, IotConnectSlice *p_slice) {
+    return scan_string(&value, p_slice);
+}
+
+// Picks the known fields out of one object. Nested "d" and "meta" objects are descended into.
+static bool parse_object(Cursor *p_cur, IotConnectInboundEvent *p_evt, int level) {
+    IotConnectSlice key;
+    Cursor value;
+    bool ok;
+    if (!consume(p_cur, '{')) {
+        return false;
+    }
+    for (bool first = true; next_member(p_cur, first, &key, &value, &ok); first = false) {
+        if (iotconnect_slice_equals(key, "ct")) {
+            parse_int(value, &p_evt->ct);
+        } else if (iotconnect_slice_equals(key, "ec")) {
+            parse_int(value, &p_evt->ec);
+        } else if (iotconnect_slice_equals(key, "cmd")) {
+            value_as_string(value, &p_evt->cmd);
+        } else if (iotconnect_slice_equals(key, "ack")) {
+            value_as_string(value, &p_evt->ack);
+        } else if (iotconnect_slice_equals(key, "sid")) {
+            value_as_string(value, &p_evt->sid);
+        } else if (iotconnect_slice_equals(key, "dtg")) {
+            value_as_string(value, &p_evt->dtg);
+        } else if (level < 2 && *value.p == '{' &&
+            (iotconnect_slice_equals(key, "d") || iotconnect_slice_equals(key, "meta"))) {
+            if (!parse_object(&value, p_evt, level + 1)) {
+                return false;
+            }
+        }
+    }
+    return ok;
+}
+
+/********************************************************************************************/
+/* Inbound functions definition                                                             */
+/********************************************************************************************/
+bool iotconnect_inbound_parse(const char *p_data, size_t len, IotConnectInboundEvent *p_evt) {
+    memset(p_evt, 0, sizeof(*p_evt));
+    p_evt->ct = IOTCONNECT_INBOUND_CT_NONE;
+    p_evt->message.p = p_data;
+    p_evt->message.len = len;
+    if (p_data == NULL) {
+        return false;
+    }
+    Cursor cur = { p_data, p_data + len };
+    return parse_object(&cur, p_evt, 0);
+}
+
+bool iotconnect_slice_copy(IotConnectSlice slice, char *p_buf, size_t size) {
+    if (slice.len >= size) {
+        return false;
+    }
+    memcpy(p_buf, slice.p, slice.len);
+    p_buf[slice.len] = 0;
+    return true;
+}
+
+bool iotconnect_slice_equals(IotConnectSlice slice, const char *p_str) {
+    size_t len = strlen(p_str);
+    return slice.len == len && memcmp(slice.p, p_str, len) == 0;
+}
@@ -0,0 +1,356 @@
+//
+// Copyright: Avnet 2021
+//
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+#include "iotconnect_batch.h"
+#include "iotconnect_priority.h"
+
+/********************************************************************************************/
+/* Static definition                                                                        */
+/********************************************************************************************/
+// Every record is a uint32_t payload length and the uint32_t time it was queued, in ms,
+// followed by the payload, padded to 4 bytes. As in the store-and-forward queue, records never
+// wrap: a wrap marker sends the reader back to offset 0.
+#define RECORD_HDR_SIZE                     (2 * sizeof(uint32_t))
+#define RECORD_WRAP_MARKER                  UINT32_MAX
+#define RECORD_ALIGN(n)                     (((n) + 3) & ~(size_t)3)
+#define RECORD_SIZE(len)                    RECORD_ALIGN(RECORD_HDR_SIZE + (len))
+
+typedef struct {
+    IotConnectClassConfig config;
+    unsigned char *p_buf;
+    size_t head;
+    size_t tail;
+    int current;                            // smooth weighted round robin credit
+    IotConnectClassStats stats;
+} ClassQueue;
+
+/********************************************************************************************/
+/* Member variables declaration                                                             */
+/********************************************************************************************/
+static ClassQueue classes[IOTCONNECT_CLASS_COUNT];
+static IotConnectPrioritySendFunction send_function = NULL;
+static bool dispatching = false;
+static char *pack_buf = NULL;
+static size_t pack_cap = 0;
+
+static const IotConnectClassConfig m_class_defaults[IOTCONNECT_CLASS_COUNT] = {
+    { 4 * 1024, 0, 8 },
+    { 4 * 1024, 0, 8 },
+    { 16 * 1024, 4, 16 },
+    { 16 * 1024, 1, 8 }
+};
+
+/********************************************************************************************/
+/* Helper functions definition                                                              */
+/********************************************************************************************/
+static uint32_t now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint32_t)((unsigned long long)ts.tv_sec * 1000 + (unsigned long long)ts.tv_nsec / 1000000);
+}
+
+static void record_latency(IotConnectClassStats *p_stats, unsigned int latency_ms) {
+    int bucket = 0;
+    p_stats->queue_latency_sum_ms += latency_ms;
+    if (latency_ms > p_stats->queue_latency_max_ms) {
+        p_stats->queue_latency_max_ms = latency_ms;
+    }
+    while (latency_ms && bucket < IOTCONNECT_PRIORITY_LATENCY_BUCKETS - 1) {
+        latency_ms >>= 1;
+        bucket++;
+    }
+    p_stats->queue_latency_hist[bucket]++;
+}
+
+// Skips a wrap marker, or an end of ring too short to hold one, at a read position.
+static size_t ring_fix(const ClassQueue *p_class, size_t offset) {
+    uint32_t hdr;
+    if (p_class->config.capacity - offset < RECORD_HDR_SIZE) {
+        return 0;
+    }
+    memcpy(&hdr, p_class->p_buf + offset, sizeof(hdr));
+    return hdr == RECORD_WRAP_MARKER ? 0 : offset;
+}
+
+static void ring_fix_head(ClassQueue *p_class) {
+    p_class->head = ring_fix(p_class, p_class->head);
+}
+
+static bool ring_reserve(ClassQueue *p_class, size_t need, size_t *p_offset) {
+    size_t cap = p_class->config.capacity;
+    if (p_class->stats.pending == 0) {
+        p_class->head = 0;
+        p_class->tail = 0;
+    } else if (p_class->tail == p_class->head) {
+        return false; // full
+    }
+    if (p_class->tail >= p_class->head) {
+        if (cap - p_class->tail >= need) {
+            *p_offset = p_class->tail;
+            return true;
+        }
+        if (p_class->head >= need) {
+            if (cap - p_class->tail >= RECORD_HDR_SIZE) {
+                uint32_t marker = RECORD_WRAP_MARKER;
+                memcpy(p_class->p_buf + p_class->tail, &marker, sizeof(marker));
+            }
+            *p_offset = 0;
+            return true;
+        }
+        return false;
+    }
+    if (p_class->head - p_class->tail >= need) {
+        *p_offset = p_class->tail;
+        return true;
+    }
+    return false;
+}
+
+static bool class_ready(const ClassQueue *p_class) {
+    return p_class->stats.pending > 0 && p_class->stats.outstanding < p_class->config.max_outstanding;
+}
+
+// Merges the records of the packets from the head of the queue into pack_buf, as long as the
+// message stays within pack_cap. Returns the message length and sets *p_count to the packets
+// it holds, or returns 0 if the head packet is to be sent as is.
+static size_t pack_head(const ClassQueue *p_class, size_t *p_count) {
+    size_t offset = p_class->head;
+    size_t len = 0;
+    size_t insert_pos = 0;
+    *p_count = 0;
+    while (*p_count < p_class->stats.pending) {
+        uint32_t hdr[2];
+        size_t open, close;
+        offset = ring_fix(p_class, offset);
+        memcpy(hdr, p_class->p_buf + offset, sizeof(hdr));
+        const char *p_packet = (const char *)p_class->p_buf + offset + RECORD_HDR_SIZE;
+        if (hdr[0] == 0 || p_packet[0] != '{' ||
+            !iotconnect_batch_find_records(p_packet, hdr[0], &open, &close)) {
+            break;
+        }
+        if (*p_count == 0) {
+            if (hdr[0] > pack_cap) {
+                break;
+            }
+            memcpy(pack_buf, p_packet, hdr[0]);
+            len = hdr[0];
+            insert_pos = close;
+        } else {
+            // Splice ",<records>" in front of the closing ']', as batching does.
+            size_t records_len = close - open - 1;
+            if (len + records_len + 1 > pack_cap) {
+                break;
+            }
+            memmove(pack_buf + insert_pos + records_len + 1, pack_buf + insert_pos,
+                len - insert_pos);
+            pack_buf[insert_pos] = ',';
+            memcpy(pack_buf + insert_pos + 1, p_packet + open + 1, records_len);
+            len += records_len + 1;
+            insert_pos += records_len + 1;
+        }
+        (*p_count)++;
+        offset += RECORD_SIZE(hdr[0]);
+    }
+    return *p_count > 1 ? len : 0;
+}
+
+// Strict classes first, in class order, then the weighted class with the most credit.
+static ClassQueue *next_class(void) {
+    int total_weight = 0;
+    ClassQueue *p_best = NULL;
+    for (int i = 0; i < IOTCONNECT_CLASS_COUNT; i++) {
+        ClassQueue *p_class = &classes[i];
+        if (!class_ready(p_class)) {
+            continue;
+        }
+        if (p_class->config.weight == 0) {
+            return p_class;
+        }
+        p_class->current += (int)p_class->config.weight;
+        total_weight += (int)p_class->config.weight;
+        if (p_best == NULL || p_class->current > p_best->current) {
+            p_best = p_class;
+        }
+    }
+    if (p_best) {
+        p_best->current -= total_weight;
+    }
+    return p_best;
+}
+
+/********************************************************************************************/
+/* Priority queue functions definition                                                      */
+/********************************************************************************************/
+bool iotconnect_priority_init(const IotConnectPriorityConfig *p_config,
+    IotConnectPrioritySendFunction send_fn) {
+    iotconnect_priority_deinit();
+    if (p_config == NULL || !p_config->enabled || send_fn == NULL) {
+        return false;
+    }
+    for (int i = 0; i < IOTCONNECT_CLASS_COUNT; i++) {
+        ClassQueue *p_class = &classes[i];
+        p_class->config = p_config->classes[i].capacity ? p_config->classes[i] : m_class_defaults[i];
+        if (p_class->config.max_outstanding == 0) {
+            p_class->config.max_outstanding = m_class_defaults[i].max_outstanding;
+        }
+        if (p_class->config.capacity < RECORD_SIZE(1)) {
+            iotconnect_priority_deinit();
+            return false;
+        }
+        p_class->p_buf = malloc(p_class->config.capacity);
+        if (p_class->p_buf == NULL) {
+            iotconnect_priority_deinit();
+            return false;
+        }
+    }
+    if (p_config->pack_bytes) {
+        pack_buf = malloc(p_config->pack_bytes);
+        if (pack_buf == NULL) {
+            iotconnect_priority_deinit();
+            return false;
+        }
+        pack_cap = p_config->pack_bytes;
+    }
+    send_function = send_fn;
+    return true;
+}
+
+void iotconnect_priority_deinit(void) {
+    for (int i = 0; i < IOTCONNECT_CLASS_COUNT; i++) {
+        free(classes[i].p_buf);
+    }
+    memset(classes, 0, sizeof(classes));
+    free(pack_buf);
+    pack_buf = NULL;
+    pack_cap = 0;
+    send_function = NULL;
+}
+
+bool iotconnect_priority_is_enabled(void) {
+    return send_function != NULL;
+}
+
+bool iotconnect_priority_enqueue(IotConnectSendClass send_class, const char *p_data, size_t len) {
+    if (send_function == NULL || send_class >= IOTCONNECT_CLASS_COUNT || p_data == NULL) {
+        return false;
+    }
+    ClassQueue *p_class = &classes[send_class];
+    size_t offset;
+    size_t need = RECORD_SIZE(len);
+    if (len >= RECORD_WRAP_MARKER || !ring_reserve(p_class, need, &offset)) {
+        p_class->stats.rejected++;
+        return false;
+    }
+    uint32_t hdr[2] = { (uint32_t)len, now_ms() };
+    memcpy(p_class->p_buf + offset, hdr, sizeof(hdr));
+    memcpy(p_class->p_buf + offset + RECORD_HDR_SIZE, p_data, len);
+    p_class->tail = offset + need;
+    p_class->stats.queued++;
+    p_class->stats.pending++;
+    p_class->stats.pending_bytes += len;
+    return true;
+}
+
+size_t iotconnect_priority_dispatch(void) {
+    size_t sent = 0;
+    // The send function may complete messages synchronously and get back here.
+    if (send_function == NULL || dispatching) {
+        return 0;
+    }
+    dispatching = true;
+    ClassQueue *p_class;
+    while ((p_class = next_class()) != NULL) {
+        uint32_t hdr[2];
+        size_t count = 1;
+        size_t len = 0;
+        IotConnectSendClass send_class = (IotConnectSendClass)(p_class - classes);
+        ring_fix_head(p_class);
+        memcpy(hdr, p_class->p_buf + p_class->head, sizeof(hdr));
+        if (pack_buf && send_class != IOTCONNECT_CLASS_CONTROL) {
+            len = pack_head(p_class, &count);
+        }
+        if (len == 0) {
+            count = 1;
+        }
+        IotConnectPrioritySendResult result = send_function(len ? pack_buf :
+            (const char *)p_class->p_buf + p_class->head + RECORD_HDR_SIZE, len ? len : hdr[0],
+            send_class);
+        if (result == IOTCONNECT_PRIORITY_RETRY) {
+            // Credits still sum to 0, so the shares even out over the next picks.
+            break;
+        }
+        uint32_t now = now_ms();
+        for (size_t i = 0; i < count; i++) {
+            ring_fix_head(p_class);
+            memcpy(hdr, p_class->p_buf + p_class->head, sizeof(hdr));
+            if (result == IOTCONNECT_PRIORITY_SENT) {
+                record_latency(&p_class->stats, now - hdr[1]);
+                p_class->stats.sent++;
+            } else {
+                p_class->stats.failed++;
+            }
+            p_class->head += RECORD_SIZE(hdr[0]);
+            p_class->stats.pending--;
+            p_class->stats.pending_bytes -= hdr[0];
+        }
+        if (p_class->stats.pending == 0) {
+            p_class->head = 0;
+            p_class->tail = 0;
+        }
+        if (result == IOTCONNECT_PRIORITY_FAILED) {
+            // Dropped so it cannot hold up its class, nor the classes after it, forever.
+            continue;
+        }
+        p_class->stats.messages++;
+        if (count > 1) {
+            p_class->stats.packed += count;
+        }
+        if (++p_class->stats.outstanding > p_class->stats.max_outstanding_seen) {
+            p_class->stats.max_outstanding_seen = p_class->stats.outstanding;
+        }
+        sent++;
+    }
+    dispatching = false;
+    return sent;
+}
+
+void iotconnect_priority_complete(IotConnectSendClass send_class, unsigned int ack_latency_ms) {
+    if (send_class >= IOTCONNECT_CLASS_COUNT) {
+        return;
+    }
+    IotConnectClassStats *p_stats = &classes[send_class].stats;
+    if (p_stats->outstanding) {
+        p_stats->outstanding--;
+    }
+    p_stats->acknowledged++;
+    p_stats->ack_latency_sum_ms += ack_latency_ms;
+    if (ack_latency_ms > p_stats->ack_latency_max_ms) {
+        p_stats->ack_latency_max_ms = ack_latency_ms;
+    }
+}
+
+size_t iotconnect_priority_pending(void) {
+    size_t pending = 0;
+    for (int i = 0; i < IOTCONNECT_CLASS_COUNT; i++) {
+        pending += classes[i].stats.pending;
+    }
+    return pending;
+}
+
+unsigned int iotconnect_priority_outstanding(void) {
+    unsigned int outstanding = 0;
+    for (int i = 0; i < IOTCONNECT_CLASS_COUNT; i++) {
+        outstanding += classes[i].stats.outstanding;
+    }
+    return outstanding;
+}
+
+void iotconnect_priority_get_stats(IotConnectSendClass send_class, IotConnectClassStats *p_stats) {
+    if (send_class < IOTCONNECT_CLASS_COUNT) {
+        *p_stats = classes[send_class].stats;
+    }
+}
@@ -0,0 +1,204 @@
+//
+// Copyright: Avnet 2021
+//
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include "iotconnect_queue.h"
+
+/********************************************************************************************/
+/* Static definition                                                                        */
+/********************************************************************************************/
+// Every record is a uint32_t payload length followed by the NUL terminated payload, padded to
+// 4 bytes. Records never wrap: when one does not fit at the end of the ring, a wrap marker is
+// written (if there is room for it) and the record starts over at offset 0.
+#define RECORD_HDR_SIZE                     sizeof(uint32_t)
+#define RECORD_WRAP_MARKER                  UINT32_MAX
+#define RECORD_ALIGN(n)                     (((n) + 3) & ~(size_t)3)
+#define RECORD_SIZE(len)                    RECORD_ALIGN(RECORD_HDR_SIZE + (len) + 1)
+
+/********************************************************************************************/
+/* Member variables declaration                                                             */
+/********************************************************************************************/
+static unsigned char *queue_buf = NULL;
+static bool queue_buf_owned = false;
+static size_t queue_cap = 0;
+static size_t queue_head = 0;
+static size_t queue_tail = 0;
+static size_t queue_count = 0;
+static IotConnectQueueDropPolicy queue_policy = IOTC_QUEUE_DROP_OLDEST;
+static IotConnectQueueStats queue_stats = { 0 };
+
+/********************************************************************************************/
+/* Helper functions definition                                                              */
+/********************************************************************************************/
+static size_t ring_used(void) {
+    if (queue_count == 0) {
+        return 0;
+    }
+    return (queue_tail > queue_head) ? (queue_tail - queue_head) :
+        (queue_cap - queue_head + queue_tail);
+}
+
+// Skips a wrap marker, or an end of ring too short to hold one, at the read position.
+static void ring_fix_head(void) {
+    uint32_t hdr;
+    if (queue_cap - queue_head < RECORD_HDR_SIZE) {
+        queue_head = 0;
+        return;
+    }
+    memcpy(&hdr, queue_buf + queue_head, sizeof(hdr));
+    if (hdr == RECORD_WRAP_MARKER) {
+        queue_head = 0;
+    }
+}
+
+static bool ring_reserve(size_t need, size_t *p_offset) {
+    if (queue_count == 0) {
+        queue_head = 0;
+        queue_tail = 0;
+    }
+    if (queue_count && queue_tail == queue_head) {
+        return false; // full
+    }
+    if (queue_tail >= queue_head) {
+        if (queue_cap - queue_tail >= need) {
+            *p_offset = queue_tail;
+            return true;
+        }
+        if (queue_head >= need) {
+            if (queue_cap - queue_tail >= RECORD_HDR_SIZE) {
+                uint32_t marker = RECORD_WRAP_MARKER;
+                memcpy(queue_buf + queue_tail, &marker, sizeof(marker));
+            }
+            *p_offset = 0;
+            return true;
+        }
+        return false;
+    }
+    if (queue_head - queue_tail >= need) {
+        *p_offset = queue_tail;
+        return true;
+    }
+    return false;
+}
+
+static void ring_discard(bool dropped) {
+    uint32_t len;
+    ring_fix_head();
+    memcpy(&len, queue_buf + queue_head, sizeof(len));
+    queue_head += RECORD_SIZE(len);
+    queue_count--;
+    queue_stats.pending_packets--;
+    queue_stats.pending_bytes -= len;
+    if (dropped) {
+        queue_stats.dropped_packets++;
+        queue_stats.dropped_bytes += len;
+    } else {
+        queue_stats.sent_packets++;
+        queue_stats.sent_bytes += len;
+    }
+    if (queue_count == 0) {
+        queue_head = 0;
+        queue_tail = 0;
+    }
+}
+
+/********************************************************************************************/
+/* Queue functions definition                                                               */
+/********************************************************************************************/
+bool iotconnect_queue_init(size_t capacity, void *p_buffer, IotConnectQueueDropPolicy policy) {
+    if (capacity < RECORD_SIZE(1)) {
+        return false;
+    }
+    iotconnect_queue_deinit();
+    if (p_buffer) {
+        queue_buf = p_buffer;
+        queue_buf_owned = false;
+    } else {
+        queue_buf = malloc(capacity);
+        if (queue_buf == NULL) {
+            return false;
+        }
+        queue_buf_owned = true;
+    }
+    queue_cap = capacity;
+    queue_policy = policy;
+    memset(&queue_stats, 0, sizeof(queue_stats));
+    return true;
+}
+
+void iotconnect_queue_deinit(void) {
+    if (queue_buf_owned) {
+        free(queue_buf);
+    }
+    queue_buf = NULL;
+    queue_buf_owned = false;
+    queue_cap = 0;
+    queue_head = 0;
+    queue_tail = 0;
+    queue_count = 0;
+}
+
+bool iotconnect_queue_push(const char *p_data, size_t len) {
+    size_t offset;
+    if (queue_buf == NULL || p_data == NULL) {
+        return false;
+    }
+    size_t need = RECORD_SIZE(len);
+    // A packet that cannot fit even in an empty queue must not evict anything first.
+    if (len >= RECORD_WRAP_MARKER || need > queue_cap) {
+        queue_stats.dropped_packets++;
+        queue_stats.dropped_bytes += len;
+        return false;
+    }
+    while (!ring_reserve(need, &offset)) {
+        if (queue_policy == IOTC_QUEUE_DROP_NEWEST || queue_count == 0) {
+            queue_stats.dropped_packets++;
+            queue_stats.dropped_bytes += len;
+            return false;
+        }
+        ring_discard(true);
+    }
+    uint32_t hdr = (uint32_t)len;
+    memcpy(queue_buf + offset, &hdr, sizeof(hdr));
+    memcpy(queue_buf + offset + RECORD_HDR_SIZE, p_data, len);
+    queue_buf[offset + RECORD_HDR_SIZE + len] = 0;
+    queue_tail = offset + need;
+    queue_count++;
+    queue_stats.queued_packets++;
+    queue_stats.queued_bytes += len;
+    queue_stats.pending_packets++;
+    queue_stats.pending_bytes += len;
+    if (ring_used() > queue_stats.high_water_bytes) {
+        queue_stats.high_water_bytes = ring_used();
+    }
+    return true;
+}
+
+const char *iotconnect_queue_peek(size_t *p_len) {
+    uint32_t len;
+    if (queue_count == 0) {
+        return NULL;
+    }
+    ring_fix_head();
+    memcpy(&len, queue_buf + queue_head, sizeof(len));
+    if (p_len) {
+        *p_len = len;
+    }
+    return (const char *)(queue_buf + queue_head + RECORD_HDR_SIZE);
+}
+
+void iotconnect_queue_pop(void) {
+    if (queue_count) {
+        ring_discard(false);
+    }
+}
+
+size_t iotconnect_queue_count(void) {
+    return queue_count;
+}
+
+void iotconnect_queue_get_stats(IotConnectQueueStats *p_stats) {
+    *p_stats = queue_stats;
+}
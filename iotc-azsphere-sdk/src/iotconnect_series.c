@@ -0,0 +1,448 @@
+//
+// Copyright: Avnet 2021
+//
+#include <string.h>
+#include <math.h>
+#include "iotconnect_series.h"
+
+/********************************************************************************************/
+/* Static definition                                                                        */
+/********************************************************************************************/
+#define HEADER_ROWS_OFFSET                  2
+#define LEADING_BITS                        5
+#define LENGTH_BITS                         6
+#define MAX_LEADING                         31
+#define FIXED_LIMIT                         9007199254740992.0  // 2^53, exact in a double
+
+// Buckets of the integer coder: prefix, its length, value bits and offset
+static const struct {
+    unsigned int prefix;
+    unsigned int prefix_bits;
+    unsigned int value_bits;
+    int64_t offset;
+} m_buckets[] = {
+    { 0x2, 2, 7, 63 },
+    { 0x6, 3, 9, 255 },
+    { 0xe, 4, 12, 2047 },
+    { 0x1e, 5, 32, 0 },
+    { 0x1f, 5, 64, 0 }
+};
+
+#define BUCKET_COUNT                        (sizeof(m_buckets) / sizeof(m_buckets[0]))
+
+static const char m_base64[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+/********************************************************************************************/
+/* Bit stream functions definition                                                          */
+/********************************************************************************************/
+static bool put_bits(IotConnectSeriesEncoder *p_enc, uint64_t value, unsigned int count) {
+    if (p_enc->size * 8 - p_enc->bit_len < count) {
+        p_enc->full = true;
+        return false;
+    }
+    while (count) {
+        size_t byte = p_enc->bit_len >> 3;
+        unsigned int offset = p_enc->bit_len & 7;
+        unsigned int take = 8 - offset < count ? 8 - offset : count;
+        if (offset == 0) {
+            p_enc->p_buf[byte] = 0;
+        }
+        unsigned int bits = (unsigned int)(value >> (count - take)) & ((1u << take) - 1);
+        p_enc->p_buf[byte] |= (unsigned char)(bits << (8 - offset - take));
+        p_enc->bit_len += take;
+        count -= take;
+    }
+    return true;
+}
+
+static uint64_t get_bits(IotConnectSeriesDecoder *p_dec, unsigned int count) {
+    if (p_dec->len * 8 - p_dec->bit_pos < count) {
+        p_dec->failed = true;
+        return 0;
+    }
+    uint64_t value = 0;
+    while (count) {
+        unsigned int offset = p_dec->bit_pos & 7;
+        unsigned int take = 8 - offset < count ? 8 - offset : count;
+        unsigned int byte = p_dec->p_block[p_dec->bit_pos >> 3];
+        value = (value << take) | ((byte >> (8 - offset - take)) & ((1u << take) - 1));
+        p_dec->bit_pos += take;
+        count -= take;
+    }
+    return value;
+}
+
+static bool put_int(IotConnectSeriesEncoder *p_enc, int64_t value) {
+    if (value == 0) {
+        return put_bits(p_enc, 0, 1);
+    }
+    for (size_t i = 0; i < BUCKET_COUNT; i++) {
+        int64_t offset = m_buckets[i].offset;
+        unsigned int bits = m_buckets[i].value_bits;
+        bool fits;
+        if (offset) {
+            fits = value >= -offset && value <= offset + 1;
+        } else {
+            fits = bits == 64 || (value >= INT32_MIN && value <= INT32_MAX);
+        }
+        if (fits) {
+            uint64_t coded = offset ? (uint64_t)(value + offset) : (uint64_t)value;
+            if (bits < 64) {
+                coded &= ((uint64_t)1 << bits) - 1;
+            }
+            return put_bits(p_enc, m_buckets[i].prefix, m_buckets[i].prefix_bits) &&
+                put_bits(p_enc, coded, bits);
+        }
+    }
+    return false;
+}
+
+static int64_t get_int(IotConnectSeriesDecoder *p_dec) {
+    unsigned int ones = 0;
+    // Count the 1 bits of the prefix, up to 4, ended by a 0 except in the last bucket.
+    while (ones < 5 && get_bits(p_dec, 1)) {
+        ones++;
+    }
+    if (ones == 0) {
+        return 0;
+    }
+    unsigned int bits = m_buckets[ones - 1].value_bits;
+    int64_t offset = m_buckets[ones - 1].offset;
+    uint64_t coded = get_bits(p_dec, bits);
+    if (offset) {
+        return (int64_t)coded - offset;
+    }
+    if (bits == 32) {
+        return (int32_t)(uint32_t)coded;
+    }
+    return (int64_t)coded;
+}
+
+static int leading_zeros(uint64_t value) {
+    int count = 0;
+    for (uint64_t mask = (uint64_t)1 << 63; mask && !(value & mask); mask >>= 1) {
+        count++;
+    }
+    return count;
+}
+
+static int trailing_zeros(uint64_t value) {
+    int count = 0;
+    for (uint64_t mask = 1; mask && !(value & mask); mask <<= 1) {
+        count++;
+    }
+    return count;
+}
+
+static bool put_xor(IotConnectSeriesEncoder *p_enc, IotConnectSeriesColumnState *p_col,
+    uint64_t bits) {
+    uint64_t xor = bits ^ p_col->bits;
+    p_col->bits = bits;
+    if (xor == 0) {
+        return put_bits(p_enc, 0, 1);
+    }
+    int leading = leading_zeros(xor);
+    int trailing = trailing_zeros(xor);
+    if (leading > MAX_LEADING) {
+        leading = MAX_LEADING;
+    }
+    if (p_col->leading >= 0 && leading >= p_col->leading && trailing >= p_col->trailing) {
+        // Inside the previous window
+        int len = 64 - p_col->leading - p_col->trailing;
+        return put_bits(p_enc, 0x2, 2) && put_bits(p_enc, xor >> p_col->trailing, (unsigned int)len);
+    }
+    int len = 64 - leading - trailing;
+    p_col->leading = leading;
+    p_col->trailing = trailing;
+    return put_bits(p_enc, 0x3, 2) && put_bits(p_enc, (uint64_t)leading, LEADING_BITS) &&
+        put_bits(p_enc, (uint64_t)(len - 1), LENGTH_BITS) &&
+        put_bits(p_enc, xor >> trailing, (unsigned int)len);
+}
+
+static uint64_t get_xor(IotConnectSeriesDecoder *p_dec, IotConnectSeriesColumnState *p_col) {
+    if (get_bits(p_dec, 1) == 0) {
+        return p_col->bits;
+    }
+    if (get_bits(p_dec, 1) == 1) {
+        p_col->leading = (int)get_bits(p_dec, LEADING_BITS);
+        int len = (int)get_bits(p_dec, LENGTH_BITS) + 1;
+        p_col->trailing = 64 - p_col->leading - len;
+        if (p_col->trailing < 0) {
+            p_dec->failed = true;
+            return 0;
+        }
+    } else if (p_col->leading < 0) {
+        p_dec->failed = true;
+        return 0;
+    }
+    int len = 64 - p_col->leading - p_col->trailing;
+    p_col->bits ^= get_bits(p_dec, (unsigned int)len) << p_col->trailing;
+    return p_col->bits;
+}
+
+static uint64_t double_bits(double value) {
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    return bits;
+}
+
+static double bits_double(uint64_t bits) {
+    double value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+/********************************************************************************************/
+/* Encoder functions definition                                                             */
+/********************************************************************************************/
+bool iotconnect_series_init(IotConnectSeriesEncoder *p_enc, const IotConnectSeriesColumn *p_columns,
+    size_t count, unsigned char *p_buf, size_t size) {
+    memset(p_enc, 0, sizeof(*p_enc));
+    if (p_columns == NULL || count == 0 || count > IOTCONNECT_SERIES_MAX_COLUMNS || p_buf == NULL) {
+        return false;
+    }
+    p_enc->p_buf = p_buf;
+    p_enc->size = size;
+    p_enc->columns = count;
+    size_t len = 4;
+    for (size_t i = 0; i < count; i++) {
+        const IotConnectSeriesColumn *p_col = &p_columns[i];
+        size_t name_len = p_col->p_name ? strlen(p_col->p_name) : 0;
+        if (name_len == 0 || name_len > UINT8_MAX || p_col->precision < 0 ||
+            p_col->precision > IOTCONNECT_SERIES_MAX_PRECISION) {
+            return false;
+        }
+        len += 2 + name_len;
+    }
+    if (len > size) {
+        p_enc->full = true;
+        return false;
+    }
+    unsigned char *p = p_buf;
+    *p++ = IOTCONNECT_SERIES_VERSION;
+    *p++ = (unsigned char)count;
+    *p++ = 0;
+    *p++ = 0;
+    for (size_t i = 0; i < count; i++) {
+        size_t name_len = strlen(p_columns[i].p_name);
+        *p++ = (unsigned char)name_len;
+        memcpy(p, p_columns[i].p_name, name_len);
+        p += name_len;
+        *p++ = (unsigned char)p_columns[i].precision;
+        p_enc->state[i].scale = p_columns[i].precision ? pow(10, p_columns[i].precision) : 0;
+        p_enc->state[i].leading = -1;
+    }
+    p_enc->bit_len = len * 8;
+    return true;
+}
+
+bool iotconnect_series_add(IotConnectSeriesEncoder *p_enc, uint64_t timestamp_ms,
+    const double *p_values) {
+    if (p_enc->columns == 0 || p_enc->rows == IOTCONNECT_SERIES_MAX_ROWS) {
+        return false;
+    }
+    // Fixed point values are checked first, so a rejected row leaves no trace.
+    int64_t fixed[IOTCONNECT_SERIES_MAX_COLUMNS];
+    for (size_t i = 0; i < p_enc->columns; i++) {
+        if (p_enc->state[i].scale != 0) {
+            double scaled = round(p_values[i] * p_enc->state[i].scale);
+            if (!(fabs(scaled) < FIXED_LIMIT)) {
+                return false;
+            }
+            fixed[i] = (int64_t)scaled;
+        }
+    }
+    size_t bit_len = p_enc->bit_len;
+    uint64_t prev_time = p_enc->prev_time;
+    int64_t prev_delta = p_enc->prev_delta;
+    IotConnectSeriesColumnState state[IOTCONNECT_SERIES_MAX_COLUMNS];
+    memcpy(state, p_enc->state, p_enc->columns * sizeof(state[0]));
+
+    bool ok;
+    if (p_enc->rows == 0) {
+        ok = put_bits(p_enc, timestamp_ms, 64);
+        p_enc->prev_delta = 0;
+    } else {
+        int64_t delta = (int64_t)(timestamp_ms - p_enc->prev_time);
+        ok = put_int(p_enc, delta - p_enc->prev_delta);
+        p_enc->prev_delta = delta;
+    }
+    p_enc->prev_time = timestamp_ms;
+    for (size_t i = 0; ok && i < p_enc->columns; i++) {
+        IotConnectSeriesColumnState *p_col = &p_enc->state[i];
+        if (p_col->scale == 0) {
+            uint64_t bits = double_bits(p_values[i]);
+            if (p_enc->rows == 0) {
+                p_col->bits = bits;
+                ok = put_bits(p_enc, bits, 64);
+            } else {
+                ok = put_xor(p_enc, p_col, bits);
+            }
+        } else {
+            ok = put_int(p_enc, p_enc->rows == 0 ? fixed[i] : fixed[i] - (int64_t)p_col->bits);
+            p_col->bits = (uint64_t)fixed[i];
+        }
+    }
+    if (!ok) {
+        // Roll back to the end of the previous row, clearing the bits written since.
+        p_enc->bit_len = bit_len;
+        if (bit_len & 7) {
+            p_enc->p_buf[bit_len >> 3] &= (unsigned char)(0xff << (8 - (bit_len & 7)));
+        }
+        p_enc->prev_time = prev_time;
+        p_enc->prev_delta = prev_delta;
+        memcpy(p_enc->state, state, p_enc->columns * sizeof(state[0]));
+        return false;
+    }
+    p_enc->rows++;
+    return true;
+}
+
+size_t iotconnect_series_finish(IotConnectSeriesEncoder *p_enc) {
+    if (p_enc->rows == 0) {
+        return 0;
+    }
+    p_enc->p_buf[HEADER_ROWS_OFFSET] = (unsigned char)(p_enc->rows >> 8);
+    p_enc->p_buf[HEADER_ROWS_OFFSET + 1] = (unsigned char)p_enc->rows;
+    return (p_enc->bit_len + 7) / 8;
+}
+
+/********************************************************************************************/
+/* Decoder functions definition                                                             */
+/********************************************************************************************/
+bool iotconnect_series_decoder_init(IotConnectSeriesDecoder *p_dec, const unsigned char *p_block,
+    size_t len) {
+    memset(p_dec, 0, sizeof(*p_dec));
+    p_dec->failed = true;
+    if (p_block == NULL || len < 4 || p_block[0] != IOTCONNECT_SERIES_VERSION || p_block[1] == 0 ||
+        p_block[1] > IOTCONNECT_SERIES_MAX_COLUMNS) {
+        return false;
+    }
+    p_dec->p_block = p_block;
+    p_dec->len = len;
+    p_dec->columns = p_block[1];
+    p_dec->rows = ((size_t)p_block[2] << 8) | p_block[3];
+    size_t pos = 4;
+    for (size_t i = 0; i < p_dec->columns; i++) {
+        if (pos >= len || len - pos < (size_t)p_block[pos] + 2) {
+            return false;
+        }
+        p_dec->name_lens[i] = p_block[pos];
+        p_dec->p_names[i] = (const char *)&p_block[pos + 1];
+        pos += 1 + p_dec->name_lens[i];
+        p_dec->precisions[i] = p_block[pos++];
+        if (p_dec->precisions[i] > IOTCONNECT_SERIES_MAX_PRECISION) {
+            return false;
+        }
+        p_dec->state[i].scale = p_dec->precisions[i] ? pow(10, p_dec->precisions[i]) : 0;
+        p_dec->state[i].leading = -1;
+    }
+    p_dec->bit_pos = pos * 8;
+    p_dec->failed = false;
+    return true;
+}
+
+bool iotconnect_series_decoder_next(IotConnectSeriesDecoder *p_dec, uint64_t *p_timestamp_ms,
+    double *p_values) {
+    if (p_dec->failed || p_dec->row >= p_dec->rows) {
+        return false;
+    }
+    if (p_dec->row == 0) {
+        p_dec->prev_time = get_bits(p_dec, 64);
+    } else {
+        p_dec->prev_delta += get_int(p_dec);
+        p_dec->prev_time += (uint64_t)p_dec->prev_delta;
+    }
+    *p_timestamp_ms = p_dec->prev_time;
+    for (size_t i = 0; i < p_dec->columns; i++) {
+        IotConnectSeriesColumnState *p_col = &p_dec->state[i];
+        if (p_col->scale == 0) {
+            if (p_dec->row == 0) {
+                p_col->bits = get_bits(p_dec, 64);
+            } else {
+                get_xor(p_dec, p_col);
+            }
+            p_values[i] = bits_double(p_col->bits);
+        } else {
+            int64_t fixed = get_int(p_dec);
+            if (p_dec->row > 0) {
+                fixed += (int64_t)p_col->bits;
+            }
+            p_col->bits = (uint64_t)fixed;
+            p_values[i] = (double)fixed / p_col->scale;
+        }
+    }
+    if (p_dec->failed) {
+        return false;
+    }
+    p_dec->row++;
+    return true;
+}
+
+/********************************************************************************************/
+/* Base64 functions definition                                                              */
+/********************************************************************************************/
+size_t iotconnect_base64_encode(const unsigned char *p_data, size_t len, char *p_out,
+    size_t out_size) {
+    size_t out_len = (len + 2) / 3 * 4;
+    if (out_size <= out_len) {
+        return 0;
+    }
+    char *p = p_out;
+    size_t i = 0;
+    for (; i + 2 < len; i += 3) {
+        uint32_t v = ((uint32_t)p_data[i] << 16) | ((uint32_t)p_data[i + 1] << 8) | p_data[i + 2];
+        *p++ = m_base64[v >> 18];
+        *p++ = m_base64[(v >> 12) & 0x3f];
+        *p++ = m_base64[(v >> 6) & 0x3f];
+        *p++ = m_base64[v & 0x3f];
+    }
+    if (i < len) {
+        uint32_t v = (uint32_t)p_data[i] << 16;
+        if (i + 1 < len) {
+            v |= (uint32_t)p_data[i + 1] << 8;
+        }
+        *p++ = m_base64[v >> 18];
+        *p++ = m_base64[(v >> 12) & 0x3f];
+        *p++ = (i + 1 < len) ? m_base64[(v >> 6) & 0x3f] : '=';
+        *p++ = '=';
+    }
+    *p = 0;
+    return out_len;
+}
+
+static int base64_value(char c) {
+    const char *p = c ? strchr(m_base64, c) : NULL;
+    return p ? (int)(p - m_base64) : -1;
+}
+
+size_t iotconnect_base64_decode(const char *p_text, size_t len, unsigned char *p_out,
+    size_t out_size) {
+    if (len == 0 || len % 4 != 0) {
+        return 0;
+    }
+    size_t pad = (p_text[len - 1] == '=') + (p_text[len - 2] == '=');
+    size_t out_len = len / 4 * 3 - pad;
+    if (out_size < out_len) {
+        return 0;
+    }
+    size_t o = 0;
+    for (size_t i = 0; i < len; i += 4) {
+        uint32_t v = 0;
+        for (size_t j = 0; j < 4; j++) {
+            int d = base64_value(p_text[i + j]);
+            if (d < 0) {
+                // Padding, only at the very end
+                if (p_text[i + j] != '=' || i + 4 != len || j < 4 - pad) {
+                    return 0;
+                }
+                d = 0;
+            }
+            v = (v << 6) | (uint32_t)d;
+        }
+        for (size_t j = 0; j < 3 && o < out_len; j++) {
+            p_out[o++] = (unsigned char)(v >> (16 - 8 * j));
+        }
+    }
+    return out_len;
+}
@@ -0,0 +1,158 @@
+//
+// Copyright: Avnet 2021
+//
+#include <string.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include "iotconnect_session.h"
+
+/********************************************************************************************/
+/* Static definition                                                                        */
+/********************************************************************************************/
+#define SESSION_MAGIC                       0x31534349 // "ICS1"
+#define SESSION_KEY_SIZE                    32
+#define SESSION_FIELD_SIZE                  80
+
+/********************************************************************************************/
+/* Data type definition                                                                     */
+/********************************************************************************************/
+typedef struct {
+    uint32_t magic;
+    char key[SESSION_KEY_SIZE];
+    char sid[SESSION_FIELD_SIZE];
+    char dtg[SESSION_FIELD_SIZE];
+    int64_t saved_at_s;                 // wall clock
+    uint32_t checksum;
+} SessionRecord;
+
+/********************************************************************************************/
+/* Member variables declaration                                                             */
+/********************************************************************************************/
+static IotConnectSessionConfig session_cfg = { 0 };
+static SessionRecord record;
+static char session_key[SESSION_KEY_SIZE] = "";
+static bool record_valid = false;
+static IotConnectSessionStats session_stats = { 0 };
+
+/********************************************************************************************/
+/* Helper functions definition                                                              */
+/********************************************************************************************/
+static uint32_t record_checksum(const SessionRecord *p_rec) {
+    // FNV-1a
+    uint32_t hash = 2166136261u;
+    const unsigned char *p = (const unsigned char *)p_rec;
+    for (size_t i = 0; i < offsetof(SessionRecord, checksum); i++) {
+        hash = (hash ^ p[i]) * 16777619u;
+    }
+    return hash;
+}
+
+static int64_t now_s(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (int64_t)ts.tv_sec;
+}
+
+static int max_age_s(void) {
+    return session_cfg.max_age_s > 0 ? session_cfg.max_age_s : IOTCONNECT_SESSION_DEFAULT_MAX_AGE_S;
+}
+
+static void write_record(void) {
+    if (lseek(session_cfg.fd, session_cfg.offset, SEEK_SET) != -1 &&
+        write(session_cfg.fd, &record, sizeof(record)) == sizeof(record)) {
+        fsync(session_cfg.fd);
+    }
+}
+
+static bool field_valid(const char *p_field, size_t size) {
+    return p_field[0] != 0 && memchr(p_field, 0, size) != NULL;
+}
+
+/********************************************************************************************/
+/* Session cache functions definition                                                       */
+/********************************************************************************************/
+bool iotconnect_session_open(const IotConnectSessionConfig *p_cfg, const char *p_key) {
+    record_valid = false;
+    session_cfg = *p_cfg;
+    if (session_cfg.size < sizeof(SessionRecord)) {
+        session_cfg.size = 0;
+        return false;
+    }
+    memset(session_key, 0, sizeof(session_key));
+    strncpy(session_key, p_key, sizeof(session_key) - 1);
+    if (lseek(session_cfg.fd, session_cfg.offset, SEEK_SET) == -1) {
+        return false;
+    }
+    ssize_t len = read(session_cfg.fd, &record, sizeof(record));
+    if (len < 0) {
+        return false;
+    }
+    record_valid = len == sizeof(record) && record.magic == SESSION_MAGIC &&
+        record.checksum == record_checksum(&record) &&
+        memcmp(record.key, session_key, sizeof(session_key)) == 0 &&
+        field_valid(record.sid, sizeof(record.sid)) && field_valid(record.dtg, sizeof(record.dtg));
+    return true;
+}
+
+bool iotconnect_session_load(char *p_sid, char *p_dtg, size_t size) {
+    if (!session_cfg.size) {
+        return false;
+    }
+    if (!record_valid) {
+        session_stats.misses++;
+        return false;
+    }
+    if (now_s() - record.saved_at_s >= max_age_s()) {
+        session_stats.expired++;
+        return false;
+    }
+    if (strlen(record.sid) >= size || strlen(record.dtg) >= size) {
+        session_stats.misses++;
+        return false;
+    }
+    strcpy(p_sid, record.sid);
+    strcpy(p_dtg, record.dtg);
+    session_stats.hits++;
+    return true;
+}
+
+void iotconnect_session_store(const char *p_sid, const char *p_dtg) {
+    if (!session_cfg.size || strlen(p_sid) >= sizeof(record.sid) ||
+        strlen(p_dtg) >= sizeof(record.dtg)) {
+        return;
+    }
+    bool unchanged = record_valid && strcmp(record.sid, p_sid) == 0 &&
+        strcmp(record.dtg, p_dtg) == 0;
+    int64_t now = now_s();
+    if (unchanged && now >= record.saved_at_s && now - record.saved_at_s < max_age_s() / 2) {
+        return;
+    }
+    if (record_valid && !unchanged) {
+        session_stats.refreshed++;
+    }
+    memset(&record, 0, sizeof(record));
+    record.magic = SESSION_MAGIC;
+    memcpy(record.key, session_key, sizeof(record.key));
+    strcpy(record.sid, p_sid);
+    strcpy(record.dtg, p_dtg);
+    record.saved_at_s = now;
+    record.checksum = record_checksum(&record);
+    record_valid = true;
+    write_record();
+}
+
+void iotconnect_session_invalidate(void) {
+    if (!session_cfg.size || !record_valid) {
+        return;
+    }
+    record_valid = false;
+    record.magic = 0;
+    session_stats.invalidated++;
+    write_record();
+}
+
+void iotconnect_session_get_stats(IotConnectSessionStats *p_stats) {
+    *p_stats = session_stats;
+}
@@ -0,0 +1,502 @@
+//
+// Copyright: Avnet 2021
+//
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include "iotconnect_spool.h"
+
+/********************************************************************************************/
+/* Static definition                                                                        */
+/********************************************************************************************/
+#define SEGMENT_MAGIC                       0x31505349 // "ISP1"
+#define SEGMENT_HDR_SIZE                    12  // magic, segment seq, seq of first data record
+#define RECORD_HDR_SIZE                     8   // length and flags, crc16, seq
+#define RECORD_ACK_FLAG                     0x8000
+#define RECORD_LEN_MASK                     0x7fff
+#define ACK_EVERY_RECORDS                   16
+
+/********************************************************************************************/
+/* Data type definition                                                                     */
+/********************************************************************************************/
+typedef struct {
+    uint32_t seg_seq;
+    uint32_t first_seq;
+    bool valid;
+} SegmentInfo;
+
+typedef struct {
+    uint16_t len_flags;
+    uint16_t crc;
+    uint32_t seq;
+} RecordHeader;
+
+/********************************************************************************************/
+/* Member variables declaration                                                             */
+/********************************************************************************************/
+static IotConnectSpoolConfig spool_cfg = { 0 };
+static SegmentInfo *segs = NULL;
+static size_t seg_count = 0;
+static unsigned char *wbuf = NULL;      // records not yet written, destined for w_seg at w_off
+static size_t wbuf_len = 0;
+static size_t w_seg = 0;
+static size_t w_off = 0;
+static uint32_t w_seg_seq = 0;
+static uint32_t next_seq = 1;           // seq of the next data record
+static unsigned char *rbuf = NULL;      // one segment, for recovery and reading records back
+static size_t r_seg = 0;                // read cursor: next record to send
+static size_t r_off = 0;
+static uint32_t r_seq = 1;
+static size_t r_len = 0;                // payload length of the peeked record, 0 if none
+static uint32_t unacked = 0;
+static IotConnectSpoolStats spool_stats = { 0 };
+
+/********************************************************************************************/
+/* Helper functions definition                                                              */
+/********************************************************************************************/
+static uint16_t crc16_update(uint16_t crc, const unsigned char *p_data, size_t len) {
+    // CRC-16/CCITT, nibble table
+    static const uint16_t table[16] = {
+        0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50a5, 0x60c6, 0x70e7,
+        0x8108, 0x9129, 0xa14a, 0xb16b, 0xc18c, 0xd1ad, 0xe1ce, 0xf1ef
+    };
+    for (size_t i = 0; i < len; i++) {
+        crc = (uint16_t)((crc << 4) ^ table[((crc >> 12) ^ (p_data[i] >> 4)) & 0x0f]);
+        crc = (uint16_t)((crc << 4) ^ table[((crc >> 12) ^ (p_data[i] & 0x0f)) & 0x0f]);
+    }
+    return crc;
+}
+
+static uint16_t record_crc(uint32_t seg_seq, const RecordHeader *p_hdr, const unsigned char *p_data) {
+    uint16_t crc = crc16_update(0xffff, (const unsigned char *)&seg_seq, sizeof(seg_seq));
+    crc = crc16_update(crc, (const unsigned char *)&p_hdr->len_flags, sizeof(p_hdr->len_flags));
+    crc = crc16_update(crc, (const unsigned char *)&p_hdr->seq, sizeof(p_hdr->seq));
+    return crc16_update(crc, p_data, p_hdr->len_flags & RECORD_LEN_MASK);
+}
+
+static unsigned long now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long)ts.tv_sec * 1000000UL + (unsigned long)ts.tv_nsec / 1000UL;
+}
+
+static off_t seg_file_offset(size_t seg, size_t off) {
+    return spool_cfg.offset + (off_t)(seg * spool_cfg.segment_size + off);
+}
+
+static bool read_at(size_t seg, size_t off, void *p_buf, size_t len) {
+    if (lseek(spool_cfg.fd, seg_file_offset(seg, off), SEEK_SET) == -1) {
+        return false;
+    }
+    return read(spool_cfg.fd, p_buf, len) == (ssize_t)len;
+}
+
+// Reads a whole segment into rbuf. The file may end inside the segment.
+static bool read_segment(size_t seg) {
+    if (lseek(spool_cfg.fd, seg_file_offset(seg, 0), SEEK_SET) == -1) {
+        return false;
+    }
+    ssize_t len = read(spool_cfg.fd, rbuf, spool_cfg.segment_size);
+    if (len < SEGMENT_HDR_SIZE) {
+        return false;
+    }
+    memset(rbuf + len, 0, spool_cfg.segment_size - (size_t)len);
+    return true;
+}
+
+static bool write_at(size_t seg, size_t off, const void *p_buf, size_t len) {
+    if (lseek(spool_cfg.fd, seg_file_offset(seg, off), SEEK_SET) == -1) {
+        return false;
+    }
+    if (write(spool_cfg.fd, p_buf, len) != (ssize_t)len) {
+        return false;
+    }
+    spool_stats.written_bytes += len;
+    spool_stats.write_ops++;
+    return true;
+}
+
+// Parses the record at off of a segment image. Returns the record size, or 0 at the end of
+// the valid records.
+static size_t parse_record(const unsigned char *p_seg, size_t off, uint32_t seg_seq,
+    RecordHeader *p_hdr) {
+    if (off + RECORD_HDR_SIZE > spool_cfg.segment_size) {
+        return 0;
+    }
+    memcpy(&p_hdr->len_flags, p_seg + off, 2);
+    memcpy(&p_hdr->crc, p_seg + off + 2, 2);
+    memcpy(&p_hdr->seq, p_seg + off + 4, 4);
+    size_t len = p_hdr->len_flags & RECORD_LEN_MASK;
+    bool is_ack = (p_hdr->len_flags & RECORD_ACK_FLAG) != 0;
+    if ((is_ack && len != 0) || (!is_ack && len == 0) ||
+        off + RECORD_HDR_SIZE + len > spool_cfg.segment_size) {
+        return 0;
+    }
+    if (record_crc(seg_seq, p_hdr, p_seg + off + RECORD_HDR_SIZE) != p_hdr->crc) {
+        return 0;
+    }
+    return RECORD_HDR_SIZE + len;
+}
+
+// Room for the zeroed record header written after the last record, which the next write
+// overwrites. Recovery resumes appending to a segment only when it finds that terminator.
+static size_t terminator_size(size_t end) {
+    return end + RECORD_HDR_SIZE <= spool_cfg.segment_size ? RECORD_HDR_SIZE : 0;
+}
+
+static bool flush_wbuf(void) {
+    if (wbuf_len == 0) {
+        return true;
+    }
+    size_t term = terminator_size(w_off + wbuf_len);
+    memset(wbuf + wbuf_len, 0, term);
+    if (!write_at(w_seg, w_off, wbuf, wbuf_len + term)) {
+        return false;
+    }
+    fsync(spool_cfg.fd);
+    w_off += wbuf_len;
+    wbuf_len = 0;
+    return true;
+}
+
+static void start_segment(void) {
+    flush_wbuf();
+    size_t next = (w_seg + 1) % seg_count;
+    if (iotconnect_spool_pending() > 0 && r_seg == next) {
+        // Out of space: the oldest segment still holds unsent records, give them up.
+        size_t after = (next + 1) % seg_count;
+        uint32_t seq = segs[after].valid ? segs[after].first_seq : next_seq;
+        spool_stats.dropped_records += seq - r_seq;
+        r_seg = after;
+        r_off = SEGMENT_HDR_SIZE;
+        r_seq = seq;
+        r_len = 0;
+    }
+    w_seg = next;
+    w_seg_seq++;
+    segs[w_seg].seg_seq = w_seg_seq;
+    segs[w_seg].first_seq = next_seq;
+    segs[w_seg].valid = true;
+    w_off = 0;
+    uint32_t magic = SEGMENT_MAGIC;
+    memcpy(wbuf, &magic, 4);
+    memcpy(wbuf + 4, &w_seg_seq, 4);
+    memcpy(wbuf + 8, &next_seq, 4);
+    wbuf_len = SEGMENT_HDR_SIZE;
+}
+
+static bool append_record(uint16_t flags, uint32_t seq, const char *p_data, size_t len) {
+    size_t need = RECORD_HDR_SIZE + len;
+    if (w_off + wbuf_len + need > spool_cfg.segment_size) {
+        start_segment();
+    }
+    if (!(flags & RECORD_ACK_FLAG) && iotconnect_spool_pending() == 0) {
+        r_seg = w_seg;
+        r_off = w_off + wbuf_len;
+        r_seq = seq;
+        r_len = 0;
+    }
+    RecordHeader hdr = { .len_flags = (uint16_t)(flags | len), .seq = seq };
+    hdr.crc = record_crc(w_seg_seq, &hdr, (const unsigned char *)p_data);
+    unsigned char raw[RECORD_HDR_SIZE];
+    memcpy(raw, &hdr.len_flags, 2);
+    memcpy(raw + 2, &hdr.crc, 2);
+    memcpy(raw + 4, &hdr.seq, 4);
+    if (wbuf_len + need > spool_cfg.coalesce_bytes) {
+        if (!flush_wbuf()) {
+            return false;
+        }
+        if (need > spool_cfg.coalesce_bytes) {
+            // Too big to coalesce, write it straight through.
+            static const unsigned char zero[RECORD_HDR_SIZE] = { 0 };
+            if (!write_at(w_seg, w_off, raw, RECORD_HDR_SIZE) ||
+                !write_at(w_seg, w_off + RECORD_HDR_SIZE, p_data, len) ||
+                (terminator_size(w_off + need) &&
+                !write_at(w_seg, w_off + need, zero, RECORD_HDR_SIZE))) {
+                return false;
+            }
+            fsync(spool_cfg.fd);
+            w_off += need;
+            return true;
+        }
+    }
+    memcpy(wbuf + wbuf_len, raw, RECORD_HDR_SIZE);
+    if (len) {
+        memcpy(wbuf + wbuf_len + RECORD_HDR_SIZE, p_data, len);
+    }
+    wbuf_len += need;
+    return true;
+}
+
+static void write_ack(uint32_t seq) {
+    append_record(RECORD_ACK_FLAG, seq, NULL, 0);
+    unacked = 0;
+}
+
+static void sort_segments(size_t *p_order, size_t n) {
+    for (size_t i = 1; i < n; i++) {
+        size_t v = p_order[i];
+        size_t j = i;
+        while (j > 0 && segs[p_order[j - 1]].seg_seq > segs[v].seg_seq) {
+            p_order[j] = p_order[j - 1];
+            j--;
+        }
+        p_order[j] = v;
+    }
+}
+
+static void recover(void) {
+    size_t *p_order = malloc(seg_count * sizeof(size_t));
+    size_t valid = 0;
+    uint32_t acked = 0;
+    uint32_t last = 0;
+    uint32_t first = 0;
+    size_t tail = 0;                    // end of the valid records of the newest segment
+    bool tail_intact = false;
+    unsigned long start = now_us();
+
+    for (size_t i = 0; i < seg_count; i++) {
+        uint32_t hdr[3];
+        segs[i].valid = read_at(i, 0, hdr, sizeof(hdr)) && hdr[0] == SEGMENT_MAGIC;
+        if (segs[i].valid) {
+            segs[i].seg_seq = hdr[1];
+            segs[i].first_seq = hdr[2];
+            first = hdr[2] > first ? hdr[2] : first;
+            if (p_order) {
+                p_order[valid++] = i;
+            }
+        }
+    }
+    w_seg = seg_count - 1;
+    w_seg_seq = 0;
+    next_seq = 1;
+    r_seq = 1;
+    if (valid && p_order) {
+        sort_segments(p_order, valid);
+        // First pass: last data record and last acknowledgement.
+        for (size_t i = 0; i < valid; i++) {
+            size_t seg = p_order[i];
+            RecordHeader hdr;
+            size_t size;
+            size_t off = SEGMENT_HDR_SIZE;
+            tail_intact = false;
+            if (!read_segment(seg)) {
+                continue;
+            }
+            for (; (size = parse_record(rbuf, off, segs[seg].seg_seq, &hdr)) != 0; off += size) {
+                if (hdr.len_flags & RECORD_ACK_FLAG) {
+                    acked = hdr.seq > acked ? hdr.seq : acked;
+                } else {
+                    last = hdr.seq;
+                }
+            }
+            // A torn write leaves a partial record instead of the zeroed terminator.
+            static const unsigned char zero[RECORD_HDR_SIZE] = { 0 };
+            tail = off;
+            tail_intact = terminator_size(off) && memcmp(rbuf + off, zero, RECORD_HDR_SIZE) == 0;
+        }
+        w_seg = p_order[valid - 1];
+        w_seg_seq = segs[w_seg].seg_seq;
+        // Records of recycled segments, acknowledged or not, keep their seqs: never reuse them.
+        next_seq = last + 1;
+        if (first > next_seq) {
+            next_seq = first;
+        }
+        if (acked + 1 > next_seq) {
+            next_seq = acked + 1;
+        }
+        r_seq = next_seq;
+        // Second pass: the first record not acknowledged.
+        for (size_t i = 0; i < valid && r_seq == next_seq; i++) {
+            size_t seg = p_order[i];
+            RecordHeader hdr;
+            size_t size;
+            if (!read_segment(seg)) {
+                continue;
+            }
+            for (size_t off = SEGMENT_HDR_SIZE;
+                (size = parse_record(rbuf, off, segs[seg].seg_seq, &hdr)) != 0; off += size) {
+                if (!(hdr.len_flags & RECORD_ACK_FLAG) && hdr.seq > acked) {
+                    r_seg = seg;
+                    r_off = off;
+                    r_seq = hdr.seq;
+                    break;
+                }
+            }
+        }
+    }
+    free(p_order);
+    spool_stats.recovered_records = next_seq - r_seq;
+    if (tail_intact) {
+        w_off = tail;
+    } else {
+        // Never append to a segment that ends in a torn write, or is full: continue in a fresh one.
+        start_segment();
+    }
+    spool_stats.recovery_us = now_us() - start;
+}
+
+/********************************************************************************************/
+/* Spool functions definition                                                               */
+/********************************************************************************************/
+bool iotconnect_spool_open(const IotConnectSpoolConfig *p_cfg) {
+    if (p_cfg == NULL || p_cfg->fd < 0 || p_cfg->size == 0) {
+        return false;
+    }
+    iotconnect_spool_close();
+    spool_cfg = *p_cfg;
+    if (spool_cfg.segment_size == 0) {
+        spool_cfg.segment_size = IOTCONNECT_SPOOL_DEFAULT_SEGMENT_SIZE;
+    }
+    if (spool_cfg.coalesce_bytes == 0) {
+        spool_cfg.coalesce_bytes = IOTCONNECT_SPOOL_DEFAULT_COALESCE_BYTES;
+    }
+    if (spool_cfg.coalesce_bytes < SEGMENT_HDR_SIZE + RECORD_HDR_SIZE) {
+        spool_cfg.coalesce_bytes = SEGMENT_HDR_SIZE + RECORD_HDR_SIZE;
+    }
+    if (spool_cfg.flush_interval_s <= 0) {
+        spool_cfg.flush_interval_s = IOTCONNECT_SPOOL_DEFAULT_FLUSH_INTERVAL_S;
+    }
+    seg_count = spool_cfg.size / spool_cfg.segment_size;
+    if (seg_count < 2 || spool_cfg.segment_size <= SEGMENT_HDR_SIZE + RECORD_HDR_SIZE ||
+        spool_cfg.segment_size > SEGMENT_HDR_SIZE + RECORD_HDR_SIZE + RECORD_LEN_MASK) {
+        spool_cfg.size = 0;
+        return false;
+    }
+    segs = calloc(seg_count, sizeof(SegmentInfo));
+    wbuf = malloc(spool_cfg.coalesce_bytes + RECORD_HDR_SIZE);
+    rbuf = malloc(spool_cfg.segment_size + 1);
+    if (segs == NULL || wbuf == NULL || rbuf == NULL) {
+        iotconnect_spool_close();
+        return false;
+    }
+    memset(&spool_stats, 0, sizeof(spool_stats));
+    recover();
+    return true;
+}
+
+void iotconnect_spool_close(void) {
+    if (spool_cfg.size && wbuf) {
+        flush_wbuf();
+    }
+    free(segs);
+    free(wbuf);
+    free(rbuf);
+    segs = NULL;
+    wbuf = NULL;
+    rbuf = NULL;
+    wbuf_len = 0;
+    r_len = 0;
+    unacked = 0;
+    spool_cfg.size = 0;
+}
+
+bool iotconnect_spool_append(const char *p_data, size_t len) {
+    if (segs == NULL || p_data == NULL) {
+        return false;
+    }
+    if (len == 0 || len > spool_cfg.segment_size - SEGMENT_HDR_SIZE - RECORD_HDR_SIZE) {
+        spool_stats.dropped_records++;
+        return false;
+    }
+    if (!append_record(0, next_seq, p_data, len)) {
+        spool_stats.dropped_records++;
+        return false;
+    }
+    next_seq++;
+    spool_stats.appended_records++;
+    spool_stats.appended_bytes += len;
+    return true;
+}
+
+bool iotconnect_spool_sync(void) {
+    if (segs == NULL) {
+        return false;
+    }
+    return flush_wbuf();
+}
+
+const char *iotconnect_spool_peek(size_t *p_len) {
+    RecordHeader hdr;
+    if (segs == NULL || iotconnect_spool_pending() == 0) {
+        return NULL;
+    }
+    if (r_len) {
+        // Still the record from the last peek.
+        if (p_len) {
+            *p_len = r_len;
+        }
+        return (const char *)rbuf;
+    }
+    for (size_t hops = 0; hops <= seg_count && iotconnect_spool_pending() > 0;) {
+        unsigned char raw[RECORD_HDR_SIZE];
+        size_t size = 0;
+        // The cursor may point into records still in the RAM buffer.
+        if (r_seg == w_seg && r_off >= w_off && wbuf_len) {
+            flush_wbuf();
+        }
+        if (r_off + RECORD_HDR_SIZE <= spool_cfg.segment_size &&
+            read_at(r_seg, r_off, raw, RECORD_HDR_SIZE)) {
+            size_t len = 0;
+            memcpy(&hdr.len_flags, raw, 2);
+            len = hdr.len_flags & RECORD_LEN_MASK;
+            if (r_off + RECORD_HDR_SIZE + len <= spool_cfg.segment_size &&
+                read_at(r_seg, r_off, rbuf, RECORD_HDR_SIZE + len)) {
+                size = parse_record(rbuf, 0, segs[r_seg].seg_seq, &hdr);
+            }
+        }
+        if (size == 0) {
+            // End of the valid records in this segment.
+            if (r_seg == w_seg) {
+                break;
+            }
+            r_seg = (r_seg + 1) % seg_count;
+            r_off = SEGMENT_HDR_SIZE;
+            hops++;
+            continue;
+        }
+        if ((hdr.len_flags & RECORD_ACK_FLAG) || hdr.seq < r_seq) {
+            r_off += size;
+            continue;
+        }
+        if (hdr.seq > r_seq) {
+            spool_stats.dropped_records += hdr.seq - r_seq;
+            r_seq = hdr.seq;
+        }
+        r_len = size - RECORD_HDR_SIZE;
+        memmove(rbuf, rbuf + RECORD_HDR_SIZE, r_len);
+        rbuf[r_len] = 0;
+        if (p_len) {
+            *p_len = r_len;
+        }
+        return (const char *)rbuf;
+    }
+    // Nothing readable is left: the remaining records were lost.
+    spool_stats.dropped_records += next_seq - r_seq;
+    r_seq = next_seq;
+    return NULL;
+}
+
+void iotconnect_spool_pop(void) {
+    if (r_len == 0) {
+        return;
+    }
+    uint32_t sent_seq = r_seq;
+    r_off += RECORD_HDR_SIZE + r_len;
+    r_len = 0;
+    r_seq++;
+    spool_stats.sent_records++;
+    if (++unacked >= ACK_EVERY_RECORDS || iotconnect_spool_pending() == 0) {
+        write_ack(sent_seq);
+    }
+}
+
+size_t iotconnect_spool_pending(void) {
+    return (size_t)(next_seq - r_seq);
+}
+
+void iotconnect_spool_get_stats(IotConnectSpoolStats *p_stats) {
+    *p_stats = spool_stats;
+}
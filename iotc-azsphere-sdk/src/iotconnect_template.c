@@ -0,0 +1,553 @@
+//
+// Copyright: Avnet 2021
+//
+#include <string.h>
+#include <stdlib.h>
+#include <math.h>
+#include "iotconnect_template.h"
+
+/********************************************************************************************/
+/* Static definition                                                                        */
+/********************************************************************************************/
+#define ISO_TIME_LEN                        24  // 2021-06-23T10:00:00.000Z
+#define ISO_TIME_PLACEHOLDER                "0000-00-00T00:00:00.000Z"
+#define MAX_PRECISION                       17
+#define JSON_ESCAPE_FACTOR                  6   // \u00XX for each control character
+// Longest encoded forms of the values
+#define NUMBER_SLOT_SIZE                    32
+#define BINARY_SCALAR_SLOT_SIZE             9
+#define STRING_HEAD_SIZE                    5
+#define BOOL_SLOT_SIZE                      5
+// The skeleton around the attributes, apart from the dtg
+#define SKELETON_SIZE                       96
+#define JSON_SUFFIX                         "}}]}"
+
+typedef struct {
+    IotConnectAttributeType type;
+    int precision;
+    double unit;                            // 10^precision
+    size_t max_len;
+    double deadband;
+    double deadband_rel;
+    unsigned int min_interval_ms;
+    unsigned int max_silence_ms;
+    size_t key_offset;
+    size_t key_len;
+    bool set;
+    bool fixed;                             // the value is a mantissa of precision decimals
+    union {
+        double number;
+        int64_t mantissa;
+        int64_t integer;
+        bool boolean;
+        const char *p_string;
+    } value;
+    // Last value reported through iotconnect_template_render_changes()
+    bool reported;
+    bool pending;                           // passes the filter in the render in progress
+    unsigned long long reported_ms;
+    double reported_number;
+    uint32_t reported_hash;                 // strings are compared by hash, as they are not copied
+    IotConnectAttributeStats stats;
+} TemplateSlot;
+
+struct IotConnectTemplate {
+    IotConnectEncoding encoding;
+    size_t count;
+    TemplateSlot *p_slots;
+    unsigned char *p_keys;                  // encoded keys with their separators, back to back
+    unsigned char *p_buf;
+    size_t size;
+    size_t prefix_len;                      // up to and including the attribute map header
+    size_t map_offset;                      // of the attribute map header, rewritten in binary
+    size_t time_offset;                     // of the record timestamp within the prefix
+    bool prefix_valid;
+    char dtg[IOTCONNECT_TEMPLATE_DTG_SIZE];
+    bool time_valid;
+    time_t rendered_time;
+    IotConnectEncoder value_enc;            // writes one value at a time after the skeleton
+    unsigned long renders;
+    unsigned long suppressed;
+};
+
+/********************************************************************************************/
+/* Helper functions definition                                                              */
+/********************************************************************************************/
+static bool is_json(const IotConnectTemplate *p_tmpl) {
+    return p_tmpl->encoding == IOTCONNECT_ENCODING_JSON;
+}
+
+static size_t string_slot_size(const IotConnectTemplate *p_tmpl, size_t len) {
+    return is_json(p_tmpl) ? len * JSON_ESCAPE_FACTOR + 2 : len + STRING_HEAD_SIZE;
+}
+
+static size_t value_slot_size(const IotConnectTemplate *p_tmpl, const TemplateSlot *p_slot) {
+    switch (p_slot->type) {
+    case IOTCONNECT_ATTR_STRING:
+        return string_slot_size(p_tmpl, p_slot->max_len);
+    case IOTCONNECT_ATTR_BOOL:
+        return BOOL_SLOT_SIZE;
+    default:
+        return is_json(p_tmpl) ? NUMBER_SLOT_SIZE : BINARY_SCALAR_SLOT_SIZE;
+    }
+}
+
+// {"dtg": dtg, "mt": 0, "d": [{"dt": time, "d": {   with every count known up front, so the
+// bytes are final and the attributes follow directly.
+static bool render_prefix(IotConnectTemplate *p_tmpl, const char *p_dtg) {
+    IotConnectEncoder enc;
+    iotconnect_encoder_init(&enc, p_tmpl->encoding, p_tmpl->p_buf, p_tmpl->size);
+    iotconnect_encoder_begin_map_n(&enc, 3);
+    iotconnect_encoder_string(&enc, "dtg");
+    iotconnect_encoder_string(&enc, p_dtg);
+    iotconnect_encoder_string(&enc, "mt");
+    iotconnect_encoder_int(&enc, 0);
+    iotconnect_encoder_string(&enc, "d");
+    iotconnect_encoder_begin_array_n(&enc, 1);
+    iotconnect_encoder_begin_map_n(&enc, 2);
+    iotconnect_encoder_string(&enc, "dt");
+    iotconnect_encoder_string(&enc, ISO_TIME_PLACEHOLDER);
+    p_tmpl->time_offset = enc.len - ISO_TIME_LEN - (is_json(p_tmpl) ? 1 : 0);
+    iotconnect_encoder_string(&enc, "d");
+    size_t key_end = enc.len;
+    iotconnect_encoder_begin_map_n(&enc, (uint16_t)p_tmpl->count);
+    // JSON writes the name/value separator before the map header.
+    p_tmpl->map_offset = is_json(p_tmpl) ? enc.len - 1 : key_end;
+    if (enc.failed) {
+        p_tmpl->prefix_valid = false;
+        return false;
+    }
+    p_tmpl->prefix_len = enc.len;
+    p_tmpl->time_valid = false;
+    p_tmpl->prefix_valid = true;
+    strcpy(p_tmpl->dtg, p_dtg);
+    return true;
+}
+
+static bool render_time(IotConnectTemplate *p_tmpl, time_t timestamp) {
+    if (p_tmpl->time_valid && p_tmpl->rendered_time == timestamp) {
+        return true;
+    }
+    char iso[ISO_TIME_LEN + 1];
+    struct tm tm;
+    if (gmtime_r(&timestamp, &tm) == NULL ||
+        strftime(iso, sizeof(iso), "%Y-%m-%dT%H:%M:%S.000Z", &tm) != ISO_TIME_LEN) {
+        return false;
+    }
+    memcpy(&p_tmpl->p_buf[p_tmpl->time_offset], iso, ISO_TIME_LEN);
+    p_tmpl->rendered_time = timestamp;
+    p_tmpl->time_valid = true;
+    return true;
+}
+
+static bool render_value(IotConnectTemplate *p_tmpl, const TemplateSlot *p_slot, size_t pos,
+    size_t *p_written) {
+    IotConnectEncoder *p_enc = &p_tmpl->value_enc;
+    // A fresh top level value each time, written in place after the previous one.
+    p_enc->p_buf = &p_tmpl->p_buf[pos];
+    p_enc->size = p_tmpl->size - pos;
+    p_enc->len = 0;
+    p_enc->depth = 0;
+    p_enc->failed = false;
+    if (!p_slot->set) {
+        iotconnect_encoder_null(p_enc);
+    } else {
+        switch (p_slot->type) {
+        case IOTCONNECT_ATTR_NUMBER:
+            if (p_slot->fixed) {
+                iotconnect_encoder_fixed(p_enc, p_slot->value.mantissa,
+                    (unsigned int)p_slot->precision);
+            } else if (p_slot->precision > 0) {
+                iotconnect_encoder_double_precision(p_enc, p_slot->value.number,
+                    (unsigned int)p_slot->precision);
+            } else {
+                iotconnect_encoder_double(p_enc, p_slot->value.number);
+            }
+            break;
+        case IOTCONNECT_ATTR_INTEGER:
+            iotconnect_encoder_int(p_enc, p_slot->value.integer);
+            break;
+        case IOTCONNECT_ATTR_BOOL:
+            iotconnect_encoder_bool(p_enc, p_slot->value.boolean);
+            break;
+        default:
+            iotconnect_encoder_string(p_enc, p_slot->value.p_string);
+            break;
+        }
+    }
+    *p_written = p_enc->len;
+    return !p_enc->failed;
+}
+
+static unsigned long long now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000 + (unsigned long long)ts.tv_nsec / 1000000;
+}
+
+// FNV-1a
+static uint32_t hash_string(const char *p_str) {
+    uint32_t hash = 2166136261u;
+    while (*p_str) {
+        hash = (hash ^ (unsigned char)*p_str++) * 16777619u;
+    }
+    return hash;
+}
+
+static double slot_number(const TemplateSlot *p_slot) {
+    switch (p_slot->type) {
+    case IOTCONNECT_ATTR_INTEGER:
+        return (double)p_slot->value.integer;
+    case IOTCONNECT_ATTR_BOOL:
+        return p_slot->value.boolean ? 1 : 0;
+    default:
+        return p_slot->fixed ? (double)p_slot->value.mantissa / p_slot->unit : p_slot->value.number;
+    }
+}
+
+static bool slot_changed(const TemplateSlot *p_slot) {
+    if (p_slot->type == IOTCONNECT_ATTR_STRING) {
+        return hash_string(p_slot->value.p_string) != p_slot->reported_hash;
+    }
+    double value = slot_number(p_slot);
+    double last = p_slot->reported_number;
+    if (p_slot->type == IOTCONNECT_ATTR_BOOL) {
+        return value != last;
+    }
+    if (isnan(value) || isnan(last)) {
+        return !(isnan(value) && isnan(last));
+    }
+    // Against the last reported value, so slow drifts are reported once they add up.
+    double delta = fabs(value - last);
+    double threshold = fmax(p_slot->deadband, p_slot->deadband_rel * fabs(last));
+    return threshold > 0 ? delta > threshold : delta != 0;
+}
+
+// Decides whether a slot goes into the message. The decision only sticks once the message is
+// rendered, see commit_filter().
+static bool filter_slot(TemplateSlot *p_slot, unsigned long long now) {
+    p_slot->pending = false;
+    if (!p_slot->set) {
+        return false;
+    }
+    p_slot->stats.offered++;
+    if (!p_slot->reported) {
+        p_slot->pending = true;
+        return true;
+    }
+    unsigned long long elapsed = now - p_slot->reported_ms;
+    if (slot_changed(p_slot)) {
+        if (p_slot->min_interval_ms && elapsed < p_slot->min_interval_ms) {
+            p_slot->stats.interval_suppressed++;
+            return false;
+        }
+    } else if (p_slot->max_silence_ms && elapsed >= p_slot->max_silence_ms) {
+        p_slot->stats.heartbeats++;
+    } else {
+        p_slot->stats.deadband_suppressed++;
+        return false;
+    }
+    p_slot->pending = true;
+    return true;
+}
+
+static void commit_filter(TemplateSlot *p_slot, unsigned long long now) {
+    if (!p_slot->pending) {
+        return;
+    }
+    p_slot->pending = false;
+    p_slot->reported = true;
+    p_slot->reported_ms = now;
+    if (p_slot->type == IOTCONNECT_ATTR_STRING) {
+        p_slot->reported_hash = hash_string(p_slot->value.p_string);
+    } else {
+        p_slot->reported_number = slot_number(p_slot);
+    }
+    p_slot->stats.reported++;
+}
+
+// Renders the slots, all of them, or with filtered set those passing the filters, which may
+// leave the attribute map empty.
+static bool render_slots(IotConnectTemplate *p_tmpl, const char *p_dtg, time_t timestamp,
+    bool filtered, size_t reported, size_t *p_len) {
+    if (p_dtg == NULL) {
+        p_dtg = "";
+    }
+    // The skeleton only changes with the session.
+    if (!p_tmpl->prefix_valid || strcmp(p_tmpl->dtg, p_dtg) != 0) {
+        if (strlen(p_dtg) >= IOTCONNECT_TEMPLATE_DTG_SIZE || !render_prefix(p_tmpl, p_dtg)) {
+            return false;
+        }
+    }
+    if (!render_time(p_tmpl, timestamp)) {
+        return false;
+    }
+    size_t pos = p_tmpl->prefix_len;
+    if (!is_json(p_tmpl)) {
+        // The attribute count is in the map header, which a filtered render changes.
+        IotConnectEncoder enc;
+        iotconnect_encoder_init(&enc, p_tmpl->encoding, &p_tmpl->p_buf[p_tmpl->map_offset],
+            p_tmpl->size - p_tmpl->map_offset);
+        if (!iotconnect_encoder_begin_map_n(&enc, (uint16_t)(filtered ? reported : p_tmpl->count))) {
+            return false;
+        }
+        pos = p_tmpl->map_offset + enc.len;
+    }
+    bool first = true;
+    for (size_t i = 0; i < p_tmpl->count; i++) {
+        const TemplateSlot *p_slot = &p_tmpl->p_slots[i];
+        if (filtered && !p_slot->pending) {
+            continue;
+        }
+        const unsigned char *p_key = &p_tmpl->p_keys[p_slot->key_offset];
+        size_t key_len = p_slot->key_len;
+        if (first && is_json(p_tmpl) && i > 0) {
+            // No separator before the first attribute written
+            p_key++;
+            key_len--;
+        }
+        first = false;
+        size_t written;
+        memcpy(&p_tmpl->p_buf[pos], p_key, key_len);
+        pos += key_len;
+        if (!render_value(p_tmpl, p_slot, pos, &written)) {
+            return false;
+        }
+        pos += written;
+    }
+    if (is_json(p_tmpl)) {
+        // The buffer is sized for the suffix and the NUL.
+        memcpy(&p_tmpl->p_buf[pos], JSON_SUFFIX, sizeof(JSON_SUFFIX));
+        pos += sizeof(JSON_SUFFIX) - 1;
+    }
+    *p_len = pos;
+    return true;
+}
+
+static TemplateSlot *get_slot(IotConnectTemplate *p_tmpl, size_t index,
+    IotConnectAttributeType type) {
+    if (p_tmpl == NULL || index >= p_tmpl->count || p_tmpl->p_slots[index].type != type) {
+        return NULL;
+    }
+    return &p_tmpl->p_slots[index];
+}
+
+/********************************************************************************************/
+/* Template functions definition                                                            */
+/********************************************************************************************/
+IotConnectTemplate *iotconnect_template_create(const IotConnectAttribute *p_attrs, size_t count,
+    IotConnectEncoding encoding) {
+    if (p_attrs == NULL || count == 0 || count > IOTCONNECT_TEMPLATE_MAX_ATTRIBUTES) {
+        return NULL;
+    }
+    IotConnectTemplate *p_tmpl = calloc(1, sizeof(*p_tmpl));
+    if (p_tmpl == NULL) {
+        return NULL;
+    }
+    p_tmpl->encoding = encoding;
+    p_tmpl->count = count;
+    p_tmpl->p_slots = calloc(count, sizeof(TemplateSlot));
+    if (p_tmpl->p_slots == NULL) {
+        iotconnect_template_destroy(p_tmpl);
+        return NULL;
+    }
+
+    size_t keys_size = 0;
+    size_t values_size = 0;
+    for (size_t i = 0; i < count; i++) {
+        const IotConnectAttribute *p_attr = &p_attrs[i];
+        TemplateSlot *p_slot = &p_tmpl->p_slots[i];
+        if (p_attr->p_name == NULL || p_attr->p_name[0] == 0 || p_attr->type > IOTCONNECT_ATTR_STRING ||
+            p_attr->precision < 0 || p_attr->precision > MAX_PRECISION ||
+            !(p_attr->deadband >= 0) || !(p_attr->deadband_rel >= 0)) {
+            iotconnect_template_destroy(p_tmpl);
+            return NULL;
+        }
+        p_slot->type = p_attr->type;
+        p_slot->precision = p_attr->precision;
+        p_slot->unit = 1;
+        for (int d = 0; d < p_attr->precision; d++) {
+            p_slot->unit *= 10;
+        }
+        p_slot->deadband = p_attr->deadband;
+        p_slot->deadband_rel = p_attr->deadband_rel;
+        p_slot->min_interval_ms = p_attr->min_interval_ms;
+        p_slot->max_silence_ms = p_attr->max_silence_ms;
+        p_slot->max_len = p_attr->max_len ? p_attr->max_len : IOTCONNECT_TEMPLATE_STRING_SIZE;
+        // Separator, key and name/value separator
+        keys_size += string_slot_size(p_tmpl, strlen(p_attr->p_name)) + 2;
+        values_size += value_slot_size(p_tmpl, p_slot);
+    }
+    p_tmpl->p_keys = malloc(keys_size);
+    p_tmpl->size = SKELETON_SIZE + string_slot_size(p_tmpl, IOTCONNECT_TEMPLATE_DTG_SIZE) +
+        keys_size + values_size + sizeof(JSON_SUFFIX);
+    p_tmpl->p_buf = malloc(p_tmpl->size);
+    if (p_tmpl->p_keys == NULL || p_tmpl->p_buf == NULL) {
+        iotconnect_template_destroy(p_tmpl);
+        return NULL;
+    }
+
+    // Pre-encode the keys: ,"name": in JSON, the bare string in binary encodings.
+    size_t offset = 0;
+    IotConnectEncoder enc;
+    for (size_t i = 0; i < count; i++) {
+        TemplateSlot *p_slot = &p_tmpl->p_slots[i];
+        p_slot->key_offset = offset;
+        if (is_json(p_tmpl) && i > 0) {
+            p_tmpl->p_keys[offset++] = ',';
+        }
+        iotconnect_encoder_init(&enc, encoding, &p_tmpl->p_keys[offset], keys_size - offset);
+        if (!iotconnect_encoder_string(&enc, p_attrs[i].p_name)) {
+            iotconnect_template_destroy(p_tmpl);
+            return NULL;
+        }
+        offset += enc.len;
+        if (is_json(p_tmpl)) {
+            p_tmpl->p_keys[offset++] = ':';
+        }
+        p_slot->key_len = offset - p_slot->key_offset;
+    }
+    iotconnect_encoder_init(&p_tmpl->value_enc, encoding, p_tmpl->p_buf, p_tmpl->size);
+
+    if (!render_prefix(p_tmpl, "")) {
+        iotconnect_template_destroy(p_tmpl);
+        return NULL;
+    }
+    return p_tmpl;
+}
+
+void iotconnect_template_destroy(IotConnectTemplate *p_tmpl) {
+    if (p_tmpl == NULL) {
+        return;
+    }
+    free(p_tmpl->p_slots);
+    free(p_tmpl->p_keys);
+    free(p_tmpl->p_buf);
+    free(p_tmpl);
+}
+
+bool iotconnect_template_set_number(IotConnectTemplate *p_tmpl, size_t index, double value) {
+    TemplateSlot *p_slot = get_slot(p_tmpl, index, IOTCONNECT_ATTR_NUMBER);
+    if (p_slot == NULL) {
+        return false;
+    }
+    p_slot->value.number = value;
+    p_slot->fixed = false;
+    p_slot->set = true;
+    return true;
+}
+
+bool iotconnect_template_set_fixed(IotConnectTemplate *p_tmpl, size_t index, int64_t mantissa) {
+    TemplateSlot *p_slot = get_slot(p_tmpl, index, IOTCONNECT_ATTR_NUMBER);
+    if (p_slot == NULL) {
+        return false;
+    }
+    p_slot->value.mantissa = mantissa;
+    p_slot->fixed = true;
+    p_slot->set = true;
+    return true;
+}
+
+bool iotconnect_template_set_integer(IotConnectTemplate *p_tmpl, size_t index, int64_t value) {
+    TemplateSlot *p_slot = get_slot(p_tmpl, index, IOTCONNECT_ATTR_INTEGER);
+    if (p_slot == NULL) {
+        return false;
+    }
+    p_slot->value.integer = value;
+    p_slot->set = true;
+    return true;
+}
+
+bool iotconnect_template_set_bool(IotConnectTemplate *p_tmpl, size_t index, bool value) {
+    TemplateSlot *p_slot = get_slot(p_tmpl, index, IOTCONNECT_ATTR_BOOL);
+    if (p_slot == NULL) {
+        return false;
+    }
+    p_slot->value.boolean = value;
+    p_slot->set = true;
+    return true;
+}
+
+bool iotconnect_template_set_string(IotConnectTemplate *p_tmpl, size_t index, const char *p_value) {
+    TemplateSlot *p_slot = get_slot(p_tmpl, index, IOTCONNECT_ATTR_STRING);
+    if (p_slot == NULL || p_value == NULL || strlen(p_value) > p_slot->max_len) {
+        return false;
+    }
+    p_slot->value.p_string = p_value;
+    p_slot->set = true;
+    return true;
+}
+
+void iotconnect_template_clear(IotConnectTemplate *p_tmpl, size_t index) {
+    if (p_tmpl != NULL && index < p_tmpl->count) {
+        p_tmpl->p_slots[index].set = false;
+    }
+}
+
+const unsigned char *iotconnect_template_render(IotConnectTemplate *p_tmpl, const char *p_dtg,
+    time_t timestamp, size_t *p_len) {
+    if (p_tmpl == NULL || p_len == NULL || !render_slots(p_tmpl, p_dtg, timestamp, false, 0, p_len)) {
+        return NULL;
+    }
+    return p_tmpl->p_buf;
+}
+
+IotConnectTemplateResult iotconnect_template_render_changes(IotConnectTemplate *p_tmpl,
+    const char *p_dtg, time_t timestamp, const unsigned char **pp_msg, size_t *p_len) {
+    if (p_tmpl == NULL || pp_msg == NULL || p_len == NULL) {
+        return IOTCONNECT_TEMPLATE_FAILED;
+    }
+    unsigned long long now = now_ms();
+    size_t reported = 0;
+    p_tmpl->renders++;
+    for (size_t i = 0; i < p_tmpl->count; i++) {
+        if (filter_slot(&p_tmpl->p_slots[i], now)) {
+            reported++;
+        }
+    }
+    if (reported == 0) {
+        p_tmpl->suppressed++;
+        return IOTCONNECT_TEMPLATE_SUPPRESSED;
+    }
+    if (!render_slots(p_tmpl, p_dtg, timestamp, true, reported, p_len)) {
+        return IOTCONNECT_TEMPLATE_FAILED;
+    }
+    for (size_t i = 0; i < p_tmpl->count; i++) {
+        commit_filter(&p_tmpl->p_slots[i], now);
+    }
+    *pp_msg = p_tmpl->p_buf;
+    return IOTCONNECT_TEMPLATE_RENDERED;
+}
+
+void iotconnect_template_reset_filters(IotConnectTemplate *p_tmpl) {
+    for (size_t i = 0; p_tmpl != NULL && i < p_tmpl->count; i++) {
+        p_tmpl->p_slots[i].reported = false;
+    }
+}
+
+bool iotconnect_template_get_attribute_stats(const IotConnectTemplate *p_tmpl, size_t index,
+    IotConnectAttributeStats *p_stats) {
+    if (p_tmpl == NULL || p_stats == NULL || index >= p_tmpl->count) {
+        return false;
+    }
+    *p_stats = p_tmpl->p_slots[index].stats;
+    return true;
+}
+
+void iotconnect_template_get_stats(const IotConnectTemplate *p_tmpl, IotConnectTemplateStats *p_stats) {
+    memset(p_stats, 0, sizeof(*p_stats));
+    p_stats->renders = p_tmpl->renders;
+    p_stats->suppressed = p_tmpl->suppressed;
+    for (size_t i = 0; i < p_tmpl->count; i++) {
+        const IotConnectAttributeStats *p_attr = &p_tmpl->p_slots[i].stats;
+        p_stats->values.offered += p_attr->offered;
+        p_stats->values.reported += p_attr->reported;
+        p_stats->values.heartbeats += p_attr->heartbeats;
+        p_stats->values.deadband_suppressed += p_attr->deadband_suppressed;
+        p_stats->values.interval_suppressed += p_attr->interval_suppressed;
+    }
+}
+
+IotConnectEncoding iotconnect_template_get_encoding(const IotConnectTemplate *p_tmpl) {
+    return p_tmpl->encoding;
+}
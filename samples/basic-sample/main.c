@@ -111,6 +111,19 @@ static ExitCode validate_user_configuration(void) {
     return validation_exit_code;
 }
 
+// Telemetry attributes, compiled once into a template whose slots are filled for each sample.
+enum {
+    ATTR_TEMPERATURE = 0,
+    ATTR_HUMIDITY
+};
+
+static const IotConnectAttribute telemetry_attrs[] = {
+    [ATTR_TEMPERATURE] = { .p_name = "temperature", .type = IOTCONNECT_ATTR_NUMBER, .precision = 1 },
+    [ATTR_HUMIDITY] = { .p_name = "humidity", .type = IOTCONNECT_ATTR_NUMBER, .precision = 2 }
+};
+
+static IotConnectTemplate *telemetry_tmpl = NULL;
+
 /// <summary>
 ///     Generate simulated telemetry and send to IoTConnect.
 /// </summary>
@@ -124,36 +137,29 @@ static void send_simulated_telemetry(void) {
     delta = ((float)(rand() % 41)) / 20.0f - 1.0f; // between -1.0 and +1.0
     humidity += delta;
 
-    IotclMessageHandle msg_hndl = iotcl_telemetry_v2_create();
-
-    if (msg_hndl == NULL) {
-        Log_Debug("Unable to create V2 telemetry message!\n");
-        return;
+    if (telemetry_tmpl == NULL) {
+        telemetry_tmpl = iotconnect_sdk_template_create(telemetry_attrs,
+            sizeof(telemetry_attrs) / sizeof(telemetry_attrs[0]));
+        if (telemetry_tmpl == NULL) {
+            Log_Debug("Unable to create telemetry template!\n");
+            return;
+        }
     }
 
-    char tmp_str[10];
-
-    // Abjust to 1 decimal point.
-    snprintf(tmp_str, sizeof(tmp_str), "%0.1f", temperature);
-    // Add temperature to telemetry
-    iotcl_telemetry_set_number(msg_hndl, "temperature", strtod(tmp_str, NULL));
-    // Abjust to 2 decimal point.
-    snprintf(tmp_str, sizeof(tmp_str), "%0.2f", humidity);
-    // Add humidity to telemetry
-    iotcl_telemetry_set_number(msg_hndl, "humidity", strtod(tmp_str, NULL));
+    // Rounded to the precision of each attribute when rendered.
+    iotconnect_template_set_number(telemetry_tmpl, ATTR_TEMPERATURE, temperature);
+    iotconnect_template_set_number(telemetry_tmpl, ATTR_HUMIDITY, humidity);
 
-    const char* p_msg = iotcl_create_serialized_string(msg_hndl, false);
+    size_t msg_len;
+    const char* p_msg = iotconnect_sdk_template_render(telemetry_tmpl, &msg_len);
 
     if (p_msg == NULL) {
-        Log_Debug("Unable to get serialized string!\n");
+        Log_Debug("Unable to render telemetry!\n");
     } else {
         Log_Debug("Send telemetry: Temperature %0.1f, Humidity %0.2f\n",
             temperature, humidity);
-        iotconnect_sdk_send_packet(p_msg);
-        iotcl_destroy_serialized(p_msg);
+        iotconnect_sdk_send_packet_len(p_msg, msg_len);
     }
-
-    iotcl_telemetry_destroy(msg_hndl);
 }
 
 /// <summary>
@@ -228,6 +234,9 @@ static ExitCode init_peripherals_and_handlers(void) {
     }
     iotconnect_cfg = iotconnect_sdk_init_and_get_config();
     iotconnect_cfg->status_cb = on_iotconnect_status_cb;
+    iotconnect_cfg->event_loop = app_evt_loop;
+    // Commands may wait up to a second, in exchange for one idle wakeup a second instead of 20.
+    iotconnect_cfg->idle_poll_ms = 1000;
     IotConnectAzsphereConfig iotconnect_init = {
         .p_netif = network_interface,
         .p_scope_id = scope_id
@@ -243,7 +252,11 @@ static ExitCode init_peripherals_and_handlers(void) {
 /// </summary>
 static void close_peripherals_and_handlers(void) {
     iotconnect_sdk_disconnect();
+    iotconnect_template_destroy(telemetry_tmpl);
+    telemetry_tmpl = NULL;
     DisposeEventLoopTimer(app_timer);
+    // The SDK unregisters its timer and provisioning events from the loop before it is closed.
+    iotconnect_sdk_deinit();
     EventLoop_Close(app_evt_loop);
 }
 
@@ -259,19 +272,15 @@ int main(int argc, char *argv[]) {
     }
     exit_code = init_peripherals_and_handlers();
 
-    // Main loop
+    // Main loop. The SDK shares the application event loop, so a single blocking run dispatches
+    // both the application and the SDK events.
     while (exit_code == ExitCode_Success) {
-        EventLoop_Run_Result app_evt_loop_result = EventLoop_Run(app_evt_loop, 50, true);
+        EventLoop_Run_Result app_evt_loop_result = EventLoop_Run(app_evt_loop, -1, true);
         // Continue if interrupted by signal, e.g. due to breakpoint being set.
         if (app_evt_loop_result == EventLoop_Run_Failed && errno != EINTR) {
             Log_Debug("ERROR: Application event loop returns EventLoop_Run_Failed!\n");
             exit_code = ExitCode_Main_EventLoopFail;
         }
-        unsigned int iotc_poll_result = iotconnect_sdk_poll(50);
-        if (iotc_poll_result != IOTC_SDK_SUCCESS) {
-            Log_Debug("ERROR: iotconnect_sdk_poll() returns %d!\n", iotc_poll_result);
-            exit_code = ExitCode_IotConnect_Sdk_EventLoopFail;
-        }
     }
     if (exit_code == ExitCode_App_Exit) {
         exit_code = ExitCode_Success;